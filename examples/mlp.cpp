@@ -0,0 +1,139 @@
+/*
+* Trains a multilayer perceptron on a synthetic classification problem, and
+* reports its training throughput. This is meant as a baseline for the
+* performance of the tensor engine on a whole training step.
+*
+* Usage : bin/mlp_example [batch size] [hidden units] [epochs]
+*
+* Samples are drawn around one random center per class, and the network has
+* two ReLU hidden layers trained with minibatch gradient descent on the
+* softmax cross entropy. Each step records 14 nodes, whatever the size of
+* the network.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../include/tensorslow.h"
+
+
+
+static const int nFeatures = 64;
+static const int nClasses = 10;
+static const int nSamples = 1 << 14;
+static const float learningRate = 0.1f;
+
+
+
+// Fills features (nSamples x nFeatures) and one-hot labels (nSamples x
+// nClasses)
+static void makeDataset(std::vector<float> &features, std::vector<float> &labels, std::vector<int> &classes) {
+	std::mt19937 generator(0);
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+	std::uniform_int_distribution<int> uniform(0, nClasses - 1);
+
+	std::vector<float> centers(nClasses * nFeatures);
+	for(float &c : centers) {
+		c = normal(generator);
+	}
+
+	features.resize(nSamples * nFeatures);
+	labels.assign(nSamples * nClasses, 0.0f);
+	classes.resize(nSamples);
+
+	for(int i = 0; i < nSamples; i++) {
+		classes[i] = uniform(generator);
+		labels[i * nClasses + classes[i]] = 1.0f;
+		for(int j = 0; j < nFeatures; j++) {
+			features[i * nFeatures + j] = centers[classes[i] * nFeatures + j] + 1.5f * normal(generator);
+		}
+	}
+}
+
+
+
+int main(int argc, char **argv) {
+	const int batchSize = argc > 1 ? std::atoi(argv[1]) : 256;
+	const int nHidden = argc > 2 ? std::atoi(argv[2]) : 256;
+	const int nEpochs = argc > 3 ? std::atoi(argv[3]) : 5;
+
+	if(batchSize <= 0 || batchSize > nSamples || nHidden <= 0 || nEpochs <= 0) {
+		std::cerr << "Usage : " << argv[0] << " [batch size] [hidden units] [epochs]" << std::endl;
+		return 1;
+	}
+
+	std::vector<float> features, labels;
+	std::vector<int> classes;
+	makeDataset(features, labels, classes);
+
+	ts::nn::Dense<float> layer1(nFeatures, nHidden, 1);
+	ts::nn::Dense<float> layer2(nHidden, nHidden, 2);
+	ts::nn::Dense<float> layer3(nHidden, nClasses, 3);
+	std::vector<ts::nn::Dense<float> *> layers = {&layer1, &layer2, &layer3};
+
+	std::cout << "MLP " << nFeatures << " -> " << nHidden << " -> " << nHidden << " -> " << nClasses;
+	std::cout << ", batch size " << batchSize << ", " << nSamples << " samples" << std::endl;
+
+	ts::TensorList<float> list;
+	const int nBatches = nSamples / batchSize;
+	double totalSeconds = 0.0;
+
+	for(int epoch = 0; epoch < nEpochs; epoch++) {
+		auto start = std::chrono::steady_clock::now();
+		double epochLoss = 0.0;
+		int nCorrect = 0;
+
+		for(int batch = 0; batch < nBatches; batch++) {
+			const int first = batch * batchSize;
+
+			ts::Tensor<float> xVal({batchSize, nFeatures}, std::vector<float>(
+				features.begin() + first * nFeatures, features.begin() + (first + batchSize) * nFeatures
+			));
+			ts::Tensor<float> tVal({batchSize, nClasses}, std::vector<float>(
+				labels.begin() + first * nClasses, labels.begin() + (first + batchSize) * nClasses
+			));
+
+			// Forward pass
+			list.reset();
+			auto x = ts::NewTensorVar(xVal, &list);
+			auto t = ts::NewTensorVar(tVal, &list);
+
+			auto h1 = ts::nn::relu(layer1.forward(x));
+			auto h2 = ts::nn::relu(layer2.forward(h1));
+			auto logits = layer3.forward(h2);
+			auto loss = ts::nn::softmaxCrossEntropy(logits, t);
+
+			epochLoss += loss.getValue()[0];
+			for(int i = 0; i < batchSize; i++) {
+				const float * row = logits.getValue().getData() + i * nClasses;
+				int prediction = std::max_element(row, row + nClasses) - row;
+				nCorrect += prediction == classes[first + i];
+			}
+
+			// Backward pass and update
+			auto grad = loss.grad();
+			for(ts::nn::Dense<float> * layer : layers) {
+				ts::Tensor<float> dw = grad.getValue(layer->getWeightsVar());
+				ts::Tensor<float> db = grad.getValue(layer->getBiasVar());
+				ts::kernels::axpy(dw.size(), -learningRate, dw.getData(), layer->getWeights().getData());
+				ts::kernels::axpy(db.size(), -learningRate, db.getData(), layer->getBias().getData());
+			}
+		}
+
+		std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+		totalSeconds += seconds.count();
+
+		std::cout << "Epoch " << epoch + 1 << " : loss " << epochLoss / nBatches;
+		std::cout << ", accuracy " << (double) nCorrect / (nBatches * batchSize);
+		std::cout << ", " << nBatches * batchSize / seconds.count() << " samples/s" << std::endl;
+	}
+
+	std::cout << "Throughput : " << (double) nEpochs * nBatches * batchSize / totalSeconds << " samples/s";
+	std::cout << " (" << nEpochs * nBatches / totalSeconds << " steps/s)" << std::endl;
+
+	return 0;
+}
@@ -1,18 +1,89 @@
 /*
 * General automatic differentiation engine based on a Wengert list
-* implementation. Reverse mode only.
+* implementation, in reverse mode. Forward mode is provided by the dual numbers
+* of dual.hpp, which can also be recorded on a list, and second order
+* derivatives are computed in forward-over-reverse mode on the recorded tape
+* (see Var::hvp()).
 */
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
 #include <vector>
 
+#include "stats.hpp"
+#include "storage.hpp"
+#include "tape.hpp"
+
 
 namespace ts {
 	template <typename T> class Node;
 	template <typename T> class WengertList;
 	template <typename T> class Var;
 	template <typename T> class Gradient;
+	template <typename T> class Jacobian;
+	template <typename T> class Plan;
+	template <typename T, class E> class Expr;
+	template <typename T> class LeafExpr;
+	template <typename T> class NoGrad;
+
+	namespace optim {
+		template <typename T> class Optimizer;
+	}
+
+	namespace io {
+		template <typename T> class Writer;
+		template <typename T> class Model;
+	}
+
+
+	// Operations recorded on a WengertList when tracing is enabled (see
+	// WengertList::setTracing())
+	enum class NodeOp : uint8_t {
+		Input,
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Exp,
+		Log,
+		Sin,
+		Cos,
+		Tanh,
+		Sqrt,
+		Pow,
+		Fused	// Expression template, can't be replayed
+	};
+
+	static_assert((int) ts::NodeOp::Fused + 1 == ts::nNodeOps, "ts::nNodeOps must match ts::NodeOp");
+
+
+	namespace internal {
+		// Number of nodes in the chunks claimed by the threads recording on a
+		// shared list (see WengertList::beginShared()). Each chunk has room
+		// for twice as many parents.
+		const int sharedChunkNodes = 1024;
+
+		// Identifies a shared recording across all lists, so that threads can
+		// tell that the chunk they were filling belongs to a previous one
+		inline uint64_t newSharedSession() {
+			static std::atomic<uint64_t> nSessions(0);
+			return ++nSessions;
+		}
+	}
+
+
+	// Formats in which a WengertList can store its partial derivatives (see
+	// WengertList::setPrecision())
+	enum class TapePrecision : uint8_t {
+		Full,	// The scalar type of the list
+		BFloat16,
+		Half	// IEEE half precision (partials above 65504 become infinite)
+	};
 
 
 	// This helper function allows us to create Var instances without template
@@ -29,6 +100,49 @@ namespace ts {
 	ts::Var<T> operator*(const ts::Var<T> &x, const ts::Var<T> &y);
 	template <typename T>
 	ts::Var<T> operator/(const ts::Var<T> &x, const ts::Var<T> &y);
+
+	// Operations with a constant, which is folded in the recorded node instead
+	// of being recorded as an input node (see Var)
+	template <typename T>
+	ts::Var<T> operator+(const ts::Var<T> &x, T c);
+	template <typename T>
+	ts::Var<T> operator+(T c, const ts::Var<T> &x);
+	template <typename T>
+	ts::Var<T> operator-(const ts::Var<T> &x, T c);
+	template <typename T>
+	ts::Var<T> operator-(T c, const ts::Var<T> &x);
+	template <typename T>
+	ts::Var<T> operator*(const ts::Var<T> &x, T c);
+	template <typename T>
+	ts::Var<T> operator*(T c, const ts::Var<T> &x);
+	template <typename T>
+	ts::Var<T> operator/(const ts::Var<T> &x, T c);
+	template <typename T>
+	ts::Var<T> operator/(T c, const ts::Var<T> &x);
+
+
+	// Elementary functions. Each one records a single node, whose partial
+	// derivative is computed along with the value (reusing it when possible).
+	template <typename T>
+	ts::Var<T> exp(const ts::Var<T> &x);
+	template <typename T>
+	ts::Var<T> log(const ts::Var<T> &x);
+	template <typename T>
+	ts::Var<T> sin(const ts::Var<T> &x);
+	template <typename T>
+	ts::Var<T> cos(const ts::Var<T> &x);
+	template <typename T>
+	ts::Var<T> tanh(const ts::Var<T> &x);
+	template <typename T>
+	ts::Var<T> sqrt(const ts::Var<T> &x);
+
+	// x^y (x must be positive for the derivative with respect to y)
+	template <typename T>
+	ts::Var<T> pow(const ts::Var<T> &x, const ts::Var<T> &y);
+
+	// x^p, p being folded as a constant
+	template <typename T>
+	ts::Var<T> pow(const ts::Var<T> &x, T p);
 }
 
 
@@ -40,35 +154,323 @@ private:
 	Node();
 
 	// Represents a unary operator
-	Node(T xVal, int xDep);
+	Node(ts::NodeOp newOp, T xVal, int xDep);
 
 	// Represents a binary operator
-	Node(T xVal, int xDep, T yVal, int yDep);
+	Node(ts::NodeOp newOp, T xVal, int xDep, T yVal, int yDep);
 
 
-	std::vector<T> values{};
-	std::vector<int> dependencies{};
+	// A Node is only a fixed-size, transient record : it is copied into the
+	// flat arrays of its WengertList and never allocates by itself.
+	T values[2];
+	int dependencies[2];
+	int arity;
+	ts::NodeOp op;
 
 public:
 
 	friend ts::Var<T>;
+	friend ts::WengertList<T>;
 
 	friend ts::Var<T> operator+<>(const ts::Var<T> &x, const ts::Var<T> &y);
 	friend ts::Var<T> operator-<>(const ts::Var<T> &x, const ts::Var<T> &y);
 	friend ts::Var<T> operator*<>(const ts::Var<T> &x, const ts::Var<T> &y);
 	friend ts::Var<T> operator/<>(const ts::Var<T> &x, const ts::Var<T> &y);
+
+	friend ts::Var<T> exp<>(const ts::Var<T> &x);
+	friend ts::Var<T> log<>(const ts::Var<T> &x);
+	friend ts::Var<T> sin<>(const ts::Var<T> &x);
+	friend ts::Var<T> cos<>(const ts::Var<T> &x);
+	friend ts::Var<T> tanh<>(const ts::Var<T> &x);
+	friend ts::Var<T> sqrt<>(const ts::Var<T> &x);
+	friend ts::Var<T> pow<>(const ts::Var<T> &x, const ts::Var<T> &y);
 };
 
 
 
+// A WengertList is recorded by a single thread, unless it is shared between
+// beginShared() and endShared() : threads can then record sub-expressions of
+// the same tape concurrently. Independent computations (one sample or batch
+// per thread) are still better off with a list per thread (see parallel.hpp),
+// which needs no reservation or padding, and can be traced or checkpointed.
 template <typename T>
 class ts::WengertList {
 private:
-	std::vector<ts::Node<T>> nodes{};
+	// The tape is stored as a structure of arrays, so recording a node never
+	// requires a heap allocation of its own. The parents of node i are
+	// dependencies[offsets[i]] to dependencies[offsets[i+1] - 1], and their
+	// partial derivatives are stored at the same positions in partials.
+	// An input node thus only takes its 4 bytes offset, and a binary node
+	// 4 + 2 * (sizeof(T) + 4) bytes. Indices are stored on 32 bits.
+	ts::internal::TapeArray<T> partials{};
+	ts::internal::TapeArray<uint32_t> dependencies{};
+	ts::internal::TapeArray<uint32_t> offsets{0};
+
+	// Reduced precision tapes store their partials here instead, on 16 bits
+	ts::TapePrecision precision = ts::TapePrecision::Full;
+	ts::internal::TapeArray<uint16_t> packedPartials{};
+
+public:
+	// Function of a checkpointed segment, mapping its inputs to its outputs
+	typedef std::function<
+		std::vector<ts::Var<T>>(const std::vector<ts::Var<T>> &)
+	> SegmentFunction;
+
+private:
+	// A checkpointed segment only keeps its function and the values of its
+	// inputs. Its outputs are consecutive nodes starting at firstOutput,
+	// recorded without dependencies.
+	struct Segment {
+		SegmentFunction function;
+		std::vector<int> inputs;	// -1 for inputs that are not on this list
+		std::vector<T> inputValues;
+		int firstOutput;
+	};
+
+	std::vector<Segment> segments{};
+
+	// When tracing, the operation and value of each node are recorded as
+	// well, so that the tape can be compiled into a ts::Plan
+	bool tracing = false;
+	ts::internal::TapeArray<ts::NodeOp> ops{};
+	ts::internal::TapeArray<T> values{};
+
+	// When not recording, operations on the Vars of this list only compute
+	// their values (see ts::NoGrad)
+	bool recording = true;
+
+	// Shared recording (see beginShared()). Chunk c holds the nodes starting
+	// at sharedFirstNode + c * sharedChunkNodes, and their parents starting
+	// at sharedFirstDependency + 2 * c * sharedChunkNodes. Each chunk is
+	// filled by the thread that claimed it, which is the only one to write
+	// its counters (they are aligned so that threads don't share cache
+	// lines). The nodes of each operation are counted by chunk as well, and
+	// added to the stats by endShared().
+	struct alignas(64) SharedChunk {
+		uint32_t nNodes;
+		uint32_t nDependencies;
+	#ifdef TS_INSTRUMENT
+		long nodesByOp[ts::nNodeOps];
+	#endif
+	};
+
+	bool shared = false;
+	uint64_t sharedSession = 0;
+	int sharedFirstNode = 0;
+	uint32_t sharedFirstDependency = 0;
+	std::vector<SharedChunk> sharedChunks{};
+	std::atomic<int> nSharedChunks{0};
+
+	// Instrumentation (see stats.hpp), only updated when TS_INSTRUMENT is
+	// defined
+	ts::TapeStats stats{};
+	bool traceEvents = false;
+	std::chrono::steady_clock::time_point traceOrigin{};
+
+	// Size of the recorded tape in bytes
+	long getBytes();
+
+	// Appends a node to the tape and returns its index (value is the value of
+	// the corresponding Var)
+	int push(const ts::Node<T> &node, T value);
+
+	// Appends a node with any number of parents (used by fused expressions)
+	int push(
+		ts::NodeOp op, int arity, const T * nodePartials,
+		const int * nodeDependencies, T value
+	);
+
+	// push() while recording is shared, in the current chunk of the calling
+	// thread
+	int pushShared(
+		ts::NodeOp op, int arity, const T * nodePartials,
+		const int * nodeDependencies, T value
+	);
+
+	// Partial derivative stored at position, in the precision of the tape
+	void pushPartial(T partial);
+	T getPartial(uint32_t position);
+
+	// Reverse sweeps computing the derivatives of the output node with
+	// respect to all nodes (derivatives must be zeroed and have the size of the
+	// list)
+	void backward(int output, std::vector<T> &derivatives);
+	void parallelBackward(int output, std::vector<T> &derivatives, int nThreads);
+
+	// Same as backward(), but for several outputs at once. Derivatives are
+	// stored node by node : derivatives[i * nOutputs + k] is the derivative of
+	// the k-th output with respect to node i.
+	void multiBackward(const std::vector<int> &outputs, std::vector<T> &derivatives);
+
+	// Same as backward(), but only the nodes the output depends on are
+	// visited, and their indices (in increasing order) and derivatives are
+	// appended to reached and derivatives
+	void sparseBackward(int output, std::vector<int> &reached, std::vector<T> &derivatives);
+
+	// Propagates derivatives (seeded by the caller between nodes first and
+	// last) from node last down to the first node, with width derivatives per
+	// node. The sweep stops below the lowest node that was reached, so that
+	// nodes recorded before everything the outputs depend on are never read.
+	void sweep(int first, int last, std::vector<T> &derivatives, int width);
+
+	// Same as sweep(), reading the partials of each node from
+	// nodePartials.get(begin, end) (see ts::internal::FullPartials)
+	template <class P>
+	void sweep(int first, int last, std::vector<T> &derivatives, int width, P &nodePartials);
+
+	// Prefetches (or drops from memory) the tape of nodes [begin, end) when it
+	// is spilled to disk
+	void adviseNodes(int begin, int end, bool willNeed);
+
+	// Recomputes a checkpointed segment and propagates the derivatives of its
+	// outputs to its inputs
+	void replay(const Segment &segment, std::vector<T> &derivatives, int width);
+
+	// True if the nodes up to last were all traced and can be replayed from
+	// their op codes and values (no fused expression or checkpointed segment)
+	bool isReplayable(int last);
+
+	// Forward-over-reverse sweep of a traced tape (see Var::hvp()). tangents
+	// is seeded on input nodes and completed by a forward pass, then the
+	// derivatives of output and their tangents are propagated backward. All
+	// vectors have output + 1 elements.
+	void tangentSweep(
+		int output, std::vector<T> &tangents,
+		std::vector<T> &derivatives, std::vector<T> &derivativeTangents
+	);
 
 public:
 	int size();
 
+	// Preallocates room for nNodes nodes (assuming binary operations), so
+	// that recording them won't reallocate the tape
+	void reserve(int nNodes);
+
+	// Clears the tape but keeps its capacity, so it can be reused for the next
+	// computation without allocating. Vars recorded before the reset must not
+	// be used anymore.
+	void reset();
+
+	// Tracing must be enabled before recording (and is kept by reset()) to
+	// compile the tape
+	void setTracing(bool newTracing);
+
+	// When recording is disabled, nothing is pushed on the list anymore :
+	// operations on its Vars (and new Vars created on it) give constants,
+	// which only hold their value (see Var). Vars recorded before stay valid.
+	// Prefer a ts::NoGrad guard, which restores the previous state.
+	void setRecording(bool newRecording);
+	bool isRecording();
+
+	// Stores the partial derivatives of the tape on 16 bits instead of T,
+	// which makes binary nodes 16 bytes instead of 20 for floats. Reverse
+	// sweeps decode them by blocks and still accumulate derivatives in T.
+	// This is mostly a memory saving : sweeps also read and write derivatives
+	// at random places, so they are rarely bound by the tape bandwidth alone.
+	// Reduced precision is only available for float lists, and must be set on
+	// an empty list (it is kept by reset()). Returns false otherwise.
+	bool setPrecision(ts::TapePrecision newPrecision);
+	ts::TapePrecision getPrecision();
+
+	// Stores the tape in memory-mapped files instead of the heap, for tapes
+	// larger than RAM. The files are created in directory and deleted right
+	// away, so they disappear with the list. The tape is written out by
+	// chunks while it is recorded, and the dense reverse sweeps (grad() and
+	// Jacobians) read it back in reverse, prefetching the chunks ahead. The
+	// derivatives buffer (sizeof(T) per node, instead of about 20 bytes for
+	// the tape) and checkpointed segments stay in memory. Must be called on
+	// an empty list (the files are kept by reset()). Returns false if the
+	// files can't be created, or on systems without mmap.
+	bool setBackingStore(const std::string &directory);
+
+	// Freezes the tape into a plan that recomputes outputs (and their
+	// gradients) from new values of inputs. Input nodes that are not part of
+	// inputs are kept as constants. Returns an empty plan if the tape was not
+	// fully traced, contains fused expressions or checkpointed segments, or if
+	// a Var is not on this list or is not an input node.
+	ts::Plan<T> compile(
+		const std::vector<ts::Var<T>> &inputs,
+		const std::vector<ts::Var<T>> &outputs
+	);
+
+	// Average size of the recorded nodes in bytes (not counting the unused
+	// capacity of the tape, or checkpointed segments)
+	double bytesPerNode();
+
+	// Counters of the list since it was created or since resetStats() (only
+	// the current size is reported without TS_INSTRUMENT). Unlike the tape,
+	// they are not cleared by reset().
+	ts::TapeStats getStats();
+	void resetStats();
+
+	// Keeps an event for every gradient computed from now on, so that they
+	// can be exported with TapeStats::toChromeTrace()
+	void setTraceEvents(bool newTraceEvents);
+
+	// Computes the gradients of several outputs in a single reverse sweep,
+	// instead of one sweep per output. Each node carries one derivative per
+	// output, stored contiguously so they are all updated in a single
+	// (vectorizable) loop.
+	ts::Jacobian<T> grad(const std::vector<ts::Var<T>> &outputs);
+
+
+	// Shared recording
+	// Between beginShared() and endShared(), several threads can record on
+	// this list at the same time (fork-join code where threads contribute
+	// sub-expressions to the same tape). Each thread claims chunks of
+	// ts::internal::sharedChunkNodes consecutive nodes with a single atomic
+	// fetch-add, and fills them without any synchronization. Chunks are
+	// claimed in increasing order, so the nodes of a thread can depend on the
+	// nodes recorded before beginShared() and on its own nodes, which keeps
+	// the tape in topological order for the reverse sweep. They must not
+	// depend on the nodes of other threads until endShared().
+	// The recording state is read by all threads without synchronization, so
+	// setRecording(), setTracing() and ts::NoGrad guards must not be used on
+	// the list while it is shared (a guard can be taken around the whole
+	// shared session instead). The stats of the nodes recorded by the threads
+	// (see stats.hpp) are only updated by endShared().
+
+	// Starts shared recording, with room for maxNodes nodes (counting the
+	// unused end of each thread's last chunk). The arrays of the tape are
+	// reserved at once, since they can't be moved while threads are writing
+	// in them : only their address space is, and memory is committed chunk by
+	// chunk as it is filled (claiming a chunk beyond maxNodes throws
+	// std::bad_alloc in the recording thread). The list must be in memory, at
+	// full precision and not traced (the ops and values of a traced list
+	// can't be written concurrently). Returns false otherwise, or if it is
+	// already shared.
+	bool beginShared(int maxNodes);
+
+	// Ends shared recording, once all threads are done (joined) : the unused
+	// part of each chunk is padded with nodes that nothing depends on, so the
+	// sweeps skip them. The list can then be differentiated, or recorded by a
+	// single thread again. Until then, it must not be differentiated, reset,
+	// or used for checkpoints.
+	void endShared();
+
+
+	// Checkpointing
+	// A checkpointed segment is executed without keeping its tape : only its
+	// inputs and outputs are recorded on this list. It is executed again
+	// during the reverse sweep to get its derivatives. The function must only
+	// use its inputs (and constants), and may checkpoint segments itself.
+
+	// Runs function on inputs as a checkpointed segment
+	std::vector<ts::Var<T>> checkpoint(
+		SegmentFunction function, const std::vector<ts::Var<T>> &inputs
+	);
+
+	// Runs nSteps iterations of state = step(state). The loop is split into
+	// nSnapshots checkpointed segments, recursively split the same way. Tape
+	// memory is then about nSnapshots * log(nSteps) / log(nSnapshots) times
+	// the size of one step, for the same number of forward recomputations of
+	// each step. The default, sqrt(nSteps) snapshots, gives a O(sqrt(nSteps))
+	// memory for a single recomputation.
+	std::vector<ts::Var<T>> checkpointLoop(
+		SegmentFunction step, const std::vector<ts::Var<T>> &state,
+		int nSteps, int nSnapshots = 0
+	);
+
 	friend class ts::Var<T>;
 };
 
@@ -84,35 +486,248 @@ private:
 	// We want this constructor to be private as it is supposed to be called by
 	// our friends overloaded operators and functions only. This constructor
 	// thus allows us to create a Var with dependencies in the Wengert list.
-	Var(T newValue, ts::WengertList<T> * newWList, ts::Node<T> node);
+	Var(T newValue, ts::WengertList<T> * newWList, const ts::Node<T> &node);
+
+	// List on which an operation on x (and y) is recorded, or NULL if it only
+	// computes a value : all of its operands are constants, or their list
+	// isn't recording. valid is set to false if x and y are on different
+	// lists.
+	static ts::WengertList<T> * getList(const ts::Var<T> &x);
+	static ts::WengertList<T> * getList(const ts::Var<T> &x, const ts::Var<T> &y, bool &valid);
+
+	// Records a binary operation on wList (returned by getList(x, y)) when
+	// one of its operands is a constant. It is folded in a unary node, unless
+	// the list is traced : plans replay binary operations on both of their
+	// operands, so it is recorded as an input node instead.
+	static ts::Var<T> fold(
+		ts::WengertList<T> * wList, ts::NodeOp op, T value,
+		const ts::Var<T> &x, T xPartial, const ts::Var<T> &y, T yPartial
+	);
 
 public:
+	// A Var created without list (or on a list that isn't recording) is a
+	// constant. Operations mixing constants with the Vars of a list fold them
+	// in their nodes, and operations on constants only compute their value
+	// without recording anything, so forward-only code can run on constants
+	// for free.
 	Var(T newValue, ts::WengertList<T> * wList);
 
-	T getValue();
+	// Evaluates an expression template and records it as a single node
+	// depending directly on its leaves (see expression.hpp)
+	template <class E>
+	Var(const ts::Expr<T, E> &expr);
+
+	T getValue() const;
+
+	// Index of the node on the list (-1 if the Var is a constant). This is
+	// also the position of its derivative in Gradient::getData().
+	int getIndex() const;
+
 	ts::Gradient<T> grad();
 
+	// Same as grad(), but derivatives are written in buffer, whose memory is
+	// reused (it is resized and zeroed, so it doesn't allocate if it is large
+	// enough). The buffer can be taken back with Gradient::release() for the
+	// next call, so that repeated gradients don't allocate at all.
+	ts::Gradient<T> grad(std::vector<T> &&buffer);
+
+	// Same as grad(), but the reverse sweep is shared between nThreads
+	// threads. Nodes are grouped by their distance to this variable, so that
+	// the nodes of a group don't depend on each other and can be processed
+	// concurrently. Each node then pulls its derivative from its children, so
+	// no two threads ever write at the same place. This only pays off for wide
+	// graphs (many independent sub-expressions), and falls back to the serial
+	// sweep when the graph is too narrow.
+	ts::Gradient<T> grad(int nThreads);
+
+	// Same as grad(), but derivatives are only stored for the nodes this
+	// variable depends on. This avoids allocating (and sweeping) a buffer as
+	// large as the tape when the variable only depends on a small part of it.
+	ts::Gradient<T> sparseGrad();
+
+
+	// Higher order derivatives (the list must be traced, see
+	// WengertList::setTracing())
+
+	// Derivatives with respect to wrt, computed by a reverse sweep that is
+	// itself recorded on the list. They are Vars, so they can be
+	// differentiated again (second order optimizers, Hessians, or higher
+	// order derivatives by calling recordGrad() on them). The sweep records a
+	// few nodes for each node recorded so far : use hvp() for Hessian-vector
+	// products. Returns an empty vector if the tape can't be replayed (see
+	// WengertList::compile()).
+	std::vector<ts::Var<T>> recordGrad(const std::vector<ts::Var<T>> &wrt);
+
+	// Hessian-vector product with respect to wrt, along v (of the same size),
+	// in forward-over-reverse mode on the recorded tape : a forward pass
+	// propagates the tangents of wrt, and a single reverse sweep propagates
+	// the adjoints along with their tangents. This costs a few gradients,
+	// without recording anything or building the Hessian. The gradient with
+	// respect to wrt is written in grad if it isn't NULL. Returns an empty
+	// vector if the tape can't be replayed.
+	std::vector<T> hvp(
+		const std::vector<ts::Var<T>> &wrt, const std::vector<T> &v,
+		std::vector<T> * grad = NULL
+	);
+
 	friend ts::Gradient<T>;
+	friend ts::Jacobian<T>;
+	friend ts::WengertList<T>;
+	friend ts::LeafExpr<T>;
 
 	friend ts::Var<T> operator+<>(const ts::Var<T> &x, const ts::Var<T> &y);
 	friend ts::Var<T> operator-<>(const ts::Var<T> &x, const ts::Var<T> &y);
 	friend ts::Var<T> operator*<>(const ts::Var<T> &x, const ts::Var<T> &y);
 	friend ts::Var<T> operator/<>(const ts::Var<T> &x, const ts::Var<T> &y);
+
+	friend ts::Var<T> exp<>(const ts::Var<T> &x);
+	friend ts::Var<T> log<>(const ts::Var<T> &x);
+	friend ts::Var<T> sin<>(const ts::Var<T> &x);
+	friend ts::Var<T> cos<>(const ts::Var<T> &x);
+	friend ts::Var<T> tanh<>(const ts::Var<T> &x);
+	friend ts::Var<T> sqrt<>(const ts::Var<T> &x);
+	friend ts::Var<T> pow<>(const ts::Var<T> &x, const ts::Var<T> &y);
+	friend ts::Var<T> pow<>(const ts::Var<T> &x, T p);
 };
 
 
 
+// Disables recording on a list for the lifetime of the guard (inference,
+// metrics...), and restores the previous state when destroyed :
+//
+//	{
+//		ts::NoGrad<float> guard(&wList);
+//		float prediction = model(x).getValue();	// Nothing is recorded
+//	}
 template <typename T>
-class ts::Gradient {
+class ts::NoGrad {
 private:
-	// Constructor is private since we want instances of this class to be
-	// generated by the Var::grad() method only
-	Gradient(std::vector<T> newDerivatives);
+	ts::WengertList<T> * wList;
+	bool wasRecording;
 
+public:
+	NoGrad(ts::WengertList<T> * newWList);
+	~NoGrad();
+
+	NoGrad(const ts::NoGrad<T> &other) = delete;
+	ts::NoGrad<T> & operator=(const ts::NoGrad<T> &other) = delete;
+};
+
+
+
+template <typename T>
+class ts::Gradient {
+protected:
+	// Constructors are protected since we want instances of this class to be
+	// generated by the Var::grad() method only. Derivatives are moved in.
+	Gradient(std::vector<T> &&newDerivatives, int newWidth = 1);
+
+	// Sparse gradient (newIndices being sorted)
+	Gradient(std::vector<int> &&newIndices, std::vector<T> &&newDerivatives);
+
+	// Dense gradients store width derivatives (one per output) for each node
+	// from the first one up to the output. Sparse gradients store the
+	// derivative of node indices[i] in derivatives[i].
 	std::vector<T> derivatives;
+	std::vector<int> indices;
+	int width;
+	bool sparse;
 
 public:
-	T getValue(ts::Var<T> a);
+	// Derivative with respect to a (of the first output for a Jacobian)
+	T getValue(const ts::Var<T> &a) const;
+
+	// Number of nodes whose derivatives are stored
+	int getNStored() const;
+
+	// View of the derivatives, without copy (getNStored() * width elements).
+	// For dense gradients, the derivatives of node i are stored from
+	// getData()[i * width] (see Var::getIndex()). For sparse gradients, they
+	// are in the order of the nodes getValue() can find.
+	const T * getData() const;
+
+	// Gives the derivatives buffer back (the gradient is empty after that),
+	// to be reused by Var::grad(std::vector<T> &&)
+	std::vector<T> release();
 
 	friend class ts::Var<T>;
+	friend class ts::optim::Optimizer<T>;
 };
+
+
+
+template <typename T>
+class ts::Jacobian : public ts::Gradient<T> {
+private:
+	// Instances are generated by the WengertList::grad() method only
+	Jacobian(std::vector<T> &&newDerivatives, int nOutputs);
+
+public:
+	int getNOutputs() const;
+
+	// Derivative of the output-th output with respect to a
+	T getValue(int output, const ts::Var<T> &a) const;
+	using ts::Gradient<T>::getValue;
+
+	friend class ts::WengertList<T>;
+};
+
+
+
+template <typename T>
+class ts::Plan {
+private:
+	// Compiled tape : node i computes ops[i] on the nodes operands[2*i] and
+	// operands[2*i+1] (only the first one for unary operations). Nodes are in
+	// the order they were recorded, which is a topological order. Plans
+	// loaded from a model file use these two arrays in place.
+	ts::internal::Storage<ts::NodeOp> ops{};
+	ts::internal::Storage<uint32_t> operands{};
+
+	// Nodes of the inputs and outputs
+	ts::internal::Storage<uint32_t> inputs{};
+	ts::internal::Storage<uint32_t> outputs{};
+
+	// Preallocated buffers, reused by every call. Values of the constant
+	// nodes are the ones that were recorded.
+	ts::internal::Storage<T> values{};
+	ts::internal::Storage<T> partials{};
+	ts::internal::Storage<T> adjoints{};
+
+public:
+	// Empty plan
+	Plan();
+
+	// Number of nodes (0 for an empty plan)
+	int size();
+	int getNInputs();
+	int getNOutputs();
+
+	// Computes the outputs for new values of the inputs. Arrays must have
+	// getNInputs() and getNOutputs() elements (outputValues may be NULL).
+	// Plans hold their own buffers so, unlike a WengertList, a plan must not
+	// be run by several threads at the same time.
+	void forward(const T * inputValues, T * outputValues);
+
+	// Same as forward(), and writes the gradient of the output-th output with
+	// respect to each input in gradient
+	void grad(const T * inputValues, T * outputValues, T * gradient, int output = 0);
+
+	// Removes the nodes that no output depends on (side computations, metrics
+	// recorded on the same tape...), so that forward() and grad() only visit
+	// the nodes they need. Inputs are kept, even if unused. Returns the number
+	// of removed nodes.
+	int prune();
+
+	friend class ts::WengertList<T>;
+	friend class ts::io::Writer<T>;
+	friend class ts::io::Model<T>;
+};
+
+
+
+// In header-only mode, the implementation is compiled in user code instead of
+// being linked from libtensorslow.so
+#ifdef TS_HEADER_ONLY
+#include "autodiff_impl.hpp"
+#endif
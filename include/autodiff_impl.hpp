@@ -0,0 +1,2290 @@
+/*
+* Implementation of the autodiff engine. This file is compiled in
+* libtensorslow.so for the float, double and ts::Dual types. It can also be
+* included directly (define TS_HEADER_ONLY before including tensorslow.h or
+* autodiff.hpp) so that the compiler can inline operators in user code, and so
+* that the engine can be used with other scalar types.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+
+#include "autodiff.hpp"
+#include "kernels.hpp"
+
+
+// Times the gradient computed in the current scope on list (see stats.hpp)
+#ifdef TS_INSTRUMENT
+#define TS_TIME_SWEEP(list, name, nNodes)	\
+	ts::internal::SweepTimer sweepTimer(	\
+		(list)->stats, name, nNodes, (list)->traceEvents, (list)->traceOrigin	\
+	)
+#else
+#define TS_TIME_SWEEP(list, name, nNodes)
+#endif
+
+
+namespace ts {
+	namespace internal {
+		// Adjoints that are exactly zero don't need to be propagated. Types
+		// for which == doesn't tell it (like ts::Dual) provide their own
+		// overload, found by argument-dependent lookup.
+		template <typename T>
+		bool isZero(const T &x) {
+			return x == T(0.0);
+		}
+
+
+		// Traced operations using both of their operands
+		inline bool isBinary(ts::NodeOp op) {
+			return
+				op == ts::NodeOp::Add || op == ts::NodeOp::Sub || op == ts::NodeOp::Mul ||
+				op == ts::NodeOp::Div || op == ts::NodeOp::Pow;
+		}
+
+
+		// Value of a unary function at x, along with its derivative. Math
+		// functions are called unqualified so that the overloads of types
+		// like ts::Dual are found as well.
+		template <typename T>
+		T evaluateUnary(ts::NodeOp op, T x, T &partial) {
+			using std::exp; using std::log; using std::sin;
+			using std::cos; using std::tanh; using std::sqrt;
+
+			switch(op) {
+			case ts::NodeOp::Exp: {
+				T y = exp(x);
+				partial = y;
+				return y;
+			}
+
+			case ts::NodeOp::Log:
+				partial = 1.0 / x;
+				return log(x);
+
+			case ts::NodeOp::Sin:
+				partial = cos(x);
+				return sin(x);
+
+			case ts::NodeOp::Cos:
+				partial = -sin(x);
+				return cos(x);
+
+			case ts::NodeOp::Tanh: {
+				T y = tanh(x);
+				partial = 1.0 - y * y;
+				return y;
+			}
+
+			case ts::NodeOp::Sqrt: {
+				T y = sqrt(x);
+				partial = 0.5 / y;
+				return y;
+			}
+
+			default:
+				partial = 0.0;
+				return x;
+			}
+		}
+
+
+		// Value only, for operations that aren't recorded
+		template <typename T>
+		T evaluateUnary(ts::NodeOp op, T x) {
+			using std::exp; using std::log; using std::sin;
+			using std::cos; using std::tanh; using std::sqrt;
+
+			switch(op) {
+			case ts::NodeOp::Exp: return exp(x);
+			case ts::NodeOp::Log: return log(x);
+			case ts::NodeOp::Sin: return sin(x);
+			case ts::NodeOp::Cos: return cos(x);
+			case ts::NodeOp::Tanh: return tanh(x);
+			case ts::NodeOp::Sqrt: return sqrt(x);
+			default: return x;
+			}
+		}
+
+
+		// x^y and its partial derivatives
+		template <typename T>
+		T evaluatePow(T x, T y, T &xPartial, T &yPartial) {
+			using std::pow; using std::log;
+
+			T res = pow(x, y);
+			xPartial = y * pow(x, y - 1.0);
+			yPartial = x > 0.0 ? res * log(x) : T(0.0);
+			return res;
+		}
+
+
+		// Number of nodes of the blocks by which spilled tapes are prefetched
+		// during reverse sweeps
+		const int sweepBlockSize = 1 << 18;
+
+
+		// Partials of a full precision tape, read in place
+		template <typename T>
+		struct FullPartials {
+			const T * data;
+
+			const T * get(uint32_t begin, uint32_t) {
+				return data + begin;
+			}
+		};
+
+
+		// Partials of a reduced precision (float) tape, decoded by blocks of
+		// at least blockSize partials. Nodes are swept backwards, so a block
+		// ends at the partials of the node that needed it.
+		class PackedPartials {
+		private:
+			static const uint32_t blockSize = 1024;
+
+			const uint16_t * data;
+			ts::TapePrecision precision;
+
+			std::vector<float> block;
+			uint32_t blockBegin = 0;
+			uint32_t blockEnd = 0;
+
+		public:
+			PackedPartials(const uint16_t * newData, ts::TapePrecision newPrecision) :
+				data(newData), precision(newPrecision), block(blockSize) {}
+
+			const float * get(uint32_t begin, uint32_t end) {
+				if(begin < blockBegin || end > blockEnd) {
+					blockEnd = end;
+					blockBegin = std::min(begin, end > blockSize ? end - blockSize : 0);
+
+					uint32_t n = blockEnd - blockBegin;
+					if(n > block.size()) {
+						block.resize(n);
+					}
+
+				#ifdef TS_HEADER_ONLY
+					// Bulk kernels are not linked in header-only mode
+					for(uint32_t j = 0; j < n; j++) {
+						block[j] = precision == ts::TapePrecision::BFloat16 ?
+							ts::kernels::fromBFloat16(data[blockBegin + j]) :
+							ts::kernels::fromHalf(data[blockBegin + j]);
+					}
+				#else
+					if(precision == ts::TapePrecision::BFloat16) {
+						ts::kernels::fromBFloat16(n, data + blockBegin, block.data());
+					} else {
+						ts::kernels::fromHalf(n, data + blockBegin, block.data());
+					}
+				#endif
+				}
+
+				return block.data() + (begin - blockBegin);
+			}
+		};
+	}
+}
+
+
+
+	// ts::Node
+
+template <typename T>
+ts::Node<T>::Node() {
+	arity = 0;
+	op = ts::NodeOp::Input;
+};
+
+
+
+template <typename T>
+ts::Node<T>::Node(ts::NodeOp newOp, T xVal, int xDep) {
+	values[0] = xVal;	// [da/dx]
+	dependencies[0] = xDep;
+	arity = 1;
+	op = newOp;
+}
+
+
+
+template <typename T>
+ts::Node<T>::Node(ts::NodeOp newOp, T xVal, int xDep, T yVal, int yDep) {
+	values[0] = xVal;	// [da/dx, da/dy]
+	values[1] = yVal;
+	dependencies[0] = xDep;
+	dependencies[1] = yDep;
+	arity = 2;
+	op = newOp;
+}
+
+
+
+	// ts::WengertList
+
+template <typename T>
+int ts::WengertList<T>::size() {
+	return offsets.size() - 1;
+}
+
+
+
+template <typename T>
+int ts::WengertList<T>::push(const ts::Node<T> &node, T value) {
+	return push(node.op, node.arity, node.values, node.dependencies, value);
+}
+
+
+
+template <typename T>
+int ts::WengertList<T>::push(
+	ts::NodeOp op, int arity, const T * nodePartials,
+	const int * nodeDependencies, T value
+) {
+	if(shared) {
+		return pushShared(op, arity, nodePartials, nodeDependencies, value);
+	}
+
+	if(tracing) {
+		ops.push_back(op);
+		values.push_back(value);
+	}
+
+#ifdef TS_INSTRUMENT
+	stats.nodesByOp[(int) op]++;
+#endif
+
+	for(int j = 0; j < arity; j++) {
+		pushPartial(nodePartials[j]);
+		dependencies.push_back(nodeDependencies[j]);
+	}
+	offsets.push_back(dependencies.size());
+
+	return offsets.size() - 2;
+}
+
+
+
+template <typename T>
+int ts::WengertList<T>::pushShared(
+	ts::NodeOp op, int arity, const T * nodePartials,
+	const int * nodeDependencies, T
+) {
+	const int chunkNodes = ts::internal::sharedChunkNodes;
+
+	// Chunk being filled by the calling thread. The last node of each chunk
+	// is kept for the padding of endShared().
+	struct Cursor {
+		uint64_t session;
+		int chunk;
+	};
+	thread_local Cursor cursor = {0, 0};
+
+	if(
+		cursor.session != sharedSession ||
+		sharedChunks[cursor.chunk].nNodes == (uint32_t) chunkNodes - 1 ||
+		sharedChunks[cursor.chunk].nDependencies + arity > 2 * (uint32_t) chunkNodes
+	) {
+		// Nothing is read from other chunks, so the order of the claims is
+		// the only thing threads have to agree on
+		int chunk = nSharedChunks.fetch_add(1, std::memory_order_relaxed);
+		if(chunk >= (int) sharedChunks.size()) {
+			throw std::bad_alloc();
+		}
+		cursor = {sharedSession, chunk};
+	}
+
+	SharedChunk &chunk = sharedChunks[cursor.chunk];
+	const int index = sharedFirstNode + cursor.chunk * chunkNodes + chunk.nNodes;
+	const uint32_t position =
+		sharedFirstDependency + 2 * cursor.chunk * chunkNodes + chunk.nDependencies;
+
+	// The arrays were reserved by beginShared(), so their elements are
+	// written in place
+	T * partialsPtr = partials.data();
+	uint32_t * dependenciesPtr = dependencies.data();
+	for(int j = 0; j < arity; j++) {
+		partialsPtr[position + j] = nodePartials[j];
+		dependenciesPtr[position + j] = nodeDependencies[j];
+	}
+	offsets[index + 1] = position + arity;
+
+	chunk.nNodes++;
+	chunk.nDependencies += arity;
+
+#ifdef TS_INSTRUMENT
+	chunk.nodesByOp[(int) op]++;
+#endif
+
+	return index;
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::pushPartial(T partial) {
+	if constexpr(std::is_same<T, float>::value) {
+		if(precision == ts::TapePrecision::BFloat16) {
+			packedPartials.push_back(ts::kernels::toBFloat16(partial));
+			return;
+		}
+		if(precision == ts::TapePrecision::Half) {
+			packedPartials.push_back(ts::kernels::toHalf(partial));
+			return;
+		}
+	}
+
+	partials.push_back(partial);
+}
+
+
+
+template <typename T>
+T ts::WengertList<T>::getPartial(uint32_t position) {
+	if constexpr(std::is_same<T, float>::value) {
+		if(precision == ts::TapePrecision::BFloat16) {
+			return ts::kernels::fromBFloat16(packedPartials[position]);
+		}
+		if(precision == ts::TapePrecision::Half) {
+			return ts::kernels::fromHalf(packedPartials[position]);
+		}
+	}
+
+	return partials[position];
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::reserve(int nNodes) {
+	if(precision == ts::TapePrecision::Full) {
+		partials.reserve(2 * nNodes);
+	} else {
+		packedPartials.reserve(2 * nNodes);
+	}
+	dependencies.reserve(2 * nNodes);
+	offsets.reserve(nNodes + 1);
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::reset() {
+#ifdef TS_INSTRUMENT
+	stats.peakNodes = std::max(stats.peakNodes, (long) size());
+	stats.peakBytes = std::max(stats.peakBytes, getBytes());
+#endif
+
+	// clear() doesn't release memory, so capacity is kept between steps
+	partials.clear();
+	packedPartials.clear();
+	dependencies.clear();
+	offsets.clear();
+	offsets.push_back(0);
+	segments.clear();
+	ops.clear();
+	values.clear();
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::setTracing(bool newTracing) {
+	tracing = newTracing;
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::setRecording(bool newRecording) {
+	recording = newRecording;
+}
+
+
+
+template <typename T>
+bool ts::WengertList<T>::isRecording() {
+	return recording;
+}
+
+
+
+template <typename T>
+bool ts::WengertList<T>::setPrecision(ts::TapePrecision newPrecision) {
+	// Recorded partials are not converted
+	if(size() > 0) {
+		return false;
+	}
+
+	if(newPrecision != ts::TapePrecision::Full && !std::is_same<T, float>::value) {
+		return false;
+	}
+
+	precision = newPrecision;
+	return true;
+}
+
+
+
+template <typename T>
+ts::TapePrecision ts::WengertList<T>::getPrecision() {
+	return precision;
+}
+
+
+
+template <typename T>
+bool ts::WengertList<T>::setBackingStore(const std::string &directory) {
+	if(size() > 0) {
+		return false;
+	}
+
+	// The first offset is written again once the offsets array is spilled
+	offsets.clear();
+	bool spilled =
+		offsets.spill(directory) && dependencies.spill(directory) &&
+		partials.spill(directory) && packedPartials.spill(directory) &&
+		ops.spill(directory) && values.spill(directory);
+	offsets.push_back(0);
+
+	return spilled;
+}
+
+
+
+template <typename T>
+ts::Plan<T> ts::WengertList<T>::compile(
+	const std::vector<ts::Var<T>> &inputs,
+	const std::vector<ts::Var<T>> &outputs
+) {
+	ts::Plan<T> plan;
+
+	if((int) ops.size() != size() || !segments.empty()) {
+		return plan;
+	}
+
+	for(unsigned j = 0; j < inputs.size(); j++) {
+		if(inputs[j].wList != this || ops[inputs[j].index] != ts::NodeOp::Input) {
+			return plan;
+		}
+	}
+
+	// Nodes recorded after the last output are not needed
+	int nNodes = 0;
+	for(unsigned k = 0; k < outputs.size(); k++) {
+		if(outputs[k].wList != this) {
+			return plan;
+		}
+		nNodes = std::max(nNodes, outputs[k].index + 1);
+	}
+
+	for(int i = 0; i < nNodes; i++) {
+		if(ops[i] == ts::NodeOp::Fused) {
+			return ts::Plan<T>();
+		}
+
+		plan.ops.push_back(ops[i]);
+		for(uint32_t j = 0; j < 2; j++) {
+			uint32_t position = offsets[i] + j;
+			bool used = position < offsets[i+1];
+
+			plan.operands.push_back(used ? dependencies[position] : 0);
+			plan.partials.push_back(used ? getPartial(position) : T(0.0));
+		}
+	}
+
+	for(unsigned j = 0; j < inputs.size(); j++) {
+		plan.inputs.push_back(inputs[j].index);
+	}
+	for(unsigned k = 0; k < outputs.size(); k++) {
+		plan.outputs.push_back(outputs[k].index);
+	}
+
+	plan.values.assign(values.data(), values.data() + nNodes);
+	plan.adjoints.resize(nNodes);
+
+	return plan;
+}
+
+
+
+template <typename T>
+long ts::WengertList<T>::getBytes() {
+	return
+		partials.size() * sizeof(T) +
+		packedPartials.size() * sizeof(uint16_t) +
+		dependencies.size() * sizeof(uint32_t) +
+		offsets.size() * sizeof(uint32_t) +
+		ops.size() * sizeof(ts::NodeOp) +
+		values.size() * sizeof(T);
+}
+
+
+
+template <typename T>
+double ts::WengertList<T>::bytesPerNode() {
+	if(size() == 0) {
+		return 0.0;
+	}
+
+	return (double) getBytes() / size();
+}
+
+
+
+template <typename T>
+ts::TapeStats ts::WengertList<T>::getStats() {
+	ts::TapeStats res = stats;
+	res.nNodes = size();
+	res.bytes = getBytes();
+
+#ifdef TS_INSTRUMENT
+	res.enabled = true;
+	res.peakNodes = std::max(res.peakNodes, res.nNodes);
+	res.peakBytes = std::max(res.peakBytes, res.bytes);
+#endif
+
+	return res;
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::resetStats() {
+	stats = ts::TapeStats();
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::setTraceEvents(bool newTraceEvents) {
+	if(newTraceEvents && !traceEvents) {
+		traceOrigin = std::chrono::steady_clock::now();
+	}
+	traceEvents = newTraceEvents;
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::backward(int output, std::vector<T> &derivatives) {
+	derivatives[output] = 1.0;
+
+	// Nodes recorded after the output can't be part of its expression
+	sweep(output, output, derivatives, 1);
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::multiBackward(const std::vector<int> &outputs, std::vector<T> &derivatives) {
+	const int width = outputs.size();
+
+	int first = std::numeric_limits<int>::max();
+	int last = -1;
+	for(int k = 0; k < width; k++) {
+		if(outputs[k] >= 0) {
+			derivatives[outputs[k] * width + k] = 1.0;
+			first = std::min(first, outputs[k]);
+			last = std::max(last, outputs[k]);
+		}
+	}
+
+	sweep(first, last, derivatives, width);
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::sparseBackward(
+	int output, std::vector<int> &reached, std::vector<T> &derivatives
+) {
+	// Adjoints are stored in a hash map, and the reached nodes are processed
+	// in decreasing order with a max-heap. Since parents are always recorded
+	// before their children, a node has received all its adjoint when it is
+	// popped. The cost only depends on the number of reached nodes.
+
+	std::unordered_map<int, T> adjoints;
+	std::priority_queue<int> pending;
+
+	adjoints[output] = 1.0;
+	pending.push(output);
+
+	while(!pending.empty()) {
+		int i = pending.top();
+		pending.pop();
+
+		T derivative = adjoints[i];
+		reached.push_back(i);
+		derivatives.push_back(derivative);
+
+		for(uint32_t j = offsets[i]; j < offsets[i+1]; j++) {
+			auto inserted = adjoints.insert({(int) dependencies[j], T(0.0)});
+			if(inserted.second) {
+				pending.push(dependencies[j]);
+			}
+			inserted.first->second += getPartial(j) * derivative;
+		}
+	}
+
+	std::reverse(reached.begin(), reached.end());
+	std::reverse(derivatives.begin(), derivatives.end());
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::sweep(int first, int last, std::vector<T> &derivatives, int width) {
+	if constexpr(std::is_same<T, float>::value) {
+		if(precision != ts::TapePrecision::Full) {
+			ts::internal::PackedPartials packed(packedPartials.data(), precision);
+			sweep(first, last, derivatives, width, packed);
+			return;
+		}
+	}
+
+	ts::internal::FullPartials<T> full = {partials.data()};
+	sweep(first, last, derivatives, width, full);
+}
+
+
+
+template <typename T>
+template <class P>
+void ts::WengertList<T>::sweep(int first, int last, std::vector<T> &derivatives, int width, P &nodePartials) {
+	using ts::internal::isZero;
+
+	const uint32_t * dependenciesPtr = dependencies.data();
+	const uint32_t * offsetsPtr = offsets.data();
+
+	// Next checkpointed segment to be replayed
+	int segment = segments.size() - 1;
+	while(segment >= 0 && segments[segment].firstOutput > last) {
+		segment--;
+	}
+
+	// Lowest node that received a derivative so far. Parents are recorded
+	// before their children, so every node below it has a zero derivative
+	// once the sweep gets there, and the sweep can stop. Segments receive
+	// derivatives on any of their outputs but are replayed from the first
+	// one, so the sweep always goes down to the next segment.
+	int lowest = std::min(first, last);
+	auto getFloor = [&]() {
+		return segment >= 0 ? std::min(lowest, segments[segment].firstOutput) : lowest;
+	};
+
+
+	// Iterate over the Wengert list backwards, by blocks of nodes so that the
+	// chunks of spilled tapes are read ahead of the sweep
+	const bool spilled = offsets.isSpilled();
+	const int blockSize = ts::internal::sweepBlockSize;
+	if(spilled) {
+		adviseNodes(std::max(last + 1 - blockSize, 0), last + 1, true);
+	}
+
+	for(int blockEnd = last + 1; blockEnd > getFloor(); blockEnd -= blockSize) {
+		int blockBegin = std::max(blockEnd - blockSize, 0);
+		if(spilled) {
+			adviseNodes(std::max(blockBegin - blockSize, getFloor()), blockBegin, true);
+		}
+
+		for(int i = blockEnd - 1; i >= blockBegin && i >= getFloor(); i--) {
+			// Outputs of a segment are consecutive nodes without dependencies, so
+			// their derivatives are complete when we reach the first one
+			if(segment >= 0 && i == segments[segment].firstOutput) {
+				replay(segments[segment], derivatives, width);
+				for(int input : segments[segment].inputs) {
+					if(input >= 0) {
+						lowest = std::min(lowest, input);
+					}
+				}
+				segment--;
+				continue;
+			}
+
+			// Increment parent nodes (nodes the outputs don't depend on are
+			// skipped, which is most of them when differentiating a small part of
+			// a large tape)
+			if(width == 1) {
+				T derivative = derivatives[i];
+				if(isZero(derivative)) {
+					continue;
+				}
+
+				uint32_t begin = offsetsPtr[i];
+				uint32_t end = offsetsPtr[i+1];
+				const T * partialsPtr = nodePartials.get(begin, end);
+
+				for(uint32_t j = begin; j < end; j++) {
+					derivatives[dependenciesPtr[j]] += partialsPtr[j - begin] * derivative;
+					lowest = std::min(lowest, (int) dependenciesPtr[j]);
+				}
+			} else {
+				const T * derivative = &derivatives[i * width];
+
+				bool reached = false;
+				for(int k = 0; k < width && !reached; k++) {
+					reached = !isZero(derivative[k]);
+				}
+				if(!reached) {
+					continue;
+				}
+
+				uint32_t begin = offsetsPtr[i];
+				uint32_t end = offsetsPtr[i+1];
+				const T * partialsPtr = nodePartials.get(begin, end);
+
+				for(uint32_t j = begin; j < end; j++) {
+					T * parentDerivative = &derivatives[dependenciesPtr[j] * width];
+					T partial = partialsPtr[j - begin];
+
+					for(int k = 0; k < width; k++) {
+						parentDerivative[k] += partial * derivative[k];
+					}
+					lowest = std::min(lowest, (int) dependenciesPtr[j]);
+				}
+			}
+		}
+
+		if(spilled) {
+			adviseNodes(blockBegin, blockEnd, false);
+		}
+	}
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::adviseNodes(int begin, int end, bool willNeed) {
+	if(begin >= end) {
+		return;
+	}
+
+	uint32_t first = offsets[begin];
+	uint32_t last = offsets[end];
+
+	if(willNeed) {
+		offsets.prefetch(begin, end + 1);
+		dependencies.prefetch(first, last);
+		partials.prefetch(first, last);
+		packedPartials.prefetch(first, last);
+	} else {
+		offsets.evict(begin, end + 1);
+		dependencies.evict(first, last);
+		partials.evict(first, last);
+		packedPartials.evict(first, last);
+	}
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::replay(const Segment &segment, std::vector<T> &derivatives, int width) {
+	// Re-runs the segment on a temporary list, and propagates the derivatives
+	// of its outputs to its inputs with a reverse sweep of that list.
+
+	ts::WengertList<T> segmentList;
+
+	std::vector<ts::Var<T>> inputs;
+	for(unsigned j = 0; j < segment.inputValues.size(); j++) {
+		inputs.push_back(ts::Var<T>(segment.inputValues[j], &segmentList));
+	}
+
+	std::vector<ts::Var<T>> outputs = segment.function(inputs);
+
+	std::vector<T> segmentDerivatives(segmentList.size() * width, 0.0);
+	int first = std::numeric_limits<int>::max();
+	int last = -1;
+	for(unsigned k = 0; k < outputs.size(); k++) {
+		// Outputs recorded after the swept range have a zero derivative
+		bool swept = (segment.firstOutput + k + 1) * width <= derivatives.size();
+		if(outputs[k].wList != &segmentList || !swept) {
+			continue;
+		}
+		for(int l = 0; l < width; l++) {
+			segmentDerivatives[outputs[k].index * width + l] +=
+				derivatives[(segment.firstOutput + k) * width + l];
+		}
+		first = std::min(first, outputs[k].index);
+		last = std::max(last, outputs[k].index);
+	}
+
+	segmentList.sweep(first, last, segmentDerivatives, width);
+
+	for(unsigned j = 0; j < inputs.size(); j++) {
+		if(segment.inputs[j] < 0) {
+			continue;
+		}
+		for(int l = 0; l < width; l++) {
+			derivatives[segment.inputs[j] * width + l] +=
+				segmentDerivatives[inputs[j].index * width + l];
+		}
+	}
+}
+
+
+
+template <typename T>
+bool ts::WengertList<T>::beginShared(int maxNodes) {
+	if(
+		shared || tracing || precision != ts::TapePrecision::Full ||
+		offsets.isSpilled()
+	) {
+		return false;
+	}
+
+	const int chunkNodes = ts::internal::sharedChunkNodes;
+	const int nChunks = (std::max(maxNodes, 0) + chunkNodes - 1) / chunkNodes;
+
+	sharedFirstNode = size();
+	sharedFirstDependency = dependencies.size();
+
+	// Only address space is reserved : pages are committed as they are
+	// written, chunk by chunk
+	const size_t nDependencies = sharedFirstDependency + 2 * (size_t) nChunks * chunkNodes;
+	partials.reserve(nDependencies);
+	dependencies.reserve(nDependencies);
+	offsets.reserve(sharedFirstNode + (size_t) nChunks * chunkNodes + 1);
+
+	sharedChunks.assign(nChunks, SharedChunk{});
+	nSharedChunks.store(0);
+	sharedSession = ts::internal::newSharedSession();
+	shared = true;
+
+	return true;
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::endShared() {
+	if(!shared) {
+		return;
+	}
+
+	const int chunkNodes = ts::internal::sharedChunkNodes;
+	const int nChunks = std::min(nSharedChunks.load(), (int) sharedChunks.size());
+
+	T * partialsPtr = partials.data();
+	uint32_t * dependenciesPtr = dependencies.data();
+
+	for(int c = 0; c < nChunks; c++) {
+		const int first = sharedFirstNode + c * chunkNodes;
+		const uint32_t firstDependency = sharedFirstDependency + 2 * c * chunkNodes;
+		const uint32_t lastDependency = firstDependency + 2 * chunkNodes;
+		const uint32_t end = firstDependency + sharedChunks[c].nDependencies;
+
+		// Unused nodes become input nodes, and the last node of the chunk
+		// takes its unused parents with zero partials. Nothing depends on
+		// them, so their derivatives are always zero.
+		for(int i = first + sharedChunks[c].nNodes; i < first + chunkNodes - 1; i++) {
+			offsets[i + 1] = end;
+		}
+		for(uint32_t j = end; j < lastDependency; j++) {
+			partialsPtr[j] = 0.0;
+			dependenciesPtr[j] = first;
+		}
+		offsets[first + chunkNodes] = lastDependency;
+
+	#ifdef TS_INSTRUMENT
+		for(int k = 0; k < ts::nNodeOps; k++) {
+			stats.nodesByOp[k] += sharedChunks[c].nodesByOp[k];
+		}
+	#endif
+	}
+
+	offsets.resize(sharedFirstNode + (size_t) nChunks * chunkNodes + 1);
+	dependencies.resize(sharedFirstDependency + 2 * (size_t) nChunks * chunkNodes);
+	partials.resize(dependencies.size());
+
+#ifdef TS_INSTRUMENT
+	stats.peakNodes = std::max(stats.peakNodes, (long) size());
+	stats.peakBytes = std::max(stats.peakBytes, getBytes());
+#endif
+
+	sharedChunks.clear();
+	shared = false;
+}
+
+
+
+template <typename T>
+std::vector<ts::Var<T>> ts::WengertList<T>::checkpoint(
+	SegmentFunction function, const std::vector<ts::Var<T>> &inputs
+) {
+	// Nothing to recompute later
+	if(!recording) {
+		return function(inputs);
+	}
+
+	Segment segment;
+	segment.function = function;
+
+	for(unsigned j = 0; j < inputs.size(); j++) {
+		segment.inputs.push_back(inputs[j].wList == this ? inputs[j].index : -1);
+		segment.inputValues.push_back(inputs[j].value);
+	}
+
+
+	// Run the segment on a temporary list that is dropped right away : only
+	// the values of its outputs are kept
+	std::vector<T> outputValues;
+	{
+		ts::WengertList<T> segmentList;
+
+		std::vector<ts::Var<T>> segmentInputs;
+		for(unsigned j = 0; j < inputs.size(); j++) {
+			segmentInputs.push_back(ts::Var<T>(segment.inputValues[j], &segmentList));
+		}
+
+		std::vector<ts::Var<T>> segmentOutputs = function(segmentInputs);
+		for(unsigned k = 0; k < segmentOutputs.size(); k++) {
+			outputValues.push_back(segmentOutputs[k].value);
+		}
+	}
+
+
+	// Outputs are recorded like input nodes, their dependencies being handled
+	// by replay()
+	segment.firstOutput = size();
+
+	std::vector<ts::Var<T>> outputs;
+	for(unsigned k = 0; k < outputValues.size(); k++) {
+		outputs.push_back(ts::Var<T>(outputValues[k], this));
+	}
+
+	segments.push_back(segment);
+
+	return outputs;
+}
+
+
+
+template <typename T>
+std::vector<ts::Var<T>> ts::WengertList<T>::checkpointLoop(
+	SegmentFunction step, const std::vector<ts::Var<T>> &state,
+	int nSteps, int nSnapshots
+) {
+	if(nSnapshots <= 0) {
+		nSnapshots = std::ceil(std::sqrt(nSteps));
+	}
+	nSnapshots = std::max(nSnapshots, 2);
+
+	// Short loops are recorded directly (and nothing is recorded at all when
+	// recording is disabled). So are loops without state : their segments
+	// would have no list to run on, and nothing to differentiate.
+	if(nSteps <= nSnapshots || !recording || state.empty()) {
+		std::vector<ts::Var<T>> res = state;
+		for(int i = 0; i < nSteps; i++) {
+			res = step(res);
+		}
+		return res;
+	}
+
+
+	// Otherwise, split the loop in nSnapshots segments, each one being
+	// checkpointed recursively on the temporary list of its segment
+	std::vector<ts::Var<T>> res = state;
+	int stepsDone = 0;
+
+	for(int s = 0; s < nSnapshots; s++) {
+		int segmentSteps = (long) nSteps * (s + 1) / nSnapshots - stepsDone;
+		stepsDone += segmentSteps;
+
+		res = checkpoint([=](const std::vector<ts::Var<T>> &segmentState) {
+			ts::WengertList<T> * segmentList = segmentState[0].wList;
+			return segmentList->checkpointLoop(step, segmentState, segmentSteps, nSnapshots);
+		}, res);
+	}
+
+	return res;
+}
+
+
+
+template <typename T>
+ts::Jacobian<T> ts::WengertList<T>::grad(const std::vector<ts::Var<T>> &outputs) {
+	// Outputs that are not on this list get a zero gradient
+	std::vector<int> indices(outputs.size());
+	for(unsigned k = 0; k < outputs.size(); k++) {
+		indices[k] = outputs[k].wList == this ? outputs[k].index : -1;
+	}
+
+	// Nodes recorded after the last output don't need derivatives
+	int last = -1;
+	for(unsigned k = 0; k < outputs.size(); k++) {
+		last = std::max(last, indices[k]);
+	}
+
+	TS_TIME_SWEEP(this, "jacobian", last + 1);
+
+	std::vector<T> derivatives((last + 1) * outputs.size(), 0.0);
+	multiBackward(indices, derivatives);
+
+	return ts::Jacobian<T>(std::move(derivatives), outputs.size());
+}
+
+
+
+namespace ts {
+	namespace internal {
+		// Minimum average number of nodes per level for the parallel sweep to
+		// be used (synchronizing threads costs more than processing narrower
+		// levels serially)
+		const int minLevelWidth = 4096;
+
+
+		// Reusable spinning barrier for a fixed number of threads
+		class Barrier {
+		private:
+			const int nThreads;
+			std::atomic<int> waiting{0};
+			std::atomic<int> generation{0};
+
+		public:
+			Barrier(int newNThreads) : nThreads(newNThreads) {}
+
+			void wait() {
+				int currentGeneration = generation.load(std::memory_order_acquire);
+
+				if(waiting.fetch_add(1, std::memory_order_acq_rel) == nThreads - 1) {
+					waiting.store(0, std::memory_order_relaxed);
+					generation.fetch_add(1, std::memory_order_release);
+				} else {
+					while(generation.load(std::memory_order_acquire) == currentGeneration) {
+						std::this_thread::yield();
+					}
+				}
+			}
+		};
+	}
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::parallelBackward(int output, std::vector<T> &derivatives, int nThreads) {
+	int nNodes = output + 1;
+
+
+	// Level of a node : length of the longest path from the node to the
+	// output. All children of a node have a lower level, so they are complete
+	// once the previous levels have been processed. Nodes the output doesn't
+	// depend on are left at -1.
+	std::vector<int> levels(nNodes, -1);
+	levels[output] = 0;
+
+	int nLevels = 1;
+	int nReached = 1;
+	for(int i = output; i >= 0; i--) {
+		if(levels[i] < 0) {
+			continue;
+		}
+		for(uint32_t j = offsets[i]; j < offsets[i+1]; j++) {
+			int parent = dependencies[j];
+			if(levels[parent] < 0) {
+				nReached++;
+			}
+			if(levels[parent] < levels[i] + 1) {
+				levels[parent] = levels[i] + 1;
+				nLevels = std::max(nLevels, levels[parent] + 1);
+			}
+		}
+	}
+
+	// Checkpointed segments are only supported by the serial sweep
+	if(
+		nThreads < 2 || !segments.empty() ||
+		nReached / nLevels < ts::internal::minLevelWidth
+	) {
+		backward(output, derivatives);
+		return;
+	}
+
+
+	// Children of each (reached) node, in a CSR layout : the children of node
+	// i are children[childOffsets[i]] to children[childOffsets[i+1] - 1], and
+	// childPartials are the corresponding partial derivatives
+	std::vector<int> childOffsets(nNodes + 1, 0);
+	for(int i = 0; i < nNodes; i++) {
+		if(levels[i] < 0) {
+			continue;
+		}
+		for(uint32_t j = offsets[i]; j < offsets[i+1]; j++) {
+			childOffsets[dependencies[j] + 1]++;
+		}
+	}
+	for(int i = 0; i < nNodes; i++) {
+		childOffsets[i+1] += childOffsets[i];
+	}
+
+	std::vector<int> children(childOffsets[nNodes]);
+	std::vector<T> childPartials(childOffsets[nNodes]);
+	std::vector<int> fill(childOffsets.begin(), childOffsets.end() - 1);
+	for(int i = 0; i < nNodes; i++) {
+		if(levels[i] < 0) {
+			continue;
+		}
+		for(uint32_t j = offsets[i]; j < offsets[i+1]; j++) {
+			int position = fill[dependencies[j]]++;
+			children[position] = i;
+			childPartials[position] = getPartial(j);
+		}
+	}
+
+
+	// Nodes sorted by level (counting sort)
+	std::vector<int> levelOffsets(nLevels + 1, 0);
+	for(int i = 0; i < nNodes; i++) {
+		if(levels[i] >= 0) {
+			levelOffsets[levels[i] + 1]++;
+		}
+	}
+	for(int l = 0; l < nLevels; l++) {
+		levelOffsets[l+1] += levelOffsets[l];
+	}
+
+	std::vector<int> sorted(levelOffsets[nLevels]);
+	fill.assign(levelOffsets.begin(), levelOffsets.end() - 1);
+	for(int i = 0; i < nNodes; i++) {
+		if(levels[i] >= 0) {
+			sorted[fill[levels[i]]++] = i;
+		}
+	}
+
+
+	// Each thread processes a contiguous chunk of every level
+	derivatives[output] = 1.0;
+	ts::internal::Barrier barrier(nThreads);
+
+	auto worker = [&](int thread) {
+		for(int l = 1; l < nLevels; l++) {
+			int levelSize = levelOffsets[l+1] - levelOffsets[l];
+			int begin = levelOffsets[l] + (long) levelSize * thread / nThreads;
+			int end = levelOffsets[l] + (long) levelSize * (thread + 1) / nThreads;
+
+			for(int k = begin; k < end; k++) {
+				int node = sorted[k];
+				T derivative = 0.0;
+				for(int j = childOffsets[node]; j < childOffsets[node+1]; j++) {
+					derivative += childPartials[j] * derivatives[children[j]];
+				}
+				derivatives[node] = derivative;
+			}
+
+			barrier.wait();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for(int t = 1; t < nThreads; t++) {
+		threads.push_back(std::thread(worker, t));
+	}
+	worker(0);
+
+	for(unsigned t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+}
+
+
+
+	// ts::Var
+
+template <typename T>
+ts::Var<T>::Var(T newValue, ts::WengertList<T> * newWList) {
+	value = newValue;
+
+	wList = newWList;
+
+	if(wList != NULL && wList->recording) {
+		// Add new Var to the Wengert list
+		index = wList->push(ts::Node<T>(), value);	// Node without dependencies (input var)
+	} else {
+		// Constant
+		wList = NULL;
+		index = -1;
+	}
+}
+
+
+
+template <typename T>
+ts::Var<T>::Var(T newValue, ts::WengertList<T> * newWList, const ts::Node<T> &node) {
+	value = newValue;
+
+	wList = newWList;
+
+	if(wList != NULL) {
+		// Add new Var to the Wengert list
+		index = wList->push(node, value);	// This node can contain dependencies & values
+	} else {
+		index = -1;
+	}
+}
+
+
+
+template <typename T>
+ts::WengertList<T> * ts::Var<T>::getList(const ts::Var<T> &x) {
+	return x.wList != NULL && x.wList->recording ? x.wList : NULL;
+}
+
+
+
+template <typename T>
+ts::WengertList<T> * ts::Var<T>::getList(
+	const ts::Var<T> &x, const ts::Var<T> &y, bool &valid
+) {
+	valid = x.wList == y.wList || x.wList == NULL || y.wList == NULL;
+
+	ts::WengertList<T> * res = x.wList != NULL ? x.wList : y.wList;
+	return valid && res != NULL && res->recording ? res : NULL;
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::Var<T>::fold(
+	ts::WengertList<T> * wList, ts::NodeOp op, T value,
+	const ts::Var<T> &x, T xPartial, const ts::Var<T> &y, T yPartial
+) {
+	const bool constantX = x.wList == NULL;
+
+	if(wList->tracing) {
+		int constant = wList->push(ts::Node<T>(), constantX ? x.value : y.value);
+		return ts::Var<T>(
+			value, wList,
+			ts::Node<T>(
+				op, xPartial, constantX ? constant : x.index,
+				yPartial, constantX ? y.index : constant
+			)
+		);
+	}
+
+	return ts::Var<T>(
+		value, wList,
+		constantX ?
+		ts::Node<T>(op, yPartial, y.index) :
+		ts::Node<T>(op, xPartial, x.index)
+	);
+}
+
+
+
+// Helper function to create new instances without syntax template
+template <typename T>
+ts::Var<T> ts::NewVar(T newValue, ts::WengertList<T> * newWList) {
+	return ts::Var<T>(newValue, newWList);
+}
+
+
+
+template <typename T>
+T ts::Var<T>::getValue() const {
+	return value;
+}
+
+
+
+template <typename T>
+bool ts::WengertList<T>::isReplayable(int last) {
+	if((int) ops.size() != size() || !segments.empty() || last >= size()) {
+		return false;
+	}
+
+	for(int i = 0; i <= last; i++) {
+		if(ops[i] == ts::NodeOp::Fused) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+
+template <typename T>
+void ts::WengertList<T>::tangentSweep(
+	int output, std::vector<T> &tangents,
+	std::vector<T> &derivatives, std::vector<T> &derivativeTangents
+) {
+	using ts::internal::isZero;
+	using std::sin; using std::cos; using std::log; using std::pow;
+
+	const uint32_t * dependenciesPtr = dependencies.data();
+	const uint32_t * offsetsPtr = offsets.data();
+	const T * v = values.data();
+
+	// Tangents of the nodes, from the partials recorded with them
+	for(int i = 0; i <= output; i++) {
+		if(ops[i] == ts::NodeOp::Input) {
+			continue;
+		}
+
+		T tangent = 0.0;
+		for(uint32_t j = offsetsPtr[i]; j < offsetsPtr[i+1]; j++) {
+			tangent += getPartial(j) * tangents[dependenciesPtr[j]];
+		}
+		tangents[i] = tangent;
+	}
+
+	// Adjoints and their tangents. The tangent of the adjoint of a parent
+	// gets the tangent of the partial times the adjoint, plus the partial
+	// times the tangent of the adjoint.
+	derivatives[output] = 1.0;
+
+	for(int i = output; i >= 0; i--) {
+		T derivative = derivatives[i];
+		T derivativeTangent = derivativeTangents[i];
+		if(ops[i] == ts::NodeOp::Input || (isZero(derivative) && isZero(derivativeTangent))) {
+			continue;
+		}
+
+		uint32_t begin = offsetsPtr[i];
+		uint32_t end = offsetsPtr[i+1];
+
+		T x = v[dependenciesPtr[begin]];
+		T xTangent = tangents[dependenciesPtr[begin]];
+		T y = 0.0;
+		T yTangent = 0.0;
+		if(end - begin > 1) {
+			y = v[dependenciesPtr[begin + 1]];
+			yTangent = tangents[dependenciesPtr[begin + 1]];
+		}
+
+		// Tangents of the partials with respect to x and y
+		T partialTangents[2] = {0.0, 0.0};
+
+		switch(ops[i]) {
+		case ts::NodeOp::Mul:
+			partialTangents[0] = yTangent;
+			partialTangents[1] = xTangent;
+			break;
+
+		case ts::NodeOp::Div:
+			// 1 / y and -x / y^2
+			partialTangents[0] = -yTangent / (y * y);
+			partialTangents[1] = (2.0 * x * yTangent / y - xTangent) / (y * y);
+			break;
+
+		case ts::NodeOp::Exp:
+			partialTangents[0] = tangents[i];
+			break;
+
+		case ts::NodeOp::Log:
+			partialTangents[0] = -xTangent / (x * x);
+			break;
+
+		case ts::NodeOp::Sin:
+			partialTangents[0] = -sin(x) * xTangent;
+			break;
+
+		case ts::NodeOp::Cos:
+			partialTangents[0] = -cos(x) * xTangent;
+			break;
+
+		case ts::NodeOp::Tanh:
+			// 1 - tanh(x)^2
+			partialTangents[0] = -2.0 * v[i] * tangents[i];
+			break;
+
+		case ts::NodeOp::Sqrt:
+			// 0.5 / sqrt(x)
+			partialTangents[0] = -0.5 * tangents[i] / (v[i] * v[i]);
+			break;
+
+		case ts::NodeOp::Pow:
+			// y x^(y-1) and x^y log(x) (0 for x <= 0, see evaluatePow())
+			partialTangents[0] = y * (y - 1.0) * pow(x, y - 2.0) * xTangent;
+			if(x > 0.0) {
+				partialTangents[0] += pow(x, y - 1.0) * (1.0 + y * log(x)) * yTangent;
+				partialTangents[1] = tangents[i] * log(x) + v[i] * xTangent / x;
+			}
+			break;
+
+		default:
+			// Constant partials of Add and Sub
+			break;
+		}
+
+		for(uint32_t j = begin; j < end; j++) {
+			T partial = getPartial(j);
+			uint32_t parent = dependenciesPtr[j];
+
+			derivatives[parent] += partial * derivative;
+			derivativeTangents[parent] += partialTangents[j - begin] * derivative + partial * derivativeTangent;
+		}
+	}
+}
+
+
+
+template <typename T>
+int ts::Var<T>::getIndex() const {
+	return index;
+}
+
+
+
+template <typename T>
+ts::Gradient<T> ts::Var<T>::grad() {
+	// Computes the gradient of all Wengert list's nodes with respect to this
+	// variable. Derivatives are stored in a vector wich size equals the
+	// Wengert list's.
+
+	// Constants don't depend on anything
+	if(wList == NULL) {
+		return ts::Gradient<T>(std::vector<T>());
+	}
+
+	// Nodes recorded after this one can't depend on it, so they are left out
+
+	TS_TIME_SWEEP(wList, "grad", index + 1);
+
+	std::vector<T> derivatives(index + 1, 0.0);
+	wList->backward(index, derivatives);
+
+	return ts::Gradient<T>(std::move(derivatives));
+}
+
+
+
+template <typename T>
+ts::Gradient<T> ts::Var<T>::grad(std::vector<T> &&buffer) {
+	if(wList == NULL) {
+		buffer.clear();
+		return ts::Gradient<T>(std::move(buffer));
+	}
+
+	TS_TIME_SWEEP(wList, "grad", index + 1);
+
+	// assign() keeps the capacity of the buffer
+	buffer.assign(index + 1, 0.0);
+	wList->backward(index, buffer);
+
+	return ts::Gradient<T>(std::move(buffer));
+}
+
+
+
+template <typename T>
+ts::Gradient<T> ts::Var<T>::grad(int nThreads) {
+	if(wList == NULL) {
+		return ts::Gradient<T>(std::vector<T>());
+	}
+
+	TS_TIME_SWEEP(wList, "parallelGrad", index + 1);
+
+	std::vector<T> derivatives(index + 1, 0.0);
+	wList->parallelBackward(index, derivatives, nThreads);
+
+	return ts::Gradient<T>(std::move(derivatives));
+}
+
+
+
+template <typename T>
+ts::Gradient<T> ts::Var<T>::sparseGrad() {
+	// Checkpointed segments need the dense sweep
+	if(wList == NULL || !wList->segments.empty()) {
+		return grad();
+	}
+
+	TS_TIME_SWEEP(wList, "sparseGrad", index + 1);
+
+	std::vector<int> indices;
+	std::vector<T> derivatives;
+	wList->sparseBackward(index, indices, derivatives);
+
+	return ts::Gradient<T>(std::move(indices), std::move(derivatives));
+}
+
+
+
+template <typename T>
+std::vector<ts::Var<T>> ts::Var<T>::recordGrad(const std::vector<ts::Var<T>> &wrt) {
+	std::vector<ts::Var<T>> res;
+	if(wList == NULL || !wList->isReplayable(index)) {
+		return res;
+	}
+	for(unsigned j = 0; j < wrt.size(); j++) {
+		if(wrt[j].wList != wList) {
+			return res;
+		}
+	}
+
+	TS_TIME_SWEEP(wList, "recordGrad", index + 1);
+
+	// The tape grows during the sweep, so its nodes are always accessed by
+	// index
+	ts::WengertList<T> &list = *wList;
+	auto getNode = [&](int i) {
+		ts::Var<T> node(0.0, NULL);
+		node.value = list.values[i];
+		node.wList = &list;
+		node.index = i;
+		return node;
+	};
+
+	// Adjoints are Vars, without any list until they are reached
+	std::vector<ts::Var<T>> adjoints(index + 1, ts::Var<T>(0.0, NULL));
+	auto accumulate = [&](int i, const ts::Var<T> &contribution) {
+		adjoints[i] = adjoints[i].wList == NULL ? contribution : adjoints[i] + contribution;
+	};
+
+	ts::Var<T> one(1.0, wList);
+	ts::Var<T> minusOne(-1.0, wList);
+	ts::Var<T> half(0.5, wList);
+	adjoints[index] = one;
+
+	for(int i = index; i >= 0; i--) {
+		ts::NodeOp op = list.ops[i];
+		if(adjoints[i].wList == NULL || op == ts::NodeOp::Input) {
+			continue;
+		}
+
+		const ts::Var<T> &a = adjoints[i];
+		uint32_t begin = list.offsets[i];
+		int xIndex = list.dependencies[begin];
+		int yIndex = ts::internal::isBinary(op) ? (int) list.dependencies[begin + 1] : -1;
+
+		ts::Var<T> x = getNode(xIndex);
+		ts::Var<T> y = yIndex >= 0 ? getNode(yIndex) : x;
+
+		// The partials are recorded as functions of the operands, so that
+		// they can be differentiated as well
+		switch(op) {
+		case ts::NodeOp::Add:
+			accumulate(xIndex, a);
+			accumulate(yIndex, a);
+			break;
+
+		case ts::NodeOp::Sub:
+			accumulate(xIndex, a);
+			accumulate(yIndex, minusOne * a);
+			break;
+
+		case ts::NodeOp::Mul:
+			accumulate(xIndex, a * y);
+			accumulate(yIndex, a * x);
+			break;
+
+		case ts::NodeOp::Div:
+			accumulate(xIndex, a / y);
+			accumulate(yIndex, minusOne * a * getNode(i) / y);
+			break;
+
+		case ts::NodeOp::Exp:
+			accumulate(xIndex, a * getNode(i));
+			break;
+
+		case ts::NodeOp::Log:
+			accumulate(xIndex, a / x);
+			break;
+
+		case ts::NodeOp::Sin:
+			accumulate(xIndex, a * ts::cos(x));
+			break;
+
+		case ts::NodeOp::Cos:
+			accumulate(xIndex, minusOne * a * ts::sin(x));
+			break;
+
+		case ts::NodeOp::Tanh: {
+			ts::Var<T> node = getNode(i);
+			accumulate(xIndex, a * (one - node * node));
+			break;
+		}
+
+		case ts::NodeOp::Sqrt:
+			accumulate(xIndex, half * a / getNode(i));
+			break;
+
+		case ts::NodeOp::Pow:
+			accumulate(xIndex, a * y * ts::pow(x, y - one));
+			if(x.value > 0.0) {
+				accumulate(yIndex, a * getNode(i) * ts::log(x));
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	// Derivatives of the nodes that weren't reached are constant zeros
+	for(unsigned j = 0; j < wrt.size(); j++) {
+		int i = wrt[j].index;
+		if(i <= index && adjoints[i].wList != NULL) {
+			res.push_back(adjoints[i]);
+		} else {
+			res.push_back(ts::Var<T>(0.0, wList));
+		}
+	}
+	return res;
+}
+
+
+
+template <typename T>
+std::vector<T> ts::Var<T>::hvp(
+	const std::vector<ts::Var<T>> &wrt, const std::vector<T> &v, std::vector<T> * grad
+) {
+	std::vector<T> res;
+	if(wList == NULL || v.size() != wrt.size() || !wList->isReplayable(index)) {
+		return res;
+	}
+
+	// Directions are taken along input nodes only, like the inputs of a plan
+	std::vector<T> tangents(index + 1, 0.0);
+	for(unsigned j = 0; j < wrt.size(); j++) {
+		if(wrt[j].wList != wList || wList->ops[wrt[j].index] != ts::NodeOp::Input) {
+			return res;
+		}
+		if(wrt[j].index <= index) {
+			tangents[wrt[j].index] += v[j];
+		}
+	}
+
+	TS_TIME_SWEEP(wList, "hvp", index + 1);
+
+	std::vector<T> derivatives(index + 1, 0.0);
+	std::vector<T> derivativeTangents(index + 1, 0.0);
+	wList->tangentSweep(index, tangents, derivatives, derivativeTangents);
+
+	if(grad != NULL) {
+		grad->clear();
+	}
+	for(unsigned j = 0; j < wrt.size(); j++) {
+		bool reached = wrt[j].index <= index;
+		res.push_back(reached ? derivativeTangents[wrt[j].index] : T(0.0));
+		if(grad != NULL) {
+			grad->push_back(reached ? derivatives[wrt[j].index] : T(0.0));
+		}
+	}
+	return res;
+}
+
+
+
+	// ts::NoGrad
+
+template <typename T>
+ts::NoGrad<T>::NoGrad(ts::WengertList<T> * newWList) {
+	wList = newWList;
+	wasRecording = wList->isRecording();
+	wList->setRecording(false);
+}
+
+
+
+template <typename T>
+ts::NoGrad<T>::~NoGrad() {
+	wList->setRecording(wasRecording);
+}
+
+
+
+	// ts::Gradient
+
+template <typename T>
+ts::Gradient<T>::Gradient(std::vector<T> &&newDerivatives, int newWidth) {
+	derivatives = std::move(newDerivatives);
+	width = newWidth;
+	sparse = false;
+}
+
+
+
+template <typename T>
+ts::Gradient<T>::Gradient(std::vector<int> &&newIndices, std::vector<T> &&newDerivatives) {
+	indices = std::move(newIndices);
+	derivatives = std::move(newDerivatives);
+	width = 1;
+	sparse = true;
+}
+
+
+
+template <typename T>
+T ts::Gradient<T>::getValue(const ts::Var<T> &a) const {
+	if(sparse) {
+		auto it = std::lower_bound(indices.begin(), indices.end(), a.index);
+		if(it == indices.end() || *it != a.index) {
+			return 0.0;
+		}
+		return derivatives[it - indices.begin()];
+	}
+
+	// Nodes recorded after the output are not stored (and nothing is for an
+	// empty list of outputs)
+	if(a.index < 0 || width == 0 || (unsigned) (a.index + 1) * width > derivatives.size()) {
+		return 0.0;
+	}
+	return derivatives[a.index * width];
+}
+
+
+
+template <typename T>
+int ts::Gradient<T>::getNStored() const {
+	return width > 0 ? derivatives.size() / width : 0;
+}
+
+
+
+template <typename T>
+const T * ts::Gradient<T>::getData() const {
+	return derivatives.data();
+}
+
+
+
+template <typename T>
+std::vector<T> ts::Gradient<T>::release() {
+	indices.clear();
+	return std::move(derivatives);
+}
+
+
+
+	// ts::Jacobian
+
+template <typename T>
+ts::Jacobian<T>::Jacobian(std::vector<T> &&newDerivatives, int nOutputs) :
+	ts::Gradient<T>(std::move(newDerivatives), nOutputs) {
+
+}
+
+
+
+template <typename T>
+int ts::Jacobian<T>::getNOutputs() const {
+	return this->width;
+}
+
+
+
+template <typename T>
+T ts::Jacobian<T>::getValue(int output, const ts::Var<T> &a) const {
+	if(
+		output < 0 || output >= this->width || a.index < 0 ||
+		(unsigned) (a.index + 1) * this->width > this->derivatives.size()
+	) {
+		return 0.0;
+	}
+	return this->derivatives[a.index * this->width + output];
+}
+
+
+
+	// ts::Plan
+
+template <typename T>
+ts::Plan<T>::Plan() {
+
+}
+
+
+
+template <typename T>
+int ts::Plan<T>::size() {
+	return ops.size();
+}
+
+
+
+template <typename T>
+int ts::Plan<T>::getNInputs() {
+	return inputs.size();
+}
+
+
+
+template <typename T>
+int ts::Plan<T>::getNOutputs() {
+	return outputs.size();
+}
+
+
+
+template <typename T>
+void ts::Plan<T>::forward(const T * inputValues, T * outputValues) {
+	for(unsigned j = 0; j < inputs.size(); j++) {
+		values[inputs[j]] = inputValues[j];
+	}
+
+	const int nNodes = ops.size();
+	T * v = values.data();
+	T * p = partials.data();
+	const uint32_t * dep = operands.data();
+
+	// Partial derivatives are computed along the way, exactly as the
+	// operators record them
+	for(int i = 0; i < nNodes; i++) {
+		T x = v[dep[2*i]];
+		T y = v[dep[2*i+1]];
+
+		switch(ops[i]) {
+		case ts::NodeOp::Add:
+			v[i] = x + y;
+			break;
+
+		case ts::NodeOp::Sub:
+			v[i] = x - y;
+			break;
+
+		case ts::NodeOp::Mul:
+			v[i] = x * y;
+			p[2*i] = y;
+			p[2*i+1] = x;
+			break;
+
+		case ts::NodeOp::Div:
+			v[i] = x / y;
+			p[2*i] = 1.0 / y;
+			p[2*i+1] = -x / (y * y);
+			break;
+
+		case ts::NodeOp::Pow:
+			v[i] = ts::internal::evaluatePow(x, y, p[2*i], p[2*i+1]);
+			break;
+
+		case ts::NodeOp::Input:
+			// Inputs and constants
+			break;
+
+		default:
+			// Unary functions (the partial of the unused operand stays 0)
+			v[i] = ts::internal::evaluateUnary(ops[i], x, p[2*i]);
+			break;
+		}
+	}
+
+	if(outputValues != NULL) {
+		for(unsigned k = 0; k < outputs.size(); k++) {
+			outputValues[k] = values[outputs[k]];
+		}
+	}
+}
+
+
+
+template <typename T>
+void ts::Plan<T>::grad(const T * inputValues, T * outputValues, T * gradient, int output) {
+	forward(inputValues, outputValues);
+
+	const int last = outputs[output];
+	T * adj = adjoints.data();
+	const T * p = partials.data();
+	const uint32_t * dep = operands.data();
+
+	std::fill(adjoints.begin(), adjoints.begin() + last + 1, 0.0);
+	adj[last] = 1.0;
+
+	for(int i = last; i >= 0; i--) {
+		// Nodes this output doesn't depend on are skipped (see prune() to
+		// remove them altogether)
+		if(ops[i] == ts::NodeOp::Input || ts::internal::isZero(adj[i])) {
+			continue;
+		}
+
+		// Partials of unused operands are 0
+		adj[dep[2*i]] += p[2*i] * adj[i];
+		adj[dep[2*i+1]] += p[2*i+1] * adj[i];
+	}
+
+	for(unsigned j = 0; j < inputs.size(); j++) {
+		gradient[j] = adj[inputs[j]];
+	}
+}
+
+
+
+template <typename T>
+int ts::Plan<T>::prune() {
+	const int nNodes = ops.size();
+
+	// Mark the nodes the outputs depend on, going down from the last node
+	// (operands are always recorded before the nodes using them)
+	std::vector<bool> needed(nNodes, false);
+	for(unsigned k = 0; k < outputs.size(); k++) {
+		needed[outputs[k]] = true;
+	}
+	for(unsigned j = 0; j < inputs.size(); j++) {
+		needed[inputs[j]] = true;
+	}
+
+	for(int i = nNodes - 1; i >= 0; i--) {
+		if(!needed[i] || ops[i] == ts::NodeOp::Input) {
+			continue;
+		}
+
+		needed[operands[2*i]] = true;
+		if(ts::internal::isBinary(ops[i])) {
+			needed[operands[2*i+1]] = true;
+		}
+	}
+
+	// Compact the kept nodes, in the same order
+	std::vector<uint32_t> newIndices(nNodes, 0);
+	ts::internal::Storage<ts::NodeOp> newOps;
+	ts::internal::Storage<uint32_t> newOperands;
+	ts::internal::Storage<T> newValues;
+	ts::internal::Storage<T> newPartials;
+
+	for(int i = 0; i < nNodes; i++) {
+		if(!needed[i]) {
+			continue;
+		}
+
+		newIndices[i] = newOps.size();
+		newOps.push_back(ops[i]);
+		newValues.push_back(values[i]);
+
+		// Unused operands point to the first node, with a zero partial
+		bool binary = ts::internal::isBinary(ops[i]);
+		newOperands.push_back(ops[i] == ts::NodeOp::Input ? 0 : newIndices[operands[2*i]]);
+		newOperands.push_back(binary ? newIndices[operands[2*i+1]] : 0);
+		newPartials.push_back(partials[2*i]);
+		newPartials.push_back(binary ? partials[2*i+1] : T(0.0));
+	}
+
+	for(unsigned j = 0; j < inputs.size(); j++) {
+		inputs[j] = newIndices[inputs[j]];
+	}
+	for(unsigned k = 0; k < outputs.size(); k++) {
+		outputs[k] = newIndices[outputs[k]];
+	}
+
+	ops = std::move(newOps);
+	operands = std::move(newOperands);
+	values = std::move(newValues);
+	partials = std::move(newPartials);
+	adjoints = ts::internal::Storage<T>(ops.size(), T(0.0));
+
+	return nNodes - ops.size();
+}
+
+
+
+	// Overloaded arithmetic operators
+
+template <typename T>
+ts::Var<T> ts::operator+(const ts::Var<T> &x, const ts::Var<T> &y){
+	bool valid;
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x, y, valid);
+	if(wList == NULL) {
+		// Value only (or an invalid Var if x and y are on different lists)
+		return ts::Var<T>(valid ? x.value + y.value : T(0.0), NULL);
+	}
+
+	// a = x + y
+	// da / dx = 1
+	// da / dy = 1
+	T value = x.value + y.value;
+	if(x.wList != y.wList) {
+		return ts::Var<T>::fold(wList, ts::NodeOp::Add, value, x, 1.0, y, 1.0);
+	}
+
+	return ts::Var<T>(
+		value,
+		wList,
+		ts::Node<T>(ts::NodeOp::Add, 1.0, x.index, 1.0, y.index)
+	);
+}
+
+
+
+
+template <typename T>
+ts::Var<T> ts::operator-(const ts::Var<T> &x, const ts::Var<T> &y){
+	bool valid;
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x, y, valid);
+	if(wList == NULL) {
+		// Value only (or an invalid Var if x and y are on different lists)
+		return ts::Var<T>(valid ? x.value - y.value : T(0.0), NULL);
+	}
+
+	// a = x - y
+	// da / dx = 1
+	// da / dy = -1
+	T value = x.value - y.value;
+	if(x.wList != y.wList) {
+		return ts::Var<T>::fold(wList, ts::NodeOp::Sub, value, x, 1.0, y, -1.0);
+	}
+
+	return ts::Var<T>(
+		value,
+		wList,
+		ts::Node<T>(ts::NodeOp::Sub, 1.0, x.index, -1.0, y.index)
+	);
+}
+
+
+
+
+template <typename T>
+ts::Var<T> ts::operator*(const ts::Var<T> &x, const ts::Var<T> &y){
+	bool valid;
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x, y, valid);
+	if(wList == NULL) {
+		// Value only (or an invalid Var if x and y are on different lists)
+		return ts::Var<T>(valid ? x.value * y.value : T(0.0), NULL);
+	}
+
+	// a = x * y
+	// da / dx = y
+	// da / dy = x
+	T value = x.value * y.value;
+	if(x.wList != y.wList) {
+		return ts::Var<T>::fold(wList, ts::NodeOp::Mul, value, x, y.value, y, x.value);
+	}
+
+	return ts::Var<T>(
+		value,
+		wList,
+		ts::Node<T>(ts::NodeOp::Mul, y.value, x.index, x.value, y.index)
+	);
+}
+
+
+
+
+template <typename T>
+ts::Var<T> ts::operator/(const ts::Var<T> &x, const ts::Var<T> &y){
+	bool valid;
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x, y, valid);
+	if(wList == NULL) {
+		// Value only (or an invalid Var if x and y are on different lists)
+		return ts::Var<T>(valid ? x.value / y.value : T(0.0), NULL);
+	}
+
+	// a = x / y
+	// da / dx = 1 / y
+	// da / dy = -x / y^2
+	T value = x.value / y.value;
+	if(x.wList != y.wList) {
+		return ts::Var<T>::fold(
+			wList, ts::NodeOp::Div, value,
+			x, 1.0 / y.value, y, -x.value / (y.value * y.value)
+		);
+	}
+
+	return ts::Var<T>(
+		value,
+		wList,
+		ts::Node<T>(ts::NodeOp::Div, 1.0 / y.value, x.index, -x.value / (y.value * y.value), y.index)
+	);
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::operator+(const ts::Var<T> &x, T c){
+	return x + ts::Var<T>(c, NULL);
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::operator+(T c, const ts::Var<T> &x){
+	return ts::Var<T>(c, NULL) + x;
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::operator-(const ts::Var<T> &x, T c){
+	return x - ts::Var<T>(c, NULL);
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::operator-(T c, const ts::Var<T> &x){
+	return ts::Var<T>(c, NULL) - x;
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::operator*(const ts::Var<T> &x, T c){
+	return x * ts::Var<T>(c, NULL);
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::operator*(T c, const ts::Var<T> &x){
+	return ts::Var<T>(c, NULL) * x;
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::operator/(const ts::Var<T> &x, T c){
+	return x / ts::Var<T>(c, NULL);
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::operator/(T c, const ts::Var<T> &x){
+	return ts::Var<T>(c, NULL) / x;
+}
+
+
+
+	// Elementary functions
+
+template <typename T>
+ts::Var<T> ts::exp(const ts::Var<T> &x) {
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x);
+	if(wList == NULL) {
+		return ts::Var<T>(ts::internal::evaluateUnary(ts::NodeOp::Exp, x.value), NULL);
+	}
+
+	// a = exp(x)
+	// da / dx = exp(x)
+	T partial;
+	T value = ts::internal::evaluateUnary(ts::NodeOp::Exp, x.value, partial);
+
+	return ts::Var<T>(value, wList, ts::Node<T>(ts::NodeOp::Exp, partial, x.index));
+}
+
+
+
+
+template <typename T>
+ts::Var<T> ts::log(const ts::Var<T> &x) {
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x);
+	if(wList == NULL) {
+		return ts::Var<T>(ts::internal::evaluateUnary(ts::NodeOp::Log, x.value), NULL);
+	}
+
+	// a = log(x)
+	// da / dx = 1 / x
+	T partial;
+	T value = ts::internal::evaluateUnary(ts::NodeOp::Log, x.value, partial);
+
+	return ts::Var<T>(value, wList, ts::Node<T>(ts::NodeOp::Log, partial, x.index));
+}
+
+
+
+
+template <typename T>
+ts::Var<T> ts::sin(const ts::Var<T> &x) {
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x);
+	if(wList == NULL) {
+		return ts::Var<T>(ts::internal::evaluateUnary(ts::NodeOp::Sin, x.value), NULL);
+	}
+
+	// a = sin(x)
+	// da / dx = cos(x)
+	T partial;
+	T value = ts::internal::evaluateUnary(ts::NodeOp::Sin, x.value, partial);
+
+	return ts::Var<T>(value, wList, ts::Node<T>(ts::NodeOp::Sin, partial, x.index));
+}
+
+
+
+
+template <typename T>
+ts::Var<T> ts::cos(const ts::Var<T> &x) {
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x);
+	if(wList == NULL) {
+		return ts::Var<T>(ts::internal::evaluateUnary(ts::NodeOp::Cos, x.value), NULL);
+	}
+
+	// a = cos(x)
+	// da / dx = -sin(x)
+	T partial;
+	T value = ts::internal::evaluateUnary(ts::NodeOp::Cos, x.value, partial);
+
+	return ts::Var<T>(value, wList, ts::Node<T>(ts::NodeOp::Cos, partial, x.index));
+}
+
+
+
+
+template <typename T>
+ts::Var<T> ts::tanh(const ts::Var<T> &x) {
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x);
+	if(wList == NULL) {
+		return ts::Var<T>(ts::internal::evaluateUnary(ts::NodeOp::Tanh, x.value), NULL);
+	}
+
+	// a = tanh(x)
+	// da / dx = 1 - tanh(x)^2
+	T partial;
+	T value = ts::internal::evaluateUnary(ts::NodeOp::Tanh, x.value, partial);
+
+	return ts::Var<T>(value, wList, ts::Node<T>(ts::NodeOp::Tanh, partial, x.index));
+}
+
+
+
+
+template <typename T>
+ts::Var<T> ts::sqrt(const ts::Var<T> &x) {
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x);
+	if(wList == NULL) {
+		return ts::Var<T>(ts::internal::evaluateUnary(ts::NodeOp::Sqrt, x.value), NULL);
+	}
+
+	// a = sqrt(x)
+	// da / dx = 1 / (2 sqrt(x))
+	T partial;
+	T value = ts::internal::evaluateUnary(ts::NodeOp::Sqrt, x.value, partial);
+
+	return ts::Var<T>(value, wList, ts::Node<T>(ts::NodeOp::Sqrt, partial, x.index));
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::pow(const ts::Var<T> &x, const ts::Var<T> &y) {
+	bool valid;
+	ts::WengertList<T> * wList = ts::Var<T>::getList(x, y, valid);
+	if(wList == NULL) {
+		using std::pow;
+		return ts::Var<T>(valid ? T(pow(x.value, y.value)) : T(0.0), NULL);
+	}
+
+	// a = x^y
+	// da / dx = y x^(y-1)
+	// da / dy = log(x) x^y
+	T xPartial, yPartial;
+	T value = ts::internal::evaluatePow(x.value, y.value, xPartial, yPartial);
+
+	if(x.wList != y.wList) {
+		return ts::Var<T>::fold(wList, ts::NodeOp::Pow, value, x, xPartial, y, yPartial);
+	}
+
+	return ts::Var<T>(
+		value,
+		wList,
+		ts::Node<T>(ts::NodeOp::Pow, xPartial, x.index, yPartial, y.index)
+	);
+}
+
+
+
+template <typename T>
+ts::Var<T> ts::pow(const ts::Var<T> &x, T p) {
+	return ts::pow(x, ts::Var<T>(p, NULL));
+}
+
+
+
+#undef TS_TIME_SWEEP
@@ -0,0 +1,290 @@
+/*
+* Input pipeline for training on large datasets. A ts::data::Dataset holds
+* samples (features and targets) in memory or in a memory-mapped binary
+* file. A ts::data::Loader shuffles them and assembles mini-batches in
+* background threads, ahead of the training loop. Batches are handed out
+* through a bounded lock-free queue, as views over a pool of reusable
+* tensors, so that loading the next batches overlaps with the forward and
+* backward passes on the current one.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensor.hpp"
+
+
+namespace ts {
+	namespace data {
+		template <typename T> class Dataset;
+		template <typename T> class Batch;
+		template <typename T> class Loader;
+	}
+
+	namespace internal {
+		template <typename U> class BoundedQueue;
+
+		// Waits for a condition by yielding first, then sleeping (so that
+		// idle threads don't take the CPU away from the training loop)
+		class Backoff {
+		private:
+			int nTries = 0;
+
+		public:
+			void wait() {
+				if(nTries < 64) {
+					nTries++;
+					std::this_thread::yield();
+				} else {
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			}
+		};
+	}
+}
+
+
+
+// Multiple producers, multiple consumers queue of a fixed capacity (a power
+// of two), in which each cell is handed over through its sequence number
+// (D. Vyukov's algorithm). push() and pop() never block : they fail when the
+// queue is full or empty.
+template <typename U>
+class ts::internal::BoundedQueue {
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		U value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	// Producers and consumers are kept on separate cache lines
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) std::atomic<size_t> head;
+
+public:
+	// Capacity is rounded up to a power of two
+	BoundedQueue(size_t minCapacity) : tail(0), head(0) {
+		size_t capacity = 1;
+		while(capacity < minCapacity) {
+			capacity *= 2;
+		}
+
+		cells.reset(new Cell[capacity]);
+		mask = capacity - 1;
+		for(size_t i = 0; i < capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool push(const U &value) {
+		size_t position = tail.load(std::memory_order_relaxed);
+
+		while(true) {
+			Cell &cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+			if(difference == 0) {
+				// The cell is free : claim it
+				if(tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					cell.value = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			} else if(difference < 0) {
+				return false;	// Full
+			} else {
+				position = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool pop(U &value) {
+		size_t position = head.load(std::memory_order_relaxed);
+
+		while(true) {
+			Cell &cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+
+			if(difference == 0) {
+				// The cell is filled : claim it
+				if(head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					value = cell.value;
+					cell.sequence.store(position + mask + 1, std::memory_order_release);
+					return true;
+				}
+			} else if(difference < 0) {
+				return false;	// Empty
+			} else {
+				position = head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+};
+
+
+
+template <typename T>
+class ts::data::Dataset {
+private:
+	// Samples are stored as records of nFeatures features followed by
+	// nTargets targets, in memory or in a mapped file
+	std::vector<T> records{};
+	const T * data = NULL;
+	int nSamples = 0;
+	int nFeatures = 0;
+	int nTargets = 0;
+
+	void * mapping = NULL;
+	size_t mappingBytes = 0;
+
+	void close();
+
+public:
+	// Empty dataset (see open())
+	Dataset();
+
+	// Samples in memory, from row-major features (nSamples x nFeatures) and
+	// targets (nSamples x nTargets). The dataset is empty if sizes don't
+	// match.
+	Dataset(const std::vector<T> &features, const std::vector<T> &targets, int newNFeatures, int newNTargets);
+
+	// Datasets may map files, so they are not copied
+	Dataset(const ts::data::Dataset<T> &other) = delete;
+	ts::data::Dataset<T> & operator=(const ts::data::Dataset<T> &other) = delete;
+
+	~Dataset();
+
+	// Opens a binary file of records (in the format written by write()),
+	// replacing the current samples. The file is memory mapped when map is
+	// true (and mmap is available), so that only the samples being loaded
+	// are read from disk, and read in memory otherwise. Returns false (and
+	// leaves the dataset empty) if the file can't be read or its size isn't
+	// a whole number of records.
+	bool open(const std::string &path, int newNFeatures, int newNTargets, bool map = true);
+
+	// Writes the samples as raw records of T (native endianness)
+	bool write(const std::string &path) const;
+
+	int size() const;
+	int getNFeatures() const;
+	int getNTargets() const;
+	bool isMapped() const;
+
+	// Features and targets of sample i
+	const T * getFeatures(int i) const;
+	const T * getTargets(int i) const;
+};
+
+
+
+// View of a mini-batch, valid until the next call to Loader::next()
+template <typename T>
+class ts::data::Batch {
+private:
+	std::shared_ptr<ts::Tensor<T>> features{};
+	std::shared_ptr<ts::Tensor<T>> targets{};
+	int index = -1;
+
+public:
+	// batchSize x nFeatures and batchSize x nTargets tensors. Recording them
+	// with ts::NewTensorVar() copies their values.
+	const ts::Tensor<T> & getFeatures() const { return *features; }
+	const ts::Tensor<T> & getTargets() const { return *targets; }
+
+	// The same tensors, borrowing the buffers of the loader instead of
+	// copying them, so that ts::NewTensorVar(batch.borrowFeatures(), &list)
+	// records the batch without copying it. The buffers are overwritten
+	// once they are handed back to the loader by next(), so the list must be
+	// reset before that (copies of a borrowed tensor have their own values).
+	ts::Tensor<T> borrowFeatures() const;
+	ts::Tensor<T> borrowTargets() const;
+
+	// Position of the batch in its epoch
+	int getIndex() const { return index; }
+
+	friend ts::data::Loader<T>;
+};
+
+
+
+template <typename T>
+class ts::data::Loader {
+private:
+	const ts::data::Dataset<T> &dataset;
+	int batchSize;
+	int nBatches;
+	bool shuffle;
+
+	// Reusable batch tensors (shared with the tensors borrowing them, see
+	// Batch::borrowFeatures())
+	std::vector<std::shared_ptr<ts::Tensor<T>>> features;
+	std::vector<std::shared_ptr<ts::Tensor<T>>> targets;
+	std::vector<int> batchIndices;
+
+	// Buffers go from free to ready (filled by a worker), and back to free
+	// once the training loop is done with them
+	ts::internal::BoundedQueue<int> freeBuffers;
+	ts::internal::BoundedQueue<int> readyBuffers;
+	int current = -1;
+
+	// Order of the samples for the current epoch
+	std::vector<int> order;
+	std::mt19937 generator;
+
+	// Next batch to load, as (epoch << 32) | batch. Workers claim batches
+	// until the end of the epoch, and the next one is only started once the
+	// training loop has received all of them.
+	std::atomic<uint64_t> ticket;
+	int epoch = 0;
+	int nDelivered = 0;
+
+	std::atomic<bool> stopping;
+	std::vector<std::thread> workers{};
+
+	void startEpoch();
+	void work();
+
+public:
+	// Batches of batchSize samples (the last incomplete batch of each epoch
+	// is dropped), shuffled again at each epoch if shuffle is true. Batches
+	// are loaded by nWorkers threads, in up to nBuffers buffers. With
+	// several workers, the batches of an epoch may be delivered out of
+	// order. The dataset must outlive the loader.
+	Loader(
+		const ts::data::Dataset<T> &newDataset, int newBatchSize, bool newShuffle = true,
+		int nWorkers = 1, int nBuffers = 4, unsigned seed = 0
+	);
+
+	Loader(const ts::data::Loader<T> &other) = delete;
+	ts::data::Loader<T> & operator=(const ts::data::Loader<T> &other) = delete;
+
+	~Loader();
+
+	int getBatchSize() const;
+
+	// Batches per epoch
+	int getNBatches() const;
+
+	// Current epoch (starting from 0)
+	int getEpoch() const;
+
+	// Gives the previous batch's buffers back, and waits for the next batch.
+	// Returns false at the end of each epoch, in which case the following
+	// call returns the first batch of the next epoch (which is already being
+	// loaded).
+	bool next(ts::data::Batch<T> &batch);
+};
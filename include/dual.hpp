@@ -0,0 +1,181 @@
+/*
+* Forward mode automatic differentiation based on dual numbers. A ts::Dual
+* carries a value and its tangent (its derivative along a chosen direction),
+* which is propagated by every operation. No tape is needed and everything is
+* defined inline in this header, so the compiler can optimize the whole
+* computation as if it was written on plain numbers.
+*
+* A WengertList can also record Dual numbers (mixed forward-over-reverse
+* mode), which gives Hessian-vector products with a single reverse sweep.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "autodiff.hpp"
+
+
+namespace ts {
+	template <typename T> class Dual;
+
+
+	// Hessian-vector product of f at x, computed in forward-over-reverse mode.
+	// f must take a std::vector<ts::Var<ts::Dual<T>>> (of the same size as x)
+	// and return a ts::Var<ts::Dual<T>>. The gradient of f at x can be
+	// obtained for free through the grad argument.
+	template <typename T, typename F>
+	std::vector<T> hvp(
+		F f, const std::vector<T> &x, const std::vector<T> &v,
+		std::vector<T> * grad = NULL
+	);
+}
+
+
+
+template <typename T>
+class ts::Dual {
+private:
+	T value;
+	T tangent;
+
+public:
+	// Constructor is implicit so that constants get a zero tangent
+	Dual(T newValue = 0.0, T newTangent = 0.0) : value(newValue), tangent(newTangent) {}
+
+	T getValue() const { return value; }
+	T getTangent() const { return tangent; }
+
+
+	// Operators are defined as friends so that implicit conversions from T
+	// apply to both operands
+
+	friend ts::Dual<T> operator+(const ts::Dual<T> &x, const ts::Dual<T> &y) {
+		return ts::Dual<T>(x.value + y.value, x.tangent + y.tangent);
+	}
+
+	friend ts::Dual<T> operator-(const ts::Dual<T> &x, const ts::Dual<T> &y) {
+		return ts::Dual<T>(x.value - y.value, x.tangent - y.tangent);
+	}
+
+	friend ts::Dual<T> operator*(const ts::Dual<T> &x, const ts::Dual<T> &y) {
+		// (xy)' = x'y + xy'
+		return ts::Dual<T>(x.value * y.value, x.tangent * y.value + x.value * y.tangent);
+	}
+
+	friend ts::Dual<T> operator/(const ts::Dual<T> &x, const ts::Dual<T> &y) {
+		// (x/y)' = (x'y - xy') / y^2 = (x' - (x/y) y') / y
+		T res = x.value / y.value;
+		return ts::Dual<T>(res, (x.tangent - res * y.tangent) / y.value);
+	}
+
+	friend ts::Dual<T> operator-(const ts::Dual<T> &x) {
+		return ts::Dual<T>(-x.value, -x.tangent);
+	}
+
+
+	ts::Dual<T> & operator+=(const ts::Dual<T> &y) { return *this = *this + y; }
+	ts::Dual<T> & operator-=(const ts::Dual<T> &y) { return *this = *this - y; }
+	ts::Dual<T> & operator*=(const ts::Dual<T> &y) { return *this = *this * y; }
+	ts::Dual<T> & operator/=(const ts::Dual<T> &y) { return *this = *this / y; }
+
+
+	// Only values are compared
+	friend bool operator==(const ts::Dual<T> &x, const ts::Dual<T> &y) {
+		return x.value == y.value;
+	}
+
+	friend bool operator!=(const ts::Dual<T> &x, const ts::Dual<T> &y) {
+		return x.value != y.value;
+	}
+
+	friend bool operator<(const ts::Dual<T> &x, const ts::Dual<T> &y) { return x.value < y.value; }
+	friend bool operator>(const ts::Dual<T> &x, const ts::Dual<T> &y) { return x.value > y.value; }
+	friend bool operator<=(const ts::Dual<T> &x, const ts::Dual<T> &y) { return x.value <= y.value; }
+	friend bool operator>=(const ts::Dual<T> &x, const ts::Dual<T> &y) { return x.value >= y.value; }
+
+
+	// Elementary functions, found by argument-dependent lookup (so that the
+	// autodiff engine can record them on Dual numbers as well)
+
+	friend ts::Dual<T> exp(const ts::Dual<T> &x) {
+		T res = std::exp(x.value);
+		return ts::Dual<T>(res, res * x.tangent);
+	}
+
+	friend ts::Dual<T> log(const ts::Dual<T> &x) {
+		return ts::Dual<T>(std::log(x.value), x.tangent / x.value);
+	}
+
+	friend ts::Dual<T> sin(const ts::Dual<T> &x) {
+		return ts::Dual<T>(std::sin(x.value), std::cos(x.value) * x.tangent);
+	}
+
+	friend ts::Dual<T> cos(const ts::Dual<T> &x) {
+		return ts::Dual<T>(std::cos(x.value), -std::sin(x.value) * x.tangent);
+	}
+
+	friend ts::Dual<T> tanh(const ts::Dual<T> &x) {
+		T res = std::tanh(x.value);
+		return ts::Dual<T>(res, (1.0 - res * res) * x.tangent);
+	}
+
+	friend ts::Dual<T> sqrt(const ts::Dual<T> &x) {
+		T res = std::sqrt(x.value);
+		return ts::Dual<T>(res, 0.5 * x.tangent / res);
+	}
+
+	friend ts::Dual<T> pow(const ts::Dual<T> &x, const ts::Dual<T> &y) {
+		// (x^y)' = y x^(y-1) x' + log(x) x^y y'
+		T res = std::pow(x.value, y.value);
+		T tangent = y.value * std::pow(x.value, y.value - 1.0) * x.tangent;
+		if(y.tangent != 0.0) {
+			tangent += std::log(x.value) * res * y.tangent;
+		}
+		return ts::Dual<T>(res, tangent);
+	}
+
+	// Used by the reverse sweep to skip zero adjoints, whose tangent must be
+	// zero as well
+	friend bool isZero(const ts::Dual<T> &x) {
+		return x.value == 0.0 && x.tangent == 0.0;
+	}
+};
+
+
+
+template <typename T, typename F>
+std::vector<T> ts::hvp(
+	F f, const std::vector<T> &x, const std::vector<T> &v,
+	std::vector<T> * grad
+) {
+	// Seeding the inputs with the tangent v makes every partial derivative
+	// on the tape carry its directional derivative along v. The reverse sweep
+	// then propagates those as well, so the tangent of the gradient is the
+	// derivative of the gradient along v, that is H * v.
+
+	ts::WengertList<ts::Dual<T>> wList;
+
+	std::vector<ts::Var<ts::Dual<T>>> inputs;
+	for(unsigned i = 0; i < x.size(); i++) {
+		inputs.push_back(ts::NewVar(ts::Dual<T>(x[i], v[i]), &wList));
+	}
+
+	ts::Var<ts::Dual<T>> output = f(inputs);
+	ts::Gradient<ts::Dual<T>> gradient = output.grad();
+
+	std::vector<T> res(x.size());
+	for(unsigned i = 0; i < x.size(); i++) {
+		res[i] = gradient.getValue(inputs[i]).getTangent();
+	}
+
+	if(grad != NULL) {
+		grad->resize(x.size());
+		for(unsigned i = 0; i < x.size(); i++) {
+			(*grad)[i] = gradient.getValue(inputs[i]).getValue();
+		}
+	}
+
+	return res;
+}
@@ -0,0 +1,261 @@
+/*
+* Expression templates for the scalar autodiff engine. Operations on
+* expressions don't record anything : they build a compile-time tree whose
+* value is computed along the way. When the expression is assigned to a Var,
+* the partial derivatives of the whole expression with respect to each of its
+* leaves are computed at once, and a single node is recorded on the Wengert
+* list. This makes the tape (and the reverse sweep) several times shorter on
+* arithmetic heavy code.
+*
+* Example :
+*
+*	ts::Var<float> res = ts::lazy(a) * b + ts::lazy(c) / d - e;
+*
+* or, without having to mark the leaves :
+*
+*	auto res = ts::fuse([](auto a, auto b, auto c, auto d, auto e) {
+*		return a * b + c / d - e;
+*	}, a, b, c, d, e);
+*/
+
+#pragma once
+
+#include "autodiff.hpp"
+
+
+namespace ts {
+	template <typename T, class E> class Expr;
+	template <typename T> class LeafExpr;
+	template <typename T, class Op, class L, class R> class BinaryExpr;
+
+
+	// Turns a Var into the leaf of an expression
+	template <typename T>
+	ts::LeafExpr<T> lazy(const ts::Var<T> &x);
+
+	// Calls f with every Var turned into a leaf, and records the resulting
+	// expression as a single node
+	template <typename F, typename T, typename... Vars>
+	ts::Var<T> fuse(F f, const ts::Var<T> &x, const Vars &... others);
+
+
+	namespace internal {
+		// Value and partial derivatives of each binary operator
+
+		struct AddOp {
+			template <typename T> static T value(T x, T y) { return x + y; }
+			template <typename T> static T leftPartial(T, T) { return 1.0; }
+			template <typename T> static T rightPartial(T, T) { return 1.0; }
+		};
+
+		struct SubOp {
+			template <typename T> static T value(T x, T y) { return x - y; }
+			template <typename T> static T leftPartial(T, T) { return 1.0; }
+			template <typename T> static T rightPartial(T, T) { return -1.0; }
+		};
+
+		struct MulOp {
+			template <typename T> static T value(T x, T y) { return x * y; }
+			template <typename T> static T leftPartial(T, T y) { return y; }
+			template <typename T> static T rightPartial(T x, T) { return x; }
+		};
+
+		struct DivOp {
+			template <typename T> static T value(T x, T y) { return x / y; }
+			template <typename T> static T leftPartial(T, T y) { return 1.0 / y; }
+			template <typename T> static T rightPartial(T x, T y) { return -x / (y * y); }
+		};
+	}
+}
+
+
+
+// Base class of all expressions (E being the actual expression type)
+template <typename T, class E>
+class ts::Expr {
+public:
+	const E & self() const {
+		return static_cast<const E &>(*this);
+	}
+};
+
+
+
+template <typename T>
+class ts::LeafExpr : public ts::Expr<T, ts::LeafExpr<T>> {
+private:
+	T value;
+	ts::WengertList<T> * wList;
+	int index;
+
+public:
+	// Number of leaves in the expression
+	static const int size = 1;
+
+	LeafExpr(const ts::Var<T> &x) : value(x.value), wList(x.wList), index(x.index) {}
+
+	T getValue() const {
+		return value;
+	}
+
+	ts::WengertList<T> * getWList() const {
+		return wList;
+	}
+
+	bool isValid() const {
+		return true;
+	}
+
+	// Writes the derivative of the whole expression with respect to each leaf
+	// (adjoint being the derivative with respect to this sub-expression)
+	template <int offset>
+	void propagate(T adjoint, T * partials, int * dependencies) const {
+		partials[offset] = adjoint;
+		dependencies[offset] = index;
+	}
+};
+
+
+
+template <typename T, class Op, class L, class R>
+class ts::BinaryExpr : public ts::Expr<T, ts::BinaryExpr<T, Op, L, R>> {
+private:
+	// Operands are stored by value, so expressions can safely outlive the
+	// temporaries they were built from
+	L left;
+	R right;
+	T value;
+
+public:
+	static const int size = L::size + R::size;
+
+	BinaryExpr(const L &newLeft, const R &newRight) :
+		left(newLeft), right(newRight),
+		value(Op::value(newLeft.getValue(), newRight.getValue())) {}
+
+	T getValue() const {
+		return value;
+	}
+
+	// List of the leaves, constant leaves (without list) being ignored. NULL
+	// if all leaves are constants.
+	ts::WengertList<T> * getWList() const {
+		return left.getWList() != NULL ? left.getWList() : right.getWList();
+	}
+
+	// False if the leaves don't all belong to the same list
+	bool isValid() const {
+		ts::WengertList<T> * leftList = left.getWList();
+		ts::WengertList<T> * rightList = right.getWList();
+
+		return
+			left.isValid() && right.isValid() &&
+			(leftList == rightList || leftList == NULL || rightList == NULL);
+	}
+
+	template <int offset>
+	void propagate(T adjoint, T * partials, int * dependencies) const {
+		T x = left.getValue();
+		T y = right.getValue();
+
+		left.template propagate<offset>(
+			adjoint * Op::leftPartial(x, y), partials, dependencies
+		);
+		right.template propagate<offset + L::size>(
+			adjoint * Op::rightPartial(x, y), partials, dependencies
+		);
+	}
+};
+
+
+
+	// ts::Var
+
+template <typename T>
+template <class E>
+ts::Var<T>::Var(const ts::Expr<T, E> &expr) {
+	const E &e = expr.self();
+
+	value = e.getValue();
+	wList = e.getWList();
+
+	if(!e.isValid()) {
+		// Same behaviour as the regular operators with different lists
+		value = 0.0;
+		wList = NULL;
+		index = -1;
+	} else if(wList != NULL && wList->isRecording()) {
+		T partials[E::size];
+		int dependencies[E::size];
+		e.template propagate<0>(1.0, partials, dependencies);
+
+		// Constant leaves are folded
+		int arity = 0;
+		for(int j = 0; j < E::size; j++) {
+			if(dependencies[j] >= 0) {
+				partials[arity] = partials[j];
+				dependencies[arity] = dependencies[j];
+				arity++;
+			}
+		}
+
+		index = wList->push(ts::NodeOp::Fused, arity, partials, dependencies, value);
+	} else {
+		// Value only
+		wList = NULL;
+		index = -1;
+	}
+}
+
+
+
+	// Helper functions
+
+template <typename T>
+ts::LeafExpr<T> ts::lazy(const ts::Var<T> &x) {
+	return ts::LeafExpr<T>(x);
+}
+
+
+
+template <typename F, typename T, typename... Vars>
+ts::Var<T> ts::fuse(F f, const ts::Var<T> &x, const Vars &... others) {
+	return ts::Var<T>(f(ts::lazy(x), ts::lazy(others)...));
+}
+
+
+
+	// Overloaded arithmetic operators
+	// Each operator combines two expressions, or an expression and a Var (which
+	// becomes a leaf). Operations between two Vars are not affected.
+
+#define TS_EXPR_OPERATOR(OPERATOR, OP)	\
+	namespace ts {	\
+		template <typename T, class L, class R>	\
+		ts::BinaryExpr<T, OP, L, R> operator OPERATOR(	\
+			const ts::Expr<T, L> &x, const ts::Expr<T, R> &y	\
+		) {	\
+			return ts::BinaryExpr<T, OP, L, R>(x.self(), y.self());	\
+		}	\
+	\
+		template <typename T, class L>	\
+		ts::BinaryExpr<T, OP, L, ts::LeafExpr<T>> operator OPERATOR(	\
+			const ts::Expr<T, L> &x, const ts::Var<T> &y	\
+		) {	\
+			return ts::BinaryExpr<T, OP, L, ts::LeafExpr<T>>(x.self(), ts::LeafExpr<T>(y));	\
+		}	\
+	\
+		template <typename T, class R>	\
+		ts::BinaryExpr<T, OP, ts::LeafExpr<T>, R> operator OPERATOR(	\
+			const ts::Var<T> &x, const ts::Expr<T, R> &y	\
+		) {	\
+			return ts::BinaryExpr<T, OP, ts::LeafExpr<T>, R>(ts::LeafExpr<T>(x), y.self());	\
+		}	\
+	}
+
+TS_EXPR_OPERATOR(+, ts::internal::AddOp)
+TS_EXPR_OPERATOR(-, ts::internal::SubOp)
+TS_EXPR_OPERATOR(*, ts::internal::MulOp)
+TS_EXPR_OPERATOR(/, ts::internal::DivOp)
+
+#undef TS_EXPR_OPERATOR
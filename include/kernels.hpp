@@ -0,0 +1,286 @@
+/*
+* Vectorized kernels working on contiguous buffers, used by the tensor engine.
+* Each kernel has SSE2, AVX2 and AVX-512 implementations on x86-64 (NEON on
+* ARM64) as well as a scalar fallback. The best instruction set supported by
+* the CPU is selected at runtime, so the library doesn't need to be built
+* with any -march flag.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+
+namespace ts {
+	namespace kernels {
+		enum class Isa {
+			Scalar,
+			Sse2,
+			Avx2,
+			Avx512,
+			Neon
+		};
+
+		// Instruction set currently used by the kernels
+		ts::kernels::Isa getIsa();
+
+		// Returns false (and keeps the current one) if the instruction set is
+		// not supported by this CPU or build. This is meant for testing and
+		// benchmarking only, and is not thread safe.
+		bool setIsa(ts::kernels::Isa isa);
+
+		bool isSupported(ts::kernels::Isa isa);
+
+		// When enabled, exp() and tanh() use vectorized polynomial
+		// approximations instead of the standard library functions. The
+		// relative error of exp() is then below 1e-6 for float (1e-14 for
+		// double), and tanh() has the same absolute error. exp() saturates
+		// instead of overflowing to infinity or underflowing to subnormals.
+		// Disabled by default, and not thread safe either.
+		void setFastMath(bool fastMath);
+		bool getFastMath();
+
+
+			// Forward kernels
+
+		// res = x + y
+		void add(int n, const float * x, const float * y, float * res);
+		void add(int n, const double * x, const double * y, double * res);
+
+		// res = x - y
+		void sub(int n, const float * x, const float * y, float * res);
+		void sub(int n, const double * x, const double * y, double * res);
+
+		// res = x * y
+		void mul(int n, const float * x, const float * y, float * res);
+		void mul(int n, const double * x, const double * y, double * res);
+
+		// res = x / y
+		void div(int n, const float * x, const float * y, float * res);
+		void div(int n, const double * x, const double * y, double * res);
+
+		// Returns sum(x)
+		float sum(int n, const float * x);
+		double sum(int n, const double * x);
+
+		// Returns sum(x * y)
+		float dot(int n, const float * x, const float * y);
+		double dot(int n, const double * x, const double * y);
+
+		// res = exp(x)
+		void exp(int n, const float * x, float * res);
+		void exp(int n, const double * x, double * res);
+
+		// res = log(x)
+		void log(int n, const float * x, float * res);
+		void log(int n, const double * x, double * res);
+
+		// res = tanh(x)
+		void tanh(int n, const float * x, float * res);
+		void tanh(int n, const double * x, double * res);
+
+		// res = max(x, 0)
+		void relu(int n, const float * x, float * res);
+		void relu(int n, const double * x, double * res);
+
+		// res = 1 / (1 + exp(-x)) (also approximated under fast math)
+		void sigmoid(int n, const float * x, float * res);
+		void sigmoid(int n, const double * x, double * res);
+
+
+			// Adjoint kernels (they all increment their outputs)
+
+		// y += a
+		void shift(int n, float a, float * y);
+		void shift(int n, double a, double * y);
+
+		// y += a * x
+		void axpy(int n, float a, const float * x, float * y);
+		void axpy(int n, double a, const double * x, double * y);
+
+		// dx += g * y
+		void mulAdjoint(int n, const float * g, const float * y, float * dx);
+		void mulAdjoint(int n, const double * g, const double * y, double * dx);
+
+		// dx += g / y
+		// dy -= g * x / y^2
+		void divAdjoint(
+			int n, const float * g, const float * x, const float * y,
+			float * dx, float * dy
+		);
+		void divAdjoint(
+			int n, const double * g, const double * x, const double * y,
+			double * dx, double * dy
+		);
+
+
+		// dx += g / x (log)
+		void logAdjoint(int n, const float * g, const float * x, float * dx);
+		void logAdjoint(int n, const double * g, const double * x, double * dx);
+
+		// dx += g * (1 - y^2) (tanh, y being its output)
+		void tanhAdjoint(int n, const float * g, const float * y, float * dx);
+		void tanhAdjoint(int n, const double * g, const double * y, double * dx);
+
+		// dx += g where x > 0 (relu)
+		void reluAdjoint(int n, const float * g, const float * x, float * dx);
+		void reluAdjoint(int n, const double * g, const double * x, double * dx);
+
+		// dx += g * y * (1 - y) (sigmoid, y being its output)
+		void sigmoidAdjoint(int n, const float * g, const float * y, float * dx);
+		void sigmoidAdjoint(int n, const double * g, const double * y, double * dx);
+
+		// The adjoint of exp is mulAdjoint(n, g, y, dx), y being its output
+
+
+			// Optimizer updates (see optim.hpp)
+
+		// velocity = momentum * velocity + g
+		// x -= learningRate * velocity
+		void momentumUpdate(
+			int n, float learningRate, float momentum,
+			const float * g, float * velocity, float * x
+		);
+		void momentumUpdate(
+			int n, double learningRate, double momentum,
+			const double * g, double * velocity, double * x
+		);
+
+		// m = beta1 * m + (1 - beta1) * g
+		// v = beta2 * v + (1 - beta2) * g^2
+		// x -= learningRate * m / (sqrt(v) + epsilon)
+		// Bias corrections are left to the caller (they are folded in
+		// learningRate and epsilon).
+		void adamUpdate(
+			int n, float learningRate, float beta1, float beta2, float epsilon,
+			const float * g, float * m, float * v, float * x
+		);
+		void adamUpdate(
+			int n, double learningRate, double beta1, double beta2, double epsilon,
+			const double * g, double * m, double * v, double * x
+		);
+
+
+			// Matrix product
+
+		// C += op(A) * op(B), where op(A) is m x k, op(B) is k x n, and op(X)
+		// is either X or its transpose. All matrices are contiguous and
+		// row-major. This is used for both the forward and backward passes of
+		// ts::matmul.
+		void gemm(
+			bool transA, bool transB, int m, int n, int k,
+			const float * a, const float * b, float * c
+		);
+		void gemm(
+			bool transA, bool transB, int m, int n, int k,
+			const double * a, const double * b, double * c
+		);
+
+
+			// Reduced precision storage
+
+		// Conversions between float and 16 bits formats (bfloat16 and IEEE
+		// half precision), rounding to nearest even. bfloat16 uses AVX-512 BF16
+		// and half precision uses F16C when available. Subnormal floats are
+		// flushed to (signed) zero when converted to bfloat16, as AVX-512 BF16
+		// does. Results are the same with every instruction set.
+		void toBFloat16(int n, const float * x, uint16_t * res);
+		void fromBFloat16(int n, const uint16_t * x, float * res);
+		void toHalf(int n, const float * x, uint16_t * res);
+		void fromHalf(int n, const uint16_t * x, float * res);
+
+		// Scalar versions, defined inline so that they can be used in
+		// header-only mode
+		inline uint16_t toBFloat16(float x);
+		inline float fromBFloat16(uint16_t x);
+		inline uint16_t toHalf(float x);
+		inline float fromHalf(uint16_t x);
+	}
+}
+
+
+
+inline uint16_t ts::kernels::toBFloat16(float x) {
+	uint32_t bits;
+	std::memcpy(&bits, &x, sizeof(bits));
+
+	// NaNs are kept quiet, subnormals are flushed
+	if((bits & 0x7FFFFFFF) > 0x7F800000) {
+		return (bits >> 16) | 0x40;
+	}
+	if((bits & 0x7F800000) == 0) {
+		return (bits >> 16) & 0x8000;
+	}
+
+	bits += 0x7FFF + ((bits >> 16) & 1);
+	return bits >> 16;
+}
+
+
+
+inline float ts::kernels::fromBFloat16(uint16_t x) {
+	uint32_t bits = (uint32_t) x << 16;
+	float res;
+	std::memcpy(&res, &bits, sizeof(res));
+	return res;
+}
+
+
+
+inline uint16_t ts::kernels::toHalf(float x) {
+	uint32_t bits;
+	std::memcpy(&bits, &x, sizeof(bits));
+
+	uint16_t sign = (bits >> 16) & 0x8000;
+	bits &= 0x7FFFFFFF;
+
+	// NaN (kept quiet) and infinity
+	if(bits >= 0x7F800000) {
+		return sign | 0x7C00 | (bits > 0x7F800000 ? 0x200 | ((bits >> 13) & 0x3FF) : 0);
+	}
+
+	// Overflows to infinity (including values rounded up past 65504)
+	if(bits >= 0x477FF000) {
+		return sign | 0x7C00;
+	}
+
+	// Subnormal results : adding 0.5 aligns the mantissa so that the
+	// hardware does the rounding
+	if(bits < 0x38800000) {
+		float a;
+		std::memcpy(&a, &bits, sizeof(a));
+		a += 0.5f;
+		std::memcpy(&bits, &a, sizeof(bits));
+		return sign | (bits - 0x3F000000);
+	}
+
+	// Normal results : rebias the exponent and round the mantissa
+	bits += 0xC8000FFF + ((bits >> 13) & 1);
+	return sign | (bits >> 13);
+}
+
+
+
+inline float ts::kernels::fromHalf(uint16_t x) {
+	uint32_t bits = (uint32_t) (x & 0x7FFF) << 13;
+	uint32_t exponent = bits & 0x0F800000;
+	bits += 0x38000000;
+
+	if(exponent == 0x0F800000) {
+		// Infinity and NaN
+		bits += 0x38000000;
+	} else if(exponent == 0) {
+		// Subnormals are renormalized by the hardware
+		bits += 0x00800000;
+		float a;
+		std::memcpy(&a, &bits, sizeof(a));
+		a -= 6.103515625e-05f;	// 2^-14
+		std::memcpy(&bits, &a, sizeof(bits));
+	}
+
+	bits |= (uint32_t) (x & 0x8000) << 16;
+	float res;
+	std::memcpy(&res, &bits, sizeof(res));
+	return res;
+}
@@ -0,0 +1,81 @@
+/*
+* Neural network layers and losses, built on the tensor engine. Each layer,
+* activation and loss is recorded as a single fused node on the TensorList,
+* working on whole batches stored in contiguous row-major buffers (one
+* sample per row), so that a network costs a handful of nodes per step
+* whatever its size.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "tensor.hpp"
+
+
+namespace ts {
+	namespace nn {
+		template <typename T> class Dense;
+
+
+		// Affine layer x * w + b, where x is a batch x nInputs tensor, w is
+		// nInputs x nOutputs and b has a {nOutputs} shape (added to each row).
+		// The result is batch x nOutputs.
+		template <typename T>
+		ts::TensorVar<T> dense(const ts::TensorVar<T> &x, const ts::TensorVar<T> &w, const ts::TensorVar<T> &b);
+
+		// Elementwise activations (see ts::tanh() as well). sigmoid() is
+		// approximated when ts::kernels::setFastMath() is enabled.
+		template <typename T>
+		ts::TensorVar<T> relu(const ts::TensorVar<T> &x);
+		template <typename T>
+		ts::TensorVar<T> sigmoid(const ts::TensorVar<T> &x);
+
+
+		// Losses (the result has a {1} shape)
+
+		// Cross entropy between softmax(x) and targets, averaged over the
+		// rows of the batch x nClasses tensor x. Each row of targets holds
+		// the probabilities of the classes (e.g. one-hot labels). Targets
+		// are treated as constants : no gradient flows to them.
+		template <typename T>
+		ts::TensorVar<T> softmaxCrossEntropy(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets);
+
+		// Mean squared error between two tensors of the same shape
+		template <typename T>
+		ts::TensorVar<T> mse(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets);
+	}
+}
+
+
+
+template <typename T>
+class ts::nn::Dense {
+private:
+	ts::Tensor<T> weights;	// nInputs x nOutputs
+	ts::Tensor<T> bias;	// {nOutputs}
+
+	// Parameters as recorded by the last forward pass
+	ts::TensorVar<T> weightsVar;
+	ts::TensorVar<T> biasVar;
+
+public:
+	// Weights are drawn uniformly in [-sqrt(6 / (nInputs + nOutputs)),
+	// sqrt(6 / (nInputs + nOutputs))] (Glorot initialization), and biases
+	// are zero
+	Dense(int nInputs, int nOutputs, unsigned seed = 0);
+
+	int getNInputs() const;
+	int getNOutputs() const;
+
+	// Parameters can be updated in place between forward passes
+	ts::Tensor<T> & getWeights();
+	ts::Tensor<T> & getBias();
+
+	// Records the parameters on the list of x, and the layer applied to x
+	ts::TensorVar<T> forward(const ts::TensorVar<T> &x);
+
+	// Parameters recorded by the last forward pass, to get their gradient
+	const ts::TensorVar<T> & getWeightsVar() const;
+	const ts::TensorVar<T> & getBiasVar() const;
+};
@@ -0,0 +1,141 @@
+/*
+* Optimizers updating a set of parameters from their gradient. Each optimizer
+* owns its parameters and state (velocity, moments) as contiguous buffers.
+* Parameters are recorded as consecutive input nodes, so their derivatives
+* are read straight from a range of the gradient buffer, and the parameters
+* and their state are updated with a single vectorized pass (which can be
+* split between threads for large models).
+*
+* The same update can also be applied from any raw gradient buffer (e.g. the
+* adjoint of a tensor).
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "autodiff.hpp"
+
+
+namespace ts {
+	namespace optim {
+		template <typename T> class Optimizer;
+		template <typename T> class SGD;
+		template <typename T> class Adam;
+	}
+
+	namespace internal {
+		// Updates are split between threads by chunks of this many
+		// parameters, and models smaller than two chunks are always updated
+		// by the calling thread
+		const int updateChunkSize = 1 << 15;
+	}
+}
+
+
+
+template <typename T>
+class ts::optim::Optimizer {
+protected:
+	std::vector<T> parameters;
+	int nThreads = 1;
+
+	// Node of the first parameter, as recorded by the last call to record()
+	// (-1 before that)
+	int first = -1;
+
+	// Derivatives of the parameters, when they have to be gathered from a
+	// Jacobian or a sparse gradient
+	std::vector<T> gathered{};
+
+
+	Optimizer(std::vector<T> initialParameters);
+
+	// Returns the derivatives of the parameters, contiguously (NULL if they
+	// were not recorded)
+	const T * getDerivatives(const ts::Gradient<T> &gradient);
+
+	// Calls update(begin, end) over [0, size()), split between threads
+	template <typename F>
+	void forEachChunk(F update);
+
+public:
+	int size() const;
+
+	// Parameters can also be modified in place between steps
+	T * getParameters();
+	const T * getParameters() const;
+
+	// Records the parameters as consecutive input nodes on wList, and returns
+	// them in the same order. This must be done again after each reset of the
+	// list, before computing the gradient passed to step().
+	std::vector<ts::Var<T>> record(ts::WengertList<T> * wList);
+
+	// Number of threads sharing each update (1 by default)
+	void setNThreads(int newNThreads);
+	int getNThreads() const;
+};
+
+
+
+// Gradient descent, with optional (heavy ball) momentum :
+// velocity = momentum * velocity + gradient
+// parameters -= learningRate * velocity
+template <typename T>
+class ts::optim::SGD : public ts::optim::Optimizer<T> {
+private:
+	T learningRate;
+	T momentum;
+
+	// Only allocated with a non-zero momentum
+	std::vector<T> velocity{};
+
+public:
+	SGD(std::vector<T> initialParameters, T newLearningRate, T newMomentum = 0.0);
+
+	void setLearningRate(T newLearningRate);
+	T getLearningRate() const;
+
+	// Updates the parameters from their derivatives (size() elements)
+	void step(const T * gradient);
+
+	// Updates the parameters from a gradient in which they were recorded
+	// (with record()), reading the derivatives of the first output for a
+	// Jacobian. Returns false (and does nothing) if they were never recorded.
+	bool step(const ts::Gradient<T> &gradient);
+};
+
+
+
+// Adam (Kingma and Ba, 2014), with bias corrected moments :
+// m = beta1 * m + (1 - beta1) * gradient
+// v = beta2 * v + (1 - beta2) * gradient^2
+// parameters -= learningRate * m' / (sqrt(v') + epsilon)
+// where m' = m / (1 - beta1^t) and v' = v / (1 - beta2^t) at step t
+template <typename T>
+class ts::optim::Adam : public ts::optim::Optimizer<T> {
+private:
+	T learningRate;
+	T beta1;
+	T beta2;
+	T epsilon;
+
+	std::vector<T> m;
+	std::vector<T> v;
+	long nSteps = 0;
+
+public:
+	Adam(
+		std::vector<T> initialParameters, T newLearningRate = 1e-3,
+		T newBeta1 = 0.9, T newBeta2 = 0.999, T newEpsilon = 1e-8
+	);
+
+	void setLearningRate(T newLearningRate);
+	T getLearningRate() const;
+
+	long getNSteps() const;
+
+	// Same as SGD::step()
+	void step(const T * gradient);
+	bool step(const ts::Gradient<T> &gradient);
+};
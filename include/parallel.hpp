@@ -0,0 +1,290 @@
+/*
+* Data parallel gradients. Each thread records on its own list (see
+* ts::threadList()), and the gradients of all tapes are then reduced into a
+* single buffer, in parallel. Threads are kept in a ts::ThreadPool between
+* computations, so that their lists keep their capacity from a training step
+* to the next. This is the way to go for independent samples
+* or batches : a list can also be shared by several threads (see
+* WengertList::beginShared()), but only for sub-expressions of a single tape,
+* which must be sized up front and can't be traced or checkpointed.
+*
+* Everything is defined inline in this header since the computation is given
+* as a callable.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "autodiff.hpp"
+
+
+namespace ts {
+	class ThreadPool;
+
+	// WengertList of the calling thread. It lives as long as the thread, so
+	// its capacity is kept when it is reset between computations.
+	template <typename T>
+	ts::WengertList<T> & threadList();
+
+
+	// Sum of the gradients of f(task, parameters) with respect to parameters,
+	// for each task in [0, nTasks). f must take an int and a
+	// std::vector<ts::Var<T>> (of the same size as parameters), and return a
+	// ts::Var<T> recorded on the same list as the parameters. Tasks are shared
+	// between nThreads threads (the calling one and the workers of pool), each
+	// one recording on its thread list. Without pool, a pool shared by the
+	// whole process is grown to nThreads threads. The sum of the outputs of f
+	// can be obtained through the loss argument.
+	template <typename T, typename F>
+	std::vector<T> parallelGrad(
+		F f, const std::vector<T> &parameters, int nTasks, int nThreads,
+		T * loss = NULL, ts::ThreadPool * pool = NULL
+	);
+
+
+	namespace internal {
+		// Gradients are reduced by chunks of this many elements, so that
+		// threads never write on the same cache line (or page, on most
+		// systems)
+		const int reduceChunkSize = 1024;
+
+		// Pool used by parallelGrad() when none is given
+		inline ts::ThreadPool & defaultPool();
+	}
+}
+
+
+
+// Worker threads that live as long as the pool, so that their thread lists
+// (and anything else they keep in thread_local storage) are reused from a
+// computation to the next. A pool of nThreads threads has nThreads - 1
+// workers : share 0 of each computation runs on the calling thread, and share
+// t on the same worker every time.
+class ts::ThreadPool {
+private:
+	std::vector<std::thread> workers{};
+
+	// Serializes the computations (and the growth of the pool)
+	std::mutex runMutex{};
+
+	// Current computation, published to the workers under mutex
+	std::mutex mutex{};
+	std::condition_variable started{};
+	std::condition_variable finished{};
+	std::function<void(int)> job{};
+	uint64_t generation = 0;
+	int nShares = 0;
+	int nPending = 0;
+	bool stopping = false;
+
+
+	// done is the last computation before the worker was created
+	void work(int share, uint64_t done) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while(true) {
+			started.wait(lock, [&]() { return stopping || generation != done; });
+			if(stopping) {
+				return;
+			}
+			done = generation;
+
+			// Workers past the shares of this computation go back to sleep
+			if(share < nShares) {
+				lock.unlock();
+				job(share);
+				lock.lock();
+
+				if(--nPending == 0) {
+					finished.notify_one();
+				}
+			}
+		}
+	}
+
+
+	// Adds workers until the pool has nThreads threads (runMutex held)
+	void grow(int nThreads) {
+		while((int) workers.size() < nThreads - 1) {
+			int share = workers.size() + 1;
+			workers.push_back(std::thread(&ts::ThreadPool::work, this, share, generation));
+		}
+	}
+
+
+public:
+	ThreadPool(int nThreads = 1) {
+		grow(nThreads);
+	}
+
+	ThreadPool(const ts::ThreadPool &other) = delete;
+	ts::ThreadPool & operator=(const ts::ThreadPool &other) = delete;
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		started.notify_all();
+
+		for(std::thread &worker : workers) {
+			worker.join();
+		}
+	}
+
+
+	// Number of threads, counting the calling one
+	int size() {
+		std::lock_guard<std::mutex> lock(runMutex);
+		return workers.size() + 1;
+	}
+
+	// Grows the pool to at least nThreads threads
+	void reserve(int nThreads) {
+		std::lock_guard<std::mutex> lock(runMutex);
+		grow(nThreads);
+	}
+
+	// Runs f(t) for each share t in [0, nShares) at the same time, one per
+	// thread (nShares must not exceed size()), and returns once they are all
+	// done. Computations from several threads run one after the other, so f
+	// must not start one itself.
+	void run(int nShares, const std::function<void(int)> &f) {
+		std::lock_guard<std::mutex> runLock(runMutex);
+		nShares = std::min(nShares, (int) workers.size() + 1);
+		if(nShares <= 0) {
+			return;
+		}
+
+		if(nShares > 1) {
+			std::lock_guard<std::mutex> lock(mutex);
+			job = f;
+			this->nShares = nShares;
+			nPending = nShares - 1;
+			generation++;
+		}
+		started.notify_all();
+
+		f(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [&]() { return nPending == 0; });
+		job = nullptr;
+	}
+};
+
+
+
+inline ts::ThreadPool & ts::internal::defaultPool() {
+	static ts::ThreadPool pool;
+	return pool;
+}
+
+
+
+template <typename T>
+ts::WengertList<T> & ts::threadList() {
+	thread_local ts::WengertList<T> list;
+	return list;
+}
+
+
+
+template <typename T, typename F>
+std::vector<T> ts::parallelGrad(
+	F f, const std::vector<T> &parameters, int nTasks, int nThreads,
+	T * loss, ts::ThreadPool * pool
+) {
+	const int nParameters = parameters.size();
+	nThreads = std::max(1, std::min(nThreads, nTasks));
+
+	if(pool == NULL) {
+		pool = &ts::internal::defaultPool();
+		pool->reserve(nThreads);
+	}
+	nThreads = std::min(nThreads, pool->size());
+
+	// One gradient buffer per thread. Each buffer is allocated and zeroed by
+	// its own thread, so that its pages are placed on the NUMA node of that
+	// thread (first touch policy). The result is allocated by the calling
+	// thread, so the reduced chunks all end up on its node.
+	std::vector<std::vector<T>> localGradients(nThreads);
+	std::vector<T> localLosses(nThreads, 0.0);
+	std::vector<T> res(nParameters, 0.0);
+
+	std::atomic<int> nextTask(0);
+	std::atomic<int> nRecorded(0);
+
+
+	auto worker = [&](int t) {
+		std::vector<T> &gradient = localGradients[t];
+		gradient.assign(nParameters, 0.0);
+
+		ts::WengertList<T> &list = ts::threadList<T>();
+		std::vector<T> buffer;
+
+
+		// Record and sweep tasks until there are none left
+		for(int task = nextTask++; task < nTasks; task = nextTask++) {
+			list.reset();
+
+			std::vector<ts::Var<T>> vars;
+			vars.reserve(nParameters);
+			for(int j = 0; j < nParameters; j++) {
+				vars.push_back(ts::NewVar(parameters[j], &list));
+			}
+
+			// Derivatives buffer is reused from a task to the next
+			ts::Var<T> output = f(task, vars);
+			ts::Gradient<T> taskGradient = output.grad(std::move(buffer));
+
+			for(int j = 0; j < nParameters; j++) {
+				gradient[j] += taskGradient.getValue(vars[j]);
+			}
+			localLosses[t] += output.getValue();
+			buffer = taskGradient.release();
+		}
+
+
+		// Wait for all threads to be done
+		nRecorded++;
+		while(nRecorded.load() < nThreads) {
+			std::this_thread::yield();
+		}
+
+
+		// Each thread reduces every nThreads-th chunk of the gradient, reading
+		// it from all buffers
+		const int chunkSize = ts::internal::reduceChunkSize;
+		for(int begin = t * chunkSize; begin < nParameters; begin += nThreads * chunkSize) {
+			int end = std::min(begin + chunkSize, nParameters);
+
+			for(int u = 0; u < nThreads; u++) {
+				const T * localGradient = localGradients[u].data();
+				for(int j = begin; j < end; j++) {
+					res[j] += localGradient[j];
+				}
+			}
+		}
+	};
+
+
+	pool->run(nThreads, worker);
+
+	if(loss != NULL) {
+		*loss = 0.0;
+		for(int t = 0; t < nThreads; t++) {
+			*loss += localLosses[t];
+		}
+	}
+
+	return res;
+}
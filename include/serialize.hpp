@@ -0,0 +1,123 @@
+/*
+* Binary model files, holding named tensors (e.g. trained parameters) and
+* compiled plans (see WengertList::compile()). Files are laid out so that they
+* can be memory mapped and used in place : a fixed header and a table of
+* entries are followed by the raw arrays of each entry, aligned on 64 bytes.
+* Opening a model only reads the header and the tables, so it takes the same
+* time whatever the size of the model. Loaded tensors point directly into the
+* mapping (pages are read from disk when first used), and so do the operations
+* of loaded plans.
+*
+* Layout (version 1, native endianness) :
+*   header   64 bytes, see ts::io::ScalarType and ts::io::formatVersion
+*   entries  64 bytes each : name (up to 47 characters), kind, sections
+*   sections 16 bytes each : offset and number of elements of an array
+*   arrays   each starting on a multiple of 64 bytes
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "autodiff.hpp"
+#include "tensor.hpp"
+
+
+namespace ts {
+	namespace io {
+		template <typename T> class Writer;
+		template <typename T> class Model;
+
+		// Incremented whenever the layout changes. Files of other versions
+		// are rejected.
+		const uint32_t formatVersion = 1;
+
+		// Type a model file was written with
+		enum class ScalarType : uint8_t {
+			Unknown,
+			Float,
+			Double
+		};
+
+		// Longest name of an entry
+		const size_t maxNameLength = 47;
+
+		// Reads the scalar type of a model file, so that it can be opened as a
+		// Model<float> or a Model<double>. Returns ScalarType::Unknown if the
+		// file isn't a valid model file.
+		ts::io::ScalarType getScalarType(const std::string &path);
+	}
+}
+
+
+
+template <typename T>
+class ts::io::Writer {
+private:
+	// Entries are referenced until write() is called, not copied. Entry i is
+	// either tensors[i] or plans[i] (the other one is NULL).
+	std::vector<std::string> names{};
+	std::vector<const ts::Tensor<T> *> tensors{};
+	std::vector<const ts::Plan<T> *> plans{};
+
+	bool isValidName(const std::string &name) const;
+
+public:
+	// Adds an entry, which must stay alive until write() is called. Returns
+	// false if the name is empty, too long or already used.
+	bool add(const std::string &name, const ts::Tensor<T> &tensor);
+	bool add(const std::string &name, const ts::Plan<T> &plan);
+
+	// Writes every entry (returns false if the file can't be written)
+	bool write(const std::string &path) const;
+};
+
+
+
+template <typename T>
+class ts::io::Model {
+private:
+	// Content of the file, mapped (or read when mmap isn't available). Loaded
+	// tensors and plans share it, so they remain valid after the model is
+	// closed.
+	std::shared_ptr<void> memory{};
+	char * bytes = NULL;
+	bool mapped = false;
+
+	int findEntry(const std::string &name, uint32_t kind) const;
+
+	template <typename U>
+	ts::internal::Storage<U> getSection(uint32_t section) const;
+
+public:
+	// Empty model (see open())
+	Model();
+
+	// Maps a model file, replacing the current one. Returns false (and leaves
+	// the model empty) if the file can't be read, has another version or
+	// scalar type, or if its tables are inconsistent. The content of the
+	// arrays themselves is not checked : tensors are used as they are, and
+	// plans are checked when they are loaded.
+	bool open(const std::string &path);
+	void close();
+
+	bool isMapped() const;
+
+	// Names of the entries, in the order they were added to the Writer
+	std::vector<std::string> getNames() const;
+
+	// Tensors are views of the file : nothing is copied, and modifications
+	// stay in memory (the file is mapped copy-on-write). Returns an empty
+	// tensor if there is no such entry.
+	ts::Tensor<T> getTensor(const std::string &name) const;
+
+	// Plans use their operations in place, but own their buffers (in
+	// O(size()) time, as their operations are checked too), so that each
+	// thread can load its own plan. Returns an empty plan if there is no
+	// such entry, or if its operations can't be replayed.
+	ts::Plan<T> getPlan(const std::string &name) const;
+};
@@ -0,0 +1,158 @@
+/*
+* Instrumentation of the autodiff engine. When TS_INSTRUMENT is defined (for
+* the library, build it with "make INSTRUMENT=1"), each WengertList counts the
+* nodes it records by operation, tracks its peak size and times its reverse
+* sweeps. Without it, none of this is compiled : recording and sweeping cost
+* exactly the same as before, and only the current size of the tape is
+* reported.
+*
+* The same TS_INSTRUMENT setting must be used for the library and the code
+* using it (or header-only mode, see autodiff_impl.hpp).
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace ts {
+	// Number of operations in ts::NodeOp
+	const int nNodeOps = 13;
+
+	// Name of each operation, in the order of ts::NodeOp
+	const char * const nodeOpNames[ts::nNodeOps] = {
+		"Input", "Add", "Sub", "Mul", "Div", "Exp", "Log", "Sin", "Cos",
+		"Tanh", "Sqrt", "Pow", "Fused"
+	};
+
+
+	// Reverse sweep, as a complete event of the Chrome trace format
+	struct SweepEvent {
+		const char * name;	// Kind of gradient (e.g. "grad", "sparseGrad")
+		double start;	// Microseconds since trace events were enabled
+		double duration;	// Microseconds
+		long nNodes;	// Nodes of the swept range
+	};
+
+
+	struct TapeStats {
+		// False when counters are not compiled (TS_INSTRUMENT not defined)
+		bool enabled = false;
+
+		// Nodes recorded since the list was created (or the stats reset), by
+		// operation (indexed by ts::NodeOp)
+		long nodesByOp[ts::nNodeOps] = {};
+
+		// Current and peak size of the tape (peak sizes are only tracked
+		// when enabled)
+		long nNodes = 0;
+		long bytes = 0;
+		long peakNodes = 0;
+		long peakBytes = 0;
+
+		// Reverse sweeps (all kinds of gradients) and their wall time
+		long nSweeps = 0;
+		long sweptNodes = 0;
+		double sweepSeconds = 0.0;
+
+		// Only recorded when enabled with WengertList::setTraceEvents()
+		std::vector<ts::SweepEvent> events{};
+
+
+		double nodesPerSecond() const {
+			return sweepSeconds > 0.0 ? sweptNodes / sweepSeconds : 0.0;
+		}
+
+		// All counters, as a JSON object (events excluded)
+		std::string toJson() const;
+
+		// Sweep events in the Chrome trace format, to be opened with
+		// chrome://tracing or Perfetto
+		std::string toChromeTrace() const;
+	};
+
+
+	namespace internal {
+		// Times a sweep for as long as it is in scope
+		class SweepTimer {
+		private:
+			ts::TapeStats &stats;
+			const char * name;
+			long nNodes;
+			bool recordEvent;
+			std::chrono::steady_clock::time_point origin;
+			std::chrono::steady_clock::time_point start;
+
+		public:
+			SweepTimer(
+				ts::TapeStats &newStats, const char * newName, long newNNodes,
+				bool newRecordEvent, std::chrono::steady_clock::time_point newOrigin
+			) :
+				stats(newStats), name(newName), nNodes(newNNodes),
+				recordEvent(newRecordEvent), origin(newOrigin),
+				start(std::chrono::steady_clock::now()) {}
+
+			~SweepTimer() {
+				auto end = std::chrono::steady_clock::now();
+				std::chrono::duration<double> seconds = end - start;
+
+				stats.nSweeps++;
+				stats.sweptNodes += nNodes;
+				stats.sweepSeconds += seconds.count();
+
+				if(recordEvent) {
+					std::chrono::duration<double, std::micro> startUs = start - origin;
+					stats.events.push_back({name, startUs.count(), seconds.count() * 1e6, nNodes});
+				}
+			}
+		};
+	}
+}
+
+
+
+inline std::string ts::TapeStats::toJson() const {
+	std::ostringstream json;
+
+	json << "{\"enabled\": " << (enabled ? "true" : "false");
+
+	json << ", \"nodesByOp\": {";
+	for(int op = 0; op < ts::nNodeOps; op++) {
+		json << (op > 0 ? ", " : "") << "\"" << ts::nodeOpNames[op] << "\": " << nodesByOp[op];
+	}
+	json << "}";
+
+	json << ", \"nNodes\": " << nNodes;
+	json << ", \"bytes\": " << bytes;
+	json << ", \"peakNodes\": " << peakNodes;
+	json << ", \"peakBytes\": " << peakBytes;
+	json << ", \"nSweeps\": " << nSweeps;
+	json << ", \"sweptNodes\": " << sweptNodes;
+	json << ", \"sweepSeconds\": " << sweepSeconds;
+	json << ", \"nodesPerSecond\": " << nodesPerSecond();
+	json << "}";
+
+	return json.str();
+}
+
+
+
+inline std::string ts::TapeStats::toChromeTrace() const {
+	std::ostringstream json;
+
+	json << "{\"traceEvents\": [";
+	for(unsigned i = 0; i < events.size(); i++) {
+		const ts::SweepEvent &event = events[i];
+		json << (i > 0 ? ", " : "");
+		json << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0";
+		json << ", \"ts\": " << event.start << ", \"dur\": " << event.duration;
+		json << ", \"args\": {\"nodes\": " << event.nNodes << "}}";
+	}
+	json << "], \"displayTimeUnit\": \"ms\"}";
+
+	return json.str();
+}
@@ -0,0 +1,138 @@
+/*
+* Contiguous arrays used by tensors and plans. They behave like a std::vector,
+* but can also use elements that live elsewhere (typically in a mapped model
+* file, see serialize.hpp), in which case a shared owner keeps that memory
+* alive. Copies always own their elements, so that they can be modified
+* independently of the original.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+namespace ts {
+	namespace internal {
+		template <typename U> class Storage;
+	}
+}
+
+
+
+template <typename U>
+class ts::internal::Storage {
+private:
+	std::vector<U> owned{};
+	U * elements = NULL;
+	size_t count = 0;
+
+	// Keeps borrowed elements alive (NULL when the elements are owned)
+	std::shared_ptr<void> owner{};
+
+
+	void bind() {
+		elements = owned.data();
+		count = owned.size();
+		owner.reset();
+	}
+
+
+	// Copies borrowed elements before they are resized
+	void own() {
+		if(owner != NULL) {
+			owned.assign(elements, elements + count);
+			bind();
+		}
+	}
+
+public:
+	Storage() {}
+
+	Storage(std::vector<U> &&newElements) : owned(std::move(newElements)) {
+		bind();
+	}
+
+	Storage(size_t newCount, const U &fill) : owned(newCount, fill) {
+		bind();
+	}
+
+	// Borrows newCount elements, which stay valid as long as newOwner does
+	Storage(U * newElements, size_t newCount, std::shared_ptr<void> newOwner) :
+		elements(newElements), count(newCount), owner(std::move(newOwner)) {
+
+	}
+
+	Storage(const ts::internal::Storage<U> &other) : owned(other.begin(), other.end()) {
+		bind();
+	}
+
+	// Moving a std::vector keeps its elements where they are
+	Storage(ts::internal::Storage<U> &&other) noexcept :
+		owned(std::move(other.owned)), elements(other.elements), count(other.count),
+		owner(std::move(other.owner)) {
+
+		other.elements = NULL;
+		other.count = 0;
+	}
+
+	ts::internal::Storage<U> & operator=(const ts::internal::Storage<U> &other) {
+		if(this != &other) {
+			owned.assign(other.begin(), other.end());
+			bind();
+		}
+		return *this;
+	}
+
+	ts::internal::Storage<U> & operator=(ts::internal::Storage<U> &&other) noexcept {
+		if(this != &other) {
+			owned = std::move(other.owned);
+			elements = other.elements;
+			count = other.count;
+			owner = std::move(other.owner);
+
+			other.elements = NULL;
+			other.count = 0;
+		}
+		return *this;
+	}
+
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	// True if the elements live in memory owned by someone else
+	bool isBorrowed() const { return owner != NULL; }
+
+	U * data() { return elements; }
+	const U * data() const { return elements; }
+
+	U * begin() { return elements; }
+	U * end() { return elements + count; }
+	const U * begin() const { return elements; }
+	const U * end() const { return elements + count; }
+
+	U & operator[](size_t i) { return elements[i]; }
+	const U & operator[](size_t i) const { return elements[i]; }
+
+
+	void push_back(const U &element) {
+		own();
+		owned.push_back(element);
+		bind();
+	}
+
+	void resize(size_t newCount) {
+		own();
+		owned.resize(newCount);
+		bind();
+	}
+
+	template <class Iterator>
+	void assign(Iterator first, Iterator last) {
+		owned.assign(first, last);
+		bind();
+	}
+};
@@ -0,0 +1,302 @@
+/*
+* Growable arrays holding the tape of a WengertList. They behave like a
+* std::vector of trivially copyable elements, but can also be backed by a
+* memory-mapped file (see WengertList::setBackingStore()), so that tapes
+* larger than RAM are written to disk as they are recorded, and read back
+* during the reverse sweep.
+*
+* Both the forward and the reverse passes access the tape sequentially, so
+* spilled arrays are processed by chunks : completed chunks are written back
+* and dropped from memory while recording, and chunks are prefetched ahead of
+* the sweep (and dropped behind it).
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <string>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TS_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+namespace ts {
+	namespace internal {
+		template <typename U> class TapeArray;
+
+		// Spilled arrays are written and read by chunks of this many bytes
+		const size_t tapeChunkBytes = 16 << 20;
+	}
+}
+
+
+
+template <typename U>
+class ts::internal::TapeArray {
+private:
+	static_assert(std::is_trivially_copyable<U>::value, "Tape elements are copied as raw memory");
+
+	U * elements = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+
+	// push_back() only calls grow() when count reaches limit. This is the
+	// capacity for arrays in memory, and the end of the current chunk for
+	// spilled arrays.
+	size_t limit = 0;
+
+	// File descriptor of spilled arrays (-1 in memory). Elements before
+	// flushed have already been handed over to the kernel.
+	int file = -1;
+	size_t flushed = 0;
+
+	static constexpr size_t chunkSize = ts::internal::tapeChunkBytes / sizeof(U);
+
+
+	void grow() {
+		if(file < 0) {
+			reallocate(std::max(2 * capacity, (size_t) 16));
+			return;
+		}
+
+	#ifdef TS_HAS_MMAP
+		// The chunk that was just filled is written back and unmapped (its
+		// content stays in the file)
+		advise(flushed, count, false);
+		flushed = count;
+
+		if(count == capacity) {
+			remap(std::max(2 * capacity, chunkSize));
+		}
+		limit = std::min(capacity, count + chunkSize);
+	#endif
+	}
+
+
+	// Goes through operator new, like a std::vector, so that replacing it
+	// accounts for the tape as well
+	void reallocate(size_t newCapacity) {
+		U * newElements = (U *) ::operator new(newCapacity * sizeof(U));
+		if(count > 0) {
+			std::memcpy(newElements, elements, count * sizeof(U));
+		}
+		::operator delete(elements);
+
+		elements = newElements;
+		capacity = newCapacity;
+		limit = capacity;
+	}
+
+
+	// Extends the file and maps all of it again
+	void remap(size_t newCapacity) {
+	#ifdef TS_HAS_MMAP
+		if(elements != NULL) {
+			munmap(elements, capacity * sizeof(U));
+			elements = NULL;
+		}
+
+		size_t bytes = newCapacity * sizeof(U);
+		if(ftruncate(file, bytes) != 0) {
+			throw std::bad_alloc();
+		}
+
+		void * mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		if(mapping == MAP_FAILED) {
+			throw std::bad_alloc();
+		}
+
+		elements = (U *) mapping;
+		capacity = newCapacity;
+	#endif
+	}
+
+
+	// Starts reading elements [begin, end) from the file, or writes them back
+	// and drops them from memory
+	void advise(size_t begin, size_t end, bool willNeed) {
+	#ifdef TS_HAS_MMAP
+		const size_t page = sysconf(_SC_PAGESIZE);
+
+		// Only whole pages are dropped, but partial ones can be prefetched
+		size_t first = begin * sizeof(U);
+		size_t last = std::min(end, capacity) * sizeof(U);
+		first = willNeed ? first / page * page : (first + page - 1) / page * page;
+		last = willNeed ? (last + page - 1) / page * page : last / page * page;
+		if(first >= last) {
+			return;
+		}
+
+		char * start = (char *) elements + first;
+		if(willNeed) {
+			madvise(start, last - first, MADV_WILLNEED);
+		} else {
+			msync(start, last - first, MS_ASYNC);
+			madvise(start, last - first, MADV_DONTNEED);
+		}
+	#endif
+	}
+
+
+	void release() {
+		if(file >= 0) {
+		#ifdef TS_HAS_MMAP
+			if(elements != NULL) {
+				munmap(elements, capacity * sizeof(U));
+			}
+			close(file);
+		#endif
+		} else {
+			::operator delete(elements);
+		}
+
+		elements = NULL;
+		count = capacity = limit = flushed = 0;
+		file = -1;
+	}
+
+
+public:
+	TapeArray() {}
+
+	TapeArray(std::initializer_list<U> init) {
+		for(const U &x : init) {
+			push_back(x);
+		}
+	}
+
+	// Copies are always in memory
+	TapeArray(const TapeArray &other) {
+		*this = other;
+	}
+
+	TapeArray(TapeArray &&other) {
+		*this = std::move(other);
+	}
+
+	TapeArray & operator=(const TapeArray &other) {
+		if(this != &other) {
+			release();
+			if(other.count > 0) {
+				reallocate(other.count);
+				std::memcpy(elements, other.elements, other.count * sizeof(U));
+				count = other.count;
+			}
+		}
+		return *this;
+	}
+
+	TapeArray & operator=(TapeArray &&other) {
+		if(this != &other) {
+			release();
+			std::swap(elements, other.elements);
+			std::swap(count, other.count);
+			std::swap(capacity, other.capacity);
+			std::swap(limit, other.limit);
+			std::swap(file, other.file);
+			std::swap(flushed, other.flushed);
+		}
+		return *this;
+	}
+
+	~TapeArray() {
+		release();
+	}
+
+
+	void push_back(U x) {
+		if(count == limit) {
+			grow();
+		}
+		elements[count++] = x;
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	U * data() { return elements; }
+	const U * data() const { return elements; }
+
+	U & operator[](size_t i) { return elements[i]; }
+	const U & operator[](size_t i) const { return elements[i]; }
+
+	// Capacity (and the file of spilled arrays) is kept
+	void clear() {
+		count = 0;
+		flushed = 0;
+		limit = file < 0 ? capacity : std::min(capacity, chunkSize);
+	}
+
+	// Elements past the current size are left uninitialized : they must have
+	// been written in place already (see WengertList::beginShared())
+	void resize(size_t n) {
+		reserve(n);
+		count = n;
+	}
+
+	void reserve(size_t n) {
+		if(n <= capacity) {
+			return;
+		}
+		if(file < 0) {
+			reallocate(n);
+		} else {
+			remap(n);
+			limit = std::min(capacity, count + chunkSize);
+		}
+	}
+
+
+	// Moves the (empty) array to an anonymous file created in directory, which
+	// is deleted as soon as it is created so that it never outlives the
+	// array. Returns false if the array is not empty or if the file can't be
+	// created (or on systems without mmap).
+	bool spill(const std::string &directory) {
+	#ifdef TS_HAS_MMAP
+		if(count > 0) {
+			return false;
+		}
+
+		std::string path = directory + "/tensorslow-tape-XXXXXX";
+		int newFile = mkstemp(&path[0]);
+		if(newFile < 0) {
+			return false;
+		}
+		unlink(path.c_str());
+
+		release();
+		file = newFile;
+		return true;
+	#else
+		return false;
+	#endif
+	}
+
+	bool isSpilled() const {
+		return file >= 0;
+	}
+
+	// Prefetching and dropping hints for spilled arrays, given in elements
+	// (no effect on arrays in memory)
+	void prefetch(size_t begin, size_t end) {
+		if(file >= 0) {
+			advise(begin, end, true);
+		}
+	}
+
+	void evict(size_t begin, size_t end) {
+		if(file >= 0) {
+			advise(begin, end, false);
+		}
+	}
+};
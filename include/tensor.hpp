@@ -0,0 +1,270 @@
+/*
+* Tensor automatic differentiation engine. Unlike the scalar ts::Var, a
+* ts::TensorVar records a single node on its TensorList for each whole
+* operation, and its adjoint is computed with a loop over contiguous buffers
+* during the backward pass. Reverse mode only.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "storage.hpp"
+
+
+namespace ts {
+	template <typename T> class Tensor;
+	template <typename T> class TensorNode;
+	template <typename T> class TensorList;
+	template <typename T> class TensorVar;
+	template <typename T> class TensorGradient;
+
+
+	// Operations that can be recorded on a TensorList
+	enum class TensorOp {
+		Input,
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Sum,
+		Dot,
+		MatMul,
+		Exp,
+		Log,
+		Tanh,
+
+		// Fused neural network operations (see nn.hpp)
+		Dense,
+		ReLU,
+		Sigmoid,
+		SoftmaxCrossEntropy,
+		MSE
+	};
+
+
+	// This helper function allows us to create TensorVar instances without
+	// template syntax. This way, the type will be the same as its parent
+	// TensorList.
+	template <typename T>
+	ts::TensorVar<T> NewTensorVar(ts::Tensor<T> newValue, ts::TensorList<T> * newList);
+
+
+	// Elementwise operators (both operands must have the same shape)
+	template <typename T>
+	ts::TensorVar<T> operator+(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	template <typename T>
+	ts::TensorVar<T> operator-(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	template <typename T>
+	ts::TensorVar<T> operator*(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	template <typename T>
+	ts::TensorVar<T> operator/(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+
+	// Reductions (the result has a {1} shape)
+	template <typename T>
+	ts::TensorVar<T> sum(const ts::TensorVar<T> &x);
+	template <typename T>
+	ts::TensorVar<T> dot(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+
+	// Matrix product of a m x k and a k x n tensor
+	template <typename T>
+	ts::TensorVar<T> matmul(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+
+	// Elementwise functions (see ts::kernels::setFastMath() for a faster
+	// approximation of exp and tanh)
+	template <typename T>
+	ts::TensorVar<T> exp(const ts::TensorVar<T> &x);
+	template <typename T>
+	ts::TensorVar<T> log(const ts::TensorVar<T> &x);
+	template <typename T>
+	ts::TensorVar<T> tanh(const ts::TensorVar<T> &x);
+
+
+	// Declared here so that they can be friends of TensorVar (documented in
+	// nn.hpp)
+	namespace nn {
+		template <typename T> class Dense;
+
+		template <typename T>
+		ts::TensorVar<T> dense(const ts::TensorVar<T> &x, const ts::TensorVar<T> &w, const ts::TensorVar<T> &b);
+		template <typename T>
+		ts::TensorVar<T> relu(const ts::TensorVar<T> &x);
+		template <typename T>
+		ts::TensorVar<T> sigmoid(const ts::TensorVar<T> &x);
+		template <typename T>
+		ts::TensorVar<T> softmaxCrossEntropy(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets);
+		template <typename T>
+		ts::TensorVar<T> mse(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets);
+	}
+
+	namespace io {
+		template <typename T> class Model;
+	}
+
+	namespace data {
+		template <typename T> class Batch;
+	}
+}
+
+
+
+template <typename T>
+class ts::Tensor {
+private:
+	// Values are stored contiguously in row-major order (possibly in a
+	// mapped model file, see serialize.hpp)
+	ts::internal::Storage<T> data{};
+	std::vector<int> shape{};
+
+public:
+	// Empty tensor
+	Tensor();
+
+	// Tensor filled with a single value
+	Tensor(std::vector<int> newShape, T fill = 0.0);
+
+	// Tensor initialized from row-major data (its size must match the shape)
+	Tensor(std::vector<int> newShape, std::vector<T> newData);
+
+	int size() const;
+	int rank() const;
+	const std::vector<int> & getShape() const;
+
+	T * getData();
+	const T * getData() const;
+
+	T & operator[](int i);
+	const T & operator[](int i) const;
+
+	friend ts::io::Model<T>;
+	friend ts::data::Batch<T>;
+};
+
+
+
+template <typename T>
+class ts::TensorNode {
+private:
+	TensorNode(
+		ts::TensorOp newOp, ts::Tensor<T> newValue, int xDep, int yDep, int zDep,
+		ts::Tensor<T> newSaved
+	);
+
+	ts::TensorOp op;
+	ts::Tensor<T> value;
+
+	// Intermediate result kept for the backward pass of fused operations
+	// (e.g. the softmax probabilities), empty otherwise
+	ts::Tensor<T> saved;
+
+	// Index of the operands on the TensorList (-1 if unused)
+	int dependencies[3];
+
+public:
+	friend ts::TensorList<T>;
+	friend ts::TensorVar<T>;
+};
+
+
+
+template <typename T>
+class ts::TensorList {
+private:
+	std::vector<ts::TensorNode<T>> nodes{};
+
+	// Appends a node to the tape and returns its index
+	int push(
+		ts::TensorOp op, ts::Tensor<T> value, int xDep, int yDep, int zDep = -1,
+		ts::Tensor<T> saved = ts::Tensor<T>()
+	);
+
+public:
+	int size();
+
+	// Clears the tape (Vars recorded before the reset must not be used anymore)
+	void reset();
+
+	friend ts::TensorVar<T>;
+
+	friend ts::TensorVar<T> operator+<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> operator-<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> operator*<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> operator/<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> sum<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> dot<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> matmul<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> exp<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> log<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> tanh<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> nn::dense<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &w, const ts::TensorVar<T> &b);
+	friend ts::TensorVar<T> nn::relu<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> nn::sigmoid<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> nn::softmaxCrossEntropy<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets);
+	friend ts::TensorVar<T> nn::mse<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets);
+};
+
+
+
+template <typename T>
+class ts::TensorVar {
+private:
+	ts::TensorList<T> * list;
+	int index;
+
+	// Records the result of an operation on the list
+	TensorVar(
+		ts::TensorList<T> * newList, ts::TensorOp op, ts::Tensor<T> newValue,
+		int xDep, int yDep, int zDep = -1, ts::Tensor<T> newSaved = ts::Tensor<T>()
+	);
+
+public:
+	TensorVar(ts::Tensor<T> newValue, ts::TensorList<T> * newList);
+
+	const ts::Tensor<T> & getValue() const;
+	const std::vector<int> & getShape() const;
+
+	// Computes the gradient of the sum of this tensor's elements (so, of the
+	// tensor itself when it only has one element)
+	ts::TensorGradient<T> grad();
+
+	friend ts::TensorGradient<T>;
+	friend ts::nn::Dense<T>;
+
+	friend ts::TensorVar<T> operator+<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> operator-<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> operator*<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> operator/<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> sum<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> dot<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> matmul<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y);
+	friend ts::TensorVar<T> exp<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> log<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> tanh<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> nn::dense<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &w, const ts::TensorVar<T> &b);
+	friend ts::TensorVar<T> nn::relu<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> nn::sigmoid<>(const ts::TensorVar<T> &x);
+	friend ts::TensorVar<T> nn::softmaxCrossEntropy<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets);
+	friend ts::TensorVar<T> nn::mse<>(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets);
+};
+
+
+
+template <typename T>
+class ts::TensorGradient {
+private:
+	// Constructor is private since we want instances of this class to be
+	// generated by the TensorVar::grad() method only
+	TensorGradient(std::vector<ts::Tensor<T>> &&newAdjoints);
+
+	// One adjoint per node of the list. Adjoints of nodes that the output
+	// doesn't depend on are left empty.
+	std::vector<ts::Tensor<T>> adjoints;
+
+public:
+	// Returns the derivatives with respect to each element of a (a zero
+	// tensor if the output doesn't depend on a)
+	ts::Tensor<T> getValue(const ts::TensorVar<T> &a);
+
+	friend class ts::TensorVar<T>;
+};
@@ -5,3 +5,12 @@
 #pragma once
 
 #include "autodiff.hpp"
+#include "kernels.hpp"
+#include "tensor.hpp"
+#include "nn.hpp"
+#include "dual.hpp"
+#include "expression.hpp"
+#include "parallel.hpp"
+#include "optim.hpp"
+#include "data.hpp"
+#include "serialize.hpp"
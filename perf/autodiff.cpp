@@ -0,0 +1,484 @@
+/*
+* Benchmarks for the scalar autodiff engine
+*
+* Results can be exported as JSON with the --benchmark_format=json or
+* --benchmark_out=<file> options (see `make run_perf`).
+*/
+
+#include <benchmark/benchmark.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "../include/tensorslow.h"
+
+
+
+// Live heap memory tracking, to measure the memory used per node
+
+static long liveBytes = 0;
+
+// These are not inlined, otherwise GCC can't tell that the pointers they free
+// come from operator new (-Wmismatched-new-delete false positives)
+__attribute__((noinline)) void * operator new(std::size_t size) {
+	void * ptr = malloc(size);
+	if(ptr == NULL) {
+		throw std::bad_alloc();
+	}
+	liveBytes += malloc_usable_size(ptr);
+	return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void * ptr) noexcept {
+	if(ptr != NULL) {
+		liveBytes -= malloc_usable_size(ptr);
+	}
+	free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void * ptr, std::size_t) noexcept {
+	operator delete(ptr);
+}
+
+
+
+	// Recording
+
+enum class Op {Add, Sub, Mul, Div};
+
+template <Op op>
+static void BM_Record(benchmark::State &state) {
+	// Nodes recorded per second for each operator, on a warm list
+
+	const int nOps = 1 << 16;
+
+	ts::WengertList<double> wList;
+	wList.reserve(nOps + 2);
+
+	for(auto _ : state) {
+		wList.reset();
+		auto x = ts::NewVar(1.0, &wList);
+		auto y = ts::NewVar(1.0000001, &wList);
+
+		for(int i = 0; i < nOps; i++) {
+			switch(op) {
+				case Op::Add: x = x + y; break;
+				case Op::Sub: x = x - y; break;
+				case Op::Mul: x = x * y; break;
+				case Op::Div: x = x / y; break;
+			}
+		}
+		benchmark::DoNotOptimize(x);
+	}
+
+	state.SetItemsProcessed(state.iterations() * nOps);
+}
+
+BENCHMARK_TEMPLATE(BM_Record, Op::Add);
+BENCHMARK_TEMPLATE(BM_Record, Op::Sub);
+BENCHMARK_TEMPLATE(BM_Record, Op::Mul);
+BENCHMARK_TEMPLATE(BM_Record, Op::Div);
+
+
+
+static void BM_Inference(benchmark::State &state) {
+	// Operations on Vars of a list (mixed with folded constants), recorded
+	// (0) or computing values only with recording disabled (1)
+
+	const int nOps = 1 << 16;
+	const bool noGrad = state.range(0);
+
+	ts::WengertList<double> wList;
+	wList.reserve(3 * nOps + 2);
+
+	for(auto _ : state) {
+		wList.reset();
+		auto x = ts::NewVar(1.0, &wList);
+		auto y = ts::NewVar(1.0000001, &wList);
+
+		wList.setRecording(!noGrad);
+		for(int i = 0; i < nOps; i++) {
+			x = (x * y + 0.5) / 1.5;
+		}
+		wList.setRecording(true);
+		benchmark::DoNotOptimize(x);
+	}
+
+	state.SetItemsProcessed(state.iterations() * 3 * nOps);
+}
+
+BENCHMARK(BM_Inference)->Arg(0)->Arg(1);
+
+
+
+	// Random tapes
+
+// Records a tape of nNodes nodes, each one combining two random earlier
+// nodes, and returns the last one (its 16 inputs are stored in inputs)
+template <typename T>
+static ts::Var<T> randomTape(
+	ts::WengertList<T> &wList, int nNodes,
+	std::vector<ts::Var<T>> * inputs = NULL
+) {
+	std::vector<ts::Var<T>> vars;
+	vars.reserve(nNodes);
+
+	srand(42);
+	for(int i = 0; i < 16 && i < nNodes; i++) {
+		vars.push_back(ts::NewVar((T) (1.0 + i), &wList));
+	}
+	if(inputs != NULL) {
+		inputs->assign(vars.begin(), vars.end());
+	}
+
+	while((int) vars.size() < nNodes) {
+		// Mostly local dependencies, like in real expressions
+		int n = vars.size();
+		const ts::Var<T> &x = vars[n - 1 - rand() % (n < 64 ? n : 64)];
+		const ts::Var<T> &y = vars[rand() % n];
+
+		switch(rand() % 4) {
+			case 0: vars.push_back(x + y); break;
+			case 1: vars.push_back(x - y); break;
+			case 2: vars.push_back(x * y); break;
+			default: vars.push_back(x / y); break;
+		}
+	}
+
+	return vars.back();
+}
+
+
+
+static void BM_Grad(benchmark::State &state) {
+	// Reverse sweep throughput against the tape size. Cache cliffs show up as
+	// drops of the nodes/s rate. The 1e8 nodes tape needs about 5 GB of RAM.
+
+	const int nNodes = state.range(0);
+
+	ts::WengertList<double> wList;
+	auto output = randomTape(wList, nNodes);
+
+	for(auto _ : state) {
+		auto grad = output.grad();
+		benchmark::DoNotOptimize(grad);
+	}
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+}
+
+BENCHMARK(BM_Grad)->RangeMultiplier(10)->Range(1000, 100000000)->Unit(benchmark::kMicrosecond);
+
+
+
+static void BM_GradSideNodes(benchmark::State &state) {
+	// Gradient of a 10000 nodes output recorded after side computations
+	// (metrics, logging...) of the given size, which the sweep doesn't visit
+
+	const int nSideNodes = state.range(0);
+
+	ts::WengertList<double> wList;
+	randomTape(wList, nSideNodes);
+	auto output = randomTape(wList, 10000);
+
+	for(auto _ : state) {
+		auto grad = output.grad();
+		benchmark::DoNotOptimize(grad);
+	}
+
+	state.SetItemsProcessed(state.iterations() * wList.size());
+}
+
+BENCHMARK(BM_GradSideNodes)->RangeMultiplier(10)->Range(10000, 10000000)->Unit(benchmark::kMicrosecond);
+
+
+
+static void BM_Hvp(benchmark::State &state) {
+	// Hessian-vector product of a traced tape along its 16 inputs, to be
+	// compared with BM_Grad
+
+	const int nNodes = state.range(0);
+
+	ts::WengertList<double> wList;
+	wList.setTracing(true);
+	std::vector<ts::Var<double>> inputs;
+	auto output = randomTape(wList, nNodes, &inputs);
+	std::vector<double> v(inputs.size(), 1.0);
+
+	for(auto _ : state) {
+		auto hv = output.hvp(inputs, v);
+		benchmark::DoNotOptimize(hv.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+}
+
+BENCHMARK(BM_Hvp)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+
+
+
+static void BM_GradPrecision(benchmark::State &state) {
+	// Reverse sweep of a float tape whose partials are stored in full
+	// precision, bfloat16 or half precision (second argument, in the order
+	// of ts::TapePrecision)
+
+	const int nNodes = state.range(0);
+	ts::TapePrecision precision = (ts::TapePrecision) state.range(1);
+
+	ts::WengertList<float> wList;
+	wList.setPrecision(precision);
+	auto output = randomTape(wList, nNodes);
+
+	std::vector<float> buffer;
+	for(auto _ : state) {
+		auto grad = output.grad(std::move(buffer));
+		benchmark::DoNotOptimize(grad.getData());
+		buffer = grad.release();
+	}
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+	state.counters["tape_bytes_per_node"] = wList.bytesPerNode();
+}
+
+BENCHMARK(BM_GradPrecision)
+	->ArgsProduct({{100000, 10000000}, {0, 1, 2}})
+	->Unit(benchmark::kMicrosecond);
+
+
+
+static void BM_BackingStore(benchmark::State &state) {
+	// Recording and reverse sweep of a tape spilled to disk (in the current
+	// directory), against the same tape in memory (second argument 0)
+
+	const int nNodes = state.range(0);
+	const bool spilled = state.range(1);
+
+	ts::WengertList<double> wList;
+	if(spilled && !wList.setBackingStore(".")) {
+		state.SkipWithError("Can't create the backing files");
+		return;
+	}
+
+	std::vector<double> buffer;
+	for(auto _ : state) {
+		wList.reset();
+		auto output = randomTape(wList, nNodes);
+		auto grad = output.grad(std::move(buffer));
+		benchmark::DoNotOptimize(grad.getData());
+		buffer = grad.release();
+	}
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+	state.SetBytesProcessed(state.iterations() * (long) (wList.bytesPerNode() * nNodes));
+}
+
+BENCHMARK(BM_BackingStore)
+	->ArgsProduct({{10000000}, {0, 1}})
+	->Unit(benchmark::kMillisecond);
+
+
+
+	// Compiled plans
+
+static void BM_Retape(benchmark::State &state) {
+	// Gradient of the same computation on new inputs, recorded again for each
+	// call (on a warm list)
+
+	const int nNodes = state.range(0);
+
+	ts::WengertList<double> wList;
+	wList.reserve(nNodes);
+
+	for(auto _ : state) {
+		wList.reset();
+		std::vector<ts::Var<double>> inputs;
+		auto output = randomTape(wList, nNodes, &inputs);
+
+		auto grad = output.grad();
+		for(unsigned j = 0; j < inputs.size(); j++) {
+			benchmark::DoNotOptimize(grad.getValue(inputs[j]));
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+}
+
+BENCHMARK(BM_Retape)->Arg(1000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+
+
+static void BM_Plan(benchmark::State &state) {
+	// Same as BM_Retape, with the tape compiled once
+
+	const int nNodes = state.range(0);
+
+	ts::WengertList<double> wList;
+	wList.setTracing(true);
+	std::vector<ts::Var<double>> inputs;
+	auto output = randomTape(wList, nNodes, &inputs);
+
+	ts::Plan<double> plan = wList.compile(inputs, {output});
+
+	std::vector<double> inputValues(inputs.size(), 1.0);
+	std::vector<double> gradient(inputs.size());
+	double outputValue;
+
+	for(auto _ : state) {
+		// The tape of randomTape() doesn't depend on the input values
+		inputValues[0] += 1e-9;
+		plan.grad(inputValues.data(), &outputValue, gradient.data());
+		benchmark::DoNotOptimize(gradient.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+}
+
+BENCHMARK(BM_Plan)->Arg(1000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+
+
+static void BM_PrunedPlan(benchmark::State &state) {
+	// Plan of an output recorded along with as many side nodes, pruned or not
+	// (second argument)
+
+	const int nNodes = state.range(0);
+
+	ts::WengertList<double> wList;
+	wList.setTracing(true);
+	std::vector<ts::Var<double>> inputs;
+	auto output = randomTape(wList, nNodes, &inputs);
+	randomTape(wList, nNodes);
+	output = output + ts::NewVar(1.0, &wList);
+
+	ts::Plan<double> plan = wList.compile(inputs, {output});
+	if(state.range(1)) {
+		plan.prune();
+	}
+
+	std::vector<double> inputValues(inputs.size(), 1.0);
+	std::vector<double> gradient(inputs.size());
+	double outputValue;
+
+	for(auto _ : state) {
+		inputValues[0] += 1e-9;
+		plan.grad(inputValues.data(), &outputValue, gradient.data());
+		benchmark::DoNotOptimize(gradient.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+}
+
+BENCHMARK(BM_PrunedPlan)->ArgsProduct({{1000, 100000}, {0, 1}})->Unit(benchmark::kMicrosecond);
+
+
+
+	// Data parallel gradients
+
+static void BM_DataParallel(benchmark::State &state) {
+	// 256 tasks of 4096 nodes each, shared between state.range(0) threads
+
+	const int nThreads = state.range(0);
+	const int nTasks = 256;
+	const int nNodes = 4096;
+	std::vector<double> parameters(64, 1.0);
+
+	auto f = [](int task, const std::vector<ts::Var<double>> &p) {
+		ts::Var<double> res = p[task % 64];
+		for(int i = 0; i < nNodes; i++) {
+			res = res * p[i % 64] - p[(i * 7) % 64];
+		}
+		return res;
+	};
+
+	for(auto _ : state) {
+		std::vector<double> gradient = ts::parallelGrad(f, parameters, nTasks, nThreads);
+		benchmark::DoNotOptimize(gradient.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * nTasks * nNodes * 2);
+}
+
+BENCHMARK(BM_DataParallel)->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+
+static void BM_SharedRecord(benchmark::State &state) {
+	// 1 << 20 nodes recorded on a single shared list by state.range(0)
+	// threads, each one recording its own sub-expression from the same
+	// parameters
+
+	const int nThreads = state.range(0);
+	const int nNodes = 1 << 20;
+
+	ts::WengertList<double> wList;
+	wList.reserve(2 * nNodes);
+
+	for(auto _ : state) {
+		wList.reset();
+		std::vector<ts::Var<double>> p;
+		for(int j = 0; j < 64; j++) {
+			p.push_back(ts::NewVar(1.0, &wList));
+		}
+
+		wList.beginShared(2 * nNodes);
+		auto worker = [&](int t) {
+			ts::Var<double> res = p[t % 64];
+			for(int i = 0; i < nNodes / nThreads / 2; i++) {
+				res = res * p[i % 64] - p[(i * 7) % 64];
+			}
+			benchmark::DoNotOptimize(res);
+		};
+
+		std::vector<std::thread> threads;
+		for(int t = 1; t < nThreads; t++) {
+			threads.push_back(std::thread(worker, t));
+		}
+		worker(0);
+		for(std::thread &thread : threads) {
+			thread.join();
+		}
+		wList.endShared();
+	}
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+}
+
+BENCHMARK(BM_SharedRecord)->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+
+static void BM_MemoryPerNode(benchmark::State &state) {
+	// Heap memory used by the tape (including the unused capacity of its
+	// arrays), per node. tape_bytes_per_node only counts the recorded nodes.
+
+	const int nNodes = state.range(0);
+	double bytesPerNode = 0.0;
+	double tapeBytesPerNode = 0.0;
+
+	for(auto _ : state) {
+		// Vars are stored outside of the measured range to count the tape only
+		std::vector<ts::Var<double>> vars;
+		vars.reserve(nNodes);
+
+		long before = liveBytes;
+		ts::WengertList<double> wList;
+
+		vars.push_back(ts::NewVar(1.0, &wList));
+		for(int i = 1; i < nNodes; i++) {
+			vars.push_back(vars[i - 1] * vars[i - 1]);
+		}
+
+		bytesPerNode = (double) (liveBytes - before) / nNodes;
+		tapeBytesPerNode = wList.bytesPerNode();
+	}
+
+	state.counters["bytes_per_node"] = bytesPerNode;
+	state.counters["tape_bytes_per_node"] = tapeBytesPerNode;
+}
+
+BENCHMARK(BM_MemoryPerNode)->Arg(1000000)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""
+Compares the results of the benchmarks (as saved by `make run_perf`) with a
+baseline, and flags the benchmarks that got slower by more than a threshold.
+
+Usage : compare.py <baseline directory> <results directory> [threshold in %]
+
+Each *_perf.json file of the results is compared with the file of the same
+name in the baseline. Benchmarks measured in real time (UseRealTime()) are
+compared on their real time, the others on their CPU time. Hardware counters
+are shown when both runs have them. Exits with status 1 if any benchmark
+regressed.
+"""
+
+import json
+import os
+import sys
+
+
+# Nanoseconds per time unit of Google Benchmark
+UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+# Counters shown next to the timings (see counters.hpp)
+COUNTERS = ["instructions", "cache_misses", "branch_misses"]
+
+
+def load(path):
+    """Benchmarks of a JSON file by name (repetitions and aggregates are
+    reduced to their mean)"""
+
+    with open(path) as f:
+        benchmarks = json.load(f)["benchmarks"]
+
+    res = {}
+    for b in benchmarks:
+        if b.get("run_type") == "aggregate" and b.get("aggregate_name") != "mean":
+            continue
+
+        name = b.get("run_name", b["name"])
+        key = "real_time" if name.endswith("/real_time") else "cpu_time"
+        res[name] = {
+            "time": b[key] * UNITS[b.get("time_unit", "ns")],
+            "counters": {c: b[c] for c in COUNTERS if c in b},
+        }
+    return res
+
+
+def formatTime(ns):
+    for unit in ["s", "ms", "us"]:
+        if ns >= UNITS[unit]:
+            return "%.3g %s" % (ns / UNITS[unit], unit)
+    return "%.3g ns" % ns
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__.strip())
+        return 2
+
+    baselineDir, resultsDir = sys.argv[1], sys.argv[2]
+    threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 10.0
+
+    files = sorted(f for f in os.listdir(resultsDir) if f.endswith("_perf.json"))
+    regressions = []
+
+    for f in files:
+        baselinePath = os.path.join(baselineDir, f)
+        if not os.path.exists(baselinePath):
+            print("%s : no baseline" % f)
+            continue
+
+        baseline = load(baselinePath)
+        results = load(os.path.join(resultsDir, f))
+
+        print("\n%s" % f)
+        print("%-56s %12s %12s %9s" % ("Benchmark", "Baseline", "Current", "Change"))
+
+        for name, current in results.items():
+            if name not in baseline:
+                continue
+
+            old = baseline[name]
+            change = 100.0 * (current["time"] / old["time"] - 1.0)
+            flag = ""
+            if change > threshold:
+                flag = "  REGRESSION"
+                regressions.append((f, name, change))
+
+            print("%-56s %12s %12s %+8.1f%%%s" % (
+                name, formatTime(old["time"]), formatTime(current["time"]), change, flag
+            ))
+
+            for c in COUNTERS:
+                if c in old["counters"] and c in current["counters"] and old["counters"][c] > 0:
+                    counterChange = 100.0 * (current["counters"][c] / old["counters"][c] - 1.0)
+                    print("%-56s %12.4g %12.4g %+8.1f%%" % (
+                        "  " + c, old["counters"][c], current["counters"][c], counterChange
+                    ))
+
+    print()
+    if regressions:
+        print("%d benchmark(s) more than %g%% slower than the baseline :" % (len(regressions), threshold))
+        for f, name, change in regressions:
+            print("  %s %s (%+.1f%%)" % (f, name, change))
+        return 1
+
+    print("No benchmark more than %g%% slower than the baseline" % threshold)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
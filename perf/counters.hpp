@@ -0,0 +1,117 @@
+/*
+* Hardware counters for the benchmarks, read through perf_event_open on Linux.
+* Each benchmark opens the counters it wants around its timed loop, and they
+* are reported per iteration next to the timings (and in the JSON output).
+*
+* Counters that can't be opened (other systems, virtual machines without a
+* PMU, or a restrictive /proc/sys/kernel/perf_event_paranoid) are simply left
+* out of the results, so benchmarks run the same everywhere.
+*/
+
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#define TS_HAS_PERF_EVENT
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+
+// Counts user space events of the calling thread, and of the threads it
+// creates while counting
+class PerfCounters {
+private:
+	struct Counter {
+		std::string name;
+		int file;
+	};
+
+	std::vector<Counter> counters;
+
+
+	void open(const std::string &name, uint32_t type, uint64_t config) {
+	#ifdef TS_HAS_PERF_EVENT
+		perf_event_attr attributes;
+		std::memset(&attributes, 0, sizeof(attributes));
+		attributes.type = type;
+		attributes.size = sizeof(attributes);
+		attributes.config = config;
+		attributes.disabled = 1;
+		attributes.inherit = 1;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+
+		int file = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+		if(file >= 0) {
+			counters.push_back({name, file});
+		}
+	#endif
+	}
+
+
+public:
+	PerfCounters() {
+	#ifdef TS_HAS_PERF_EVENT
+		open("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		open("cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		open("branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+		open("branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+		open("page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+	#endif
+	}
+
+	PerfCounters(const PerfCounters &other) = delete;
+	PerfCounters & operator=(const PerfCounters &other) = delete;
+
+	~PerfCounters() {
+	#ifdef TS_HAS_PERF_EVENT
+		for(const Counter &counter : counters) {
+			close(counter.file);
+		}
+	#endif
+	}
+
+
+	// Resets and starts every counter
+	void start() {
+	#ifdef TS_HAS_PERF_EVENT
+		for(const Counter &counter : counters) {
+			ioctl(counter.file, PERF_EVENT_IOC_RESET, 0);
+			ioctl(counter.file, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	#endif
+	}
+
+	void stop() {
+	#ifdef TS_HAS_PERF_EVENT
+		for(const Counter &counter : counters) {
+			ioctl(counter.file, PERF_EVENT_IOC_DISABLE, 0);
+		}
+	#endif
+	}
+
+
+	// Adds the counts since start() to the counters of state, divided by the
+	// number of iterations
+	void report(benchmark::State &state) {
+	#ifdef TS_HAS_PERF_EVENT
+		for(const Counter &counter : counters) {
+			uint64_t count = 0;
+			if(read(counter.file, &count, sizeof(count)) == sizeof(count)) {
+				state.counters[counter.name] = benchmark::Counter(
+					count, benchmark::Counter::kAvgIterations
+				);
+			}
+		}
+	#endif
+	}
+};
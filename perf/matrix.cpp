@@ -0,0 +1,200 @@
+/*
+* Benchmark matrix of the engine : tape size, thread count, scalar type and
+* code path, each point reporting its hardware counters (see counters.hpp).
+* This is meant to show how the engine scales and to catch regressions
+* between two versions, by saving the results of a version as a baseline and
+* comparing the next ones against it (see `make compare_perf`).
+*
+* Results can be exported as JSON with the --benchmark_format=json or
+* --benchmark_out=<file> options (see `make run_perf`).
+*/
+
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "../include/tensorslow.h"
+#include "counters.hpp"
+
+
+
+// Records a tape of nNodes nodes, each one combining two random earlier
+// nodes, and returns the last one
+template <typename T>
+static ts::Var<T> randomTape(ts::WengertList<T> &wList, int nNodes) {
+	std::vector<ts::Var<T>> vars;
+	vars.reserve(nNodes);
+
+	srand(42);
+	for(int i = 0; i < 16 && i < nNodes; i++) {
+		vars.push_back(ts::NewVar((T) (1.0 + i), &wList));
+	}
+
+	while((int) vars.size() < nNodes) {
+		// Mostly local dependencies, like in real expressions
+		int n = vars.size();
+		const ts::Var<T> &x = vars[n - 1 - rand() % (n < 64 ? n : 64)];
+		const ts::Var<T> &y = vars[rand() % n];
+
+		switch(rand() % 4) {
+			case 0: vars.push_back(x + y); break;
+			case 1: vars.push_back(x - y); break;
+			case 2: vars.push_back(x * y); break;
+			default: vars.push_back(x / y); break;
+		}
+	}
+
+	return vars.back();
+}
+
+
+
+	// Tape size
+
+template <typename T>
+static void BM_GradSize(benchmark::State &state) {
+	// Reverse sweep throughput against the tape size : cache cliffs show up
+	// as drops of the nodes/s rate, along with a jump of the cache misses
+	// per iteration
+
+	const int nNodes = state.range(0);
+
+	ts::WengertList<T> wList;
+	auto output = randomTape(wList, nNodes);
+	std::vector<T> buffer;
+
+	PerfCounters counters;
+	counters.start();
+	for(auto _ : state) {
+		auto grad = output.grad(std::move(buffer));
+		benchmark::DoNotOptimize(grad.getData());
+		buffer = grad.release();
+	}
+	counters.stop();
+	counters.report(state);
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+}
+
+BENCHMARK_TEMPLATE(BM_GradSize, float)->RangeMultiplier(4)->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(BM_GradSize, double)->RangeMultiplier(4)->Range(1 << 10, 1 << 22);
+
+
+
+	// Thread count
+
+template <typename T>
+static void BM_GradThreads(benchmark::State &state) {
+	// Parallel reverse sweep (Var::grad(nThreads)) of a wide tape : 4096
+	// independent chains of 256 nodes, summed at the end
+
+	const int nThreads = state.range(0);
+	const int nChains = 4096;
+	const int chainLength = 256;
+
+	ts::WengertList<T> wList;
+	std::vector<ts::Var<T>> inputs;
+	for(int j = 0; j < 16; j++) {
+		inputs.push_back(ts::NewVar((T) (1.0 + 0.01 * j), &wList));
+	}
+
+	ts::Var<T> output((T) 0.0, NULL);
+	for(int k = 0; k < nChains; k++) {
+		ts::Var<T> chain = inputs[k % 16];
+		for(int i = 0; i < chainLength; i++) {
+			chain = chain * inputs[(k + i) % 16] - inputs[i % 16];
+		}
+		output = output + chain;
+	}
+	const int nNodes = wList.size();
+
+	PerfCounters counters;
+	counters.start();
+	for(auto _ : state) {
+		auto grad = output.grad(nThreads);
+		benchmark::DoNotOptimize(grad.getData());
+	}
+	counters.stop();
+	counters.report(state);
+
+	state.SetItemsProcessed(state.iterations() * nNodes);
+}
+
+BENCHMARK_TEMPLATE(BM_GradThreads, float)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_GradThreads, double)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+
+
+	// Code paths
+
+enum class Path {Tape, Fused, TensorScalar, TensorSimd};
+
+template <typename T, Path path>
+static void BM_Path(benchmark::State &state) {
+	// Forward and backward of sum(x * y + x / y) on n elements, computed by
+	// the scalar engine (one node per operation, or one fused node per
+	// element) or by the tensor engine (with the scalar kernels, or the best
+	// instruction set of the CPU)
+
+	const int n = state.range(0);
+
+	std::vector<T> xValues(n), yValues(n);
+	ts::Tensor<T> xTensor({n}), yTensor({n});
+	for(int i = 0; i < n; i++) {
+		xTensor[i] = xValues[i] = (T) rand() / (T) RAND_MAX + 0.5;
+		yTensor[i] = yValues[i] = (T) rand() / (T) RAND_MAX + 0.5;
+	}
+
+	const ts::kernels::Isa isa = ts::kernels::getIsa();
+	if(path == Path::TensorScalar) {
+		ts::kernels::setIsa(ts::kernels::Isa::Scalar);
+	}
+
+	ts::WengertList<T> wList;
+	wList.reserve(5 * n + 2);
+	ts::TensorList<T> tensorList;
+
+	PerfCounters counters;
+	counters.start();
+	for(auto _ : state) {
+		if(path == Path::Tape || path == Path::Fused) {
+			wList.reset();
+			ts::Var<T> res((T) 0.0, NULL);
+			for(int i = 0; i < n; i++) {
+				auto x = ts::NewVar(xValues[i], &wList);
+				auto y = ts::NewVar(yValues[i], &wList);
+				if(path == Path::Fused) {
+					res = ts::lazy(x) * y + ts::lazy(x) / y + res;
+				} else {
+					res = x * y + x / y + res;
+				}
+			}
+			auto grad = res.grad();
+			benchmark::DoNotOptimize(grad.getData());
+		} else {
+			tensorList.reset();
+			auto x = ts::NewTensorVar(xTensor, &tensorList);
+			auto y = ts::NewTensorVar(yTensor, &tensorList);
+			auto grad = ts::sum(x * y + x / y).grad();
+			benchmark::DoNotOptimize(grad);
+		}
+	}
+	counters.stop();
+	counters.report(state);
+
+	ts::kernels::setIsa(isa);
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK_TEMPLATE(BM_Path, float, Path::Tape)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_Path, float, Path::Fused)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_Path, float, Path::TensorScalar)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_Path, float, Path::TensorSimd)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_Path, double, Path::Tape)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_Path, double, Path::Fused)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_Path, double, Path::TensorScalar)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_Path, double, Path::TensorSimd)->Arg(1 << 16);
+
+
+
+BENCHMARK_MAIN();
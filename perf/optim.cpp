@@ -0,0 +1,92 @@
+/*
+* Benchmarks for the optimizers
+*
+* Results can be exported as JSON with the --benchmark_format=json or
+* --benchmark_out=<file> options (see `make run_perf`).
+*/
+
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <stdlib.h>
+#include <vector>
+
+#include "../include/tensorslow.h"
+
+
+
+static std::vector<float> randomVector(int n) {
+	std::vector<float> res(n);
+	for(int i = 0; i < n; i++) {
+		res[i] = (float) rand() / (float) RAND_MAX - 0.5f;
+	}
+	return res;
+}
+
+
+
+static void BM_NaiveAdam(benchmark::State &state) {
+	// Adam written against the gradient, one Var at a time, as a baseline
+	// for BM_Adam
+
+	const int n = state.range(0);
+	std::vector<float> x = randomVector(n);
+	std::vector<float> m(n, 0.0f), v(n, 0.0f);
+
+	ts::WengertList<float> wList;
+	std::vector<ts::Var<float>> vars;
+	for(int i = 0; i < n; i++) {
+		vars.push_back(ts::NewVar(x[i], &wList));
+	}
+	ts::Var<float> y = vars[0];
+	for(int i = 1; i < n; i++) {
+		y = y + vars[i] * vars[i];
+	}
+	ts::Gradient<float> gradient = y.grad();
+
+	for(auto _ : state) {
+		for(int i = 0; i < n; i++) {
+			float g = gradient.getValue(vars[i]);
+			m[i] = 0.9f * m[i] + 0.1f * g;
+			v[i] = 0.999f * v[i] + 0.001f * g * g;
+			x[i] -= 1e-3f * m[i] / (std::sqrt(v[i]) + 1e-8f);
+		}
+		benchmark::DoNotOptimize(x.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK(BM_NaiveAdam)->RangeMultiplier(16)->Range(1 << 12, 1 << 24);
+
+
+
+static void BM_Adam(benchmark::State &state) {
+	// Fused update, reading the derivatives in place from the gradient
+
+	const int n = state.range(0);
+	ts::optim::Adam<float> adam(randomVector(n));
+	adam.setNThreads(state.range(1));
+
+	ts::WengertList<float> wList;
+	std::vector<ts::Var<float>> vars = adam.record(&wList);
+	ts::Var<float> y = vars[0];
+	for(int i = 1; i < n; i++) {
+		y = y + vars[i] * vars[i];
+	}
+	ts::Gradient<float> gradient = y.grad();
+
+	for(auto _ : state) {
+		adam.step(gradient);
+		benchmark::DoNotOptimize(adam.getParameters());
+	}
+
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK(BM_Adam)
+	->ArgsProduct({benchmark::CreateRange(1 << 12, 1 << 24, 16), {1, 4}})
+	->UseRealTime();
+
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,119 @@
+/*
+* Benchmarks for model files
+*
+* Results can be exported as JSON with the --benchmark_format=json or
+* --benchmark_out=<file> options (see `make run_perf`).
+*/
+
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "../include/tensorslow.h"
+
+
+
+// Writes a model of one parameter tensor of n values, followed by a plan of
+// about nPlanNodes nodes if nPlanNodes > 0
+static std::string writeModel(int n, int nPlanNodes = 0) {
+	ts::Tensor<float> parameters({n});
+	for(int i = 0; i < n; i++) {
+		parameters[i] = (float) rand() / (float) RAND_MAX - 0.5f;
+	}
+
+	ts::WengertList<float> wList;
+	wList.setTracing(true);
+	auto x = ts::NewVar(1.0f, &wList);
+	auto y = ts::NewVar(0.5f, &wList);
+	ts::Var<float> z = x;
+	for(int i = 0; i < nPlanNodes / 2; i++) {
+		z = ts::sin(z) * y;
+	}
+	ts::Plan<float> plan = wList.compile({x, y}, {z});
+
+	std::string path =
+		"/tmp/tensorslow-perf-" + std::to_string(n) + "-" + std::to_string(nPlanNodes) + ".tsm";
+	ts::io::Writer<float> writer;
+	writer.add("parameters", parameters);
+	if(nPlanNodes > 0) {
+		writer.add("plan", plan);
+	}
+	writer.write(path);
+	return path;
+}
+
+
+
+static void BM_ReadModel(benchmark::State &state) {
+	// Parsing the same file into a tensor with a copy, as a baseline for
+	// BM_OpenModel
+
+	const int n = state.range(0);
+	std::string path = writeModel(n);
+
+	for(auto _ : state) {
+		std::ifstream file(path, std::ios::binary);
+		std::vector<char> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		ts::Tensor<float> parameters({n});
+		std::copy(content.end() - n * sizeof(float), content.end(), (char *) parameters.getData());
+		benchmark::DoNotOptimize(parameters.getData());
+	}
+
+	std::remove(path.c_str());
+	state.SetBytesProcessed(state.iterations() * n * sizeof(float));
+}
+
+BENCHMARK(BM_ReadModel)->RangeMultiplier(16)->Range(1 << 12, 1 << 24);
+
+
+
+static void BM_OpenModel(benchmark::State &state) {
+	// Mapping the file and getting the tensor in place, which shouldn't
+	// depend on the size of the model, even when it also holds a plan of n
+	// nodes (plans are only checked by getPlan())
+
+	const int n = state.range(0);
+	std::string path = writeModel(n, state.range(1) ? n : 0);
+
+	for(auto _ : state) {
+		ts::io::Model<float> model;
+		model.open(path);
+		ts::Tensor<float> parameters = model.getTensor("parameters");
+		benchmark::DoNotOptimize(parameters.getData());
+	}
+
+	std::remove(path.c_str());
+	state.SetBytesProcessed(state.iterations() * n * sizeof(float));
+}
+
+BENCHMARK(BM_OpenModel)->ArgsProduct({benchmark::CreateRange(1 << 12, 1 << 24, 16), {0, 1}});
+
+
+
+static void BM_GetPlan(benchmark::State &state) {
+	// Loading a plan of n nodes : its operations are checked and used in
+	// place, and its buffers are copied
+
+	const int n = state.range(0);
+	std::string path = writeModel(1, n);
+
+	ts::io::Model<float> model;
+	model.open(path);
+
+	for(auto _ : state) {
+		ts::Plan<float> plan = model.getPlan("plan");
+		benchmark::DoNotOptimize(plan.size());
+	}
+
+	std::remove(path.c_str());
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK(BM_GetPlan)->RangeMultiplier(16)->Range(1 << 12, 1 << 20);
+
+
+
+BENCHMARK_MAIN();
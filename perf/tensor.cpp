@@ -0,0 +1,112 @@
+/*
+* Benchmarks for the tensor engine and its kernels
+*
+* Results can be exported as JSON with the --benchmark_format=json or
+* --benchmark_out=<file> options (see `make run_perf`).
+*/
+
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "../include/tensorslow.h"
+
+
+
+static ts::Tensor<float> randomTensor(std::vector<int> shape) {
+	ts::Tensor<float> res(shape);
+	for(int i = 0; i < res.size(); i++) {
+		res[i] = (float) rand() / (float) RAND_MAX - 0.5f;
+	}
+	return res;
+}
+
+
+
+static void BM_ElementwiseGrad(benchmark::State &state) {
+	// Forward and backward of sum(x * y + x / y), against the tensor size
+
+	const int n = state.range(0);
+	ts::Tensor<float> xVal = randomTensor({n});
+	ts::Tensor<float> yVal = randomTensor({n});
+
+	ts::TensorList<float> list;
+
+	for(auto _ : state) {
+		list.reset();
+		auto x = ts::NewTensorVar(xVal, &list);
+		auto y = ts::NewTensorVar(yVal, &list);
+
+		auto res = ts::sum(x * y + x / y);
+		auto grad = res.grad();
+		benchmark::DoNotOptimize(grad);
+	}
+
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK(BM_ElementwiseGrad)->RangeMultiplier(16)->Range(256, 1 << 24);
+
+
+
+static void BM_Gemm(benchmark::State &state) {
+	// Square matrix product, in FLOP/s
+
+	const int n = state.range(0);
+	ts::Tensor<float> a = randomTensor({n, n});
+	ts::Tensor<float> b = randomTensor({n, n});
+	ts::Tensor<float> c({n, n}, 0.0f);
+
+	for(auto _ : state) {
+		ts::kernels::gemm(false, false, n, n, n, a.getData(), b.getData(), c.getData());
+		benchmark::ClobberMemory();
+	}
+
+	state.counters["flops"] = benchmark::Counter(
+		2.0 * n * n * n * state.iterations(), benchmark::Counter::kIsRate
+	);
+}
+
+BENCHMARK(BM_Gemm)->RangeMultiplier(2)->Range(64, 1024)->Unit(benchmark::kMillisecond);
+
+
+
+static void BM_Mlp(benchmark::State &state) {
+	// Forward + backward of a 2 layers perceptron (squared activation, since
+	// it only uses the arithmetic operators) with a squared error loss
+
+	const int batch = state.range(0);
+	const int inputs = 784;
+	const int hidden = 256;
+	const int outputs = 10;
+
+	ts::Tensor<float> x = randomTensor({batch, inputs});
+	ts::Tensor<float> target = randomTensor({batch, outputs});
+	ts::Tensor<float> w1 = randomTensor({inputs, hidden});
+	ts::Tensor<float> w2 = randomTensor({hidden, outputs});
+
+	ts::TensorList<float> list;
+
+	for(auto _ : state) {
+		list.reset();
+		auto xVar = ts::NewTensorVar(x, &list);
+		auto targetVar = ts::NewTensorVar(target, &list);
+		auto w1Var = ts::NewTensorVar(w1, &list);
+		auto w2Var = ts::NewTensorVar(w2, &list);
+
+		auto h = ts::matmul(xVar, w1Var);
+		auto error = ts::matmul(h * h, w2Var) - targetVar;
+		auto loss = ts::sum(error * error);
+
+		auto grad = loss.grad();
+		benchmark::DoNotOptimize(grad);
+	}
+
+	state.SetItemsProcessed(state.iterations() * batch);
+}
+
+BENCHMARK(BM_Mlp)->RangeMultiplier(4)->Range(16, 256)->Unit(benchmark::kMillisecond);
+
+
+
+BENCHMARK_MAIN();
@@ -1,216 +1,17 @@
 /*
 * General automatic differentiation engine based on a Wengert list
-* implementation. Reverse mode only.
+* implementation, in reverse mode. It is also instantiated on the dual numbers
+* of dual.hpp, so that tapes of Duals give forward-over-reverse derivatives.
 */
 
-#include "../include/autodiff.hpp"
+#include "../include/autodiff_impl.hpp"
+#include "../include/dual.hpp"
 
 
-	// ts::Node
 
-template <typename T>
-ts::Node<T>::Node() {
-
-};
-
-
-
-template <typename T>
-ts::Node<T>::Node(T xVal, int xDep) {
-	values =  {xVal};	// [da/dx]
-	dependencies =  {xDep};
-}
-
-
-
-template <typename T>
-ts::Node<T>::Node(T xVal, int xDep, T yVal, int yDep) {
-	values =  {xVal, yVal};	// [da/dx, da/dy]
-	dependencies =  {xDep, yDep};
-}
-
-
-
-	// ts::WengertList
-
-template <typename T>
-int ts::WengertList<T>::size() {
-	return nodes.size();
-}
-
-
-
-	// ts::Var
-
-template <typename T>
-ts::Var<T>::Var(T newValue, ts::WengertList<T> * newWList) {
-	value = newValue;
-
-	wList = newWList;
-
-	if(wList != NULL) {
-		// Add new Var to the Wengert list
-		index = wList->nodes.size();
-		wList->nodes.push_back(ts::Node<T>());	// Node without dependencies (input var)
-	} else {
-		index = -1;
-	}
-}
-
-
-
-template <typename T>
-ts::Var<T>::Var(T newValue, ts::WengertList<T> * newWList, ts::Node<T> node) {
-	value = newValue;
-
-	wList = newWList;
-
-	if(wList != NULL) {
-		// Add new Var to the Wengert list
-		index = wList->nodes.size();
-		wList->nodes.push_back(node);	// This node can contain dependencies & values
-	} else {
-		index = -1;
-	}
-}
-
-
-
-// Helper function to create new instances without syntax template
-template <typename T>
-ts::Var<T> ts::NewVar(T newValue, ts::WengertList<T> * newWList) {
-	return ts::Var<T>(newValue, newWList);
-}
-
-
-
-template <typename T>
-T ts::Var<T>::getValue() {
-	return value;
-}
-
-
-
-template <typename T>
-ts::Gradient<T> ts::Var<T>::grad() {
-	// Computes the gradient of all Wengert list's nodes with respect to this
-	// variable. Derivatives are stored in a vector wich size equals the
-	// Wengert list's.
-
-	std::vector<T> derivatives(wList->nodes.size(), 0.0);
-	derivatives[index] = 1.0;
-
-
-	// Iterate over the Wengert list backwards
-	for (unsigned i = wList->nodes.size(); i > 0; i--) {
-		ts::Node<T> * node = &(wList->nodes[i]);
-		T derivative = derivatives[i];
-
-		// Increment parent nodes
-		for(unsigned j = 0; j < node->dependencies.size(); j++) {
-			derivatives[node->dependencies[j]] += node->values[j] * derivative;
-		}
-	}
-
-	return ts::Gradient<T>(derivatives);
-}
-
-
-
-	// ts::Gradient
-
-template <typename T>
-ts::Gradient<T>::Gradient(std::vector<T> newDerivatives) {
-	derivatives = newDerivatives;
-}
-
-
-
-template <typename T>
-T ts::Gradient<T>::getValue(ts::Var<T> a) {
-	return derivatives[a.index];
-}
-
-
-
-	// Overloaded arithmetic operators
-
-template <typename T>
-ts::Var<T> ts::operator+(const ts::Var<T> &x, const ts::Var<T> &y){
-	if(x.wList != y.wList) {
-		return ts::Var<T>(0.0, NULL);
-	}
-
-	// a = x + y
-	// da / dx = 1
-	// a / dy = 1
-	return ts::Var<T>(
-		x.value + y.value,
-		x.wList,
-		ts::Node<T>(1.0, x.index, 1.0, y.index)
-	);
-}
-
-
-
-template <typename T>
-ts::Var<T> ts::operator-(const ts::Var<T> &x, const ts::Var<T> &y){
-	if(x.wList != y.wList) {
-		return ts::Var<T>(0.0, NULL);
-	}
-
-	// a = x - y
-	// da / dx = 1
-	// a / dy = -1
-	return ts::Var<T>(
-		x.value - y.value,
-		x.wList,
-		ts::Node<T>(1.0, x.index, -1.0, y.index)
-	);
-}
-
-
-
-template <typename T>
-ts::Var<T> ts::operator*(const ts::Var<T> &x, const ts::Var<T> &y){
-	if(x.wList != y.wList) {
-		return Var<T>(0.0, NULL);
-	}
-
-	// a = x * y
-	// da / dx = y
-	// a / dy = x
-	return ts::Var<T>(
-		x.value * y.value,
-		x.wList,
-		ts::Node<T>(y.value, x.index, x.value, y.index)
-	);
-}
-
-
-
-template <typename T>
-ts::Var<T> ts::operator/(const ts::Var<T> &x, const ts::Var<T> &y){
-	if(x.wList != y.wList) {
-		return ts::Var<T>(0.0, NULL);
-	}
-
-	// a = x / y
-	// da / dx = 1 / y
-	// a / dy = -x / y^2
-	return ts::Var<T>(
-		x.value + y.value,
-		x.wList,
-		ts::Node<T>(1.0 / y.value, x.index, -x.value / (y.value * y.value), y.index)
-	);
-}
-
-
-
-// Add data types support manually (the compiler would need an implementation
-// directly in the header file otherwise).
-// This method has the advantage of forbidding non-numeric data types like
-// strings, etc... as well as keeping the source code in this .cpp file.
+// Add data types support manually, so that users of the prebuilt library
+// don't need the implementation (see autodiff_impl.hpp for the header-only
+// mode, which supports any scalar type).
 // More data types may be added in the future.
 
 	// float
@@ -218,19 +19,117 @@ template class ts::Node<float>;
 template class ts::WengertList<float>;
 template class ts::Var<float>;
 template class ts::Gradient<float>;
+template class ts::Jacobian<float>;
+template class ts::Plan<float>;
+template class ts::NoGrad<float>;
 template ts::Var<float> ts::NewVar(float newValue, ts::WengertList<float> * newWList);
 template ts::Var<float> ts::operator+(const ts::Var<float> &x, const ts::Var<float> &y);
 template ts::Var<float> ts::operator-(const ts::Var<float> &x, const ts::Var<float> &y);
 template ts::Var<float> ts::operator*(const ts::Var<float> &x, const ts::Var<float> &y);
 template ts::Var<float> ts::operator/(const ts::Var<float> &x, const ts::Var<float> &y);
+template ts::Var<float> ts::operator+(const ts::Var<float> &x, float c);
+template ts::Var<float> ts::operator+(float c, const ts::Var<float> &x);
+template ts::Var<float> ts::operator-(const ts::Var<float> &x, float c);
+template ts::Var<float> ts::operator-(float c, const ts::Var<float> &x);
+template ts::Var<float> ts::operator*(const ts::Var<float> &x, float c);
+template ts::Var<float> ts::operator*(float c, const ts::Var<float> &x);
+template ts::Var<float> ts::operator/(const ts::Var<float> &x, float c);
+template ts::Var<float> ts::operator/(float c, const ts::Var<float> &x);
+template ts::Var<float> ts::exp(const ts::Var<float> &x);
+template ts::Var<float> ts::log(const ts::Var<float> &x);
+template ts::Var<float> ts::sin(const ts::Var<float> &x);
+template ts::Var<float> ts::cos(const ts::Var<float> &x);
+template ts::Var<float> ts::tanh(const ts::Var<float> &x);
+template ts::Var<float> ts::sqrt(const ts::Var<float> &x);
+template ts::Var<float> ts::pow(const ts::Var<float> &x, const ts::Var<float> &y);
+template ts::Var<float> ts::pow(const ts::Var<float> &x, float p);
 
 	// double
 template class ts::Node<double>;
 template class ts::WengertList<double>;
 template class ts::Var<double>;
 template class ts::Gradient<double>;
+template class ts::Jacobian<double>;
+template class ts::Plan<double>;
+template class ts::NoGrad<double>;
 template ts::Var<double> ts::NewVar(double newValue, ts::WengertList<double> * newWList);
 template ts::Var<double> ts::operator+(const ts::Var<double> &x, const ts::Var<double> &y);
 template ts::Var<double> ts::operator-(const ts::Var<double> &x, const ts::Var<double> &y);
 template ts::Var<double> ts::operator*(const ts::Var<double> &x, const ts::Var<double> &y);
 template ts::Var<double> ts::operator/(const ts::Var<double> &x, const ts::Var<double> &y);
+template ts::Var<double> ts::operator+(const ts::Var<double> &x, double c);
+template ts::Var<double> ts::operator+(double c, const ts::Var<double> &x);
+template ts::Var<double> ts::operator-(const ts::Var<double> &x, double c);
+template ts::Var<double> ts::operator-(double c, const ts::Var<double> &x);
+template ts::Var<double> ts::operator*(const ts::Var<double> &x, double c);
+template ts::Var<double> ts::operator*(double c, const ts::Var<double> &x);
+template ts::Var<double> ts::operator/(const ts::Var<double> &x, double c);
+template ts::Var<double> ts::operator/(double c, const ts::Var<double> &x);
+template ts::Var<double> ts::exp(const ts::Var<double> &x);
+template ts::Var<double> ts::log(const ts::Var<double> &x);
+template ts::Var<double> ts::sin(const ts::Var<double> &x);
+template ts::Var<double> ts::cos(const ts::Var<double> &x);
+template ts::Var<double> ts::tanh(const ts::Var<double> &x);
+template ts::Var<double> ts::sqrt(const ts::Var<double> &x);
+template ts::Var<double> ts::pow(const ts::Var<double> &x, const ts::Var<double> &y);
+template ts::Var<double> ts::pow(const ts::Var<double> &x, double p);
+
+	// ts::Dual<float> (forward-over-reverse mode)
+template class ts::Node<ts::Dual<float>>;
+template class ts::WengertList<ts::Dual<float>>;
+template class ts::Var<ts::Dual<float>>;
+template class ts::Gradient<ts::Dual<float>>;
+template class ts::Jacobian<ts::Dual<float>>;
+template class ts::Plan<ts::Dual<float>>;
+template class ts::NoGrad<ts::Dual<float>>;
+template ts::Var<ts::Dual<float>> ts::NewVar(ts::Dual<float> newValue, ts::WengertList<ts::Dual<float>> * newWList);
+template ts::Var<ts::Dual<float>> ts::operator+(const ts::Var<ts::Dual<float>> &x, const ts::Var<ts::Dual<float>> &y);
+template ts::Var<ts::Dual<float>> ts::operator-(const ts::Var<ts::Dual<float>> &x, const ts::Var<ts::Dual<float>> &y);
+template ts::Var<ts::Dual<float>> ts::operator*(const ts::Var<ts::Dual<float>> &x, const ts::Var<ts::Dual<float>> &y);
+template ts::Var<ts::Dual<float>> ts::operator/(const ts::Var<ts::Dual<float>> &x, const ts::Var<ts::Dual<float>> &y);
+template ts::Var<ts::Dual<float>> ts::operator+(const ts::Var<ts::Dual<float>> &x, ts::Dual<float> c);
+template ts::Var<ts::Dual<float>> ts::operator+(ts::Dual<float> c, const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::operator-(const ts::Var<ts::Dual<float>> &x, ts::Dual<float> c);
+template ts::Var<ts::Dual<float>> ts::operator-(ts::Dual<float> c, const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::operator*(const ts::Var<ts::Dual<float>> &x, ts::Dual<float> c);
+template ts::Var<ts::Dual<float>> ts::operator*(ts::Dual<float> c, const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::operator/(const ts::Var<ts::Dual<float>> &x, ts::Dual<float> c);
+template ts::Var<ts::Dual<float>> ts::operator/(ts::Dual<float> c, const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::exp(const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::log(const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::sin(const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::cos(const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::tanh(const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::sqrt(const ts::Var<ts::Dual<float>> &x);
+template ts::Var<ts::Dual<float>> ts::pow(const ts::Var<ts::Dual<float>> &x, const ts::Var<ts::Dual<float>> &y);
+template ts::Var<ts::Dual<float>> ts::pow(const ts::Var<ts::Dual<float>> &x, ts::Dual<float> p);
+
+	// ts::Dual<double> (forward-over-reverse mode)
+template class ts::Node<ts::Dual<double>>;
+template class ts::WengertList<ts::Dual<double>>;
+template class ts::Var<ts::Dual<double>>;
+template class ts::Gradient<ts::Dual<double>>;
+template class ts::Jacobian<ts::Dual<double>>;
+template class ts::Plan<ts::Dual<double>>;
+template class ts::NoGrad<ts::Dual<double>>;
+template ts::Var<ts::Dual<double>> ts::NewVar(ts::Dual<double> newValue, ts::WengertList<ts::Dual<double>> * newWList);
+template ts::Var<ts::Dual<double>> ts::operator+(const ts::Var<ts::Dual<double>> &x, const ts::Var<ts::Dual<double>> &y);
+template ts::Var<ts::Dual<double>> ts::operator-(const ts::Var<ts::Dual<double>> &x, const ts::Var<ts::Dual<double>> &y);
+template ts::Var<ts::Dual<double>> ts::operator*(const ts::Var<ts::Dual<double>> &x, const ts::Var<ts::Dual<double>> &y);
+template ts::Var<ts::Dual<double>> ts::operator/(const ts::Var<ts::Dual<double>> &x, const ts::Var<ts::Dual<double>> &y);
+template ts::Var<ts::Dual<double>> ts::operator+(const ts::Var<ts::Dual<double>> &x, ts::Dual<double> c);
+template ts::Var<ts::Dual<double>> ts::operator+(ts::Dual<double> c, const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::operator-(const ts::Var<ts::Dual<double>> &x, ts::Dual<double> c);
+template ts::Var<ts::Dual<double>> ts::operator-(ts::Dual<double> c, const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::operator*(const ts::Var<ts::Dual<double>> &x, ts::Dual<double> c);
+template ts::Var<ts::Dual<double>> ts::operator*(ts::Dual<double> c, const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::operator/(const ts::Var<ts::Dual<double>> &x, ts::Dual<double> c);
+template ts::Var<ts::Dual<double>> ts::operator/(ts::Dual<double> c, const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::exp(const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::log(const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::sin(const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::cos(const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::tanh(const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::sqrt(const ts::Var<ts::Dual<double>> &x);
+template ts::Var<ts::Dual<double>> ts::pow(const ts::Var<ts::Dual<double>> &x, const ts::Var<ts::Dual<double>> &y);
+template ts::Var<ts::Dual<double>> ts::pow(const ts::Var<ts::Dual<double>> &x, ts::Dual<double> p);
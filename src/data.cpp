@@ -0,0 +1,429 @@
+/*
+* Input pipeline for training on large datasets. A ts::data::Dataset holds
+* samples (features and targets) in memory or in a memory-mapped binary
+* file. A ts::data::Loader shuffles them and assembles mini-batches in
+* background threads, ahead of the training loop. Batches are handed out
+* through a bounded lock-free queue, as views over a pool of reusable
+* tensors, so that loading the next batches overlaps with the forward and
+* backward passes on the current one.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "../include/data.hpp"
+#include "../include/tape.hpp"	// TS_HAS_MMAP and its headers
+
+
+	// ts::data::Dataset
+
+template <typename T>
+ts::data::Dataset<T>::Dataset() {
+
+}
+
+
+
+template <typename T>
+ts::data::Dataset<T>::Dataset(
+	const std::vector<T> &features, const std::vector<T> &targets,
+	int newNFeatures, int newNTargets
+) {
+	if(newNFeatures <= 0 || newNTargets < 0 || features.size() % newNFeatures != 0) {
+		return;
+	}
+
+	int newNSamples = features.size() / newNFeatures;
+	if(targets.size() != (size_t) newNSamples * newNTargets) {
+		return;
+	}
+
+	// Features and targets are interleaved, so that each sample is read from
+	// a single place
+	const int stride = newNFeatures + newNTargets;
+	records.resize((size_t) newNSamples * stride);
+	for(int i = 0; i < newNSamples; i++) {
+		std::copy(
+			features.begin() + (size_t) i * newNFeatures, features.begin() + (size_t) (i + 1) * newNFeatures,
+			records.begin() + (size_t) i * stride
+		);
+		std::copy(
+			targets.begin() + (size_t) i * newNTargets, targets.begin() + (size_t) (i + 1) * newNTargets,
+			records.begin() + (size_t) i * stride + newNFeatures
+		);
+	}
+
+	data = records.data();
+	nSamples = newNSamples;
+	nFeatures = newNFeatures;
+	nTargets = newNTargets;
+}
+
+
+
+template <typename T>
+ts::data::Dataset<T>::~Dataset() {
+	close();
+}
+
+
+
+template <typename T>
+void ts::data::Dataset<T>::close() {
+#ifdef TS_HAS_MMAP
+	if(mapping != NULL) {
+		munmap(mapping, mappingBytes);
+	}
+#endif
+
+	mapping = NULL;
+	mappingBytes = 0;
+	records.clear();
+	records.shrink_to_fit();
+	data = NULL;
+	nSamples = nFeatures = nTargets = 0;
+}
+
+
+
+template <typename T>
+bool ts::data::Dataset<T>::open(const std::string &path, int newNFeatures, int newNTargets, bool map) {
+	close();
+
+	if(newNFeatures <= 0 || newNTargets < 0) {
+		return false;
+	}
+
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if(!file) {
+		return false;
+	}
+
+	const size_t bytes = file.tellg();
+	const size_t recordBytes = (newNFeatures + newNTargets) * sizeof(T);
+	if(bytes == 0 || bytes % recordBytes != 0) {
+		return false;
+	}
+
+#ifdef TS_HAS_MMAP
+	if(map) {
+		int descriptor = ::open(path.c_str(), O_RDONLY);
+		if(descriptor < 0) {
+			return false;
+		}
+
+		// The mapping stays valid once the file is closed
+		void * newMapping = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		::close(descriptor);
+		if(newMapping == MAP_FAILED) {
+			return false;
+		}
+
+		mapping = newMapping;
+		mappingBytes = bytes;
+		data = (const T *) mapping;
+	}
+#endif
+
+	if(mapping == NULL) {
+		records.resize(bytes / sizeof(T));
+		file.seekg(0);
+		if(!file.read((char *) records.data(), bytes)) {
+			records.clear();
+			return false;
+		}
+		data = records.data();
+	}
+
+	nSamples = bytes / recordBytes;
+	nFeatures = newNFeatures;
+	nTargets = newNTargets;
+	return true;
+}
+
+
+
+template <typename T>
+bool ts::data::Dataset<T>::write(const std::string &path) const {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if(!file) {
+		return false;
+	}
+
+	size_t bytes = (size_t) nSamples * (nFeatures + nTargets) * sizeof(T);
+	file.write((const char *) data, bytes);
+	return (bool) file;
+}
+
+
+
+template <typename T>
+int ts::data::Dataset<T>::size() const {
+	return nSamples;
+}
+
+
+
+template <typename T>
+int ts::data::Dataset<T>::getNFeatures() const {
+	return nFeatures;
+}
+
+
+
+template <typename T>
+int ts::data::Dataset<T>::getNTargets() const {
+	return nTargets;
+}
+
+
+
+template <typename T>
+bool ts::data::Dataset<T>::isMapped() const {
+	return mapping != NULL;
+}
+
+
+
+template <typename T>
+const T * ts::data::Dataset<T>::getFeatures(int i) const {
+	return data + (size_t) i * (nFeatures + nTargets);
+}
+
+
+
+template <typename T>
+const T * ts::data::Dataset<T>::getTargets(int i) const {
+	return data + (size_t) i * (nFeatures + nTargets) + nFeatures;
+}
+
+
+
+	// ts::data::Batch
+
+namespace {
+	// Tensor using the values of a loader buffer, and keeping the buffer
+	// alive
+	template <typename T>
+	ts::internal::Storage<T> borrow(const std::shared_ptr<ts::Tensor<T>> &buffer) {
+		return ts::internal::Storage<T>(buffer->getData(), buffer->size(), buffer);
+	}
+}
+
+
+
+template <typename T>
+ts::Tensor<T> ts::data::Batch<T>::borrowFeatures() const {
+	ts::Tensor<T> res;
+	if(features != NULL) {
+		res.shape = features->shape;
+		res.data = borrow(features);
+	}
+	return res;
+}
+
+
+
+template <typename T>
+ts::Tensor<T> ts::data::Batch<T>::borrowTargets() const {
+	ts::Tensor<T> res;
+	if(targets != NULL) {
+		res.shape = targets->shape;
+		res.data = borrow(targets);
+	}
+	return res;
+}
+
+
+
+	// ts::data::Loader
+
+namespace {
+	// Each worker may hold a buffer while the training loop holds another
+	// one, so there is always one more to fill
+	int getNBuffers(int nWorkers, int nBuffers) {
+		return std::max(nBuffers, std::max(1, nWorkers) + 2);
+	}
+}
+
+
+
+template <typename T>
+ts::data::Loader<T>::Loader(
+	const ts::data::Dataset<T> &newDataset, int newBatchSize, bool newShuffle,
+	int nWorkers, int nBuffers, unsigned seed
+) :
+	dataset(newDataset), batchSize(std::max(1, newBatchSize)), shuffle(newShuffle),
+	freeBuffers(getNBuffers(nWorkers, nBuffers)), readyBuffers(getNBuffers(nWorkers, nBuffers)),
+	generator(seed), ticket(0), stopping(false) {
+
+	nBuffers = getNBuffers(nWorkers, nBuffers);
+	nWorkers = std::max(1, nWorkers);
+	nBatches = dataset.size() / batchSize;
+
+	// Buffers are allocated once, and overwritten by each batch
+	for(int i = 0; i < nBuffers; i++) {
+		features.push_back(std::make_shared<ts::Tensor<T>>(std::vector<int>({batchSize, dataset.getNFeatures()})));
+		targets.push_back(std::make_shared<ts::Tensor<T>>(std::vector<int>({batchSize, dataset.getNTargets()})));
+		batchIndices.push_back(-1);
+		freeBuffers.push(i);
+	}
+
+	order.resize(dataset.size());
+	for(int i = 0; i < dataset.size(); i++) {
+		order[i] = i;
+	}
+
+	epoch = -1;
+	startEpoch();
+
+	for(int i = 0; i < nWorkers; i++) {
+		workers.push_back(std::thread(&ts::data::Loader<T>::work, this));
+	}
+}
+
+
+
+template <typename T>
+ts::data::Loader<T>::~Loader() {
+	stopping.store(true);
+	for(unsigned i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+
+
+template <typename T>
+void ts::data::Loader<T>::startEpoch() {
+	// Only called once every batch of the previous epoch was received, so no
+	// worker is reading the order anymore
+
+	if(shuffle) {
+		std::shuffle(order.begin(), order.end(), generator);
+	}
+
+	epoch++;
+	nDelivered = 0;
+	ticket.store((uint64_t) epoch << 32, std::memory_order_release);
+}
+
+
+
+template <typename T>
+void ts::data::Loader<T>::work() {
+	const int nFeatures = dataset.getNFeatures();
+	const int nTargets = dataset.getNTargets();
+
+	while(!stopping.load(std::memory_order_relaxed)) {
+		// Get a buffer to fill
+		int buffer;
+		ts::internal::Backoff backoff;
+		while(!freeBuffers.pop(buffer)) {
+			if(stopping.load(std::memory_order_relaxed)) {
+				return;
+			}
+			backoff.wait();
+		}
+
+		// Claim the next batch of the epoch, waiting for the next epoch if
+		// they were all claimed
+		uint64_t claimed = ticket.load(std::memory_order_acquire);
+		backoff = ts::internal::Backoff();
+		while(
+			(int) (claimed & 0xFFFFFFFF) >= nBatches ||
+			!ticket.compare_exchange_weak(claimed, claimed + 1, std::memory_order_acq_rel)
+		) {
+			if(stopping.load(std::memory_order_relaxed)) {
+				return;
+			}
+			if((int) (claimed & 0xFFFFFFFF) >= nBatches) {
+				backoff.wait();
+				claimed = ticket.load(std::memory_order_acquire);
+			}
+		}
+
+		// Gather the samples of the batch
+		const int batch = claimed & 0xFFFFFFFF;
+		T * batchFeatures = features[buffer]->getData();
+		T * batchTargets = targets[buffer]->getData();
+
+		for(int i = 0; i < batchSize; i++) {
+			int sample = order[batch * batchSize + i];
+			std::memcpy(batchFeatures + i * nFeatures, dataset.getFeatures(sample), nFeatures * sizeof(T));
+			std::memcpy(batchTargets + i * nTargets, dataset.getTargets(sample), nTargets * sizeof(T));
+		}
+		batchIndices[buffer] = batch;
+
+		// Can't fail : there are as many cells as buffers
+		readyBuffers.push(buffer);
+	}
+}
+
+
+
+template <typename T>
+int ts::data::Loader<T>::getBatchSize() const {
+	return batchSize;
+}
+
+
+
+template <typename T>
+int ts::data::Loader<T>::getNBatches() const {
+	return nBatches;
+}
+
+
+
+template <typename T>
+int ts::data::Loader<T>::getEpoch() const {
+	return epoch;
+}
+
+
+
+template <typename T>
+bool ts::data::Loader<T>::next(ts::data::Batch<T> &batch) {
+	if(current >= 0) {
+		freeBuffers.push(current);
+		current = -1;
+	}
+
+	batch.features.reset();
+	batch.targets.reset();
+	batch.index = -1;
+
+	if(nDelivered == nBatches) {
+		startEpoch();
+		return false;
+	}
+
+	ts::internal::Backoff backoff;
+	while(!readyBuffers.pop(current)) {
+		backoff.wait();
+	}
+	nDelivered++;
+
+	batch.features = features[current];
+	batch.targets = targets[current];
+	batch.index = batchIndices[current];
+	return true;
+}
+
+
+
+// Add data types support manually (the compiler would need an implementation
+// directly in the header file otherwise).
+// More data types may be added in the future.
+
+	// float
+template class ts::data::Dataset<float>;
+template class ts::data::Batch<float>;
+template class ts::data::Loader<float>;
+
+	// double
+template class ts::data::Dataset<double>;
+template class ts::data::Batch<double>;
+template class ts::data::Loader<double>;
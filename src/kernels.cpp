@@ -0,0 +1,1024 @@
+/*
+* Vectorized kernels working on contiguous buffers, used by the tensor engine.
+* Each kernel has SSE2, AVX2 and AVX-512 implementations on x86-64 (NEON on
+* ARM64) as well as a scalar fallback. The best instruction set supported by
+* the CPU is selected at runtime, so the library doesn't need to be built
+* with any -march flag.
+*/
+
+#include "../include/kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+
+	// Dispatch tables
+
+namespace ts {
+	namespace kernels {
+		template <typename T>
+		struct Table {
+			void (*add)(int, const T *, const T *, T *);
+			void (*sub)(int, const T *, const T *, T *);
+			void (*mul)(int, const T *, const T *, T *);
+			void (*div)(int, const T *, const T *, T *);
+			T (*sum)(int, const T *);
+			T (*dot)(int, const T *, const T *);
+			void (*shift)(int, T, T *);
+			void (*axpy)(int, T, const T *, T *);
+			void (*mulAdjoint)(int, const T *, const T *, T *);
+			void (*divAdjoint)(int, const T *, const T *, const T *, T *, T *);
+			void (*fastExp)(int, const T *, T *);
+			void (*fastTanh)(int, const T *, T *);
+			void (*logAdjoint)(int, const T *, const T *, T *);
+			void (*tanhAdjoint)(int, const T *, const T *, T *);
+			void (*fastSigmoid)(int, const T *, T *);
+			void (*relu)(int, const T *, T *);
+			void (*sigmoidAdjoint)(int, const T *, const T *, T *);
+			void (*momentumUpdate)(int, T, T, const T *, T *, T *);
+			void (*adamUpdate)(int, T, T, T, T, const T *, T *, T *, T *);
+			void (*gemm)(bool, bool, int, int, int, const T *, const T *, T *);
+		};
+	}
+}
+
+
+
+	// Scalar fallback
+
+namespace scalar {
+	template <typename T>
+	struct Vec {
+		typedef T Scalar;
+		typedef T Reg;
+		static const int width = 1;
+
+		static inline Reg load(const T * p) { return *p; }
+		static inline void store(T * p, Reg a) { *p = a; }
+		static inline Reg set(T s) { return s; }
+		static inline Reg zero() { return 0.0; }
+		static inline Reg add(Reg a, Reg b) { return a + b; }
+		static inline Reg sub(Reg a, Reg b) { return a - b; }
+		static inline Reg mul(Reg a, Reg b) { return a * b; }
+		static inline Reg div(Reg a, Reg b) { return a / b; }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return a * b + c; }
+		static inline T reduce(Reg a) { return a; }
+		static inline Reg min(Reg a, Reg b) { return std::min(a, b); }
+		static inline Reg max(Reg a, Reg b) { return std::max(a, b); }
+		static inline Reg sqrt(Reg a) { return std::sqrt(a); }
+		static inline Reg round(Reg a) { return std::nearbyint(a); }
+		static inline Reg pow2(Reg n) { return std::ldexp((T) 1.0, (int) n); }
+	};
+
+	#include "kernels_generic.hpp"
+
+
+	// Conversions (also used for the tails of the vectorized ones)
+
+	void toBFloat16(int n, const float * x, uint16_t * res) {
+		for(int i = 0; i < n; i++) {
+			res[i] = ts::kernels::toBFloat16(x[i]);
+		}
+	}
+
+	void fromBFloat16(int n, const uint16_t * x, float * res) {
+		for(int i = 0; i < n; i++) {
+			res[i] = ts::kernels::fromBFloat16(x[i]);
+		}
+	}
+
+	void toHalf(int n, const float * x, uint16_t * res) {
+		for(int i = 0; i < n; i++) {
+			res[i] = ts::kernels::toHalf(x[i]);
+		}
+	}
+
+	void fromHalf(int n, const uint16_t * x, float * res) {
+		for(int i = 0; i < n; i++) {
+			res[i] = ts::kernels::fromHalf(x[i]);
+		}
+	}
+}
+
+
+
+#if defined(__x86_64__)
+
+	// SSE2 (always available on x86-64)
+
+namespace sse2 {
+	struct Float {
+		typedef float Scalar;
+		typedef __m128 Reg;
+		static const int width = 4;
+
+		static inline Reg load(const float * p) { return _mm_loadu_ps(p); }
+		static inline void store(float * p, Reg a) { _mm_storeu_ps(p, a); }
+		static inline Reg set(float s) { return _mm_set1_ps(s); }
+		static inline Reg zero() { return _mm_setzero_ps(); }
+		static inline Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+		static inline Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+		static inline Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+		static inline Reg div(Reg a, Reg b) { return _mm_div_ps(a, b); }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+		static inline float reduce(Reg a) {
+			Reg shuf = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+			Reg sums = _mm_add_ps(a, shuf);
+			shuf = _mm_movehl_ps(shuf, sums);
+			return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+		}
+		static inline Reg min(Reg a, Reg b) { return _mm_min_ps(a, b); }
+		static inline Reg max(Reg a, Reg b) { return _mm_max_ps(a, b); }
+		static inline Reg sqrt(Reg a) { return _mm_sqrt_ps(a); }
+		static inline Reg round(Reg a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+		static inline Reg pow2(Reg n) {
+			__m128i e = _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127));
+			return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+		}
+	};
+
+	struct Double {
+		typedef double Scalar;
+		typedef __m128d Reg;
+		static const int width = 2;
+
+		static inline Reg load(const double * p) { return _mm_loadu_pd(p); }
+		static inline void store(double * p, Reg a) { _mm_storeu_pd(p, a); }
+		static inline Reg set(double s) { return _mm_set1_pd(s); }
+		static inline Reg zero() { return _mm_setzero_pd(); }
+		static inline Reg add(Reg a, Reg b) { return _mm_add_pd(a, b); }
+		static inline Reg sub(Reg a, Reg b) { return _mm_sub_pd(a, b); }
+		static inline Reg mul(Reg a, Reg b) { return _mm_mul_pd(a, b); }
+		static inline Reg div(Reg a, Reg b) { return _mm_div_pd(a, b); }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+		static inline double reduce(Reg a) {
+			return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+		}
+		static inline Reg min(Reg a, Reg b) { return _mm_min_pd(a, b); }
+		static inline Reg max(Reg a, Reg b) { return _mm_max_pd(a, b); }
+		static inline Reg sqrt(Reg a) { return _mm_sqrt_pd(a); }
+		static inline Reg round(Reg a) { return _mm_cvtepi32_pd(_mm_cvtpd_epi32(a)); }
+		static inline Reg pow2(Reg n) {
+			// Biased exponents are positive, so they are zero extended to 64 bits
+			__m128i e = _mm_add_epi32(_mm_cvtpd_epi32(n), _mm_set1_epi32(1023));
+			e = _mm_unpacklo_epi32(e, _mm_setzero_si128());
+			return _mm_castsi128_pd(_mm_slli_epi64(e, 52));
+		}
+	};
+
+	#include "kernels_generic.hpp"
+}
+
+
+
+	// AVX2 + FMA
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+namespace avx2 {
+	struct Float {
+		typedef float Scalar;
+		typedef __m256 Reg;
+		static const int width = 8;
+
+		static inline Reg load(const float * p) { return _mm256_loadu_ps(p); }
+		static inline void store(float * p, Reg a) { _mm256_storeu_ps(p, a); }
+		static inline Reg set(float s) { return _mm256_set1_ps(s); }
+		static inline Reg zero() { return _mm256_setzero_ps(); }
+		static inline Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+		static inline Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+		static inline Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+		static inline Reg div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+		static inline float reduce(Reg a) {
+			return sse2::Float::reduce(
+				_mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1))
+			);
+		}
+		static inline Reg min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+		static inline Reg max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+		static inline Reg sqrt(Reg a) { return _mm256_sqrt_ps(a); }
+		static inline Reg round(Reg a) {
+			return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		}
+		static inline Reg pow2(Reg n) {
+			__m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+			return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+		}
+	};
+
+	struct Double {
+		typedef double Scalar;
+		typedef __m256d Reg;
+		static const int width = 4;
+
+		static inline Reg load(const double * p) { return _mm256_loadu_pd(p); }
+		static inline void store(double * p, Reg a) { _mm256_storeu_pd(p, a); }
+		static inline Reg set(double s) { return _mm256_set1_pd(s); }
+		static inline Reg zero() { return _mm256_setzero_pd(); }
+		static inline Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+		static inline Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+		static inline Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+		static inline Reg div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_pd(a, b, c); }
+		static inline double reduce(Reg a) {
+			return sse2::Double::reduce(
+				_mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1))
+			);
+		}
+		static inline Reg min(Reg a, Reg b) { return _mm256_min_pd(a, b); }
+		static inline Reg max(Reg a, Reg b) { return _mm256_max_pd(a, b); }
+		static inline Reg sqrt(Reg a) { return _mm256_sqrt_pd(a); }
+		static inline Reg round(Reg a) {
+			return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		}
+		static inline Reg pow2(Reg n) {
+			__m128i e = _mm_add_epi32(_mm256_cvtpd_epi32(n), _mm_set1_epi32(1023));
+			return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_cvtepi32_epi64(e), 52));
+		}
+	};
+
+	#include "kernels_generic.hpp"
+
+
+	// Same rounding as ts::kernels::toBFloat16(float), with integer operations
+
+	void toBFloat16(int n, const float * x, uint16_t * res) {
+		const __m256i absMask = _mm256_set1_epi32(0x7FFFFFFF);
+		const __m256i exponentMask = _mm256_set1_epi32(0x7F800000);
+		const __m256i one = _mm256_set1_epi32(1);
+
+		int i = 0;
+		for(; i + 8 <= n; i += 8) {
+			__m256i bits = _mm256_castps_si256(_mm256_loadu_ps(x + i));
+			__m256i high = _mm256_srli_epi32(bits, 16);
+
+			__m256i isNan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, absMask), exponentMask);
+			__m256i isSubnormal = _mm256_cmpeq_epi32(
+				_mm256_and_si256(bits, exponentMask), _mm256_setzero_si256()
+			);
+
+			__m256i bias = _mm256_add_epi32(_mm256_set1_epi32(0x7FFF), _mm256_and_si256(high, one));
+			__m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, bias), 16);
+			rounded = _mm256_blendv_epi8(
+				rounded, _mm256_or_si256(high, _mm256_set1_epi32(0x40)), isNan
+			);
+			rounded = _mm256_blendv_epi8(
+				rounded, _mm256_and_si256(high, _mm256_set1_epi32(0x8000)), isSubnormal
+			);
+
+			// Packing works within 128 bits lanes, so the two halves are
+			// gathered afterwards
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(rounded, rounded), 0x08);
+			_mm_storeu_si128((__m128i *) (res + i), _mm256_castsi256_si128(packed));
+		}
+		scalar::toBFloat16(n - i, x + i, res + i);
+	}
+
+	void fromBFloat16(int n, const uint16_t * x, float * res) {
+		int i = 0;
+		for(; i + 8 <= n; i += 8) {
+			__m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (x + i)));
+			_mm256_storeu_ps(res + i, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+		}
+		scalar::fromBFloat16(n - i, x + i, res + i);
+	}
+}
+
+#pragma GCC pop_options
+
+
+
+	// F16C (half precision conversions, detected separately from AVX2)
+
+#pragma GCC push_options
+#pragma GCC target("avx,f16c")
+
+namespace f16c {
+	void toHalf(int n, const float * x, uint16_t * res) {
+		int i = 0;
+		for(; i + 8 <= n; i += 8) {
+			__m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT);
+			_mm_storeu_si128((__m128i *) (res + i), half);
+		}
+		scalar::toHalf(n - i, x + i, res + i);
+	}
+
+	void fromHalf(int n, const uint16_t * x, float * res) {
+		int i = 0;
+		for(; i + 8 <= n; i += 8) {
+			_mm256_storeu_ps(res + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (x + i))));
+		}
+		scalar::fromHalf(n - i, x + i, res + i);
+	}
+}
+
+#pragma GCC pop_options
+
+
+
+	// AVX-512
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma")
+
+namespace avx512 {
+	struct Float {
+		typedef float Scalar;
+		typedef __m512 Reg;
+		static const int width = 16;
+
+		static inline Reg load(const float * p) { return _mm512_loadu_ps(p); }
+		static inline void store(float * p, Reg a) { _mm512_storeu_ps(p, a); }
+		static inline Reg set(float s) { return _mm512_set1_ps(s); }
+		static inline Reg zero() { return _mm512_setzero_ps(); }
+		static inline Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+		static inline Reg sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+		static inline Reg mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+		static inline Reg div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+		static inline float reduce(Reg a) {
+			// Avoids _mm512_reduce_add_ps, which triggers false positive
+			// -Wuninitialized warnings with some GCC versions
+			float halves[16];
+			_mm512_storeu_ps(halves, a);
+			return avx2::Float::reduce(
+				_mm256_add_ps(_mm256_loadu_ps(halves), _mm256_loadu_ps(halves + 8))
+			);
+		}
+		// Zero-masked forms (with a full mask) are used for the same reason
+		static inline Reg min(Reg a, Reg b) { return _mm512_maskz_min_ps(all, a, b); }
+		static inline Reg max(Reg a, Reg b) { return _mm512_maskz_max_ps(all, a, b); }
+		static inline Reg sqrt(Reg a) { return _mm512_maskz_sqrt_ps(all, a); }
+		static inline Reg round(Reg a) {
+			return _mm512_maskz_roundscale_ps(all, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		}
+		static inline Reg pow2(Reg n) {
+			__m512i e = _mm512_add_epi32(_mm512_maskz_cvtps_epi32(all, n), _mm512_set1_epi32(127));
+			return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(all, e, 23));
+		}
+		static const __mmask16 all = 0xFFFF;
+	};
+
+	struct Double {
+		typedef double Scalar;
+		typedef __m512d Reg;
+		static const int width = 8;
+
+		static inline Reg load(const double * p) { return _mm512_loadu_pd(p); }
+		static inline void store(double * p, Reg a) { _mm512_storeu_pd(p, a); }
+		static inline Reg set(double s) { return _mm512_set1_pd(s); }
+		static inline Reg zero() { return _mm512_setzero_pd(); }
+		static inline Reg add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+		static inline Reg sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+		static inline Reg mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+		static inline Reg div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_pd(a, b, c); }
+		static inline double reduce(Reg a) {
+			double halves[8];
+			_mm512_storeu_pd(halves, a);
+			return avx2::Double::reduce(
+				_mm256_add_pd(_mm256_loadu_pd(halves), _mm256_loadu_pd(halves + 4))
+			);
+		}
+		static inline Reg min(Reg a, Reg b) { return _mm512_maskz_min_pd(all, a, b); }
+		static inline Reg max(Reg a, Reg b) { return _mm512_maskz_max_pd(all, a, b); }
+		static inline Reg sqrt(Reg a) { return _mm512_maskz_sqrt_pd(all, a); }
+		static inline Reg round(Reg a) {
+			return _mm512_maskz_roundscale_pd(all, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		}
+		static inline Reg pow2(Reg n) {
+			__m256i e = _mm256_add_epi32(_mm512_maskz_cvtpd_epi32(all, n), _mm256_set1_epi32(1023));
+			__m512i wide = _mm512_maskz_cvtepi32_epi64(all, e);
+			return _mm512_castsi512_pd(_mm512_maskz_slli_epi64(all, wide, 52));
+		}
+		static const __mmask8 all = 0xFF;
+	};
+
+	#include "kernels_generic.hpp"
+
+
+	// Used when AVX-512 BF16 is not available
+
+	void toBFloat16(int n, const float * x, uint16_t * res) {
+		const __mmask16 all = Float::all;
+		const __m512i absMask = _mm512_set1_epi32(0x7FFFFFFF);
+		const __m512i exponentMask = _mm512_set1_epi32(0x7F800000);
+		const __m512i one = _mm512_set1_epi32(1);
+
+		int i = 0;
+		for(; i + 16 <= n; i += 16) {
+			__m512i bits = _mm512_castps_si512(_mm512_loadu_ps(x + i));
+			__m512i high = _mm512_maskz_srli_epi32(all, bits, 16);
+
+			__mmask16 isNan = _mm512_cmpgt_epi32_mask(_mm512_and_si512(bits, absMask), exponentMask);
+			__mmask16 isSubnormal = _mm512_testn_epi32_mask(bits, exponentMask);
+
+			__m512i bias = _mm512_add_epi32(_mm512_set1_epi32(0x7FFF), _mm512_and_si512(high, one));
+			__m512i rounded = _mm512_maskz_srli_epi32(all, _mm512_add_epi32(bits, bias), 16);
+			rounded = _mm512_mask_blend_epi32(
+				isNan, rounded, _mm512_or_si512(high, _mm512_set1_epi32(0x40))
+			);
+			rounded = _mm512_mask_blend_epi32(
+				isSubnormal, rounded, _mm512_and_si512(high, _mm512_set1_epi32(0x8000))
+			);
+
+			_mm256_storeu_si256((__m256i *) (res + i), _mm512_maskz_cvtepi32_epi16(all, rounded));
+		}
+		scalar::toBFloat16(n - i, x + i, res + i);
+	}
+
+	void fromBFloat16(int n, const uint16_t * x, float * res) {
+		const __mmask16 all = Float::all;
+
+		int i = 0;
+		for(; i + 16 <= n; i += 16) {
+			__m256i narrow = _mm256_loadu_si256((const __m256i *) (x + i));
+			__m512i wide = _mm512_maskz_cvtepu16_epi32(all, narrow);
+			_mm512_storeu_ps(res + i, _mm512_castsi512_ps(_mm512_maskz_slli_epi32(all, wide, 16)));
+		}
+		scalar::fromBFloat16(n - i, x + i, res + i);
+	}
+
+	void toHalf(int n, const float * x, uint16_t * res) {
+		const __mmask16 all = Float::all;
+
+		int i = 0;
+		for(; i + 16 <= n; i += 16) {
+			__m256i half = _mm512_maskz_cvtps_ph(all, _mm512_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT);
+			_mm256_storeu_si256((__m256i *) (res + i), half);
+		}
+		scalar::toHalf(n - i, x + i, res + i);
+	}
+
+	void fromHalf(int n, const uint16_t * x, float * res) {
+		const __mmask16 all = Float::all;
+
+		int i = 0;
+		for(; i + 16 <= n; i += 16) {
+			__m256i half = _mm256_loadu_si256((const __m256i *) (x + i));
+			_mm512_storeu_ps(res + i, _mm512_maskz_cvtph_ps(all, half));
+		}
+		scalar::fromHalf(n - i, x + i, res + i);
+	}
+}
+
+#pragma GCC pop_options
+
+
+
+	// AVX-512 BF16 (native rounding to bfloat16)
+
+#pragma GCC push_options
+#pragma GCC target("avx512bf16,avx512f,avx2,fma")
+
+namespace avx512bf16 {
+	void toBFloat16(int n, const float * x, uint16_t * res) {
+		const __mmask16 all = avx512::Float::all;
+
+		int i = 0;
+		for(; i + 16 <= n; i += 16) {
+			__m256bh packed = _mm512_maskz_cvtneps_pbh(all, _mm512_loadu_ps(x + i));
+			_mm256_storeu_si256((__m256i *) (res + i), (__m256i) packed);
+		}
+		scalar::toBFloat16(n - i, x + i, res + i);
+	}
+}
+
+#pragma GCC pop_options
+
+#endif
+
+
+
+#if defined(__aarch64__)
+
+	// NEON (always available on ARM64)
+
+namespace neon {
+	struct Float {
+		typedef float Scalar;
+		typedef float32x4_t Reg;
+		static const int width = 4;
+
+		static inline Reg load(const float * p) { return vld1q_f32(p); }
+		static inline void store(float * p, Reg a) { vst1q_f32(p, a); }
+		static inline Reg set(float s) { return vdupq_n_f32(s); }
+		static inline Reg zero() { return vdupq_n_f32(0.0f); }
+		static inline Reg add(Reg a, Reg b) { return vaddq_f32(a, b); }
+		static inline Reg sub(Reg a, Reg b) { return vsubq_f32(a, b); }
+		static inline Reg mul(Reg a, Reg b) { return vmulq_f32(a, b); }
+		static inline Reg div(Reg a, Reg b) { return vdivq_f32(a, b); }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return vfmaq_f32(c, a, b); }
+		static inline float reduce(Reg a) { return vaddvq_f32(a); }
+		static inline Reg min(Reg a, Reg b) { return vminq_f32(a, b); }
+		static inline Reg max(Reg a, Reg b) { return vmaxq_f32(a, b); }
+		static inline Reg sqrt(Reg a) { return vsqrtq_f32(a); }
+		static inline Reg round(Reg a) { return vrndnq_f32(a); }
+		static inline Reg pow2(Reg n) {
+			int32x4_t e = vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127));
+			return vreinterpretq_f32_s32(vshlq_n_s32(e, 23));
+		}
+	};
+
+	struct Double {
+		typedef double Scalar;
+		typedef float64x2_t Reg;
+		static const int width = 2;
+
+		static inline Reg load(const double * p) { return vld1q_f64(p); }
+		static inline void store(double * p, Reg a) { vst1q_f64(p, a); }
+		static inline Reg set(double s) { return vdupq_n_f64(s); }
+		static inline Reg zero() { return vdupq_n_f64(0.0); }
+		static inline Reg add(Reg a, Reg b) { return vaddq_f64(a, b); }
+		static inline Reg sub(Reg a, Reg b) { return vsubq_f64(a, b); }
+		static inline Reg mul(Reg a, Reg b) { return vmulq_f64(a, b); }
+		static inline Reg div(Reg a, Reg b) { return vdivq_f64(a, b); }
+		static inline Reg fmadd(Reg a, Reg b, Reg c) { return vfmaq_f64(c, a, b); }
+		static inline double reduce(Reg a) { return vaddvq_f64(a); }
+		static inline Reg min(Reg a, Reg b) { return vminq_f64(a, b); }
+		static inline Reg max(Reg a, Reg b) { return vmaxq_f64(a, b); }
+		static inline Reg sqrt(Reg a) { return vsqrtq_f64(a); }
+		static inline Reg round(Reg a) { return vrndnq_f64(a); }
+		static inline Reg pow2(Reg n) {
+			int64x2_t e = vaddq_s64(vcvtq_s64_f64(n), vdupq_n_s64(1023));
+			return vreinterpretq_f64_s64(vshlq_n_s64(e, 52));
+		}
+	};
+
+	#include "kernels_generic.hpp"
+}
+
+#endif
+
+
+
+	// Runtime dispatch
+
+namespace {
+	// Tables of the instruction set in use
+	ts::kernels::Isa isa = ts::kernels::Isa::Scalar;
+	bool fastMath = false;
+	ts::kernels::Table<float> floatTable = scalar::makeTable<scalar::Vec<float>>();
+	ts::kernels::Table<double> doubleTable = scalar::makeTable<scalar::Vec<double>>();
+
+	// Conversions only exist for float, and don't always follow the
+	// instruction set of the tables
+	struct Conversions {
+		void (*toBFloat16)(int, const float *, uint16_t *);
+		void (*fromBFloat16)(int, const uint16_t *, float *);
+		void (*toHalf)(int, const float *, uint16_t *);
+		void (*fromHalf)(int, const uint16_t *, float *);
+	};
+
+	Conversions conversions = {
+		scalar::toBFloat16, scalar::fromBFloat16, scalar::toHalf, scalar::fromHalf
+	};
+
+
+	void selectIsa(ts::kernels::Isa newIsa) {
+		isa = newIsa;
+		conversions = {
+			scalar::toBFloat16, scalar::fromBFloat16, scalar::toHalf, scalar::fromHalf
+		};
+
+		switch(newIsa) {
+		#if defined(__x86_64__)
+			case ts::kernels::Isa::Sse2:
+				floatTable = sse2::makeTable<sse2::Float>();
+				doubleTable = sse2::makeTable<sse2::Double>();
+				break;
+
+			case ts::kernels::Isa::Avx2:
+				floatTable = avx2::makeTable<avx2::Float>();
+				doubleTable = avx2::makeTable<avx2::Double>();
+				conversions.toBFloat16 = avx2::toBFloat16;
+				conversions.fromBFloat16 = avx2::fromBFloat16;
+				if(__builtin_cpu_supports("f16c")) {
+					conversions.toHalf = f16c::toHalf;
+					conversions.fromHalf = f16c::fromHalf;
+				}
+				break;
+
+			case ts::kernels::Isa::Avx512:
+				floatTable = avx512::makeTable<avx512::Float>();
+				doubleTable = avx512::makeTable<avx512::Double>();
+				conversions = {
+					avx512::toBFloat16, avx512::fromBFloat16, avx512::toHalf, avx512::fromHalf
+				};
+				if(__builtin_cpu_supports("avx512bf16")) {
+					conversions.toBFloat16 = avx512bf16::toBFloat16;
+				}
+				break;
+		#endif
+
+		#if defined(__aarch64__)
+			case ts::kernels::Isa::Neon:
+				floatTable = neon::makeTable<neon::Float>();
+				doubleTable = neon::makeTable<neon::Double>();
+				break;
+		#endif
+
+			default:
+				isa = ts::kernels::Isa::Scalar;
+				floatTable = scalar::makeTable<scalar::Vec<float>>();
+				doubleTable = scalar::makeTable<scalar::Vec<double>>();
+				break;
+		}
+	}
+
+
+	// Selects the best instruction set when the library is loaded
+	struct Detector {
+		Detector() {
+			if(ts::kernels::isSupported(ts::kernels::Isa::Avx512)) {
+				selectIsa(ts::kernels::Isa::Avx512);
+			} else if(ts::kernels::isSupported(ts::kernels::Isa::Avx2)) {
+				selectIsa(ts::kernels::Isa::Avx2);
+			} else if(ts::kernels::isSupported(ts::kernels::Isa::Sse2)) {
+				selectIsa(ts::kernels::Isa::Sse2);
+			} else if(ts::kernels::isSupported(ts::kernels::Isa::Neon)) {
+				selectIsa(ts::kernels::Isa::Neon);
+			}
+		}
+	};
+
+	Detector detector;
+}
+
+
+
+ts::kernels::Isa ts::kernels::getIsa() {
+	return isa;
+}
+
+
+
+bool ts::kernels::setIsa(ts::kernels::Isa newIsa) {
+	if(!isSupported(newIsa)) {
+		return false;
+	}
+
+	selectIsa(newIsa);
+	return true;
+}
+
+
+
+void ts::kernels::setFastMath(bool newFastMath) {
+	fastMath = newFastMath;
+}
+
+
+
+bool ts::kernels::getFastMath() {
+	return fastMath;
+}
+
+
+
+bool ts::kernels::isSupported(ts::kernels::Isa isa) {
+	switch(isa) {
+		case ts::kernels::Isa::Scalar:
+			return true;
+
+	#if defined(__x86_64__)
+		case ts::kernels::Isa::Sse2:
+			return true;
+
+		case ts::kernels::Isa::Avx2:
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+		case ts::kernels::Isa::Avx512:
+			return __builtin_cpu_supports("avx512f");
+	#endif
+
+	#if defined(__aarch64__)
+		case ts::kernels::Isa::Neon:
+			return true;
+	#endif
+
+		default:
+			return false;
+	}
+}
+
+
+
+	// Kernels
+
+void ts::kernels::add(int n, const float * x, const float * y, float * res) {
+	floatTable.add(n, x, y, res);
+}
+
+void ts::kernels::add(int n, const double * x, const double * y, double * res) {
+	doubleTable.add(n, x, y, res);
+}
+
+
+
+void ts::kernels::sub(int n, const float * x, const float * y, float * res) {
+	floatTable.sub(n, x, y, res);
+}
+
+void ts::kernels::sub(int n, const double * x, const double * y, double * res) {
+	doubleTable.sub(n, x, y, res);
+}
+
+
+
+void ts::kernels::mul(int n, const float * x, const float * y, float * res) {
+	floatTable.mul(n, x, y, res);
+}
+
+void ts::kernels::mul(int n, const double * x, const double * y, double * res) {
+	doubleTable.mul(n, x, y, res);
+}
+
+
+
+void ts::kernels::div(int n, const float * x, const float * y, float * res) {
+	floatTable.div(n, x, y, res);
+}
+
+void ts::kernels::div(int n, const double * x, const double * y, double * res) {
+	doubleTable.div(n, x, y, res);
+}
+
+
+
+float ts::kernels::sum(int n, const float * x) {
+	return floatTable.sum(n, x);
+}
+
+double ts::kernels::sum(int n, const double * x) {
+	return doubleTable.sum(n, x);
+}
+
+
+
+float ts::kernels::dot(int n, const float * x, const float * y) {
+	return floatTable.dot(n, x, y);
+}
+
+double ts::kernels::dot(int n, const double * x, const double * y) {
+	return doubleTable.dot(n, x, y);
+}
+
+
+
+void ts::kernels::shift(int n, float a, float * y) {
+	floatTable.shift(n, a, y);
+}
+
+void ts::kernels::shift(int n, double a, double * y) {
+	doubleTable.shift(n, a, y);
+}
+
+
+
+void ts::kernels::axpy(int n, float a, const float * x, float * y) {
+	floatTable.axpy(n, a, x, y);
+}
+
+void ts::kernels::axpy(int n, double a, const double * x, double * y) {
+	doubleTable.axpy(n, a, x, y);
+}
+
+
+
+void ts::kernels::mulAdjoint(int n, const float * g, const float * y, float * dx) {
+	floatTable.mulAdjoint(n, g, y, dx);
+}
+
+void ts::kernels::mulAdjoint(int n, const double * g, const double * y, double * dx) {
+	doubleTable.mulAdjoint(n, g, y, dx);
+}
+
+
+
+void ts::kernels::divAdjoint(
+	int n, const float * g, const float * x, const float * y,
+	float * dx, float * dy
+) {
+	floatTable.divAdjoint(n, g, x, y, dx, dy);
+}
+
+void ts::kernels::divAdjoint(
+	int n, const double * g, const double * x, const double * y,
+	double * dx, double * dy
+) {
+	doubleTable.divAdjoint(n, g, x, y, dx, dy);
+}
+
+
+
+void ts::kernels::exp(int n, const float * x, float * res) {
+	if(fastMath) {
+		floatTable.fastExp(n, x, res);
+		return;
+	}
+	for(int i = 0; i < n; i++) {
+		res[i] = std::exp(x[i]);
+	}
+}
+
+void ts::kernels::exp(int n, const double * x, double * res) {
+	if(fastMath) {
+		doubleTable.fastExp(n, x, res);
+		return;
+	}
+	for(int i = 0; i < n; i++) {
+		res[i] = std::exp(x[i]);
+	}
+}
+
+
+
+void ts::kernels::log(int n, const float * x, float * res) {
+	for(int i = 0; i < n; i++) {
+		res[i] = std::log(x[i]);
+	}
+}
+
+void ts::kernels::log(int n, const double * x, double * res) {
+	for(int i = 0; i < n; i++) {
+		res[i] = std::log(x[i]);
+	}
+}
+
+
+
+void ts::kernels::tanh(int n, const float * x, float * res) {
+	if(fastMath) {
+		floatTable.fastTanh(n, x, res);
+		return;
+	}
+	for(int i = 0; i < n; i++) {
+		res[i] = std::tanh(x[i]);
+	}
+}
+
+void ts::kernels::tanh(int n, const double * x, double * res) {
+	if(fastMath) {
+		doubleTable.fastTanh(n, x, res);
+		return;
+	}
+	for(int i = 0; i < n; i++) {
+		res[i] = std::tanh(x[i]);
+	}
+}
+
+
+
+void ts::kernels::relu(int n, const float * x, float * res) {
+	floatTable.relu(n, x, res);
+}
+
+void ts::kernels::relu(int n, const double * x, double * res) {
+	doubleTable.relu(n, x, res);
+}
+
+
+
+void ts::kernels::sigmoid(int n, const float * x, float * res) {
+	if(fastMath) {
+		floatTable.fastSigmoid(n, x, res);
+		return;
+	}
+	for(int i = 0; i < n; i++) {
+		res[i] = 1.0f / (1.0f + std::exp(-x[i]));
+	}
+}
+
+void ts::kernels::sigmoid(int n, const double * x, double * res) {
+	if(fastMath) {
+		doubleTable.fastSigmoid(n, x, res);
+		return;
+	}
+	for(int i = 0; i < n; i++) {
+		res[i] = 1.0 / (1.0 + std::exp(-x[i]));
+	}
+}
+
+
+
+void ts::kernels::logAdjoint(int n, const float * g, const float * x, float * dx) {
+	floatTable.logAdjoint(n, g, x, dx);
+}
+
+void ts::kernels::logAdjoint(int n, const double * g, const double * x, double * dx) {
+	doubleTable.logAdjoint(n, g, x, dx);
+}
+
+
+
+void ts::kernels::tanhAdjoint(int n, const float * g, const float * y, float * dx) {
+	floatTable.tanhAdjoint(n, g, y, dx);
+}
+
+void ts::kernels::tanhAdjoint(int n, const double * g, const double * y, double * dx) {
+	doubleTable.tanhAdjoint(n, g, y, dx);
+}
+
+
+
+// The vector types have no comparisons, but the compiler vectorizes these
+// loops on its own
+void ts::kernels::reluAdjoint(int n, const float * g, const float * x, float * dx) {
+	for(int i = 0; i < n; i++) {
+		dx[i] += x[i] > 0.0f ? g[i] : 0.0f;
+	}
+}
+
+void ts::kernels::reluAdjoint(int n, const double * g, const double * x, double * dx) {
+	for(int i = 0; i < n; i++) {
+		dx[i] += x[i] > 0.0 ? g[i] : 0.0;
+	}
+}
+
+
+
+void ts::kernels::sigmoidAdjoint(int n, const float * g, const float * y, float * dx) {
+	floatTable.sigmoidAdjoint(n, g, y, dx);
+}
+
+void ts::kernels::sigmoidAdjoint(int n, const double * g, const double * y, double * dx) {
+	doubleTable.sigmoidAdjoint(n, g, y, dx);
+}
+
+
+
+void ts::kernels::momentumUpdate(
+	int n, float learningRate, float momentum,
+	const float * g, float * velocity, float * x
+) {
+	floatTable.momentumUpdate(n, learningRate, momentum, g, velocity, x);
+}
+
+void ts::kernels::momentumUpdate(
+	int n, double learningRate, double momentum,
+	const double * g, double * velocity, double * x
+) {
+	doubleTable.momentumUpdate(n, learningRate, momentum, g, velocity, x);
+}
+
+
+
+void ts::kernels::adamUpdate(
+	int n, float learningRate, float beta1, float beta2, float epsilon,
+	const float * g, float * m, float * v, float * x
+) {
+	floatTable.adamUpdate(n, learningRate, beta1, beta2, epsilon, g, m, v, x);
+}
+
+void ts::kernels::adamUpdate(
+	int n, double learningRate, double beta1, double beta2, double epsilon,
+	const double * g, double * m, double * v, double * x
+) {
+	doubleTable.adamUpdate(n, learningRate, beta1, beta2, epsilon, g, m, v, x);
+}
+
+
+
+void ts::kernels::gemm(
+	bool transA, bool transB, int m, int n, int k,
+	const float * a, const float * b, float * c
+) {
+	floatTable.gemm(transA, transB, m, n, k, a, b, c);
+}
+
+void ts::kernels::gemm(
+	bool transA, bool transB, int m, int n, int k,
+	const double * a, const double * b, double * c
+) {
+	doubleTable.gemm(transA, transB, m, n, k, a, b, c);
+}
+
+
+
+void ts::kernels::toBFloat16(int n, const float * x, uint16_t * res) {
+	conversions.toBFloat16(n, x, res);
+}
+
+void ts::kernels::fromBFloat16(int n, const uint16_t * x, float * res) {
+	conversions.fromBFloat16(n, x, res);
+}
+
+
+
+void ts::kernels::toHalf(int n, const float * x, uint16_t * res) {
+	conversions.toHalf(n, x, res);
+}
+
+void ts::kernels::fromHalf(int n, const uint16_t * x, float * res) {
+	conversions.fromHalf(n, x, res);
+}
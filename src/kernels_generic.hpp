@@ -0,0 +1,588 @@
+/*
+* Generic kernel implementations, written once in terms of a vector type V.
+* This file is included by kernels.cpp once per instruction set (inside the
+* corresponding namespace and target pragma), so it must not be guarded.
+*
+* V must provide :
+* - Scalar, Reg and width
+* - load(p), store(p, a), set(s) and zero()
+* - add(a, b), sub(a, b), mul(a, b), div(a, b), fmadd(a, b, c) = a * b + c
+* - reduce(a), the horizontal sum of a register
+* - min(a, b), max(a, b), sqrt(a) and round(a) (to the nearest integer)
+* - pow2(n), 2^n for a register of integral values in the range of normal
+*   numbers
+*/
+
+
+template <class V>
+void add(int n, const typename V::Scalar * x, const typename V::Scalar * y, typename V::Scalar * res) {
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(res + i, V::add(V::load(x + i), V::load(y + i)));
+	}
+	for(; i < n; i++) {
+		res[i] = x[i] + y[i];
+	}
+}
+
+
+
+template <class V>
+void sub(int n, const typename V::Scalar * x, const typename V::Scalar * y, typename V::Scalar * res) {
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(res + i, V::sub(V::load(x + i), V::load(y + i)));
+	}
+	for(; i < n; i++) {
+		res[i] = x[i] - y[i];
+	}
+}
+
+
+
+template <class V>
+void mul(int n, const typename V::Scalar * x, const typename V::Scalar * y, typename V::Scalar * res) {
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(res + i, V::mul(V::load(x + i), V::load(y + i)));
+	}
+	for(; i < n; i++) {
+		res[i] = x[i] * y[i];
+	}
+}
+
+
+
+template <class V>
+void div(int n, const typename V::Scalar * x, const typename V::Scalar * y, typename V::Scalar * res) {
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(res + i, V::div(V::load(x + i), V::load(y + i)));
+	}
+	for(; i < n; i++) {
+		res[i] = x[i] / y[i];
+	}
+}
+
+
+
+template <class V>
+typename V::Scalar sum(int n, const typename V::Scalar * x) {
+	// Two accumulators to hide the latency of the additions
+	typename V::Reg acc0 = V::zero();
+	typename V::Reg acc1 = V::zero();
+
+	int i = 0;
+	for(; i + 2 * V::width <= n; i += 2 * V::width) {
+		acc0 = V::add(acc0, V::load(x + i));
+		acc1 = V::add(acc1, V::load(x + i + V::width));
+	}
+	for(; i + V::width <= n; i += V::width) {
+		acc0 = V::add(acc0, V::load(x + i));
+	}
+
+	typename V::Scalar res = V::reduce(V::add(acc0, acc1));
+	for(; i < n; i++) {
+		res += x[i];
+	}
+	return res;
+}
+
+
+
+template <class V>
+typename V::Scalar dot(int n, const typename V::Scalar * x, const typename V::Scalar * y) {
+	typename V::Reg acc0 = V::zero();
+	typename V::Reg acc1 = V::zero();
+
+	int i = 0;
+	for(; i + 2 * V::width <= n; i += 2 * V::width) {
+		acc0 = V::fmadd(V::load(x + i), V::load(y + i), acc0);
+		acc1 = V::fmadd(V::load(x + i + V::width), V::load(y + i + V::width), acc1);
+	}
+	for(; i + V::width <= n; i += V::width) {
+		acc0 = V::fmadd(V::load(x + i), V::load(y + i), acc0);
+	}
+
+	typename V::Scalar res = V::reduce(V::add(acc0, acc1));
+	for(; i < n; i++) {
+		res += x[i] * y[i];
+	}
+	return res;
+}
+
+
+
+template <class V>
+void shift(int n, typename V::Scalar a, typename V::Scalar * y) {
+	typename V::Reg aReg = V::set(a);
+
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(y + i, V::add(V::load(y + i), aReg));
+	}
+	for(; i < n; i++) {
+		y[i] += a;
+	}
+}
+
+
+
+template <class V>
+void axpy(int n, typename V::Scalar a, const typename V::Scalar * x, typename V::Scalar * y) {
+	typename V::Reg aReg = V::set(a);
+
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(y + i, V::fmadd(aReg, V::load(x + i), V::load(y + i)));
+	}
+	for(; i < n; i++) {
+		y[i] += a * x[i];
+	}
+}
+
+
+
+template <class V>
+void mulAdjoint(int n, const typename V::Scalar * g, const typename V::Scalar * y, typename V::Scalar * dx) {
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(dx + i, V::fmadd(V::load(g + i), V::load(y + i), V::load(dx + i)));
+	}
+	for(; i < n; i++) {
+		dx[i] += g[i] * y[i];
+	}
+}
+
+
+
+template <class V>
+void divAdjoint(
+	int n, const typename V::Scalar * g, const typename V::Scalar * x,
+	const typename V::Scalar * y, typename V::Scalar * dx, typename V::Scalar * dy
+) {
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		typename V::Reg yReg = V::load(y + i);
+		typename V::Reg gy = V::div(V::load(g + i), yReg);
+		V::store(dx + i, V::add(V::load(dx + i), gy));
+		V::store(dy + i, V::sub(V::load(dy + i), V::div(V::mul(gy, V::load(x + i)), yReg)));
+	}
+	for(; i < n; i++) {
+		typename V::Scalar gy = g[i] / y[i];
+		dx[i] += gy;
+		dy[i] -= gy * x[i] / y[i];
+	}
+}
+
+
+
+	// Elementary functions
+	// exp(x) = 2^n * exp(r), where n = round(x / ln(2)) and |r| <= ln(2) / 2.
+	// exp(r) is then given by its Taylor series (7 terms for float, 13 for
+	// double), and ln(2) is split in two constants so that r is exact.
+
+template <class V>
+typename V::Reg expReg(typename V::Reg x) {
+	typedef typename V::Scalar S;
+	const bool single = sizeof(S) == 4;
+
+	// Inverse factorials
+	static const S coefficients[13] = {
+		1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040,
+		1.0 / 40320, 1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600
+	};
+	const int nTerms = single ? 7 : 13;
+
+	// Results stay normal numbers in that range
+	x = V::max(V::min(x, V::set(single ? 88.0 : 709.0)), V::set(single ? -87.0 : -708.0));
+
+	typename V::Reg n = V::round(V::mul(x, V::set(1.44269504088896340736)));
+	typename V::Reg r = V::fmadd(n, V::set(single ? -0.693359375 : -6.93147180369123816490e-01), x);
+	r = V::fmadd(n, V::set(single ? 2.12194440e-4 : -1.90821492927058770002e-10), r);
+
+	typename V::Reg p = V::set(coefficients[nTerms - 1]);
+	for(int k = nTerms - 2; k >= 0; k--) {
+		p = V::fmadd(p, r, V::set(coefficients[k]));
+	}
+
+	return V::mul(p, V::pow2(n));
+}
+
+
+
+// tanh(x) = 1 - 2 / (exp(2x) + 1)
+template <class V>
+typename V::Reg tanhReg(typename V::Reg x) {
+	typename V::Reg one = V::set(1.0);
+	typename V::Reg e = expReg<V>(V::add(x, x));
+	return V::sub(one, V::div(V::set(2.0), V::add(e, one)));
+}
+
+
+
+// sigmoid(x) = 1 / (1 + exp(-x))
+template <class V>
+typename V::Reg sigmoidReg(typename V::Reg x) {
+	typename V::Reg one = V::set(1.0);
+	return V::div(one, V::add(one, expReg<V>(V::sub(V::zero(), x))));
+}
+
+
+
+template <class V>
+typename V::Reg reluReg(typename V::Reg x) {
+	return V::max(x, V::zero());
+}
+
+
+
+// Applies f to n elements, the last ones going through a padded register
+template <class V, typename V::Reg (*f)(typename V::Reg)>
+void apply(int n, const typename V::Scalar * x, typename V::Scalar * res) {
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(res + i, f(V::load(x + i)));
+	}
+
+	if(i < n) {
+		typename V::Scalar block[V::width] = {};
+		for(int j = i; j < n; j++) {
+			block[j - i] = x[j];
+		}
+		V::store(block, f(V::load(block)));
+		for(int j = i; j < n; j++) {
+			res[j] = block[j - i];
+		}
+	}
+}
+
+
+
+template <class V>
+void fastExp(int n, const typename V::Scalar * x, typename V::Scalar * res) {
+	apply<V, expReg<V>>(n, x, res);
+}
+
+
+
+template <class V>
+void fastTanh(int n, const typename V::Scalar * x, typename V::Scalar * res) {
+	apply<V, tanhReg<V>>(n, x, res);
+}
+
+
+
+template <class V>
+void fastSigmoid(int n, const typename V::Scalar * x, typename V::Scalar * res) {
+	apply<V, sigmoidReg<V>>(n, x, res);
+}
+
+
+
+template <class V>
+void relu(int n, const typename V::Scalar * x, typename V::Scalar * res) {
+	apply<V, reluReg<V>>(n, x, res);
+}
+
+
+
+template <class V>
+void logAdjoint(int n, const typename V::Scalar * g, const typename V::Scalar * x, typename V::Scalar * dx) {
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		V::store(dx + i, V::add(V::load(dx + i), V::div(V::load(g + i), V::load(x + i))));
+	}
+	for(; i < n; i++) {
+		dx[i] += g[i] / x[i];
+	}
+}
+
+
+
+template <class V>
+void tanhAdjoint(int n, const typename V::Scalar * g, const typename V::Scalar * y, typename V::Scalar * dx) {
+	typename V::Reg one = V::set(1.0);
+
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		typename V::Reg yReg = V::load(y + i);
+		typename V::Reg d = V::sub(one, V::mul(yReg, yReg));
+		V::store(dx + i, V::fmadd(V::load(g + i), d, V::load(dx + i)));
+	}
+	for(; i < n; i++) {
+		dx[i] += g[i] * (1.0 - y[i] * y[i]);
+	}
+}
+
+
+
+template <class V>
+void sigmoidAdjoint(int n, const typename V::Scalar * g, const typename V::Scalar * y, typename V::Scalar * dx) {
+	typename V::Reg one = V::set(1.0);
+
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		typename V::Reg yReg = V::load(y + i);
+		typename V::Reg d = V::mul(yReg, V::sub(one, yReg));
+		V::store(dx + i, V::fmadd(V::load(g + i), d, V::load(dx + i)));
+	}
+	for(; i < n; i++) {
+		dx[i] += g[i] * y[i] * (1.0 - y[i]);
+	}
+}
+
+
+
+	// Optimizer updates
+	// Parameters and their state are updated in one pass, so that each
+	// buffer is read and written only once per step.
+
+template <class V>
+void momentumUpdate(
+	int n, typename V::Scalar learningRate, typename V::Scalar momentum,
+	const typename V::Scalar * g, typename V::Scalar * velocity, typename V::Scalar * x
+) {
+	typename V::Reg lrReg = V::set(-learningRate);
+	typename V::Reg muReg = V::set(momentum);
+
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		typename V::Reg v = V::fmadd(muReg, V::load(velocity + i), V::load(g + i));
+		V::store(velocity + i, v);
+		V::store(x + i, V::fmadd(lrReg, v, V::load(x + i)));
+	}
+	for(; i < n; i++) {
+		velocity[i] = momentum * velocity[i] + g[i];
+		x[i] -= learningRate * velocity[i];
+	}
+}
+
+
+
+template <class V>
+void adamUpdate(
+	int n, typename V::Scalar learningRate, typename V::Scalar beta1,
+	typename V::Scalar beta2, typename V::Scalar epsilon,
+	const typename V::Scalar * g, typename V::Scalar * m, typename V::Scalar * v,
+	typename V::Scalar * x
+) {
+	typename V::Reg lrReg = V::set(-learningRate);
+	typename V::Reg beta1Reg = V::set(beta1);
+	typename V::Reg beta2Reg = V::set(beta2);
+	typename V::Reg oneMinusBeta1 = V::set(1.0 - beta1);
+	typename V::Reg oneMinusBeta2 = V::set(1.0 - beta2);
+	typename V::Reg epsilonReg = V::set(epsilon);
+
+	int i = 0;
+	for(; i + V::width <= n; i += V::width) {
+		typename V::Reg gReg = V::load(g + i);
+		typename V::Reg mReg = V::fmadd(beta1Reg, V::load(m + i), V::mul(oneMinusBeta1, gReg));
+		typename V::Reg vReg = V::fmadd(beta2Reg, V::load(v + i), V::mul(oneMinusBeta2, V::mul(gReg, gReg)));
+		V::store(m + i, mReg);
+		V::store(v + i, vReg);
+
+		typename V::Reg step = V::div(mReg, V::add(V::sqrt(vReg), epsilonReg));
+		V::store(x + i, V::fmadd(lrReg, step, V::load(x + i)));
+	}
+	for(; i < n; i++) {
+		m[i] = beta1 * m[i] + (1.0 - beta1) * g[i];
+		v[i] = beta2 * v[i] + (1.0 - beta2) * g[i] * g[i];
+		x[i] -= learningRate * m[i] / (std::sqrt(v[i]) + epsilon);
+	}
+}
+
+
+
+	// GEMM
+	// C += op(A) * op(B), where op(A) is m x k and op(B) is k x n. All
+	// matrices are contiguous and row-major, op(X) being X or its transpose.
+	// The product is computed by blocks of kc x nc of op(B) and mc x kc of
+	// op(A), which are packed contiguously (in the order they will be read) so
+	// that they stay in cache. These blocks are then multiplied by a
+	// micro-kernel, which keeps a gemmMr x (2 * V::width) block of C in
+	// registers.
+
+static const int gemmMc = 96;
+static const int gemmKc = 256;
+static const int gemmNc = 2048;
+static const int gemmMr = 4;
+
+
+
+// Packs op(A)[i0:i0+mc, p0:p0+kc] as slivers of gemmMr rows (zero padded)
+template <class V>
+void packA(
+	bool transA, const typename V::Scalar * a, int lda,
+	int i0, int p0, int mc, int kc, typename V::Scalar * aPack
+) {
+	for(int is = 0; is < mc; is += gemmMr) {
+		for(int p = 0; p < kc; p++) {
+			for(int i = 0; i < gemmMr; i++) {
+				int row = i0 + is + i;
+				int col = p0 + p;
+
+				if(is + i >= mc) {
+					*aPack = 0.0;
+				} else if(transA) {
+					*aPack = a[col * lda + row];
+				} else {
+					*aPack = a[row * lda + col];
+				}
+				aPack++;
+			}
+		}
+	}
+}
+
+
+
+// Packs op(B)[p0:p0+kc, j0:j0+nc] as slivers of nr columns (zero padded)
+template <class V>
+void packB(
+	bool transB, const typename V::Scalar * b, int ldb,
+	int p0, int j0, int kc, int nc, typename V::Scalar * bPack
+) {
+	const int nr = 2 * V::width;
+
+	for(int js = 0; js < nc; js += nr) {
+		for(int p = 0; p < kc; p++) {
+			for(int j = 0; j < nr; j++) {
+				int row = p0 + p;
+				int col = j0 + js + j;
+
+				if(js + j >= nc) {
+					*bPack = 0.0;
+				} else if(transB) {
+					*bPack = b[col * ldb + row];
+				} else {
+					*bPack = b[row * ldb + col];
+				}
+				bPack++;
+			}
+		}
+	}
+}
+
+
+
+// C[0:mLeft, 0:nLeft] += aPack * bPack, both slivers being kc long
+template <class V>
+void gemmMicroKernel(
+	int kc, const typename V::Scalar * aPack, const typename V::Scalar * bPack,
+	typename V::Scalar * c, int ldc, int mLeft, int nLeft
+) {
+	const int nr = 2 * V::width;
+
+	typename V::Reg acc[gemmMr][2];
+	for(int i = 0; i < gemmMr; i++) {
+		acc[i][0] = V::zero();
+		acc[i][1] = V::zero();
+	}
+
+	for(int p = 0; p < kc; p++) {
+		typename V::Reg b0 = V::load(bPack + p * nr);
+		typename V::Reg b1 = V::load(bPack + p * nr + V::width);
+
+		for(int i = 0; i < gemmMr; i++) {
+			typename V::Reg aReg = V::set(aPack[p * gemmMr + i]);
+			acc[i][0] = V::fmadd(aReg, b0, acc[i][0]);
+			acc[i][1] = V::fmadd(aReg, b1, acc[i][1]);
+		}
+	}
+
+	if(mLeft == gemmMr && nLeft == nr) {
+		for(int i = 0; i < gemmMr; i++) {
+			typename V::Scalar * cRow = c + i * ldc;
+			V::store(cRow, V::add(V::load(cRow), acc[i][0]));
+			V::store(cRow + V::width, V::add(V::load(cRow + V::width), acc[i][1]));
+		}
+	} else {
+		// Edge of C : go through a temporary block
+		typename V::Scalar block[gemmMr * nr];
+		for(int i = 0; i < gemmMr; i++) {
+			V::store(block + i * nr, acc[i][0]);
+			V::store(block + i * nr + V::width, acc[i][1]);
+		}
+
+		for(int i = 0; i < mLeft; i++) {
+			for(int j = 0; j < nLeft; j++) {
+				c[i * ldc + j] += block[i * nr + j];
+			}
+		}
+	}
+}
+
+
+
+template <class V>
+void gemm(
+	bool transA, bool transB, int m, int n, int k,
+	const typename V::Scalar * a, const typename V::Scalar * b, typename V::Scalar * c
+) {
+	const int nr = 2 * V::width;
+	const int lda = transA ? m : k;
+	const int ldb = transB ? k : n;
+
+	// Packing buffers are kept between calls
+	thread_local std::vector<typename V::Scalar> aPack;
+	thread_local std::vector<typename V::Scalar> bPack;
+	aPack.resize((gemmMc + gemmMr) * gemmKc);
+	bPack.resize((gemmNc + nr) * gemmKc);
+
+	for(int j0 = 0; j0 < n; j0 += gemmNc) {
+		int nc = n - j0 < gemmNc ? n - j0 : gemmNc;
+
+		for(int p0 = 0; p0 < k; p0 += gemmKc) {
+			int kc = k - p0 < gemmKc ? k - p0 : gemmKc;
+			packB<V>(transB, b, ldb, p0, j0, kc, nc, bPack.data());
+
+			for(int i0 = 0; i0 < m; i0 += gemmMc) {
+				int mc = m - i0 < gemmMc ? m - i0 : gemmMc;
+				packA<V>(transA, a, lda, i0, p0, mc, kc, aPack.data());
+
+				for(int js = 0; js < nc; js += nr) {
+					for(int is = 0; is < mc; is += gemmMr) {
+						gemmMicroKernel<V>(
+							kc, aPack.data() + is * kc, bPack.data() + js * kc,
+							c + (i0 + is) * n + j0 + js, n,
+							mc - is < gemmMr ? mc - is : gemmMr,
+							nc - js < nr ? nc - js : nr
+						);
+					}
+				}
+			}
+		}
+	}
+}
+
+
+
+// Gathers the kernels of this instruction set in a dispatch table
+template <class V>
+ts::kernels::Table<typename V::Scalar> makeTable() {
+	ts::kernels::Table<typename V::Scalar> table;
+
+	table.add = add<V>;
+	table.sub = sub<V>;
+	table.mul = mul<V>;
+	table.div = div<V>;
+	table.sum = sum<V>;
+	table.dot = dot<V>;
+	table.shift = shift<V>;
+	table.axpy = axpy<V>;
+	table.mulAdjoint = mulAdjoint<V>;
+	table.divAdjoint = divAdjoint<V>;
+	table.fastExp = fastExp<V>;
+	table.fastTanh = fastTanh<V>;
+	table.logAdjoint = logAdjoint<V>;
+	table.tanhAdjoint = tanhAdjoint<V>;
+	table.fastSigmoid = fastSigmoid<V>;
+	table.relu = relu<V>;
+	table.sigmoidAdjoint = sigmoidAdjoint<V>;
+	table.momentumUpdate = momentumUpdate<V>;
+	table.adamUpdate = adamUpdate<V>;
+	table.gemm = gemm<V>;
+
+	return table;
+}
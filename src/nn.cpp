@@ -0,0 +1,235 @@
+/*
+* Neural network layers and losses, built on the tensor engine. Each layer,
+* activation and loss is recorded as a single fused node on the TensorList,
+* working on whole batches stored in contiguous row-major buffers (one
+* sample per row), so that a network costs a handful of nodes per step
+* whatever its size.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "../include/nn.hpp"
+#include "../include/kernels.hpp"
+
+
+	// Fused operations
+
+template <typename T>
+ts::TensorVar<T> ts::nn::dense(const ts::TensorVar<T> &x, const ts::TensorVar<T> &w, const ts::TensorVar<T> &b) {
+	const std::vector<int> &xShape = x.getShape();
+	const std::vector<int> &wShape = w.getShape();
+	const std::vector<int> &bShape = b.getShape();
+
+	if(
+		x.list != w.list || x.list != b.list || x.list == NULL ||
+		xShape.size() != 2 || wShape.size() != 2 || bShape.size() != 1 ||
+		xShape[1] != wShape[0] || wShape[1] != bShape[0]
+	) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	// Each row starts from the bias, and the product is accumulated on it
+	int rows = xShape[0];
+	int cols = wShape[1];
+	ts::Tensor<T> res({rows, cols});
+	for(int i = 0; i < rows; i++) {
+		std::copy(b.getValue().getData(), b.getValue().getData() + cols, res.getData() + i * cols);
+	}
+	ts::kernels::gemm(
+		false, false, rows, cols, xShape[1],
+		x.getValue().getData(), w.getValue().getData(), res.getData()
+	);
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Dense, std::move(res), x.index, w.index, b.index);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::nn::relu(const ts::TensorVar<T> &x) {
+	if(x.list == NULL) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::relu(res.size(), x.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::ReLU, std::move(res), x.index, -1);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::nn::sigmoid(const ts::TensorVar<T> &x) {
+	if(x.list == NULL) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::sigmoid(res.size(), x.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Sigmoid, std::move(res), x.index, -1);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::nn::softmaxCrossEntropy(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets) {
+	const std::vector<int> &xShape = x.getShape();
+
+	if(
+		x.list != targets.list || x.list == NULL ||
+		xShape.size() != 2 || xShape != targets.getShape() || x.getValue().size() == 0
+	) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	// The softmax probabilities are kept for the backward pass. For each
+	// row, the loss is sum(t * (logsumexp(x) - x)), which is computed from
+	// the shifted exponentials so that it never overflows.
+	int rows = xShape[0];
+	int cols = xShape[1];
+	const T * xData = x.getValue().getData();
+	const T * tData = targets.getValue().getData();
+	ts::Tensor<T> probabilities = x.getValue();
+	T loss = 0.0;
+
+	for(int i = 0; i < rows; i++) {
+		T * p = probabilities.getData() + i * cols;
+
+		T max = *std::max_element(p, p + cols);
+		ts::kernels::shift(cols, -max, p);
+		ts::kernels::exp(cols, p, p);
+		T total = ts::kernels::sum(cols, p);
+		for(int j = 0; j < cols; j++) {
+			p[j] /= total;
+		}
+
+		T logSumExp = max + std::log(total);
+		T s = ts::kernels::sum(cols, tData + i * cols);
+		loss += s * logSumExp - ts::kernels::dot(cols, tData + i * cols, xData + i * cols);
+	}
+
+	ts::Tensor<T> res({1}, loss / rows);
+
+	return ts::TensorVar<T>(
+		x.list, ts::TensorOp::SoftmaxCrossEntropy, std::move(res),
+		x.index, targets.index, -1, std::move(probabilities)
+	);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::nn::mse(const ts::TensorVar<T> &x, const ts::TensorVar<T> &targets) {
+	if(x.list != targets.list || x.list == NULL || x.getValue().size() == 0 || x.getShape() != targets.getShape()) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	// The differences are kept for the backward pass
+	int n = x.getValue().size();
+	ts::Tensor<T> differences(x.getShape());
+	ts::kernels::sub(n, x.getValue().getData(), targets.getValue().getData(), differences.getData());
+
+	T loss = ts::kernels::dot(n, differences.getData(), differences.getData()) / n;
+	ts::Tensor<T> res({1}, loss);
+
+	return ts::TensorVar<T>(
+		x.list, ts::TensorOp::MSE, std::move(res),
+		x.index, targets.index, -1, std::move(differences)
+	);
+}
+
+
+
+	// ts::nn::Dense
+
+template <typename T>
+ts::nn::Dense<T>::Dense(int nInputs, int nOutputs, unsigned seed) :
+	weights({nInputs, nOutputs}), bias({nOutputs}, 0.0),
+	weightsVar(ts::Tensor<T>(), NULL), biasVar(ts::Tensor<T>(), NULL) {
+
+	std::mt19937 generator(seed);
+	T limit = std::sqrt(6.0 / (nInputs + nOutputs));
+	std::uniform_real_distribution<T> distribution(-limit, limit);
+
+	for(int i = 0; i < weights.size(); i++) {
+		weights[i] = distribution(generator);
+	}
+}
+
+
+
+template <typename T>
+int ts::nn::Dense<T>::getNInputs() const {
+	return weights.getShape()[0];
+}
+
+
+
+template <typename T>
+int ts::nn::Dense<T>::getNOutputs() const {
+	return weights.getShape()[1];
+}
+
+
+
+template <typename T>
+ts::Tensor<T> & ts::nn::Dense<T>::getWeights() {
+	return weights;
+}
+
+
+
+template <typename T>
+ts::Tensor<T> & ts::nn::Dense<T>::getBias() {
+	return bias;
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::nn::Dense<T>::forward(const ts::TensorVar<T> &x) {
+	weightsVar = ts::NewTensorVar(weights, x.list);
+	biasVar = ts::NewTensorVar(bias, x.list);
+
+	return ts::nn::dense(x, weightsVar, biasVar);
+}
+
+
+
+template <typename T>
+const ts::TensorVar<T> & ts::nn::Dense<T>::getWeightsVar() const {
+	return weightsVar;
+}
+
+
+
+template <typename T>
+const ts::TensorVar<T> & ts::nn::Dense<T>::getBiasVar() const {
+	return biasVar;
+}
+
+
+
+// Add data types support manually (the compiler would need an implementation
+// directly in the header file otherwise).
+// More data types may be added in the future.
+
+	// float
+template class ts::nn::Dense<float>;
+template ts::TensorVar<float> ts::nn::dense(const ts::TensorVar<float> &x, const ts::TensorVar<float> &w, const ts::TensorVar<float> &b);
+template ts::TensorVar<float> ts::nn::relu(const ts::TensorVar<float> &x);
+template ts::TensorVar<float> ts::nn::sigmoid(const ts::TensorVar<float> &x);
+template ts::TensorVar<float> ts::nn::softmaxCrossEntropy(const ts::TensorVar<float> &x, const ts::TensorVar<float> &targets);
+template ts::TensorVar<float> ts::nn::mse(const ts::TensorVar<float> &x, const ts::TensorVar<float> &targets);
+
+	// double
+template class ts::nn::Dense<double>;
+template ts::TensorVar<double> ts::nn::dense(const ts::TensorVar<double> &x, const ts::TensorVar<double> &w, const ts::TensorVar<double> &b);
+template ts::TensorVar<double> ts::nn::relu(const ts::TensorVar<double> &x);
+template ts::TensorVar<double> ts::nn::sigmoid(const ts::TensorVar<double> &x);
+template ts::TensorVar<double> ts::nn::softmaxCrossEntropy(const ts::TensorVar<double> &x, const ts::TensorVar<double> &targets);
+template ts::TensorVar<double> ts::nn::mse(const ts::TensorVar<double> &x, const ts::TensorVar<double> &targets);
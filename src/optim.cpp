@@ -0,0 +1,307 @@
+/*
+* Optimizers updating a set of parameters from their gradient. Each optimizer
+* owns its parameters and state (velocity, moments) as contiguous buffers.
+* Parameters are recorded as consecutive input nodes, so their derivatives
+* are read straight from a range of the gradient buffer, and the parameters
+* and their state are updated with a single vectorized pass (which can be
+* split between threads for large models).
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "../include/optim.hpp"
+#include "../include/kernels.hpp"
+
+
+	// ts::optim::Optimizer
+
+template <typename T>
+ts::optim::Optimizer<T>::Optimizer(std::vector<T> initialParameters) {
+	parameters = std::move(initialParameters);
+}
+
+
+
+template <typename T>
+const T * ts::optim::Optimizer<T>::getDerivatives(const ts::Gradient<T> &gradient) {
+	// Derivatives are used in place when they are already contiguous (dense
+	// gradient of a single output), and gathered otherwise
+
+	if(first < 0) {
+		return NULL;
+	}
+
+	const int n = size();
+	const std::vector<T> &derivatives = gradient.derivatives;
+
+	if(gradient.sparse) {
+		const std::vector<int> &indices = gradient.indices;
+		gathered.assign(n, 0.0);
+
+		auto it = std::lower_bound(indices.begin(), indices.end(), first);
+		for(; it != indices.end() && *it < first + n; it++) {
+			gathered[*it - first] = derivatives[it - indices.begin()];
+		}
+		return gathered.data();
+	}
+
+	// Nodes recorded after the output are not stored
+	const int width = gradient.width;
+	const int nStored = gradient.getNStored();
+
+	if(width == 1 && first + n <= nStored) {
+		return derivatives.data() + first;
+	}
+
+	gathered.assign(n, 0.0);
+	for(int i = 0; i < n && first + i < nStored; i++) {
+		gathered[i] = derivatives[(first + i) * width];
+	}
+	return gathered.data();
+}
+
+
+
+template <typename T>
+template <typename F>
+void ts::optim::Optimizer<T>::forEachChunk(F update) {
+	// Each thread updates a contiguous range of whole chunks
+
+	const int n = size();
+	const int chunkSize = ts::internal::updateChunkSize;
+	const int nChunks = (n + chunkSize - 1) / chunkSize;
+	const int nWorkers = nChunks < 2 ? 1 : std::max(1, std::min(nThreads, nChunks));
+
+	auto worker = [&](int t) {
+		int begin = std::min(n, (int) ((long) nChunks * t / nWorkers) * chunkSize);
+		int end = std::min(n, (int) ((long) nChunks * (t + 1) / nWorkers) * chunkSize);
+		if(begin < end) {
+			update(begin, end);
+		}
+	};
+
+	if(nWorkers == 1) {
+		worker(0);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	for(int t = 1; t < nWorkers; t++) {
+		threads.push_back(std::thread(worker, t));
+	}
+	worker(0);
+	for(unsigned t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+}
+
+
+
+template <typename T>
+int ts::optim::Optimizer<T>::size() const {
+	return parameters.size();
+}
+
+
+
+template <typename T>
+T * ts::optim::Optimizer<T>::getParameters() {
+	return parameters.data();
+}
+
+
+
+template <typename T>
+const T * ts::optim::Optimizer<T>::getParameters() const {
+	return parameters.data();
+}
+
+
+
+template <typename T>
+std::vector<ts::Var<T>> ts::optim::Optimizer<T>::record(ts::WengertList<T> * wList) {
+	std::vector<ts::Var<T>> vars;
+	vars.reserve(parameters.size());
+
+	for(unsigned i = 0; i < parameters.size(); i++) {
+		vars.push_back(ts::NewVar(parameters[i], wList));
+	}
+
+	first = vars.empty() ? -1 : vars[0].getIndex();
+	return vars;
+}
+
+
+
+template <typename T>
+void ts::optim::Optimizer<T>::setNThreads(int newNThreads) {
+	nThreads = std::max(1, newNThreads);
+}
+
+
+
+template <typename T>
+int ts::optim::Optimizer<T>::getNThreads() const {
+	return nThreads;
+}
+
+
+
+	// ts::optim::SGD
+
+template <typename T>
+ts::optim::SGD<T>::SGD(std::vector<T> initialParameters, T newLearningRate, T newMomentum) :
+	ts::optim::Optimizer<T>(std::move(initialParameters)) {
+
+	learningRate = newLearningRate;
+	momentum = newMomentum;
+
+	if(momentum != 0.0) {
+		velocity.assign(this->parameters.size(), 0.0);
+	}
+}
+
+
+
+template <typename T>
+void ts::optim::SGD<T>::setLearningRate(T newLearningRate) {
+	learningRate = newLearningRate;
+}
+
+
+
+template <typename T>
+T ts::optim::SGD<T>::getLearningRate() const {
+	return learningRate;
+}
+
+
+
+template <typename T>
+void ts::optim::SGD<T>::step(const T * gradient) {
+	T * x = this->parameters.data();
+
+	if(velocity.empty()) {
+		this->forEachChunk([&](int begin, int end) {
+			ts::kernels::axpy(end - begin, -learningRate, gradient + begin, x + begin);
+		});
+		return;
+	}
+
+	this->forEachChunk([&](int begin, int end) {
+		ts::kernels::momentumUpdate(
+			end - begin, learningRate, momentum,
+			gradient + begin, velocity.data() + begin, x + begin
+		);
+	});
+}
+
+
+
+template <typename T>
+bool ts::optim::SGD<T>::step(const ts::Gradient<T> &gradient) {
+	const T * derivatives = this->getDerivatives(gradient);
+	if(derivatives == NULL) {
+		return false;
+	}
+
+	step(derivatives);
+	return true;
+}
+
+
+
+	// ts::optim::Adam
+
+template <typename T>
+ts::optim::Adam<T>::Adam(
+	std::vector<T> initialParameters, T newLearningRate,
+	T newBeta1, T newBeta2, T newEpsilon
+) : ts::optim::Optimizer<T>(std::move(initialParameters)) {
+
+	learningRate = newLearningRate;
+	beta1 = newBeta1;
+	beta2 = newBeta2;
+	epsilon = newEpsilon;
+
+	m.assign(this->parameters.size(), 0.0);
+	v.assign(this->parameters.size(), 0.0);
+}
+
+
+
+template <typename T>
+void ts::optim::Adam<T>::setLearningRate(T newLearningRate) {
+	learningRate = newLearningRate;
+}
+
+
+
+template <typename T>
+T ts::optim::Adam<T>::getLearningRate() const {
+	return learningRate;
+}
+
+
+
+template <typename T>
+long ts::optim::Adam<T>::getNSteps() const {
+	return nSteps;
+}
+
+
+
+template <typename T>
+void ts::optim::Adam<T>::step(const T * gradient) {
+	// Bias corrections are folded in the learning rate and epsilon, so that
+	// the moments are stored uncorrected :
+	// learningRate * m' / (sqrt(v') + epsilon)
+	// = (learningRate * sqrt(c2) / c1) * m / (sqrt(v) + epsilon * sqrt(c2))
+	// with c1 = 1 - beta1^t and c2 = 1 - beta2^t
+
+	nSteps++;
+	T c1 = 1.0 - std::pow(beta1, (T) nSteps);
+	T c2 = 1.0 - std::pow(beta2, (T) nSteps);
+	T stepSize = learningRate * std::sqrt(c2) / c1;
+	T stepEpsilon = epsilon * std::sqrt(c2);
+
+	T * x = this->parameters.data();
+
+	this->forEachChunk([&](int begin, int end) {
+		ts::kernels::adamUpdate(
+			end - begin, stepSize, beta1, beta2, stepEpsilon,
+			gradient + begin, m.data() + begin, v.data() + begin, x + begin
+		);
+	});
+}
+
+
+
+template <typename T>
+bool ts::optim::Adam<T>::step(const ts::Gradient<T> &gradient) {
+	const T * derivatives = this->getDerivatives(gradient);
+	if(derivatives == NULL) {
+		return false;
+	}
+
+	step(derivatives);
+	return true;
+}
+
+
+
+// Add data types support manually (the compiler would need an implementation
+// directly in the header file otherwise).
+// More data types may be added in the future.
+
+	// float
+template class ts::optim::Optimizer<float>;
+template class ts::optim::SGD<float>;
+template class ts::optim::Adam<float>;
+
+	// double
+template class ts::optim::Optimizer<double>;
+template class ts::optim::SGD<double>;
+template class ts::optim::Adam<double>;
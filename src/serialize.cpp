@@ -0,0 +1,545 @@
+/*
+* Binary model files, holding named tensors (e.g. trained parameters) and
+* compiled plans (see WengertList::compile()). Files are laid out so that they
+* can be memory mapped and used in place : a fixed header and a table of
+* entries are followed by the raw arrays of each entry, aligned on 64 bytes.
+* Opening a model only reads the header and the tables, so it takes the same
+* time whatever the size of the model. Loaded tensors point directly into the
+* mapping (pages are read from disk when first used), and so do the operations
+* of loaded plans.
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+
+#include "../include/serialize.hpp"
+#include "../include/tape.hpp"	// TS_HAS_MMAP and its headers
+
+
+namespace {
+	const char fileMagic[8] = {'T', 'S', 'M', 'O', 'D', 'E', 'L', '\0'};
+
+	// Written as is, to detect files of another endianness
+	const uint32_t byteOrderMark = 0x01020304;
+
+	const size_t alignment = 64;
+
+	enum EntryKind : uint32_t {
+		TensorEntry = 1,	// Shape (int32_t), values (T)
+		PlanEntry = 2	// ops, operands, inputs, outputs, values, partials, adjoints
+	};
+
+	const uint32_t nTensorSections = 2;
+	const uint32_t nPlanSections = 7;
+
+	struct FileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint8_t scalarType;
+		uint8_t scalarBytes;
+		uint16_t reserved0;
+		uint32_t nEntries;
+		uint32_t nSections;
+		uint32_t reserved1;
+		uint64_t fileBytes;
+		char reserved2[24];
+	};
+
+	struct FileEntry {
+		char name[ts::io::maxNameLength + 1];
+		uint32_t kind;
+		uint32_t firstSection;
+		uint32_t nSections;
+		uint32_t reserved;
+	};
+
+	struct FileSection {
+		uint64_t offset;
+		uint64_t count;
+	};
+
+	static_assert(sizeof(FileHeader) == 64, "The header must keep its size");
+	static_assert(sizeof(FileEntry) == 64, "Entries must keep their size");
+	static_assert(sizeof(FileSection) == 16, "Sections must keep their size");
+	static_assert(sizeof(int) == sizeof(int32_t), "Shapes are written as int32_t");
+	static_assert(sizeof(ts::NodeOp) == 1, "Ops are written as bytes");
+
+
+	template <typename T>
+	ts::io::ScalarType getScalarTypeOf();
+
+	template <>
+	ts::io::ScalarType getScalarTypeOf<float>() {
+		return ts::io::ScalarType::Float;
+	}
+
+	template <>
+	ts::io::ScalarType getScalarTypeOf<double>() {
+		return ts::io::ScalarType::Double;
+	}
+
+
+	size_t align(size_t n) {
+		return (n + alignment - 1) / alignment * alignment;
+	}
+
+
+	// Checks everything but the scalar type
+	bool isValidHeader(const FileHeader &header) {
+		return
+			std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) == 0 &&
+			header.version == ts::io::formatVersion &&
+			header.byteOrder == byteOrderMark;
+	}
+
+
+	// Size of the elements of each section of an entry
+	size_t getElementBytes(uint32_t kind, uint32_t section, size_t scalarBytes) {
+		if(kind == TensorEntry) {
+			return section == 0 ? sizeof(int32_t) : scalarBytes;
+		}
+
+		const size_t planBytes[nPlanSections] = {
+			sizeof(ts::NodeOp), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t),
+			scalarBytes, scalarBytes, scalarBytes
+		};
+		return planBytes[section];
+	}
+
+
+	// Array of an entry, as written by Writer::write()
+	struct Array {
+		const void * data;
+		size_t count;
+		size_t elementBytes;
+	};
+}
+
+
+
+ts::io::ScalarType ts::io::getScalarType(const std::string &path) {
+	std::ifstream file(path, std::ios::binary);
+	FileHeader header;
+
+	if(!file.read((char *) &header, sizeof(header)) || !isValidHeader(header)) {
+		return ts::io::ScalarType::Unknown;
+	}
+
+	if(header.scalarType == (uint8_t) ts::io::ScalarType::Float && header.scalarBytes == sizeof(float)) {
+		return ts::io::ScalarType::Float;
+	}
+	if(header.scalarType == (uint8_t) ts::io::ScalarType::Double && header.scalarBytes == sizeof(double)) {
+		return ts::io::ScalarType::Double;
+	}
+	return ts::io::ScalarType::Unknown;
+}
+
+
+
+	// ts::io::Writer
+
+template <typename T>
+bool ts::io::Writer<T>::isValidName(const std::string &name) const {
+	if(name.empty() || name.size() > ts::io::maxNameLength || name.find('\0') != std::string::npos) {
+		return false;
+	}
+
+	for(unsigned i = 0; i < names.size(); i++) {
+		if(names[i] == name) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+
+template <typename T>
+bool ts::io::Writer<T>::add(const std::string &name, const ts::Tensor<T> &tensor) {
+	if(!isValidName(name)) {
+		return false;
+	}
+
+	names.push_back(name);
+	tensors.push_back(&tensor);
+	plans.push_back(NULL);
+	return true;
+}
+
+
+
+template <typename T>
+bool ts::io::Writer<T>::add(const std::string &name, const ts::Plan<T> &plan) {
+	if(!isValidName(name)) {
+		return false;
+	}
+
+	names.push_back(name);
+	tensors.push_back(NULL);
+	plans.push_back(&plan);
+	return true;
+}
+
+
+
+template <typename T>
+bool ts::io::Writer<T>::write(const std::string &path) const {
+	std::vector<FileEntry> entries(names.size());
+	std::vector<Array> arrays;
+
+	for(unsigned i = 0; i < names.size(); i++) {
+		std::memset(&entries[i], 0, sizeof(FileEntry));
+		std::memcpy(entries[i].name, names[i].data(), names[i].size());
+		entries[i].firstSection = arrays.size();
+
+		if(tensors[i] != NULL) {
+			const ts::Tensor<T> &tensor = *tensors[i];
+			entries[i].kind = TensorEntry;
+			arrays.push_back({tensor.getShape().data(), tensor.getShape().size(), sizeof(int32_t)});
+			arrays.push_back({tensor.getData(), (size_t) tensor.size(), sizeof(T)});
+		} else {
+			const ts::Plan<T> &plan = *plans[i];
+			entries[i].kind = PlanEntry;
+			arrays.push_back({plan.ops.data(), plan.ops.size(), sizeof(ts::NodeOp)});
+			arrays.push_back({plan.operands.data(), plan.operands.size(), sizeof(uint32_t)});
+			arrays.push_back({plan.inputs.data(), plan.inputs.size(), sizeof(uint32_t)});
+			arrays.push_back({plan.outputs.data(), plan.outputs.size(), sizeof(uint32_t)});
+			arrays.push_back({plan.values.data(), plan.values.size(), sizeof(T)});
+			arrays.push_back({plan.partials.data(), plan.partials.size(), sizeof(T)});
+			arrays.push_back({plan.adjoints.data(), plan.adjoints.size(), sizeof(T)});
+		}
+
+		entries[i].nSections = arrays.size() - entries[i].firstSection;
+	}
+
+	// Arrays start after the tables, each one on its own aligned offset
+	std::vector<FileSection> sections(arrays.size());
+	size_t offset = align(sizeof(FileHeader) + entries.size() * sizeof(FileEntry) + sections.size() * sizeof(FileSection));
+	for(unsigned j = 0; j < arrays.size(); j++) {
+		sections[j].offset = offset;
+		sections[j].count = arrays[j].count;
+		offset = align(offset + arrays[j].count * arrays[j].elementBytes);
+	}
+
+	FileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+	header.version = ts::io::formatVersion;
+	header.byteOrder = byteOrderMark;
+	header.scalarType = (uint8_t) getScalarTypeOf<T>();
+	header.scalarBytes = sizeof(T);
+	header.nEntries = entries.size();
+	header.nSections = sections.size();
+	header.fileBytes = offset;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if(!file) {
+		return false;
+	}
+
+	file.write((const char *) &header, sizeof(header));
+	file.write((const char *) entries.data(), entries.size() * sizeof(FileEntry));
+	file.write((const char *) sections.data(), sections.size() * sizeof(FileSection));
+
+	const char padding[alignment] = {};
+	size_t position = sizeof(FileHeader) + entries.size() * sizeof(FileEntry) + sections.size() * sizeof(FileSection);
+	for(unsigned j = 0; j < arrays.size(); j++) {
+		file.write(padding, sections[j].offset - position);
+		size_t arrayBytes = arrays[j].count * arrays[j].elementBytes;
+		file.write((const char *) arrays[j].data, arrayBytes);
+		position = sections[j].offset + arrayBytes;
+	}
+	file.write(padding, offset - position);
+
+	return (bool) file;
+}
+
+
+
+	// ts::io::Model
+
+template <typename T>
+ts::io::Model<T>::Model() {
+
+}
+
+
+
+template <typename T>
+void ts::io::Model<T>::close() {
+	// Memory is only released once no tensor or plan uses it anymore
+	memory.reset();
+	bytes = NULL;
+	mapped = false;
+}
+
+
+
+template <typename T>
+bool ts::io::Model<T>::open(const std::string &path) {
+	close();
+
+	size_t fileBytes = 0;
+	std::shared_ptr<void> newMemory;
+	bool newMapped = false;
+
+#ifdef TS_HAS_MMAP
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if(descriptor < 0) {
+		return false;
+	}
+
+	off_t end = lseek(descriptor, 0, SEEK_END);
+	if(end >= (off_t) sizeof(FileHeader)) {
+		// Private mapping : plans write their buffers in place, and tensors
+		// may be updated, without changing the file
+		fileBytes = end;
+		void * mapping = mmap(NULL, fileBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+		if(mapping != MAP_FAILED) {
+			newMemory = std::shared_ptr<void>(mapping, [fileBytes](void * p) { munmap(p, fileBytes); });
+			newMapped = true;
+		}
+	}
+	::close(descriptor);
+#endif
+
+	if(newMemory == NULL) {
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if(!file || (size_t) file.tellg() < sizeof(FileHeader)) {
+			return false;
+		}
+
+		fileBytes = file.tellg();
+		void * buffer = std::aligned_alloc(alignment, align(fileBytes));
+		if(buffer == NULL) {
+			throw std::bad_alloc();
+		}
+		newMemory = std::shared_ptr<void>(buffer, std::free);
+
+		file.seekg(0);
+		if(!file.read((char *) buffer, fileBytes)) {
+			return false;
+		}
+	}
+
+	// Check the tables, so that getTensor() and getPlan() can trust them
+	char * newBytes = (char *) newMemory.get();
+	const FileHeader &header = *(const FileHeader *) newBytes;
+	if(
+		!isValidHeader(header) || header.fileBytes != fileBytes ||
+		header.scalarType != (uint8_t) getScalarTypeOf<T>() || header.scalarBytes != sizeof(T)
+	) {
+		return false;
+	}
+
+	size_t tablesBytes =
+		sizeof(FileHeader) + (size_t) header.nEntries * sizeof(FileEntry) +
+		(size_t) header.nSections * sizeof(FileSection);
+	if(tablesBytes > fileBytes) {
+		return false;
+	}
+
+	const FileEntry * entries = (const FileEntry *) (newBytes + sizeof(FileHeader));
+	const FileSection * sections = (const FileSection *) (entries + header.nEntries);
+
+	for(uint32_t i = 0; i < header.nEntries; i++) {
+		const FileEntry &entry = entries[i];
+		uint32_t nSections = entry.kind == TensorEntry ? nTensorSections : nPlanSections;
+
+		if(
+			(entry.kind != TensorEntry && entry.kind != PlanEntry) ||
+			entry.name[ts::io::maxNameLength] != '\0' || entry.nSections != nSections ||
+			entry.firstSection > header.nSections || header.nSections - entry.firstSection < nSections
+		) {
+			return false;
+		}
+
+		for(uint32_t j = 0; j < nSections; j++) {
+			const FileSection &section = sections[entry.firstSection + j];
+			size_t elementBytes = getElementBytes(entry.kind, j, sizeof(T));
+			if(
+				section.offset % alignment != 0 || section.offset > fileBytes ||
+				section.count > (fileBytes - section.offset) / elementBytes
+			) {
+				return false;
+			}
+		}
+
+		const FileSection * entrySections = sections + entry.firstSection;
+		if(entry.kind == TensorEntry) {
+			// The shape must match the number of values
+			const int32_t * shape = (const int32_t *) (newBytes + entrySections[0].offset);
+			uint64_t size = 1;
+			for(uint64_t k = 0; k < entrySections[0].count; k++) {
+				if(shape[k] < 0 || (shape[k] > 0 && size > entrySections[1].count / shape[k])) {
+					return false;
+				}
+				size *= shape[k];
+			}
+			// (empty tensors have neither a shape nor values)
+			bool isEmpty = entrySections[0].count == 0 && entrySections[1].count == 0;
+			if(size != entrySections[1].count && !isEmpty) {
+				return false;
+			}
+		} else {
+			// Buffers must match the number of nodes (the nodes themselves are
+			// checked by getPlan())
+			uint64_t nNodes = entrySections[0].count;
+			if(
+				entrySections[1].count != 2 * nNodes || entrySections[4].count != nNodes ||
+				entrySections[5].count != 2 * nNodes || entrySections[6].count != nNodes
+			) {
+				return false;
+			}
+		}
+	}
+
+	memory = newMemory;
+	bytes = newBytes;
+	mapped = newMapped;
+	return true;
+}
+
+
+
+template <typename T>
+bool ts::io::Model<T>::isMapped() const {
+	return mapped;
+}
+
+
+
+template <typename T>
+int ts::io::Model<T>::findEntry(const std::string &name, uint32_t kind) const {
+	if(bytes == NULL) {
+		return -1;
+	}
+
+	const FileHeader &header = *(const FileHeader *) bytes;
+	const FileEntry * entries = (const FileEntry *) (bytes + sizeof(FileHeader));
+
+	for(uint32_t i = 0; i < header.nEntries; i++) {
+		if(entries[i].kind == kind && name == entries[i].name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+
+template <typename T>
+template <typename U>
+ts::internal::Storage<U> ts::io::Model<T>::getSection(uint32_t section) const {
+	const FileHeader &header = *(const FileHeader *) bytes;
+	const FileEntry * entries = (const FileEntry *) (bytes + sizeof(FileHeader));
+	const FileSection &fileSection = ((const FileSection *) (entries + header.nEntries))[section];
+
+	if(fileSection.count == 0) {
+		return ts::internal::Storage<U>();
+	}
+
+	return ts::internal::Storage<U>((U *) (bytes + fileSection.offset), fileSection.count, memory);
+}
+
+
+
+template <typename T>
+std::vector<std::string> ts::io::Model<T>::getNames() const {
+	std::vector<std::string> res;
+	if(bytes == NULL) {
+		return res;
+	}
+
+	const FileHeader &header = *(const FileHeader *) bytes;
+	const FileEntry * entries = (const FileEntry *) (bytes + sizeof(FileHeader));
+	for(uint32_t i = 0; i < header.nEntries; i++) {
+		res.push_back(entries[i].name);
+	}
+	return res;
+}
+
+
+
+template <typename T>
+ts::Tensor<T> ts::io::Model<T>::getTensor(const std::string &name) const {
+	ts::Tensor<T> res;
+
+	int i = findEntry(name, TensorEntry);
+	if(i < 0) {
+		return res;
+	}
+
+	const FileEntry &entry = ((const FileEntry *) (bytes + sizeof(FileHeader)))[i];
+	ts::internal::Storage<int32_t> shape = getSection<int32_t>(entry.firstSection);
+
+	res.shape.assign(shape.begin(), shape.end());
+	res.data = getSection<T>(entry.firstSection + 1);
+	return res;
+}
+
+
+
+template <typename T>
+ts::Plan<T> ts::io::Model<T>::getPlan(const std::string &name) const {
+	ts::Plan<T> res;
+
+	int i = findEntry(name, PlanEntry);
+	if(i < 0) {
+		return res;
+	}
+
+	const uint32_t first = ((const FileEntry *) (bytes + sizeof(FileHeader)))[i].firstSection;
+	ts::internal::Storage<ts::NodeOp> ops = getSection<ts::NodeOp>(first);
+	ts::internal::Storage<uint32_t> operands = getSection<uint32_t>(first + 1);
+	ts::internal::Storage<uint32_t> inputs = getSection<uint32_t>(first + 2);
+	ts::internal::Storage<uint32_t> outputs = getSection<uint32_t>(first + 3);
+
+	// Ops must be replayable, and operands, inputs and outputs must be nodes
+	// of the plan (they index its buffers directly)
+	const size_t nNodes = ops.size();
+	for(size_t k = 0; k < nNodes; k++) {
+		if((uint8_t) ops[k] >= (uint8_t) ts::NodeOp::Fused) {
+			return res;
+		}
+	}
+	for(const ts::internal::Storage<uint32_t> * nodes : {&operands, &inputs, &outputs}) {
+		for(uint32_t node : *nodes) {
+			if(node >= nNodes) {
+				return res;
+			}
+		}
+	}
+
+	// Only the operations are used in place : the buffers are written by
+	// every call, and the (small) inputs and outputs by prune(), so each plan
+	// gets its own copy of them
+	const ts::internal::Storage<T> values = getSection<T>(first + 4);
+	const ts::internal::Storage<T> partials = getSection<T>(first + 5);
+
+	res.ops = std::move(ops);
+	res.operands = std::move(operands);
+	res.inputs = inputs;
+	res.outputs = outputs;
+	res.values = values;
+	res.partials = partials;
+	res.adjoints = ts::internal::Storage<T>(nNodes, T(0.0));
+	return res;
+}
+
+
+
+// Add data types support manually (the compiler would need an implementation
+// directly in the header file otherwise).
+// More data types may be added in the future.
+
+	// float
+template class ts::io::Writer<float>;
+template class ts::io::Model<float>;
+
+	// double
+template class ts::io::Writer<double>;
+template class ts::io::Model<double>;
@@ -0,0 +1,597 @@
+/*
+* Tensor automatic differentiation engine. Unlike the scalar ts::Var, a
+* ts::TensorVar records a single node on its TensorList for each whole
+* operation, and its adjoint is computed with a loop over contiguous buffers
+* during the backward pass. Reverse mode only.
+*/
+
+#include "../include/tensor.hpp"
+#include "../include/kernels.hpp"
+
+
+	// ts::Tensor
+
+template <typename T>
+ts::Tensor<T>::Tensor() {
+
+}
+
+
+
+template <typename T>
+ts::Tensor<T>::Tensor(std::vector<int> newShape, T fill) {
+	shape = newShape;
+
+	int newSize = 1;
+	for(unsigned i = 0; i < shape.size(); i++) {
+		newSize *= shape[i];
+	}
+
+	data = ts::internal::Storage<T>(newSize, fill);
+}
+
+
+
+template <typename T>
+ts::Tensor<T>::Tensor(std::vector<int> newShape, std::vector<T> newData) {
+	shape = newShape;
+	data = ts::internal::Storage<T>(std::move(newData));
+}
+
+
+
+template <typename T>
+int ts::Tensor<T>::size() const {
+	return data.size();
+}
+
+
+
+template <typename T>
+int ts::Tensor<T>::rank() const {
+	return shape.size();
+}
+
+
+
+template <typename T>
+const std::vector<int> & ts::Tensor<T>::getShape() const {
+	return shape;
+}
+
+
+
+template <typename T>
+T * ts::Tensor<T>::getData() {
+	return data.data();
+}
+
+
+
+template <typename T>
+const T * ts::Tensor<T>::getData() const {
+	return data.data();
+}
+
+
+
+template <typename T>
+T & ts::Tensor<T>::operator[](int i) {
+	return data[i];
+}
+
+
+
+template <typename T>
+const T & ts::Tensor<T>::operator[](int i) const {
+	return data[i];
+}
+
+
+
+namespace {
+	// Gets the adjoint of a node, allocating it on first use
+	template <typename T>
+	T * getAdjoint(std::vector<ts::Tensor<T>> &adjoints, const ts::Tensor<T> &value, int i) {
+		if(adjoints[i].size() != value.size()) {
+			adjoints[i] = ts::Tensor<T>(value.getShape(), 0.0);
+		}
+		return adjoints[i].getData();
+	}
+}
+
+
+
+	// ts::TensorNode
+
+template <typename T>
+ts::TensorNode<T>::TensorNode(
+	ts::TensorOp newOp, ts::Tensor<T> newValue, int xDep, int yDep, int zDep,
+	ts::Tensor<T> newSaved
+) {
+	op = newOp;
+	value = std::move(newValue);
+	saved = std::move(newSaved);
+	dependencies[0] = xDep;
+	dependencies[1] = yDep;
+	dependencies[2] = zDep;
+}
+
+
+
+	// ts::TensorList
+
+template <typename T>
+int ts::TensorList<T>::size() {
+	return nodes.size();
+}
+
+
+
+template <typename T>
+void ts::TensorList<T>::reset() {
+	nodes.clear();
+}
+
+
+
+template <typename T>
+int ts::TensorList<T>::push(
+	ts::TensorOp op, ts::Tensor<T> value, int xDep, int yDep, int zDep,
+	ts::Tensor<T> saved
+) {
+	nodes.push_back(ts::TensorNode<T>(op, std::move(value), xDep, yDep, zDep, std::move(saved)));
+	return nodes.size() - 1;
+}
+
+
+
+	// ts::TensorVar
+
+template <typename T>
+ts::TensorVar<T>::TensorVar(ts::Tensor<T> newValue, ts::TensorList<T> * newList) {
+	list = newList;
+
+	if(list != NULL) {
+		index = list->push(ts::TensorOp::Input, std::move(newValue), -1, -1, -1);
+	} else {
+		index = -1;
+	}
+}
+
+
+
+template <typename T>
+ts::TensorVar<T>::TensorVar(
+	ts::TensorList<T> * newList, ts::TensorOp op, ts::Tensor<T> newValue,
+	int xDep, int yDep, int zDep, ts::Tensor<T> newSaved
+) {
+	list = newList;
+
+	if(list != NULL) {
+		index = list->push(op, std::move(newValue), xDep, yDep, zDep, std::move(newSaved));
+	} else {
+		index = -1;
+	}
+}
+
+
+
+// Helper function to create new instances without syntax template
+template <typename T>
+ts::TensorVar<T> ts::NewTensorVar(ts::Tensor<T> newValue, ts::TensorList<T> * newList) {
+	return ts::TensorVar<T>(std::move(newValue), newList);
+}
+
+
+
+template <typename T>
+const ts::Tensor<T> & ts::TensorVar<T>::getValue() const {
+	static const ts::Tensor<T> empty;
+
+	if(list == NULL) {
+		return empty;
+	}
+	return list->nodes[index].value;
+}
+
+
+
+template <typename T>
+const std::vector<int> & ts::TensorVar<T>::getShape() const {
+	return getValue().getShape();
+}
+
+
+
+template <typename T>
+ts::TensorGradient<T> ts::TensorVar<T>::grad() {
+	// Computes the gradient of all the list's nodes with respect to this
+	// variable. Each node processes its whole tensor at once.
+
+	// Results of invalid operations aren't recorded, and don't depend on
+	// anything
+	if(list == NULL) {
+		return ts::TensorGradient<T>(std::vector<ts::Tensor<T>>());
+	}
+
+	std::vector<ts::Tensor<T>> adjoints(list->size());
+	adjoints[index] = ts::Tensor<T>(getShape(), 1.0);
+
+
+	// Iterate over the list backwards
+	for(int i = index; i >= 0; i--) {
+		ts::TensorNode<T> * node = &(list->nodes[i]);
+
+		// Nodes the output doesn't depend on have no adjoint
+		if(adjoints[i].size() == 0 || node->op == ts::TensorOp::Input) {
+			continue;
+		}
+
+		const T * g = adjoints[i].getData();
+		int xDep = node->dependencies[0];
+		int yDep = node->dependencies[1];
+		const ts::Tensor<T> &x = list->nodes[xDep].value;
+		int n = x.size();
+
+		switch(node->op) {
+			case ts::TensorOp::Add:
+				ts::kernels::axpy(n, 1.0, g, getAdjoint(adjoints, x, xDep));
+				ts::kernels::axpy(n, 1.0, g, getAdjoint(adjoints, x, yDep));
+				break;
+
+			case ts::TensorOp::Sub:
+				ts::kernels::axpy(n, 1.0, g, getAdjoint(adjoints, x, xDep));
+				ts::kernels::axpy(n, -1.0, g, getAdjoint(adjoints, x, yDep));
+				break;
+
+			case ts::TensorOp::Mul: {
+				const ts::Tensor<T> &y = list->nodes[yDep].value;
+				ts::kernels::mulAdjoint(n, g, y.getData(), getAdjoint(adjoints, x, xDep));
+				ts::kernels::mulAdjoint(n, g, x.getData(), getAdjoint(adjoints, y, yDep));
+				break;
+			}
+
+			case ts::TensorOp::Div: {
+				const ts::Tensor<T> &y = list->nodes[yDep].value;
+				T * dx = getAdjoint(adjoints, x, xDep);
+				T * dy = getAdjoint(adjoints, y, yDep);
+				ts::kernels::divAdjoint(n, g, x.getData(), y.getData(), dx, dy);
+				break;
+			}
+
+			case ts::TensorOp::Sum: {
+				ts::kernels::shift(n, g[0], getAdjoint(adjoints, x, xDep));
+				break;
+			}
+
+			case ts::TensorOp::Dot: {
+				const ts::Tensor<T> &y = list->nodes[yDep].value;
+				ts::kernels::axpy(n, g[0], y.getData(), getAdjoint(adjoints, x, xDep));
+				ts::kernels::axpy(n, g[0], x.getData(), getAdjoint(adjoints, y, yDep));
+				break;
+			}
+
+			case ts::TensorOp::MatMul: {
+				// a = x * y
+				// dx += g * y^T
+				// dy += x^T * g
+				const ts::Tensor<T> &y = list->nodes[yDep].value;
+				int rows = x.getShape()[0];
+				int inner = x.getShape()[1];
+				int cols = y.getShape()[1];
+
+				T * dx = getAdjoint(adjoints, x, xDep);
+				T * dy = getAdjoint(adjoints, y, yDep);
+				ts::kernels::gemm(false, true, rows, inner, cols, g, y.getData(), dx);
+				ts::kernels::gemm(true, false, inner, cols, rows, x.getData(), g, dy);
+				break;
+			}
+
+			case ts::TensorOp::Exp:
+				// The output is its own derivative
+				ts::kernels::mulAdjoint(n, g, node->value.getData(), getAdjoint(adjoints, x, xDep));
+				break;
+
+			case ts::TensorOp::Log:
+				ts::kernels::logAdjoint(n, g, x.getData(), getAdjoint(adjoints, x, xDep));
+				break;
+
+			case ts::TensorOp::Tanh:
+				ts::kernels::tanhAdjoint(n, g, node->value.getData(), getAdjoint(adjoints, x, xDep));
+				break;
+
+			case ts::TensorOp::Dense: {
+				// a = x * w + b
+				// dx += g * w^T
+				// dw += x^T * g
+				// db += sum of the rows of g
+				int zDep = node->dependencies[2];
+				const ts::Tensor<T> &w = list->nodes[yDep].value;
+				const ts::Tensor<T> &b = list->nodes[zDep].value;
+				int rows = x.getShape()[0];
+				int inner = x.getShape()[1];
+				int cols = w.getShape()[1];
+
+				T * dx = getAdjoint(adjoints, x, xDep);
+				T * dw = getAdjoint(adjoints, w, yDep);
+				T * db = getAdjoint(adjoints, b, zDep);
+				ts::kernels::gemm(false, true, rows, inner, cols, g, w.getData(), dx);
+				ts::kernels::gemm(true, false, inner, cols, rows, x.getData(), g, dw);
+				for(int i = 0; i < rows; i++) {
+					ts::kernels::axpy(cols, 1.0, g + i * cols, db);
+				}
+				break;
+			}
+
+			case ts::TensorOp::ReLU:
+				ts::kernels::reluAdjoint(n, g, x.getData(), getAdjoint(adjoints, x, xDep));
+				break;
+
+			case ts::TensorOp::Sigmoid:
+				ts::kernels::sigmoidAdjoint(n, g, node->value.getData(), getAdjoint(adjoints, x, xDep));
+				break;
+
+			case ts::TensorOp::SoftmaxCrossEntropy: {
+				// The loss is the mean over the rows of s * logsumexp(x) - t . x,
+				// s being the sum of the row's targets t, so
+				// dx += g / rows * (s * softmax(x) - t)
+				// Targets are constants and get no adjoint.
+				const ts::Tensor<T> &t = list->nodes[yDep].value;
+				const T * p = node->saved.getData();
+				int rows = x.getShape()[0];
+				int cols = x.getShape()[1];
+				T scale = g[0] / rows;
+
+				T * dx = getAdjoint(adjoints, x, xDep);
+				for(int i = 0; i < rows; i++) {
+					T s = ts::kernels::sum(cols, t.getData() + i * cols);
+					ts::kernels::axpy(cols, scale * s, p + i * cols, dx + i * cols);
+					ts::kernels::axpy(cols, -scale, t.getData() + i * cols, dx + i * cols);
+				}
+				break;
+			}
+
+			case ts::TensorOp::MSE: {
+				// The loss is the mean of d^2, with d = x - y (kept on the node)
+				T scale = 2.0 * g[0] / n;
+				const T * d = node->saved.getData();
+				ts::kernels::axpy(n, scale, d, getAdjoint(adjoints, x, xDep));
+				ts::kernels::axpy(n, -scale, d, getAdjoint(adjoints, x, yDep));
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+
+	return ts::TensorGradient<T>(std::move(adjoints));
+}
+
+
+
+	// ts::TensorGradient
+
+template <typename T>
+ts::TensorGradient<T>::TensorGradient(std::vector<ts::Tensor<T>> &&newAdjoints) {
+	adjoints = std::move(newAdjoints);
+}
+
+
+
+template <typename T>
+ts::Tensor<T> ts::TensorGradient<T>::getValue(const ts::TensorVar<T> &a) {
+	if(a.index < 0 || a.index >= (int) adjoints.size()) {
+		return ts::Tensor<T>();
+	}
+
+	if(adjoints[a.index].size() == 0) {
+		return ts::Tensor<T>(a.getShape(), 0.0);
+	}
+	return adjoints[a.index];
+}
+
+
+
+	// Overloaded arithmetic operators
+
+namespace {
+	// Checks that two operands can be combined elementwise
+	template <typename T>
+	bool areCompatible(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y) {
+		return x.getValue().size() > 0 && x.getShape() == y.getShape();
+	}
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::operator+(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y) {
+	if(x.list != y.list || !areCompatible(x, y)) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::add(res.size(), x.getValue().getData(), y.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Add, std::move(res), x.index, y.index);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::operator-(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y) {
+	if(x.list != y.list || !areCompatible(x, y)) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::sub(res.size(), x.getValue().getData(), y.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Sub, std::move(res), x.index, y.index);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::operator*(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y) {
+	if(x.list != y.list || !areCompatible(x, y)) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::mul(res.size(), x.getValue().getData(), y.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Mul, std::move(res), x.index, y.index);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::operator/(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y) {
+	if(x.list != y.list || !areCompatible(x, y)) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::div(res.size(), x.getValue().getData(), y.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Div, std::move(res), x.index, y.index);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::sum(const ts::TensorVar<T> &x) {
+	if(x.list == NULL) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res({1}, 0.0);
+	res[0] = ts::kernels::sum(x.getValue().size(), x.getValue().getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Sum, std::move(res), x.index, -1);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::dot(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y) {
+	if(x.list != y.list || !areCompatible(x, y)) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res({1}, 0.0);
+	res[0] = ts::kernels::dot(x.getValue().size(), x.getValue().getData(), y.getValue().getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Dot, std::move(res), x.index, y.index);
+}
+
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::matmul(const ts::TensorVar<T> &x, const ts::TensorVar<T> &y) {
+	const std::vector<int> &xShape = x.getShape();
+	const std::vector<int> &yShape = y.getShape();
+
+	if(
+		x.list != y.list || x.list == NULL ||
+		xShape.size() != 2 || yShape.size() != 2 || xShape[1] != yShape[0]
+	) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res({xShape[0], yShape[1]}, 0.0);
+	ts::kernels::gemm(
+		false, false, xShape[0], yShape[1], xShape[1],
+		x.getValue().getData(), y.getValue().getData(), res.getData()
+	);
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::MatMul, std::move(res), x.index, y.index);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::exp(const ts::TensorVar<T> &x) {
+	if(x.list == NULL) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::exp(res.size(), x.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Exp, std::move(res), x.index, -1);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::log(const ts::TensorVar<T> &x) {
+	if(x.list == NULL) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::log(res.size(), x.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Log, std::move(res), x.index, -1);
+}
+
+
+
+template <typename T>
+ts::TensorVar<T> ts::tanh(const ts::TensorVar<T> &x) {
+	if(x.list == NULL) {
+		return ts::TensorVar<T>(ts::Tensor<T>(), NULL);
+	}
+
+	ts::Tensor<T> res(x.getShape());
+	ts::kernels::tanh(res.size(), x.getValue().getData(), res.getData());
+
+	return ts::TensorVar<T>(x.list, ts::TensorOp::Tanh, std::move(res), x.index, -1);
+}
+
+
+
+// Add data types support manually (the compiler would need an implementation
+// directly in the header file otherwise).
+// More data types may be added in the future.
+
+	// float
+template class ts::Tensor<float>;
+template class ts::TensorNode<float>;
+template class ts::TensorList<float>;
+template class ts::TensorVar<float>;
+template class ts::TensorGradient<float>;
+template ts::TensorVar<float> ts::NewTensorVar(ts::Tensor<float> newValue, ts::TensorList<float> * newList);
+template ts::TensorVar<float> ts::operator+(const ts::TensorVar<float> &x, const ts::TensorVar<float> &y);
+template ts::TensorVar<float> ts::operator-(const ts::TensorVar<float> &x, const ts::TensorVar<float> &y);
+template ts::TensorVar<float> ts::operator*(const ts::TensorVar<float> &x, const ts::TensorVar<float> &y);
+template ts::TensorVar<float> ts::operator/(const ts::TensorVar<float> &x, const ts::TensorVar<float> &y);
+template ts::TensorVar<float> ts::sum(const ts::TensorVar<float> &x);
+template ts::TensorVar<float> ts::dot(const ts::TensorVar<float> &x, const ts::TensorVar<float> &y);
+template ts::TensorVar<float> ts::matmul(const ts::TensorVar<float> &x, const ts::TensorVar<float> &y);
+template ts::TensorVar<float> ts::exp(const ts::TensorVar<float> &x);
+template ts::TensorVar<float> ts::log(const ts::TensorVar<float> &x);
+template ts::TensorVar<float> ts::tanh(const ts::TensorVar<float> &x);
+
+	// double
+template class ts::Tensor<double>;
+template class ts::TensorNode<double>;
+template class ts::TensorList<double>;
+template class ts::TensorVar<double>;
+template class ts::TensorGradient<double>;
+template ts::TensorVar<double> ts::NewTensorVar(ts::Tensor<double> newValue, ts::TensorList<double> * newList);
+template ts::TensorVar<double> ts::operator+(const ts::TensorVar<double> &x, const ts::TensorVar<double> &y);
+template ts::TensorVar<double> ts::operator-(const ts::TensorVar<double> &x, const ts::TensorVar<double> &y);
+template ts::TensorVar<double> ts::operator*(const ts::TensorVar<double> &x, const ts::TensorVar<double> &y);
+template ts::TensorVar<double> ts::operator/(const ts::TensorVar<double> &x, const ts::TensorVar<double> &y);
+template ts::TensorVar<double> ts::sum(const ts::TensorVar<double> &x);
+template ts::TensorVar<double> ts::dot(const ts::TensorVar<double> &x, const ts::TensorVar<double> &y);
+template ts::TensorVar<double> ts::matmul(const ts::TensorVar<double> &x, const ts::TensorVar<double> &y);
+template ts::TensorVar<double> ts::exp(const ts::TensorVar<double> &x);
+template ts::TensorVar<double> ts::log(const ts::TensorVar<double> &x);
+template ts::TensorVar<double> ts::tanh(const ts::TensorVar<double> &x);
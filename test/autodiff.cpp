@@ -6,11 +6,38 @@
 #include <iostream>
 #include <iomanip>
 #include <math.h>
+#include <thread>
 
 #include "../include/tensorslow.h"
 
 
 
+// Counts heap allocations made by the whole test binary, so we can make sure
+// some code paths don't allocate
+
+static unsigned long nAllocations = 0;
+
+// These are not inlined, otherwise GCC can't tell that the pointers they free
+// come from operator new (-Wmismatched-new-delete false positives)
+__attribute__((noinline)) void * operator new(std::size_t size) {
+	nAllocations++;
+	void * ptr = malloc(size);
+	if(ptr == NULL) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void * ptr) noexcept {
+	free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void * ptr, std::size_t) noexcept {
+	free(ptr);
+}
+
+
+
 TEST(AutodiffTest, SimpleSum) {
 	// Simple test of + operator
 
@@ -138,6 +165,699 @@ TEST(AutodiffTest, DifferentLists) {
 
 
 
+TEST(AutodiffTest, LongChain) {
+	// Records a long chain of operations to make sure the flat tape keeps
+	// dependencies and partials consistent as it grows
+
+	ts::WengertList<double> wList;
+
+	auto x = ts::NewVar(1.0001, &wList);
+	auto y = ts::NewVar(1.0, &wList);
+
+	for(int i = 0; i < 1000; i++) {
+		y = y * x;
+	}
+
+	auto grad = y.grad();
+
+	ASSERT_NEAR(y.getValue(), pow(1.0001, 1000), 1e-9);
+	ASSERT_NEAR(grad.getValue(x), 1000 * pow(1.0001, 999), 1e-9);
+	ASSERT_EQ(wList.size(), 1002);
+}
+
+
+
+TEST(AutodiffTest, ReusableList) {
+	// Once a Wengert list is warm, resetting it and recording the same
+	// computation again must not allocate
+
+	ts::WengertList<float> wList;
+	wList.reserve(16);
+
+	unsigned long warmupAllocations = 0;
+
+	for(int step = 0; step < 3; step++) {
+		wList.reset();
+		unsigned long before = nAllocations;
+
+		auto x = ts::NewVar(2.0f, &wList);
+		auto a = ts::NewVar(3.0f, &wList);
+		auto y = a * x * x + a / x - x;
+
+		ASSERT_EQ(y.getValue(), 3.0f * 2.0f * 2.0f + 3.0f / 2.0f - 2.0f);
+		ASSERT_EQ(wList.size(), 7);
+
+		if(step == 0) {
+			warmupAllocations = nAllocations - before;
+		} else {
+			ASSERT_EQ(nAllocations - before, 0ul);
+		}
+	}
+
+	// The reserve() call should have made even the first step allocation free
+	ASSERT_EQ(warmupAllocations, 0ul);
+
+	// Whereas a cold list allocates as it grows
+	ts::WengertList<float> coldList;
+	unsigned long before = nAllocations;
+	auto x = ts::NewVar(1.0f, &coldList);
+	for(int i = 0; i < 7000; i++) {
+		x = x * x;
+	}
+	ASSERT_GT(nAllocations - before, 0ul);
+}
+
+
+
+TEST(AutodiffTest, ParallelGrad) {
+	// Many independent products summed together : the parallel sweep must give
+	// the same gradient as the serial one
+
+	ts::WengertList<double> wList;
+
+	std::vector<ts::Var<double>> inputs;
+	for(int i = 0; i < 50000; i++) {
+		inputs.push_back(ts::NewVar(1.0 + i * 1e-4, &wList));
+	}
+
+	std::vector<ts::Var<double>> terms;
+	for(int i = 0; i < 50000; i++) {
+		terms.push_back(inputs[i] * inputs[(i * 7) % 50000] - inputs[i]);
+	}
+
+	// Pairwise sum to keep the graph wide
+	while(terms.size() > 1) {
+		std::vector<ts::Var<double>> sums;
+		for(unsigned i = 0; i + 1 < terms.size(); i += 2) {
+			sums.push_back(terms[i] + terms[i+1]);
+		}
+		if(terms.size() % 2 == 1) {
+			sums.push_back(terms.back());
+		}
+		terms = sums;
+	}
+
+	// Side computation that the output doesn't depend on
+	auto unused = inputs[0] * inputs[1];
+	auto loss = terms[0];
+
+	auto serialGrad = loss.grad();
+	auto parallelGrad = loss.grad(4);
+
+	for(int i = 0; i < 50000; i++) {
+		ASSERT_NEAR(parallelGrad.getValue(inputs[i]), serialGrad.getValue(inputs[i]), 1e-9);
+	}
+	ASSERT_EQ(parallelGrad.getValue(unused), 0.0);
+
+	// A narrow graph falls back to the serial sweep
+	auto chain = inputs[0] * inputs[1] * inputs[2];
+	auto chainGrad = chain.grad(4);
+	ASSERT_EQ(chainGrad.getValue(inputs[0]), inputs[1].getValue() * inputs[2].getValue());
+}
+
+
+
+TEST(AutodiffTest, Jacobian) {
+	// Gradients of several outputs computed in a single sweep
+
+	ts::WengertList<float> wList;
+
+	auto x = ts::NewVar(3.0f, &wList);
+	auto y = ts::NewVar(5.0f, &wList);
+
+	auto f = x * y;
+	auto g = x / y;
+	auto h = f + g - x;
+
+	auto jacobian = wList.grad({f, g, h});
+
+	ASSERT_EQ(jacobian.getNOutputs(), 3);
+
+	ASSERT_EQ(jacobian.getValue(0, x), y.getValue());
+	ASSERT_EQ(jacobian.getValue(0, y), x.getValue());
+	ASSERT_EQ(jacobian.getValue(1, x), 1.0f / y.getValue());
+	ASSERT_EQ(jacobian.getValue(1, y), -x.getValue() / (y.getValue() * y.getValue()));
+
+	// Must match the single output sweep
+	auto hGrad = h.grad();
+	ASSERT_EQ(jacobian.getValue(2, x), hGrad.getValue(x));
+	ASSERT_EQ(jacobian.getValue(2, y), hGrad.getValue(y));
+
+	// Gradient::getValue() refers to the first output
+	ASSERT_EQ(jacobian.getValue(x), jacobian.getValue(0, x));
+
+	// f doesn't depend on g
+	ASSERT_EQ(jacobian.getValue(0, g), 0.0f);
+
+	// Outputs that don't exist have no derivatives
+	ASSERT_EQ(jacobian.getValue(3, x), 0.0f);
+	ASSERT_EQ(jacobian.getValue(-1, x), 0.0f);
+
+	// Nor does an empty list of outputs
+	auto empty = wList.grad({});
+	ASSERT_EQ(empty.getNOutputs(), 0);
+	ASSERT_EQ(empty.getNStored(), 0);
+	ASSERT_EQ(empty.getValue(x), 0.0f);
+	ASSERT_EQ(empty.getValue(0, x), 0.0f);
+}
+
+
+
+TEST(AutodiffTest, Checkpoint) {
+	// A checkpointed loop must give the same gradient as the recorded one,
+	// with a much shorter tape
+
+	auto step = [](const std::vector<ts::Var<double>> &state) {
+		return std::vector<ts::Var<double>>{state[0] * state[1] + state[2], state[1], state[2]};
+	};
+
+	ts::WengertList<double> plainList;
+	std::vector<ts::Var<double>> plainState = {
+		ts::NewVar(0.5, &plainList), ts::NewVar(0.999, &plainList), ts::NewVar(0.01, &plainList)
+	};
+	std::vector<ts::Var<double>> plainInputs = plainState;
+	for(int i = 0; i < 1000; i++) {
+		plainState = step(plainState);
+	}
+	auto plainGrad = plainState[0].grad();
+
+	for(int nSnapshots : {0, 4}) {
+		ts::WengertList<double> wList;
+		std::vector<ts::Var<double>> inputs = {
+			ts::NewVar(0.5, &wList), ts::NewVar(0.999, &wList), ts::NewVar(0.01, &wList)
+		};
+
+		auto state = wList.checkpointLoop(step, inputs, 1000, nSnapshots);
+		auto loss = state[0] * state[0];
+		auto grad = loss.grad();
+
+		// Plain recording takes 2 nodes per step
+		ASSERT_LE(wList.size(), 100);
+		ASSERT_EQ(state[0].getValue(), plainState[0].getValue());
+
+		for(int i = 0; i < 3; i++) {
+			ASSERT_NEAR(
+				grad.getValue(inputs[i]),
+				2.0 * plainState[0].getValue() * plainGrad.getValue(plainInputs[i]),
+				1e-9
+			);
+		}
+
+
+		// Jacobian sweeps replay the segments as well
+		auto jacobian = wList.grad({state[0], loss});
+		for(int i = 0; i < 3; i++) {
+			ASSERT_NEAR(jacobian.getValue(0, inputs[i]), plainGrad.getValue(plainInputs[i]), 1e-9);
+			ASSERT_NEAR(jacobian.getValue(1, inputs[i]), grad.getValue(inputs[i]), 1e-9);
+		}
+	}
+
+
+	// Single segment, with an input from another list treated as a constant
+	ts::WengertList<float> wList;
+	ts::WengertList<float> otherList;
+	auto x = ts::NewVar(3.0f, &wList);
+	auto c = ts::NewVar(2.0f, &otherList);
+
+	auto outputs = wList.checkpoint([](const std::vector<ts::Var<float>> &in) {
+		return std::vector<ts::Var<float>>{in[0] * in[0] * in[1]};
+	}, {x, c});
+
+	ASSERT_EQ(outputs[0].getValue(), 18.0f);
+	ASSERT_EQ(outputs[0].grad().getValue(x), 12.0f);
+
+
+	// Loop without state
+	int nCalls = 0;
+	auto emptyState = wList.checkpointLoop([&](const std::vector<ts::Var<float>> &in) {
+		nCalls++;
+		return in;
+	}, {}, 100);
+	ASSERT_TRUE(emptyState.empty());
+	ASSERT_EQ(nCalls, 100);
+}
+
+
+
+TEST(AutodiffTest, BytesPerNode) {
+	ts::WengertList<double> wList;
+	ASSERT_EQ(wList.bytesPerNode(), 0.0);
+
+	// Input nodes only take their offset
+	auto x = ts::NewVar(2.0, &wList);
+	auto y = ts::NewVar(3.0, &wList);
+	ASSERT_EQ(wList.bytesPerNode(), (2.0 * 4 + 4) / 2);
+
+	// A binary node takes 2 partials and 2 parent indices
+	auto z = x * y;
+	ASSERT_EQ(z.getValue(), 6.0);
+	ASSERT_EQ(wList.bytesPerNode(), (3.0 * 4 + 4 + 2 * (8 + 4)) / 3);
+}
+
+
+
+TEST(AutodiffTest, SparseGrad) {
+	// Differentiating a small part of a large tape
+
+	ts::WengertList<double> wList;
+
+	auto x = ts::NewVar(2.0, &wList);
+	auto y = ts::NewVar(3.0, &wList);
+	auto early = x * y;
+
+	ts::Var<double> chain = ts::NewVar(1.0, &wList);
+	for(int i = 0; i < 100000; i++) {
+		chain = chain * y + x;
+	}
+	auto late = early / x + y;
+
+	// Dense gradients stop at their output
+	auto earlyGrad = early.grad();
+	ASSERT_EQ(earlyGrad.getNStored(), 3);
+	ASSERT_EQ(earlyGrad.getValue(x), 3.0);
+	ASSERT_EQ(earlyGrad.getValue(chain), 0.0);
+
+	// The sparse gradient only stores the nodes late depends on
+	auto lateGrad = late.sparseGrad();
+	auto lateDenseGrad = late.grad();
+	ASSERT_EQ(lateGrad.getNStored(), 5);
+	ASSERT_EQ(lateDenseGrad.getNStored(), wList.size());
+
+	ASSERT_EQ(lateGrad.getValue(x), lateDenseGrad.getValue(x));
+	ASSERT_EQ(lateGrad.getValue(y), lateDenseGrad.getValue(y));
+	ASSERT_EQ(lateGrad.getValue(early), 0.5);
+	ASSERT_EQ(lateGrad.getValue(late), 1.0);
+	ASSERT_EQ(lateGrad.getValue(chain), 0.0);
+
+	// Both must match on a dense graph as well
+	auto chainGrad = chain.sparseGrad();
+	auto chainDenseGrad = chain.grad();
+	ASSERT_EQ(chainGrad.getValue(x), chainDenseGrad.getValue(x));
+	ASSERT_EQ(chainGrad.getValue(y), chainDenseGrad.getValue(y));
+}
+
+
+
+TEST(AutodiffTest, GradBuffer) {
+	// Gradients computed in a reused buffer must not allocate once it is
+	// large enough, and views must point to that buffer
+
+	ts::WengertList<double> wList;
+	wList.reserve(16);
+	std::vector<double> buffer;
+	buffer.reserve(16);
+	const double * bufferData = buffer.data();
+
+	for(int step = 0; step < 3; step++) {
+		wList.reset();
+		unsigned long before = nAllocations;
+
+		auto x = ts::NewVar(2.0 + step, &wList);
+		auto y = ts::NewVar(3.0, &wList);
+		auto z = x * y - x / y;
+
+		ts::Gradient<double> grad = z.grad(std::move(buffer));
+		ASSERT_EQ(grad.getData(), bufferData);
+		ASSERT_EQ(grad.getNStored(), 5);
+		ASSERT_EQ(grad.getData()[x.getIndex()], grad.getValue(x));
+		ASSERT_EQ(grad.getValue(x), 3.0 - 1.0 / 3.0);
+		ASSERT_EQ(grad.getValue(y), x.getValue() + x.getValue() / 9.0);
+
+		buffer = grad.release();
+		ASSERT_EQ(grad.getNStored(), 0);
+		ASSERT_EQ(nAllocations - before, 0ul);
+	}
+}
+
+
+
+TEST(AutodiffTest, ElementaryFunctions) {
+	// Each function records a single node, whose partial derivative is
+	// computed along with its value
+
+	ts::WengertList<double> wList;
+
+	auto x = ts::NewVar(0.7, &wList);
+	auto y = ts::NewVar(1.3, &wList);
+
+	auto e = ts::exp(x);
+	auto l = ts::log(y);
+	auto s = ts::sin(x);
+	auto c = ts::cos(x);
+	auto t = ts::tanh(y);
+	auto r = ts::sqrt(y);
+	auto p = ts::pow(x, y);
+	auto q = ts::pow(y, 3.0);	// The exponent is folded
+	ASSERT_EQ(wList.size(), 10);
+
+	ASSERT_EQ(e.getValue(), exp(0.7));
+	ASSERT_EQ(q.getValue(), pow(1.3, 3.0));
+
+	ASSERT_NEAR(e.grad().getValue(x), exp(0.7), 1e-15);
+	ASSERT_NEAR(l.grad().getValue(y), 1.0 / 1.3, 1e-15);
+	ASSERT_NEAR(s.grad().getValue(x), cos(0.7), 1e-15);
+	ASSERT_NEAR(c.grad().getValue(x), -sin(0.7), 1e-15);
+	ASSERT_NEAR(t.grad().getValue(y), 1.0 - tanh(1.3) * tanh(1.3), 1e-15);
+	ASSERT_NEAR(r.grad().getValue(y), 0.5 / sqrt(1.3), 1e-15);
+	ASSERT_NEAR(q.grad().getValue(y), 3.0 * 1.3 * 1.3, 1e-14);
+
+	auto pGrad = p.grad();
+	ASSERT_NEAR(pGrad.getValue(x), 1.3 * pow(0.7, 0.3), 1e-15);
+	ASSERT_NEAR(pGrad.getValue(y), log(0.7) * pow(0.7, 1.3), 1e-15);
+
+	// Composition with the arithmetic operators
+	auto z = ts::exp(x * y) / ts::sqrt(x);
+	auto zGrad = z.grad();
+	double expected = exp(0.91) * (1.3 / sqrt(0.7) - 0.5 / pow(0.7, 1.5));
+	ASSERT_NEAR(zGrad.getValue(x), expected, 1e-14);
+}
+
+
+
+TEST(AutodiffTest, ReducedPrecision) {
+	// Partials stored on 16 bits give the same gradients, up to their
+	// rounding, with every reverse sweep
+
+	auto f = [](ts::Var<float> x, ts::Var<float> y) {
+		ts::Var<float> res = x;
+		for(int i = 0; i < 2000; i++) {
+			res = ts::tanh(res * y + x) + res / (y + x);
+		}
+		return res + ts::sin(x * y);
+	};
+
+	ts::WengertList<float> fullList;
+	fullList.setTracing(true);
+	auto xf = ts::NewVar(0.3f, &fullList);
+	auto yf = ts::NewVar(0.7f, &fullList);
+	auto expected = f(xf, yf).grad();
+
+	for(ts::TapePrecision precision : {ts::TapePrecision::BFloat16, ts::TapePrecision::Half}) {
+		float tolerance = precision == ts::TapePrecision::BFloat16 ? 1e-2 : 2e-3;
+
+		ts::WengertList<float> wList;
+		ASSERT_TRUE(wList.setPrecision(precision));
+		ASSERT_EQ(wList.getPrecision(), precision);
+		wList.setTracing(true);
+
+		auto x = ts::NewVar(0.3f, &wList);
+		auto y = ts::NewVar(0.7f, &wList);
+		auto z = f(x, y);
+		ASSERT_EQ(wList.size(), fullList.size());
+		ASSERT_LT(wList.bytesPerNode(), fullList.bytesPerNode() - 2.0);
+
+		// Dense, sparse and multiple outputs sweeps
+		auto grad = z.grad();
+		auto sparse = z.sparseGrad();
+		auto jacobian = wList.grad({z, x * y});
+		for(auto a : {std::make_pair(x, xf), std::make_pair(y, yf)}) {
+			float value = expected.getValue(a.second);
+			ASSERT_NEAR(grad.getValue(a.first), value, tolerance * std::fabs(value));
+			ASSERT_EQ(sparse.getValue(a.first), grad.getValue(a.first));
+			ASSERT_EQ(jacobian.getValue(0, a.first), grad.getValue(a.first));
+		}
+		ASSERT_NEAR(jacobian.getValue(1, x), 0.7f, tolerance);
+
+		// Plans recompute their partials in full precision
+		ts::Plan<float> plan = wList.compile({x, y}, {z});
+		ASSERT_EQ(plan.size(), wList.size() - 1);
+
+		float inputs[2] = {0.3f, 0.7f};
+		float gradient[2];
+		plan.grad(inputs, NULL, gradient);
+		ASSERT_EQ(gradient[0], expected.getValue(xf));
+		ASSERT_EQ(gradient[1], expected.getValue(yf));
+
+		// Precision is kept by reset(), and can't change once recorded
+		ASSERT_FALSE(wList.setPrecision(ts::TapePrecision::Full));
+		wList.reset();
+		ASSERT_EQ(wList.getPrecision(), precision);
+		ASSERT_TRUE(wList.setPrecision(ts::TapePrecision::Full));
+	}
+
+	// Only float lists can be stored in reduced precision
+	ts::WengertList<double> doubleList;
+	ASSERT_FALSE(doubleList.setPrecision(ts::TapePrecision::BFloat16));
+	ASSERT_EQ(doubleList.getPrecision(), ts::TapePrecision::Full);
+}
+
+
+
+TEST(AutodiffTest, BackingStore) {
+	// Tapes spilled to disk must give the same gradients as tapes in memory.
+	// This one spans several chunks of each file.
+
+	auto record = [](ts::WengertList<double> &wList, std::vector<ts::Var<double>> &inputs) {
+		inputs.clear();
+		for(int i = 0; i < 16; i++) {
+			inputs.push_back(ts::NewVar(0.5 + 0.01 * i, &wList));
+		}
+		ts::Var<double> res = inputs[0];
+		for(int i = 0; i < 1500000; i++) {
+			res = res * inputs[i % 16] - inputs[(i + 3) % 16];
+		}
+		return res;
+	};
+
+	ts::WengertList<double> memoryList;
+	std::vector<ts::Var<double>> memoryInputs;
+	auto expected = record(memoryList, memoryInputs).grad();
+
+	ts::WengertList<double> wList;
+	ASSERT_FALSE(wList.setBackingStore("/nonexistent/directory"));
+	ASSERT_TRUE(wList.setBackingStore(testing::TempDir()));
+
+	for(int step = 0; step < 2; step++) {
+		wList.reset();
+		std::vector<ts::Var<double>> inputs;
+		auto y = record(wList, inputs);
+		ASSERT_EQ(wList.size(), memoryList.size());
+		ASSERT_EQ(wList.bytesPerNode(), memoryList.bytesPerNode());
+
+		auto grad = y.grad();
+		auto jacobian = wList.grad({y, inputs[2] * inputs[3]});
+		for(int i = 0; i < 16; i++) {
+			ASSERT_EQ(grad.getValue(inputs[i]), expected.getValue(memoryInputs[i]));
+			ASSERT_EQ(jacobian.getValue(0, inputs[i]), expected.getValue(memoryInputs[i]));
+		}
+		ASSERT_EQ(jacobian.getValue(1, inputs[2]), inputs[3].getValue());
+	}
+
+	// Only empty lists can be spilled
+	ASSERT_FALSE(wList.setBackingStore(testing::TempDir()));
+}
+
+
+
+TEST(AutodiffTest, UnreachedNodes) {
+	// Nodes recorded before everything the output depends on are never
+	// swept, which must not change the gradients, including those of
+	// checkpointed segments whose first output isn't used
+
+	ts::WengertList<double> wList;
+	ts::Var<double> metric = ts::NewVar(1.0, &wList);
+	for(int i = 0; i < 1000; i++) {
+		metric = metric * ts::NewVar(1.001, &wList);
+	}
+
+	auto x = ts::NewVar(2.0, &wList);
+	auto y = ts::NewVar(3.0, &wList);
+	auto outputs = wList.checkpoint(
+		[](const std::vector<ts::Var<double>> &in) {
+			return std::vector<ts::Var<double>>{in[0] + in[1], in[0] * in[1]};
+		},
+		{x, y}
+	);
+	auto z = outputs[1] * x;
+
+	auto grad = z.grad();
+	ASSERT_EQ(grad.getValue(x), 2.0 * 2.0 * 3.0);
+	ASSERT_EQ(grad.getValue(y), 2.0 * 2.0);
+	ASSERT_EQ(grad.getValue(metric), 0.0);
+
+	// Same with several outputs, one of them only depending on the prefix
+	auto w = metric * metric;
+	auto jacobian = wList.grad({z, w, outputs[0]});
+	ASSERT_EQ(jacobian.getValue(0, x), 12.0);
+	ASSERT_EQ(jacobian.getValue(0, y), 4.0);
+	ASSERT_EQ(jacobian.getValue(1, metric), 2.0 * metric.getValue());
+	ASSERT_EQ(jacobian.getValue(2, x), 1.0);
+	ASSERT_EQ(jacobian.getValue(2, y), 1.0);
+}
+
+
+
+TEST(AutodiffTest, Constants) {
+	// Constants (Vars without list, or plain values) are folded in the nodes
+	// of the operations using them, and operations on constants only are
+	// not recorded
+
+	ts::WengertList<double> wList;
+	auto x = ts::NewVar(1.5, &wList);
+	ts::Var<double> c(4.0, NULL);
+	ASSERT_EQ(c.getIndex(), -1);
+
+	auto y = 2.0 * x * x + c * x - x / 4.0 + 1.0 / x - (3.0 - x) + c / 2.0;
+	ASSERT_EQ(wList.size(), 12);
+
+	double expected = 2.0 * 1.5 * 1.5 + 4.0 * 1.5 - 1.5 / 4.0 + 1.0 / 1.5 - (3.0 - 1.5) + 4.0 / 2.0;
+	ASSERT_DOUBLE_EQ(y.getValue(), expected);
+	ASSERT_DOUBLE_EQ(y.grad().getValue(x), 4.0 * 1.5 + 4.0 - 0.25 - 1.0 / (1.5 * 1.5) + 1.0);
+
+	// Operations on constants only
+	auto d = ts::exp(c * c) + ts::pow(c, 0.5);
+	ASSERT_EQ(d.getIndex(), -1);
+	ASSERT_EQ(d.getValue(), exp(16.0) + 2.0);
+	ASSERT_EQ(d.grad().getNStored(), 0);
+	ASSERT_EQ(wList.size(), 12);
+
+	// Expression templates ignore constant leaves
+	auto e = ts::fuse([](auto a, auto b, auto k) { return a * b + k * a; }, x, y, c);
+	ASSERT_EQ(wList.size(), 13);
+	ASSERT_DOUBLE_EQ(e.grad().getValue(x), y.getValue() + 4.0 + 1.5 * y.grad().getValue(x));
+
+	// Traced lists record them as input nodes, so the tape can be compiled
+	ts::WengertList<double> tracedList;
+	tracedList.setTracing(true);
+	auto t = ts::NewVar(1.5, &tracedList);
+	auto u = ts::pow(3.0 * t, 2.0);
+	ASSERT_EQ(tracedList.size(), 5);
+
+	ts::Plan<double> plan = tracedList.compile({t}, {u});
+	ASSERT_EQ(plan.size(), 5);
+	double in = 2.0, out, gradient;
+	plan.grad(&in, &out, &gradient);
+	ASSERT_DOUBLE_EQ(out, 36.0);
+	ASSERT_DOUBLE_EQ(gradient, 36.0);
+
+	// Different lists still give an invalid Var
+	ts::WengertList<double> otherList;
+	auto z = x * ts::NewVar(2.0, &otherList);
+	ASSERT_EQ(z.getValue(), 0.0);
+	ASSERT_EQ(z.getIndex(), -1);
+}
+
+
+
+TEST(AutodiffTest, NoGrad) {
+	// Nothing is pushed on a list while recording is disabled, and the
+	// values are the same
+
+	ts::WengertList<float> wList;
+	auto x = ts::NewVar(0.5f, &wList);
+	auto y = ts::NewVar(2.0f, &wList);
+	auto f = [](ts::Var<float> a, ts::Var<float> b) {
+		return ts::tanh(a * b) + ts::sqrt(b) / ts::exp(a) - ts::log(b) * ts::sin(a) + ts::pow(a, b);
+	};
+
+	auto recorded = f(x, y);
+	const int size = wList.size();
+
+	ts::Var<float> inferred(0.0f, NULL);
+	{
+		ts::NoGrad<float> guard(&wList);
+		ASSERT_FALSE(wList.isRecording());
+
+		unsigned long allocations = nAllocations;
+		inferred = f(x, y);
+		ASSERT_EQ(nAllocations, allocations);
+
+		ASSERT_EQ(ts::NewVar(1.0f, &wList).getIndex(), -1);
+		auto outputs = wList.checkpoint(
+			[](const std::vector<ts::Var<float>> &in) {
+				return std::vector<ts::Var<float>>{in[0] * in[1]};
+			},
+			{x, y}
+		);
+		ASSERT_EQ(outputs[0].getValue(), 1.0f);
+		ASSERT_EQ(ts::Var<float>(ts::lazy(x) * y + x).getIndex(), -1);
+	}
+
+	ASSERT_TRUE(wList.isRecording());
+	ASSERT_EQ(wList.size(), size);
+	ASSERT_EQ(inferred.getIndex(), -1);
+	ASSERT_EQ(inferred.getValue(), recorded.getValue());
+
+	// Vars recorded before the guard are still differentiable
+	auto z = x * y;
+	ASSERT_EQ(z.grad().getValue(x), 2.0f);
+}
+
+
+
+TEST(AutodiffTest, SharedList) {
+	// Threads recording sub-expressions on a shared list give the same
+	// gradient as a single thread recording them one after the other
+
+	auto term = [](const std::vector<ts::Var<double>> &p, int t) {
+		ts::Var<double> res = p[t % 4] * 0.0;
+		for(int i = 0; i < 1500; i++) {
+			res = res + ts::sin(p[t % 4] * (double) i) * p[(t + i) % 4];
+			if(i % 100 == 0) {
+				res = ts::lazy(res) * p[0] + p[1];
+			}
+		}
+		return res;
+	};
+	const int nTerms = 6;
+
+	std::vector<double> expected(4);
+	{
+		ts::WengertList<double> wList;
+		std::vector<ts::Var<double>> p;
+		for(int j = 0; j < 4; j++) {
+			p.push_back(ts::NewVar(0.1 * (j + 1), &wList));
+		}
+		ts::Var<double> sum = ts::Var<double>(0.0, NULL);
+		for(int t = 0; t < nTerms; t++) {
+			sum = sum + term(p, t);
+		}
+		auto grad = sum.grad();
+		for(int j = 0; j < 4; j++) {
+			expected[j] = grad.getValue(p[j]);
+		}
+	}
+
+	ts::WengertList<double> wList;
+	std::vector<ts::Var<double>> p;
+	for(int j = 0; j < 4; j++) {
+		p.push_back(ts::NewVar(0.1 * (j + 1), &wList));
+	}
+
+	for(int run = 0; run < 2; run++) {
+		ASSERT_TRUE(wList.beginShared(nTerms * 8000));
+		ASSERT_FALSE(wList.beginShared(1000));
+
+		std::vector<ts::Var<double>> terms(nTerms, ts::Var<double>(0.0, NULL));
+		std::vector<std::thread> threads;
+		for(int t = 1; t < nTerms; t++) {
+			threads.push_back(std::thread([&, t]() { terms[t] = term(p, t); }));
+		}
+		terms[0] = term(p, 0);
+		for(std::thread &thread : threads) {
+			thread.join();
+		}
+		wList.endShared();
+
+		ts::Var<double> sum = terms[0];
+		for(int t = 1; t < nTerms; t++) {
+			sum = sum + terms[t];
+		}
+		auto grad = sum.grad();
+		for(int j = 0; j < 4; j++) {
+			ASSERT_NEAR(grad.getValue(p[j]), expected[j], 1e-9 * std::abs(expected[j]));
+		}
+		ASSERT_EQ(sum.sparseGrad().getValue(p[3]), grad.getValue(p[3]));
+	}
+
+	// Traced and spilled lists can't be shared
+	ts::WengertList<double> tracedList;
+	tracedList.setTracing(true);
+	ASSERT_FALSE(tracedList.beginShared(1000));
+}
+
+
+
 int main(int argc, char **argv) {
 	std::cout << "*** AUTODIFF TEST SUITE ***" << std::endl;
 
@@ -0,0 +1,249 @@
+/*
+* Test suite for the data loader
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+#include <thread>
+
+#include "../include/tensorslow.h"
+
+
+
+// Dataset of n samples, whose features are (i, -i) and target i + 0.5
+static ts::data::Dataset<float> * makeDataset(int n) {
+	std::vector<float> features, targets;
+	for(int i = 0; i < n; i++) {
+		features.push_back(i);
+		features.push_back(-i);
+		targets.push_back(i + 0.5f);
+	}
+	return new ts::data::Dataset<float>(features, targets, 2, 1);
+}
+
+
+
+// Checks that batch rows are whole samples, and returns their index
+static std::vector<int> getSamples(const ts::data::Batch<float> &batch) {
+	std::vector<int> res;
+	const ts::Tensor<float> &features = batch.getFeatures();
+	const ts::Tensor<float> &targets = batch.getTargets();
+
+	for(int i = 0; i < features.getShape()[0]; i++) {
+		int sample = features[2 * i];
+		EXPECT_EQ(features[2 * i + 1], -sample);
+		EXPECT_EQ(targets[i], sample + 0.5f);
+		res.push_back(sample);
+	}
+	return res;
+}
+
+
+
+TEST(DataTest, Dataset) {
+	std::unique_ptr<ts::data::Dataset<float>> dataset(makeDataset(10));
+	ASSERT_EQ(dataset->size(), 10);
+	ASSERT_EQ(dataset->getNFeatures(), 2);
+	ASSERT_EQ(dataset->getNTargets(), 1);
+	ASSERT_FALSE(dataset->isMapped());
+	ASSERT_EQ(dataset->getFeatures(3)[1], -3.0f);
+	ASSERT_EQ(dataset->getTargets(3)[0], 3.5f);
+
+	// Written datasets are read back, mapped or not
+	std::string path = testing::TempDir() + "/tensorslow-dataset.bin";
+	ASSERT_TRUE(dataset->write(path));
+
+	for(bool map : {true, false}) {
+		ts::data::Dataset<float> read;
+		ASSERT_TRUE(read.open(path, 2, 1, map));
+		ASSERT_EQ(read.size(), 10);
+		for(int i = 0; i < 10; i++) {
+			ASSERT_EQ(read.getFeatures(i)[0], dataset->getFeatures(i)[0]);
+			ASSERT_EQ(read.getFeatures(i)[1], dataset->getFeatures(i)[1]);
+			ASSERT_EQ(read.getTargets(i)[0], dataset->getTargets(i)[0]);
+		}
+	}
+
+	// Files that aren't made of whole records are rejected
+	ts::data::Dataset<float> invalid;
+	ASSERT_FALSE(invalid.open(path, 3, 1));
+	ASSERT_EQ(invalid.size(), 0);
+	ASSERT_FALSE(invalid.open(path + ".missing", 2, 1));
+
+	std::remove(path.c_str());
+
+	// As well as mismatched sizes
+	ts::data::Dataset<float> mismatched({1.0f, 2.0f, 3.0f, 4.0f}, {1.0f}, 2, 1);
+	ASSERT_EQ(mismatched.size(), 0);
+}
+
+
+
+TEST(DataTest, Queue) {
+	// Every element pushed by several producers is popped exactly once by
+	// several consumers
+
+	ts::internal::BoundedQueue<int> queue(5);
+	int value;
+	for(int i = 0; i < 8; i++) {
+		ASSERT_TRUE(queue.push(i));
+	}
+	ASSERT_FALSE(queue.push(8));
+	for(int i = 0; i < 8; i++) {
+		ASSERT_TRUE(queue.pop(value));
+		ASSERT_EQ(value, i);
+	}
+	ASSERT_FALSE(queue.pop(value));
+
+	const int nPerThread = 100000;
+	std::vector<std::atomic<int>> counts(2 * nPerThread);
+	std::atomic<int> nPopped(0);
+	std::vector<std::thread> threads;
+
+	for(int t = 0; t < 2; t++) {
+		threads.push_back(std::thread([&, t]() {
+			for(int i = 0; i < nPerThread; i++) {
+				while(!queue.push(t * nPerThread + i)) {
+					std::this_thread::yield();
+				}
+			}
+		}));
+		threads.push_back(std::thread([&]() {
+			int popped;
+			while(nPopped.load() < 2 * nPerThread) {
+				if(queue.pop(popped)) {
+					counts[popped]++;
+					nPopped++;
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		}));
+	}
+	for(std::thread &thread : threads) {
+		thread.join();
+	}
+
+	for(int i = 0; i < 2 * nPerThread; i++) {
+		ASSERT_EQ(counts[i].load(), 1);
+	}
+}
+
+
+
+TEST(DataTest, Sequential) {
+	// Without shuffling and with a single worker, batches come in order, and
+	// the incomplete batch is dropped
+
+	std::unique_ptr<ts::data::Dataset<float>> dataset(makeDataset(103));
+	ts::data::Loader<float> loader(*dataset, 10, false);
+	ASSERT_EQ(loader.getNBatches(), 10);
+	ASSERT_EQ(loader.getBatchSize(), 10);
+
+	for(int epoch = 0; epoch < 2; epoch++) {
+		ASSERT_EQ(loader.getEpoch(), epoch);
+
+		ts::data::Batch<float> batch;
+		for(int b = 0; b < 10; b++) {
+			ASSERT_TRUE(loader.next(batch));
+			ASSERT_EQ(batch.getIndex(), b);
+			ASSERT_EQ(batch.getFeatures().getShape(), std::vector<int>({10, 2}));
+
+			std::vector<int> samples = getSamples(batch);
+			for(int i = 0; i < 10; i++) {
+				ASSERT_EQ(samples[i], b * 10 + i);
+			}
+		}
+		ASSERT_FALSE(loader.next(batch));
+	}
+}
+
+
+
+TEST(DataTest, Shuffled) {
+	// Each epoch covers every sample once in a new order, with several
+	// workers
+
+	std::unique_ptr<ts::data::Dataset<float>> dataset(makeDataset(1000));
+	ts::data::Loader<float> loader(*dataset, 50, true, 3, 4, 42);
+
+	std::vector<int> previous;
+	for(int epoch = 0; epoch < 3; epoch++) {
+		std::vector<int> seen(1000, 0);
+		std::vector<int> order;
+		std::vector<int> batchesSeen(20, 0);
+
+		ts::data::Batch<float> batch;
+		while(loader.next(batch)) {
+			batchesSeen[batch.getIndex()]++;
+			for(int sample : getSamples(batch)) {
+				seen[sample]++;
+				order.push_back(sample);
+			}
+		}
+
+		for(int i = 0; i < 1000; i++) {
+			ASSERT_EQ(seen[i], 1);
+		}
+		for(int b = 0; b < 20; b++) {
+			ASSERT_EQ(batchesSeen[b], 1);
+		}
+		ASSERT_NE(order, previous);
+		previous = order;
+	}
+}
+
+
+
+TEST(DataTest, Training) {
+	// Batches feed the tensor engine without copies : a linear model learns
+	// target = x0 + 0.5 from a memory-mapped dataset
+
+	std::unique_ptr<ts::data::Dataset<float>> source(makeDataset(64));
+	std::string path = testing::TempDir() + "/tensorslow-training.bin";
+	ASSERT_TRUE(source->write(path));
+
+	ts::data::Dataset<float> dataset;
+	ASSERT_TRUE(dataset.open(path, 2, 1));
+	ASSERT_TRUE(dataset.isMapped());
+
+	ts::nn::Dense<float> layer(2, 1);
+	ts::data::Loader<float> loader(dataset, 16);
+	ts::TensorList<float> list;
+	float loss = 0.0f;
+
+	for(int epoch = 0; epoch < 300; epoch++) {
+		ts::data::Batch<float> batch;
+		while(loader.next(batch)) {
+			list.reset();
+			auto x = ts::NewTensorVar(batch.borrowFeatures(), &list);
+			auto t = ts::NewTensorVar(batch.borrowTargets(), &list);
+			ASSERT_EQ(x.getValue().getData(), batch.getFeatures().getData());
+			auto mse = ts::nn::mse(layer.forward(x), t);
+			loss = mse.getValue()[0];
+
+			auto grad = mse.grad();
+			ts::Tensor<float> dw = grad.getValue(layer.getWeightsVar());
+			ts::Tensor<float> db = grad.getValue(layer.getBiasVar());
+
+			// Features go up to 63, hence the small learning rate
+			ts::kernels::axpy(dw.size(), -1e-4f, dw.getData(), layer.getWeights().getData());
+			ts::kernels::axpy(db.size(), -1e-2f, db.getData(), layer.getBias().getData());
+		}
+	}
+
+	std::remove(path.c_str());
+	ASSERT_LT(loss, 1e-2f);
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** DATA TEST SUITE ***" << std::endl;
+
+	srand (time(NULL));
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
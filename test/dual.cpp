@@ -0,0 +1,224 @@
+/*
+* Test suite for the forward mode (dual numbers)
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+
+#include "../include/tensorslow.h"
+
+
+
+TEST(DualTest, Operators) {
+	// Tangents of the four arithmetic operators
+
+	ts::Dual<double> x(3.0, 1.0);	// dx/dx = 1
+	ts::Dual<double> y(5.0);	// Constant
+
+	ASSERT_EQ((x + y).getValue(), 8.0);
+	ASSERT_EQ((x + y).getTangent(), 1.0);
+	ASSERT_EQ((x - y).getTangent(), 1.0);
+	ASSERT_EQ((y - x).getTangent(), -1.0);
+	ASSERT_EQ((x * y).getTangent(), 5.0);
+	ASSERT_DOUBLE_EQ((x / y).getTangent(), 1.0 / 5.0);
+	ASSERT_DOUBLE_EQ((y / x).getTangent(), -5.0 / 9.0);
+	ASSERT_EQ((-x).getTangent(), -1.0);
+}
+
+
+
+TEST(DualTest, Polynomial) {
+	// Plain numbers mix with dual numbers as constants
+
+	ts::Dual<float> x(2.0f, 1.0f);
+
+	auto y = 3.0f * x * x + 2.0f * x - 1.0f;
+
+	ASSERT_EQ(y.getValue(), 3.0f * 4.0f + 4.0f - 1.0f);
+	ASSERT_EQ(y.getTangent(), 6.0f * 2.0f + 2.0f);
+}
+
+
+
+TEST(DualTest, HessianVectorProduct) {
+	// f(x, y) = x^2 * y + y / x
+	// H = [[2y + 2y/x^3, 2x - 1/x^2], [2x - 1/x^2, 0]]
+
+	auto f = [](const std::vector<ts::Var<ts::Dual<double>>> &in) {
+		return in[0] * in[0] * in[1] + in[1] / in[0];
+	};
+
+	double x = 1.5, y = -2.0;
+	std::vector<double> v = {0.3, 0.7};
+
+	std::vector<double> grad;
+	std::vector<double> hv = ts::hvp(f, {x, y}, v, &grad);
+
+	double hxx = 2.0 * y + 2.0 * y / (x * x * x);
+	double hxy = 2.0 * x - 1.0 / (x * x);
+
+	ASSERT_NEAR(hv[0], hxx * v[0] + hxy * v[1], 1e-12);
+	ASSERT_NEAR(hv[1], hxy * v[0], 1e-12);
+
+	ASSERT_NEAR(grad[0], 2.0 * x * y - y / (x * x), 1e-12);
+	ASSERT_NEAR(grad[1], x * x + 1.0 / x, 1e-12);
+}
+
+
+
+TEST(DualTest, ZeroAdjoint) {
+	// f(x, y) = x^2 * y at (1, 0) : the adjoint of x^2 is y = 0, but its
+	// tangent isn't, so the reverse sweep must not skip it
+	// H * (0, 1) = (2x, 0)
+
+	auto f = [](const std::vector<ts::Var<ts::Dual<double>>> &in) {
+		return in[0] * in[0] * in[1];
+	};
+
+	std::vector<double> hv = ts::hvp(f, std::vector<double>{1.0, 0.0}, std::vector<double>{0.0, 1.0});
+
+	ASSERT_EQ(hv[0], 2.0);
+	ASSERT_EQ(hv[1], 0.0);
+}
+
+
+
+TEST(DualTest, ElementaryFunctions) {
+	// f(x, y) = exp(x) * sin(y), whose Hessian is
+	// [exp(x) sin(y), exp(x) cos(y) ; exp(x) cos(y), -exp(x) sin(y)]
+
+	auto f = [](const std::vector<ts::Var<ts::Dual<double>>> &v) {
+		return ts::exp(v[0]) * ts::sin(v[1]);
+	};
+
+	double x = 0.4;
+	double y = 1.1;
+	std::vector<double> grad;
+	std::vector<double> hv = ts::hvp(f, {x, y}, {1.0, 2.0}, &grad);
+
+	ASSERT_NEAR(grad[0], exp(x) * sin(y), 1e-14);
+	ASSERT_NEAR(grad[1], exp(x) * cos(y), 1e-14);
+	ASSERT_NEAR(hv[0], exp(x) * sin(y) + 2.0 * exp(x) * cos(y), 1e-14);
+	ASSERT_NEAR(hv[1], exp(x) * cos(y) - 2.0 * exp(x) * sin(y), 1e-14);
+}
+
+
+
+// Uses every traced operation, without constants (so it can be recorded on
+// Vars of any type)
+template <typename V>
+V allOps(const std::vector<V> &in) {
+	V x = in[0], y = in[1];
+	return
+		x * x * y + ts::sin(x) * y / (x + y) + ts::exp(x * y) * ts::tanh(y) +
+		ts::sqrt(x * y) + ts::log(x) + ts::pow(x, y) - ts::cos(y);
+}
+
+
+
+TEST(DualTest, TapeHessianVectorProduct) {
+	// Var::hvp() on a recorded tape, and the second order derivatives of
+	// Var::recordGrad(), match forward-over-reverse on Dual numbers
+
+	std::vector<double> point = {0.7, 1.3};
+	std::vector<double> v = {0.4, -1.2};
+
+	std::vector<double> expectedGrad;
+	std::vector<double> expected = ts::hvp(allOps<ts::Var<ts::Dual<double>>>, point, v, &expectedGrad);
+
+	ts::WengertList<double> wList;
+	wList.setTracing(true);
+	std::vector<ts::Var<double>> in = {ts::NewVar(point[0], &wList), ts::NewVar(point[1], &wList)};
+	ts::Var<double> f = allOps(in);
+	const int tapeSize = wList.size();
+
+	std::vector<double> grad;
+	std::vector<double> hv = f.hvp(in, v, &grad);
+	ASSERT_EQ(wList.size(), tapeSize);
+	for(int j = 0; j < 2; j++) {
+		ASSERT_NEAR(hv[j], expected[j], 1e-12);
+		ASSERT_NEAR(grad[j], expectedGrad[j], 1e-12);
+	}
+
+	std::vector<ts::Var<double>> g = f.recordGrad(in);
+	ASSERT_EQ(g.size(), 2u);
+	ASSERT_GT(wList.size(), tapeSize);
+
+	// H * v as the gradient of g . v
+	ts::Var<double> gv = g[0] * ts::NewVar(v[0], &wList) + g[1] * ts::NewVar(v[1], &wList);
+	auto secondOrder = gv.grad();
+	for(int j = 0; j < 2; j++) {
+		ASSERT_NEAR(g[j].getValue(), expectedGrad[j], 1e-12);
+		ASSERT_NEAR(secondOrder.getValue(in[j]), expected[j], 1e-12);
+	}
+}
+
+
+
+TEST(DualTest, HigherOrder) {
+	// Derivatives of recordGrad() are recorded as well, so they can be
+	// differentiated again : for f = x^4, the next derivatives are 4x^3,
+	// 12x^2 and 24x
+
+	ts::WengertList<float> wList;
+	wList.setTracing(true);
+
+	auto x = ts::NewVar(1.5f, &wList);
+	auto f = x * x * x * x;
+
+	auto d1 = f.recordGrad({x})[0];
+	auto d2 = d1.recordGrad({x})[0];
+	auto d3 = d2.recordGrad({x})[0];
+
+	ASSERT_FLOAT_EQ(d1.getValue(), 4.0f * 1.5f * 1.5f * 1.5f);
+	ASSERT_FLOAT_EQ(d2.getValue(), 12.0f * 1.5f * 1.5f);
+	ASSERT_FLOAT_EQ(d3.getValue(), 24.0f * 1.5f);
+	ASSERT_FLOAT_EQ(d3.grad().getValue(x), 24.0f);
+
+	// Nodes the output doesn't depend on get a constant zero derivative
+	auto unused = ts::NewVar(2.0f, &wList);
+	auto d = f.recordGrad({unused, x});
+	ASSERT_EQ(d[0].getValue(), 0.0f);
+	ASSERT_EQ(d[0].grad().getValue(x), 0.0f);
+
+	// The zero adjoint of x^2 at y = 0 must still be propagated
+	auto y = ts::NewVar(0.0f, &wList);
+	auto h = (x * x * y).hvp({x, y}, {0.0f, 1.0f});
+	ASSERT_FLOAT_EQ(h[0], 2.0f * 1.5f);
+	ASSERT_EQ(h[1], 0.0f);
+}
+
+
+
+TEST(DualTest, HigherOrderInvalid) {
+	// Tapes must be traced, and directions taken along input nodes
+
+	ts::WengertList<double> wList;
+	auto x = ts::NewVar(1.0, &wList);
+	auto y = x * x;
+	ASSERT_EQ(y.recordGrad({x}).size(), 0u);
+	ASSERT_EQ(y.hvp({x}, {1.0}).size(), 0u);
+
+	ts::WengertList<double> tracedList;
+	tracedList.setTracing(true);
+	x = ts::NewVar(1.0, &tracedList);
+	y = x * x;
+	auto z = y * x;
+	ASSERT_EQ(z.hvp({y}, {1.0}).size(), 0u);
+	ASSERT_EQ(z.hvp({x}, {1.0, 2.0}).size(), 0u);
+	ASSERT_EQ(z.hvp({x}, {1.0})[0], 6.0);
+
+	// Vars of another list
+	ASSERT_EQ(z.recordGrad({ts::NewVar(1.0, &wList)}).size(), 0u);
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** DUAL TEST SUITE ***" << std::endl;
+
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
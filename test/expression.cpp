@@ -0,0 +1,109 @@
+/*
+* Test suite for the expression templates
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+
+#include "../include/tensorslow.h"
+
+
+
+TEST(ExpressionTest, SingleNode) {
+	// a * b + c / d - e is recorded as a single node with 5 parents
+
+	ts::WengertList<double> wList;
+
+	auto a = ts::NewVar(2.0, &wList);
+	auto b = ts::NewVar(3.0, &wList);
+	auto c = ts::NewVar(5.0, &wList);
+	auto d = ts::NewVar(7.0, &wList);
+	auto e = ts::NewVar(11.0, &wList);
+
+	ts::Var<double> res = ts::lazy(a) * b + ts::lazy(c) / d - e;
+
+	ASSERT_EQ(wList.size(), 6);
+	ASSERT_DOUBLE_EQ(res.getValue(), 2.0 * 3.0 + 5.0 / 7.0 - 11.0);
+
+	auto grad = res.grad();
+	ASSERT_DOUBLE_EQ(grad.getValue(a), 3.0);
+	ASSERT_DOUBLE_EQ(grad.getValue(b), 2.0);
+	ASSERT_DOUBLE_EQ(grad.getValue(c), 1.0 / 7.0);
+	ASSERT_DOUBLE_EQ(grad.getValue(d), -5.0 / 49.0);
+	ASSERT_DOUBLE_EQ(grad.getValue(e), -1.0);
+}
+
+
+
+TEST(ExpressionTest, Fuse) {
+	// Same polynomial as AutodiffTest.Polynomial, through ts::fuse(). Leaves
+	// used several times get one entry each, which the sweep sums.
+
+	ts::WengertList<float> wList;
+
+	auto x = ts::NewVar(1.5f, &wList);
+	auto a = ts::NewVar(2.0f, &wList);
+	auto b = ts::NewVar(-3.0f, &wList);
+	auto c = ts::NewVar(0.5f, &wList);
+
+	auto y = ts::fuse([](auto x, auto a, auto b, auto c) {
+		return a * x * x + b * x - c;
+	}, x, a, b, c);
+
+	ASSERT_EQ(wList.size(), 5);
+	ASSERT_FLOAT_EQ(y.getValue(), 2.0f * 1.5f * 1.5f - 3.0f * 1.5f - 0.5f);
+
+	auto grad = y.grad();
+	ASSERT_FLOAT_EQ(grad.getValue(x), 2.0f * 2.0f * 1.5f - 3.0f);
+	ASSERT_FLOAT_EQ(grad.getValue(a), 1.5f * 1.5f);
+	ASSERT_FLOAT_EQ(grad.getValue(c), -1.0f);
+}
+
+
+
+TEST(ExpressionTest, MixedWithVars) {
+	// Fused nodes can be used as regular Vars afterwards
+
+	ts::WengertList<double> wList;
+
+	auto x = ts::NewVar(2.0, &wList);
+	auto y = ts::NewVar(3.0, &wList);
+
+	ts::Var<double> f = ts::lazy(x) * y - x;	// 1 node
+	auto g = f * f;	// 1 node
+
+	ASSERT_EQ(wList.size(), 4);
+
+	auto grad = g.grad();
+	ASSERT_DOUBLE_EQ(grad.getValue(x), 2.0 * f.getValue() * (3.0 - 1.0));
+	ASSERT_DOUBLE_EQ(grad.getValue(y), 2.0 * f.getValue() * 2.0);
+}
+
+
+
+TEST(ExpressionTest, DifferentLists) {
+	// Like regular operators, mixing lists doesn't record anything
+
+	ts::WengertList<float> wList1;
+	ts::WengertList<float> wList2;
+
+	auto a = ts::NewVar(1.0f, &wList1);
+	auto b = ts::NewVar(2.0f, &wList2);
+
+	ts::Var<float> c = ts::lazy(a) + b;
+
+	ASSERT_EQ(c.getValue(), 0.0f);
+	ASSERT_EQ(wList1.size(), 1);
+	ASSERT_EQ(wList2.size(), 1);
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** EXPRESSION TEST SUITE ***" << std::endl;
+
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,55 @@
+/*
+* Test suite for the header-only mode of the autodiff engine
+*/
+
+#define TS_HEADER_ONLY
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+
+#include "../include/tensorslow.h"
+
+
+
+TEST(HeaderOnlyTest, CustomScalarType) {
+	// long double is not instantiated in libtensorslow.so, so this only links
+	// if the implementation is compiled here
+
+	ts::WengertList<long double> wList;
+
+	auto x = ts::NewVar((long double) 2.0, &wList);
+	auto a = ts::NewVar((long double) 3.0, &wList);
+
+	auto y = a * x * x - x / a;
+	auto grad = y.grad();
+
+	ASSERT_EQ(y.getValue(), 3.0L * 4.0L - 2.0L / 3.0L);
+	ASSERT_EQ(grad.getValue(x), 2.0L * 3.0L * 2.0L - 1.0L / 3.0L);
+	ASSERT_EQ(grad.getValue(a), 4.0L + 2.0L / 9.0L);
+	ASSERT_EQ(wList.size(), 6);
+}
+
+
+
+TEST(HeaderOnlyTest, CustomDualType) {
+	// Forward-over-reverse mode with a non-instantiated type
+
+	auto f = [](const std::vector<ts::Var<ts::Dual<long double>>> &in) {
+		return in[0] * in[0] * in[0];
+	};
+
+	std::vector<long double> hv = ts::hvp<long double>(f, {2.0L}, {1.0L});
+
+	ASSERT_EQ(hv[0], 6.0L * 2.0L);
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** HEADER-ONLY TEST SUITE ***" << std::endl;
+
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,376 @@
+/*
+* Test suite for the vectorized kernels
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+#include <vector>
+
+#include "../include/tensorslow.h"
+
+
+
+// Every instruction set, in the order of the ts::kernels::Isa enum
+static const std::vector<ts::kernels::Isa> isas = {
+	ts::kernels::Isa::Scalar,
+	ts::kernels::Isa::Sse2,
+	ts::kernels::Isa::Avx2,
+	ts::kernels::Isa::Avx512,
+	ts::kernels::Isa::Neon
+};
+
+
+
+template <typename T>
+std::vector<T> randomVector(int n) {
+	std::vector<T> res(n);
+	for(int i = 0; i < n; i++) {
+		res[i] = 1.0 + (T)rand()/(T)(RAND_MAX/10.0);
+	}
+	return res;
+}
+
+
+
+template <typename T>
+void checkKernels(T tolerance) {
+	// Compares every kernel with a plain loop for sizes that don't fit
+	// exactly in vector registers, to test the scalar tails as well
+
+	ts::kernels::Isa defaultIsa = ts::kernels::getIsa();
+
+	for(ts::kernels::Isa isa : isas) {
+		if(!ts::kernels::setIsa(isa)) {
+			ASSERT_FALSE(ts::kernels::isSupported(isa));
+			continue;
+		}
+
+		for(int n : {0, 1, 3, 17, 100, 1031}) {
+			std::vector<T> x = randomVector<T>(n);
+			std::vector<T> y = randomVector<T>(n);
+			std::vector<T> g = randomVector<T>(n);
+
+			std::vector<T> add(n), sub(n), mul(n), div(n);
+			ts::kernels::add(n, x.data(), y.data(), add.data());
+			ts::kernels::sub(n, x.data(), y.data(), sub.data());
+			ts::kernels::mul(n, x.data(), y.data(), mul.data());
+			ts::kernels::div(n, x.data(), y.data(), div.data());
+
+			std::vector<T> shift = x, axpy = x, mulAdj = x, dx = x, dy = y;
+			ts::kernels::shift(n, (T) 2.0, shift.data());
+			ts::kernels::axpy(n, (T) 3.0, g.data(), axpy.data());
+			ts::kernels::mulAdjoint(n, g.data(), y.data(), mulAdj.data());
+			ts::kernels::divAdjoint(n, g.data(), x.data(), y.data(), dx.data(), dy.data());
+
+			T sum = 0.0, dot = 0.0;
+			for(int i = 0; i < n; i++) {
+				ASSERT_EQ(add[i], x[i] + y[i]);
+				ASSERT_EQ(sub[i], x[i] - y[i]);
+				ASSERT_EQ(mul[i], x[i] * y[i]);
+				ASSERT_EQ(div[i], x[i] / y[i]);
+
+				ASSERT_EQ(shift[i], x[i] + (T) 2.0);
+				ASSERT_NEAR(axpy[i], x[i] + (T) 3.0 * g[i], tolerance);
+				ASSERT_NEAR(mulAdj[i], x[i] + g[i] * y[i], tolerance);
+				ASSERT_NEAR(dx[i], x[i] + g[i] / y[i], tolerance);
+				ASSERT_NEAR(dy[i], y[i] - g[i] * x[i] / (y[i] * y[i]), tolerance);
+
+				sum += x[i];
+				dot += x[i] * y[i];
+			}
+
+			T relTolerance = tolerance * (1.0 + dot);
+			ASSERT_NEAR(ts::kernels::sum(n, x.data()), sum, relTolerance);
+			ASSERT_NEAR(ts::kernels::dot(n, x.data(), y.data()), dot, relTolerance);
+
+			// Optimizer updates, x being the parameters and y their state
+			std::vector<T> momentumX = x, velocity = y;
+			std::vector<T> adamX = x, m = y, v = y;
+			ts::kernels::momentumUpdate(n, (T) 0.1, (T) 0.9, g.data(), velocity.data(), momentumX.data());
+			ts::kernels::adamUpdate(
+				n, (T) 0.1, (T) 0.9, (T) 0.999, (T) 1e-8,
+				g.data(), m.data(), v.data(), adamX.data()
+			);
+
+			for(int i = 0; i < n; i++) {
+				T expectedVelocity = (T) 0.9 * y[i] + g[i];
+				ASSERT_NEAR(velocity[i], expectedVelocity, tolerance);
+				ASSERT_NEAR(momentumX[i], x[i] - (T) 0.1 * expectedVelocity, tolerance);
+
+				T expectedM = (T) 0.9 * y[i] + (T) 0.1 * g[i];
+				T expectedV = (T) 0.999 * y[i] + (T) 0.001 * g[i] * g[i];
+				ASSERT_NEAR(m[i], expectedM, tolerance);
+				ASSERT_NEAR(v[i], expectedV, tolerance);
+				ASSERT_NEAR(adamX[i], x[i] - (T) 0.1 * expectedM / (std::sqrt(expectedV) + (T) 1e-8), tolerance);
+			}
+		}
+	}
+
+	ts::kernels::setIsa(defaultIsa);
+}
+
+
+
+TEST(KernelsTest, Float) {
+	checkKernels<float>(1e-4);
+}
+
+
+
+TEST(KernelsTest, Double) {
+	checkKernels<double>(1e-12);
+}
+
+
+
+template <typename T>
+void checkGemm(T tolerance) {
+	// Compares the GEMM kernel with a naive product for every transposition
+	// and sizes that span several blocks and micro-kernel edges
+
+	ts::kernels::Isa defaultIsa = ts::kernels::getIsa();
+
+	const std::vector<std::vector<int>> sizes = {
+		{1, 1, 1}, {3, 5, 7}, {4, 16, 8}, {37, 19, 300}, {101, 70, 3}
+	};
+
+	for(ts::kernels::Isa isa : isas) {
+		if(!ts::kernels::setIsa(isa)) {
+			continue;
+		}
+
+		for(const std::vector<int> &size : sizes) {
+			int m = size[0], n = size[1], k = size[2];
+
+			for(int trans = 0; trans < 4; trans++) {
+				bool transA = trans & 1;
+				bool transB = trans & 2;
+
+				std::vector<T> a = randomVector<T>(m * k);
+				std::vector<T> b = randomVector<T>(k * n);
+				std::vector<T> c = randomVector<T>(m * n);
+				std::vector<T> expected = c;
+
+				for(int i = 0; i < m; i++) {
+					for(int j = 0; j < n; j++) {
+						for(int p = 0; p < k; p++) {
+							T aVal = transA ? a[p * m + i] : a[i * k + p];
+							T bVal = transB ? b[j * k + p] : b[p * n + j];
+							expected[i * n + j] += aVal * bVal;
+						}
+					}
+				}
+
+				ts::kernels::gemm(transA, transB, m, n, k, a.data(), b.data(), c.data());
+
+				for(int i = 0; i < m * n; i++) {
+					ASSERT_NEAR(c[i], expected[i], tolerance * expected[i]);
+				}
+			}
+		}
+	}
+
+	ts::kernels::setIsa(defaultIsa);
+}
+
+
+
+TEST(KernelsTest, GemmFloat) {
+	checkGemm<float>(1e-5);
+}
+
+
+
+TEST(KernelsTest, GemmDouble) {
+	checkGemm<double>(1e-12);
+}
+
+
+
+template <typename T>
+void checkMath(T tolerance) {
+	// Fast math approximations must stay close to the standard library, over
+	// the whole range (including values that overflow or underflow)
+
+	ts::kernels::Isa defaultIsa = ts::kernels::getIsa();
+
+	const T maxX = sizeof(T) == 4 ? 88.0 : 709.0;
+	const T minX = sizeof(T) == 4 ? -87.0 : -708.0;
+
+	const int n = 1031;
+	std::vector<T> x(n), g = randomVector<T>(n);
+	for(int i = 0; i < n; i++) {
+		x[i] = -800.0 + 1600.0 * i / (n - 1);
+	}
+	for(int i = 0; i < 200; i++) {
+		x[i * 5] = -10.0 + 0.1 * i;	// Where most values are
+	}
+
+	for(ts::kernels::Isa isa : isas) {
+		if(!ts::kernels::setIsa(isa)) {
+			continue;
+		}
+
+		for(bool fastMath : {false, true}) {
+			ts::kernels::setFastMath(fastMath);
+			ASSERT_EQ(ts::kernels::getFastMath(), fastMath);
+
+			std::vector<T> exp(n), tanh(n), sigmoid(n);
+			ts::kernels::exp(n, x.data(), exp.data());
+			ts::kernels::tanh(n, x.data(), tanh.data());
+			ts::kernels::sigmoid(n, x.data(), sigmoid.data());
+
+			for(int i = 0; i < n; i++) {
+				// Fast exp() saturates out of [minX, maxX]
+				T clamped = std::max(std::min(x[i], maxX), minX);
+				T expected = std::exp(fastMath ? clamped : x[i]);
+
+				if(std::isinf(expected)) {
+					ASSERT_TRUE(std::isinf(exp[i]));
+				} else {
+					ASSERT_NEAR(exp[i], expected, tolerance * expected);
+				}
+				ASSERT_NEAR(tanh[i], std::tanh(x[i]), tolerance);
+				ASSERT_NEAR(sigmoid[i], 1.0 / (1.0 + std::exp(-x[i])), tolerance);
+			}
+		}
+		ts::kernels::setFastMath(false);
+
+		std::vector<T> y = randomVector<T>(n);
+		std::vector<T> log(n), logAdj = g, tanhAdj = g, sigmoidAdj = g;
+		ts::kernels::log(n, y.data(), log.data());
+		ts::kernels::logAdjoint(n, g.data(), y.data(), logAdj.data());
+		ts::kernels::tanhAdjoint(n, g.data(), y.data(), tanhAdj.data());
+		ts::kernels::sigmoidAdjoint(n, g.data(), y.data(), sigmoidAdj.data());
+
+		for(int i = 0; i < n; i++) {
+			ASSERT_EQ(log[i], std::log(y[i]));
+			ASSERT_NEAR(logAdj[i], g[i] + g[i] / y[i], tolerance * 10);
+			ASSERT_NEAR(tanhAdj[i], g[i] + g[i] * (1 - y[i] * y[i]), tolerance * 1000);
+			ASSERT_NEAR(sigmoidAdj[i], g[i] + g[i] * y[i] * (1 - y[i]), tolerance * 1000);
+		}
+
+		// relu is exact, and its adjoint only goes through positive inputs
+		std::vector<T> relu(n), reluAdj = g;
+		ts::kernels::relu(n, x.data(), relu.data());
+		ts::kernels::reluAdjoint(n, g.data(), x.data(), reluAdj.data());
+
+		for(int i = 0; i < n; i++) {
+			ASSERT_EQ(relu[i], x[i] > 0.0 ? x[i] : 0.0);
+			ASSERT_EQ(reluAdj[i], x[i] > 0.0 ? g[i] + g[i] : g[i]);
+		}
+	}
+
+	ts::kernels::setIsa(defaultIsa);
+}
+
+
+
+TEST(KernelsTest, MathFloat) {
+	checkMath<float>(1e-6);
+}
+
+
+
+TEST(KernelsTest, MathDouble) {
+	checkMath<double>(1e-14);
+}
+
+
+
+TEST(KernelsTest, Conversions) {
+	// Every instruction set must give the same 16 bits values as the scalar
+	// conversions, including rounding ties, overflows, subnormals and NaNs
+
+	ts::kernels::Isa defaultIsa = ts::kernels::getIsa();
+
+	const float inf = INFINITY;
+	std::vector<float> x = {
+		0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 65519.0f, 65520.0f, 1e-7f, -3e-6f,
+		6.1e-5f, 1e-40f, -1e-39f, inf, -inf, NAN,
+		3.4e38f,	// Rounded up to infinity in bfloat16
+		1.00390625f,	// 1 + 2^-8, tie rounded down to even in bfloat16
+		1.01171875f,	// 1 + 3 * 2^-8, tie rounded up to even in bfloat16
+		1.00048828125f,	// 1 + 2^-11, tie rounded down to even in half precision
+	};
+	std::vector<float> random = randomVector<float>(77);
+	for(unsigned i = 0; i < random.size(); i++) {
+		x.push_back((i % 2 ? -1.0f : 1.0f) * random[i] * std::pow(10.0f, (int) i % 9 - 4));
+	}
+	const int n = x.size();
+
+	ASSERT_EQ(ts::kernels::toBFloat16(1.00390625f), 0x3F80);
+	ASSERT_EQ(ts::kernels::toBFloat16(1.01171875f), 0x3F82);
+	ASSERT_EQ(ts::kernels::toBFloat16(1e-40f), 0x0000);
+	ASSERT_EQ(ts::kernels::toBFloat16(-1e-39f), 0x8000);
+	ASSERT_EQ(ts::kernels::toHalf(1.00048828125f), 0x3C00);
+	ASSERT_EQ(ts::kernels::toHalf(65504.0f), 0x7BFF);
+	ASSERT_EQ(ts::kernels::toHalf(65520.0f), 0x7C00);
+	ASSERT_EQ(ts::kernels::toHalf(-inf), 0xFC00);
+	ASSERT_EQ(ts::kernels::fromHalf(0x0001), std::ldexp(1.0f, -24));
+	ASSERT_TRUE(std::isnan(ts::kernels::fromHalf(ts::kernels::toHalf(NAN))));
+	ASSERT_TRUE(std::isnan(ts::kernels::fromBFloat16(ts::kernels::toBFloat16(NAN))));
+
+	for(int i = 0; i < n; i++) {
+		// Round trips are within half an ulp (in the range of normal numbers)
+		float bf16 = ts::kernels::fromBFloat16(ts::kernels::toBFloat16(x[i]));
+		float half = ts::kernels::fromHalf(ts::kernels::toHalf(x[i]));
+		if(std::fabs(x[i]) > 1e-37f && std::fabs(x[i]) < 3e38f) {
+			ASSERT_NEAR(bf16, x[i], std::fabs(x[i]) / 256.0f);
+		}
+		if(std::fabs(x[i]) > 6.2e-5f && std::fabs(x[i]) < 65504.0f) {
+			ASSERT_NEAR(half, x[i], std::fabs(x[i]) / 2048.0f);
+		}
+	}
+
+	for(ts::kernels::Isa isa : isas) {
+		if(!ts::kernels::setIsa(isa)) {
+			continue;
+		}
+
+		std::vector<uint16_t> bf16(n), half(n);
+		std::vector<float> bf16Back(n), halfBack(n);
+		ts::kernels::toBFloat16(n, x.data(), bf16.data());
+		ts::kernels::toHalf(n, x.data(), half.data());
+		ts::kernels::fromBFloat16(n, bf16.data(), bf16Back.data());
+		ts::kernels::fromHalf(n, half.data(), halfBack.data());
+
+		for(int i = 0; i < n; i++) {
+			ASSERT_EQ(bf16[i], ts::kernels::toBFloat16(x[i])) << "at " << i;
+			ASSERT_EQ(half[i], ts::kernels::toHalf(x[i])) << "at " << i;
+
+			float bf16Expected = ts::kernels::fromBFloat16(bf16[i]);
+			float halfExpected = ts::kernels::fromHalf(half[i]);
+			ASSERT_EQ(memcmp(&bf16Back[i], &bf16Expected, sizeof(float)), 0);
+			ASSERT_EQ(memcmp(&halfBack[i], &halfExpected, sizeof(float)), 0);
+		}
+	}
+
+	ts::kernels::setIsa(defaultIsa);
+}
+
+
+
+TEST(KernelsTest, DefaultIsa) {
+	// The library always selects a supported instruction set when loaded
+
+	ts::kernels::Isa isa = ts::kernels::getIsa();
+	ASSERT_TRUE(ts::kernels::isSupported(isa));
+
+#if defined(__x86_64__) || defined(__aarch64__)
+	ASSERT_NE(isa, ts::kernels::Isa::Scalar);
+#endif
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** KERNELS TEST SUITE ***" << std::endl;
+
+	srand (time(NULL));
+
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,272 @@
+/*
+* Test suite for the neural network layers and losses
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+
+#include "../include/tensorslow.h"
+
+
+
+// Returns a tensor filled with random values in [min, min + range]
+ts::Tensor<double> randomTensor(std::vector<int> shape, double min, double range) {
+	ts::Tensor<double> res(shape);
+	for(int i = 0; i < res.size(); i++) {
+		res[i] = min + (double)rand()/(double)(RAND_MAX/range);
+	}
+	return res;
+}
+
+
+
+// Checks the adjoint of each input of f against central finite differences.
+// f must take a std::vector of the inputs (recorded on the same list), and
+// return the output whose gradient is checked.
+template <typename F>
+void checkGradient(F f, std::vector<ts::Tensor<double>> inputs, double tolerance) {
+	ts::TensorList<double> list;
+	std::vector<ts::TensorVar<double>> vars;
+	for(const ts::Tensor<double> &input : inputs) {
+		vars.push_back(ts::NewTensorVar(input, &list));
+	}
+	ts::TensorGradient<double> grad = f(vars).grad();
+
+	const double h = 1e-6;
+	for(unsigned k = 0; k < inputs.size(); k++) {
+		ts::Tensor<double> adjoint = grad.getValue(vars[k]);
+
+		for(int i = 0; i < inputs[k].size(); i++) {
+			double outputs[2];
+			for(int side = 0; side < 2; side++) {
+				ts::TensorList<double> shiftedList;
+				std::vector<ts::TensorVar<double>> shiftedVars;
+				for(unsigned l = 0; l < inputs.size(); l++) {
+					ts::Tensor<double> value = inputs[l];
+					if(l == k) {
+						value[i] += side == 0 ? h : -h;
+					}
+					shiftedVars.push_back(ts::NewTensorVar(value, &shiftedList));
+				}
+				ts::Tensor<double> output = f(shiftedVars).getValue();
+				outputs[side] = ts::kernels::sum(output.size(), output.getData());
+			}
+
+			ASSERT_NEAR(adjoint[i], (outputs[0] - outputs[1]) / (2 * h), tolerance);
+		}
+	}
+}
+
+
+
+TEST(NnTest, Dense) {
+	// x * w + b records a single node, whose adjoints match finite
+	// differences
+
+	ts::TensorList<double> list;
+	ts::Tensor<double> xVal({2, 3}, {1.0, 2.0, 3.0, 4.0, 5.0, 6.0});
+	ts::Tensor<double> wVal({3, 2}, {1.0, -1.0, 0.5, 2.0, -2.0, 0.0});
+	ts::Tensor<double> bVal({2}, {10.0, 20.0});
+
+	auto x = ts::NewTensorVar(xVal, &list);
+	auto w = ts::NewTensorVar(wVal, &list);
+	auto b = ts::NewTensorVar(bVal, &list);
+	auto res = ts::nn::dense(x, w, b);
+
+	ASSERT_EQ(list.size(), 4);
+	ASSERT_EQ(res.getShape(), std::vector<int>({2, 2}));
+	ASSERT_DOUBLE_EQ(res.getValue()[0], 1.0 + 1.0 - 6.0 + 10.0);
+	ASSERT_DOUBLE_EQ(res.getValue()[1], -1.0 + 4.0 + 20.0);
+	ASSERT_DOUBLE_EQ(res.getValue()[2], 4.0 + 2.5 - 12.0 + 10.0);
+	ASSERT_DOUBLE_EQ(res.getValue()[3], -4.0 + 10.0 + 20.0);
+
+	// Each bias is added to both rows
+	auto grad = res.grad();
+	ASSERT_EQ(grad.getValue(b)[0], 2.0);
+	ASSERT_EQ(grad.getValue(b)[1], 2.0);
+
+	auto f = [](std::vector<ts::TensorVar<double>> &v) {
+		return ts::nn::dense(v[0], v[1], v[2]) * ts::nn::dense(v[0], v[1], v[2]);
+	};
+	checkGradient(f, {randomTensor({5, 7}, -1.0, 2.0), randomTensor({7, 3}, -1.0, 2.0), randomTensor({3}, -1.0, 2.0)}, 1e-6);
+}
+
+
+
+TEST(NnTest, Activations) {
+	ts::TensorList<double> list;
+	ts::Tensor<double> xVal({5}, {-2.0, -0.5, 0.0, 0.5, 2.0});
+
+	auto x = ts::NewTensorVar(xVal, &list);
+	auto relu = ts::nn::relu(x);
+	auto sigmoid = ts::nn::sigmoid(x);
+
+	for(int i = 0; i < 5; i++) {
+		ASSERT_EQ(relu.getValue()[i], std::max(xVal[i], 0.0));
+		ASSERT_DOUBLE_EQ(sigmoid.getValue()[i], 1.0 / (1.0 + std::exp(-xVal[i])));
+	}
+
+	// relu is not differentiable at 0, so inputs are kept away from it
+	auto f = [](std::vector<ts::TensorVar<double>> &v) {
+		return ts::nn::relu(v[0]) * ts::nn::sigmoid(v[0]) + ts::tanh(v[0]);
+	};
+	ts::Tensor<double> input = randomTensor({4, 9}, 0.1, 1.0);
+	for(int i = 0; i < input.size(); i += 2) {
+		input[i] = -input[i];
+	}
+
+	for(bool fastMath : {false, true}) {
+		ts::kernels::setFastMath(fastMath);
+		checkGradient(f, {input}, fastMath ? 1e-5 : 1e-6);
+	}
+	ts::kernels::setFastMath(false);
+}
+
+
+
+TEST(NnTest, SoftmaxCrossEntropy) {
+	ts::TensorList<double> list;
+
+	// Constant rows have uniform probabilities, and logits large enough to
+	// overflow exp() don't matter
+	ts::Tensor<double> xVal({2, 4}, {1.0, 1.0, 1.0, 1.0, 1000.0, 0.0, 0.0, 0.0});
+	ts::Tensor<double> tVal({2, 4}, {0.0, 1.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0});
+
+	auto x = ts::NewTensorVar(xVal, &list);
+	auto t = ts::NewTensorVar(tVal, &list);
+	auto loss = ts::nn::softmaxCrossEntropy(x, t);
+
+	ASSERT_EQ(list.size(), 3);
+	ASSERT_EQ(loss.getShape(), std::vector<int>({1}));
+	ASSERT_NEAR(loss.getValue()[0], std::log(4.0) / 2.0, 1e-12);
+
+	// dx = (softmax(x) - t) / rows, and targets get no gradient
+	auto grad = loss.grad();
+	ASSERT_NEAR(grad.getValue(x)[0], 0.25 / 2.0, 1e-12);
+	ASSERT_NEAR(grad.getValue(x)[1], -0.75 / 2.0, 1e-12);
+	ASSERT_NEAR(grad.getValue(x)[4], 0.0, 1e-12);
+	for(int i = 0; i < 8; i++) {
+		ASSERT_EQ(grad.getValue(t)[i], 0.0);
+	}
+
+	// Soft targets, whose rows don't sum to 1
+	ts::Tensor<double> targets = randomTensor({6, 5}, 0.0, 1.0);
+	for(int i = 0; i < targets.size(); i++) {
+		targets[i] = targets[i] > 0.5 ? targets[i] : 0.0;
+	}
+
+	ts::TensorList<double> softList;
+	ts::Tensor<double> logits = randomTensor({6, 5}, -3.0, 6.0);
+	auto softX = ts::NewTensorVar(logits, &softList);
+	auto softT = ts::NewTensorVar(targets, &softList);
+	auto softGrad = ts::nn::softmaxCrossEntropy(softX, softT).grad();
+
+	const double h = 1e-6;
+	for(int i = 0; i < logits.size(); i++) {
+		double outputs[2];
+		for(int side = 0; side < 2; side++) {
+			ts::TensorList<double> shiftedList;
+			ts::Tensor<double> shifted = logits;
+			shifted[i] += side == 0 ? h : -h;
+			auto shiftedX = ts::NewTensorVar(shifted, &shiftedList);
+			auto shiftedT = ts::NewTensorVar(targets, &shiftedList);
+			outputs[side] = ts::nn::softmaxCrossEntropy(shiftedX, shiftedT).getValue()[0];
+		}
+		ASSERT_NEAR(softGrad.getValue(softX)[i], (outputs[0] - outputs[1]) / (2 * h), 1e-6);
+	}
+}
+
+
+
+TEST(NnTest, MSE) {
+	ts::TensorList<double> list;
+	ts::Tensor<double> xVal({2, 2}, {1.0, 2.0, 3.0, 4.0});
+	ts::Tensor<double> yVal({2, 2}, {1.0, 0.0, 4.0, 2.0});
+
+	auto x = ts::NewTensorVar(xVal, &list);
+	auto y = ts::NewTensorVar(yVal, &list);
+	auto loss = ts::nn::mse(x, y);
+
+	ASSERT_EQ(list.size(), 3);
+	ASSERT_DOUBLE_EQ(loss.getValue()[0], (0.0 + 4.0 + 1.0 + 4.0) / 4.0);
+
+	auto f = [](std::vector<ts::TensorVar<double>> &v) {
+		return ts::nn::mse(v[0], v[1]);
+	};
+	checkGradient(f, {randomTensor({3, 4}, -1.0, 2.0), randomTensor({3, 4}, -1.0, 2.0)}, 1e-6);
+}
+
+
+
+TEST(NnTest, Training) {
+	// A small MLP learns XOR with plain gradient descent, recording 10 nodes
+	// per step
+
+	ts::nn::Dense<float> hidden(2, 8, 1);
+	ts::nn::Dense<float> output(8, 2, 2);
+
+	ts::Tensor<float> inputs({4, 2}, {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f});
+	ts::Tensor<float> labels({4, 2}, {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f});
+
+	ts::TensorList<float> list;
+	float firstLoss = 0.0f;
+	float lastLoss = 0.0f;
+
+	for(int step = 0; step < 500; step++) {
+		list.reset();
+		auto x = ts::NewTensorVar(inputs, &list);
+		auto t = ts::NewTensorVar(labels, &list);
+		auto loss = ts::nn::softmaxCrossEntropy(output.forward(ts::tanh(hidden.forward(x))), t);
+		ASSERT_EQ(list.size(), 10);
+
+		lastLoss = loss.getValue()[0];
+		if(step == 0) {
+			firstLoss = lastLoss;
+		}
+
+		auto grad = loss.grad();
+		for(ts::nn::Dense<float> * layer : {&hidden, &output}) {
+			ts::Tensor<float> dw = grad.getValue(layer->getWeightsVar());
+			ts::Tensor<float> db = grad.getValue(layer->getBiasVar());
+			ts::kernels::axpy(dw.size(), -0.5f, dw.getData(), layer->getWeights().getData());
+			ts::kernels::axpy(db.size(), -0.5f, db.getData(), layer->getBias().getData());
+		}
+	}
+
+	ASSERT_GT(firstLoss, 0.5f);
+	ASSERT_LT(lastLoss, 0.05f);
+}
+
+
+
+TEST(NnTest, IncompatibleShapes) {
+	// Invalid operands don't record anything
+
+	ts::TensorList<float> list;
+	auto x = ts::NewTensorVar(ts::Tensor<float>({2, 3}), &list);
+	auto w = ts::NewTensorVar(ts::Tensor<float>({2, 3}), &list);
+	auto b = ts::NewTensorVar(ts::Tensor<float>({3}), &list);
+	auto v = ts::NewTensorVar(ts::Tensor<float>({6}), &list);
+
+	ASSERT_EQ(ts::nn::dense(x, w, b).getValue().size(), 0);
+	ASSERT_EQ(ts::nn::softmaxCrossEntropy(v, v).getValue().size(), 0);
+	ASSERT_EQ(ts::nn::mse(x, v).getValue().size(), 0);
+	ASSERT_EQ(list.size(), 4);
+
+	ts::nn::Dense<float> layer(4, 3);
+	ASSERT_EQ(layer.getNInputs(), 4);
+	ASSERT_EQ(layer.getNOutputs(), 3);
+	ASSERT_EQ(layer.forward(x).getValue().size(), 0);
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** NN TEST SUITE ***" << std::endl;
+
+	srand (time(NULL));
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
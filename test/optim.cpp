@@ -0,0 +1,202 @@
+/*
+* Test suite for the optimizers
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+
+#include "../include/tensorslow.h"
+
+
+
+// sum(c_i * x_i^2), whose gradient is 2 * c_i * x_i
+template <typename T>
+ts::Var<T> quadratic(const std::vector<ts::Var<T>> &x, ts::WengertList<T> * wList) {
+	ts::Var<T> res = ts::NewVar((T) 0.0, wList);
+
+	for(unsigned i = 0; i < x.size(); i++) {
+		res = res + ts::NewVar((T) (i + 1), wList) * x[i] * x[i];
+	}
+	return res;
+}
+
+
+
+TEST(OptimTest, SGD) {
+	// One step of plain gradient descent, with derivatives read from the
+	// gradient of a list on which other nodes were recorded first
+
+	ts::WengertList<double> wList;
+	ts::Var<double> unrelated = ts::NewVar(5.0, &wList);
+
+	ts::optim::SGD<double> sgd({1.0, -2.0, 3.0}, 0.1);
+	std::vector<ts::Var<double>> x = sgd.record(&wList);
+	ASSERT_EQ(x.size(), 3u);
+	ASSERT_EQ(x[0].getIndex(), unrelated.getIndex() + 1);
+
+	ts::Var<double> y = quadratic(x, &wList) + unrelated;
+	ASSERT_TRUE(sgd.step(y.grad()));
+
+	ASSERT_DOUBLE_EQ(sgd.getParameters()[0], 1.0 - 0.1 * 2.0);
+	ASSERT_DOUBLE_EQ(sgd.getParameters()[1], -2.0 + 0.1 * 8.0);
+	ASSERT_DOUBLE_EQ(sgd.getParameters()[2], 3.0 - 0.1 * 18.0);
+
+	// Parameters that were never recorded can't be updated
+	ts::optim::SGD<double> notRecorded({1.0}, 0.1);
+	ASSERT_FALSE(notRecorded.step(y.grad()));
+	ASSERT_EQ(notRecorded.getParameters()[0], 1.0);
+}
+
+
+
+TEST(OptimTest, Momentum) {
+	// Two steps with a constant gradient accumulate the velocity
+
+	ts::optim::SGD<double> sgd({1.0, 2.0}, 0.5, 0.9);
+	std::vector<double> gradient = {1.0, -1.0};
+
+	sgd.step(gradient.data());
+	sgd.step(gradient.data());
+
+	// velocity = g, then 1.9 * g
+	ASSERT_DOUBLE_EQ(sgd.getParameters()[0], 1.0 - 0.5 * (1.0 + 1.9));
+	ASSERT_DOUBLE_EQ(sgd.getParameters()[1], 2.0 + 0.5 * (1.0 + 1.9));
+}
+
+
+
+TEST(OptimTest, Adam) {
+	// Matches a plain implementation of Adam (without folded bias
+	// corrections), for a size that doesn't fit exactly in vector registers
+
+	const int n = 1031;
+	std::vector<double> initial(n), gradient(n);
+	for(int i = 0; i < n; i++) {
+		initial[i] = i * 0.01 - 5.0;
+	}
+
+	ts::optim::Adam<double> adam(initial, 0.01);
+	std::vector<double> x = initial, m(n, 0.0), v(n, 0.0);
+
+	for(int t = 1; t <= 10; t++) {
+		for(int i = 0; i < n; i++) {
+			gradient[i] = std::sin(i + t) * (i % 7 + 1);
+		}
+		adam.step(gradient.data());
+
+		for(int i = 0; i < n; i++) {
+			m[i] = 0.9 * m[i] + 0.1 * gradient[i];
+			v[i] = 0.999 * v[i] + 0.001 * gradient[i] * gradient[i];
+			double mHat = m[i] / (1.0 - std::pow(0.9, t));
+			double vHat = v[i] / (1.0 - std::pow(0.999, t));
+			x[i] -= 0.01 * mHat / (std::sqrt(vHat) + 1e-8);
+		}
+	}
+
+	ASSERT_EQ(adam.getNSteps(), 10);
+	for(int i = 0; i < n; i++) {
+		ASSERT_NEAR(adam.getParameters()[i], x[i], 1e-12);
+	}
+}
+
+
+
+TEST(OptimTest, Convergence) {
+	// Both optimizers minimize a quadratic, recording the parameters again
+	// after each reset of the list
+
+	ts::WengertList<float> wList;
+	std::vector<float> initial = {1.0f, -1.0f, 0.5f, 2.0f};
+
+	ts::optim::SGD<float> sgd(initial, 0.05f, 0.5f);
+	ts::optim::Adam<float> adam(initial, 0.05f);
+
+	for(int step = 0; step < 300; step++) {
+		wList.reset();
+		ASSERT_TRUE(sgd.step(quadratic(sgd.record(&wList), &wList).grad()));
+
+		wList.reset();
+		ASSERT_TRUE(adam.step(quadratic(adam.record(&wList), &wList).grad()));
+	}
+
+	for(int i = 0; i < 4; i++) {
+		ASSERT_NEAR(sgd.getParameters()[i], 0.0f, 1e-4f);
+		ASSERT_NEAR(adam.getParameters()[i], 0.0f, 1e-2f);
+	}
+}
+
+
+
+TEST(OptimTest, GradientKinds) {
+	// Sparse gradients and Jacobians give the same update as dense
+	// gradients
+
+	std::vector<double> initial = {0.5, 1.5, -2.5};
+	ts::optim::SGD<double> dense(initial, 0.1);
+	ts::optim::SGD<double> sparse(initial, 0.1);
+	ts::optim::SGD<double> jacobian(initial, 0.1);
+
+	ts::WengertList<double> wList;
+	ts::Var<double> y = quadratic(dense.record(&wList), &wList);
+	ASSERT_TRUE(dense.step(y.grad()));
+
+	wList.reset();
+	y = quadratic(sparse.record(&wList), &wList);
+	ASSERT_TRUE(sparse.step(y.sparseGrad()));
+
+	wList.reset();
+	y = quadratic(jacobian.record(&wList), &wList);
+	ts::Var<double> z = y * ts::NewVar(2.0, &wList);
+	ASSERT_TRUE(jacobian.step(wList.grad({y, z})));
+
+	for(int i = 0; i < 3; i++) {
+		ASSERT_DOUBLE_EQ(dense.getParameters()[i], initial[i] - 0.1 * 2.0 * (i + 1) * initial[i]);
+		ASSERT_EQ(sparse.getParameters()[i], dense.getParameters()[i]);
+		ASSERT_EQ(jacobian.getParameters()[i], dense.getParameters()[i]);
+	}
+
+	// A Jacobian of no outputs is a zero gradient
+	ASSERT_TRUE(jacobian.step(wList.grad({})));
+	for(int i = 0; i < 3; i++) {
+		ASSERT_EQ(jacobian.getParameters()[i], dense.getParameters()[i]);
+	}
+}
+
+
+
+TEST(OptimTest, Threads) {
+	// Updates split between threads are the same as serial ones
+
+	const int n = 5 * ts::internal::updateChunkSize + 17;
+	std::vector<float> initial(n), gradient(n);
+	for(int i = 0; i < n; i++) {
+		initial[i] = std::cos(i);
+		gradient[i] = std::sin(i);
+	}
+
+	ts::optim::Adam<float> serial(initial);
+	ts::optim::Adam<float> parallel(initial);
+	parallel.setNThreads(3);
+	ASSERT_EQ(parallel.getNThreads(), 3);
+
+	for(int step = 0; step < 3; step++) {
+		serial.step(gradient.data());
+		parallel.step(gradient.data());
+	}
+
+	for(int i = 0; i < n; i++) {
+		ASSERT_EQ(parallel.getParameters()[i], serial.getParameters()[i]);
+	}
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** OPTIM TEST SUITE ***" << std::endl;
+
+	srand (time(NULL));
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,129 @@
+/*
+* Test suite for data parallel gradients
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+#include <thread>
+
+#include "../include/tensorslow.h"
+
+
+
+TEST(ParallelTest, ThreadList) {
+	// Each thread gets its own list
+
+	ts::WengertList<float> * mainList = &ts::threadList<float>();
+	ts::WengertList<float> * otherList = NULL;
+
+	std::thread thread([&]() {
+		otherList = &ts::threadList<float>();
+	});
+	thread.join();
+
+	ASSERT_EQ(&ts::threadList<float>(), mainList);
+	ASSERT_NE(otherList, mainList);
+}
+
+
+
+TEST(ParallelTest, Pool) {
+	// Share 0 runs on the calling thread, and the others on the same workers
+	// from a computation to the next, so their thread lists are kept
+
+	ts::ThreadPool pool(3);
+	ASSERT_EQ(pool.size(), 3);
+
+	std::vector<ts::WengertList<float> *> lists(3, NULL);
+	pool.run(3, [&](int t) {
+		lists[t] = &ts::threadList<float>();
+	});
+	ASSERT_EQ(lists[0], &ts::threadList<float>());
+	ASSERT_NE(lists[1], lists[0]);
+	ASSERT_NE(lists[2], lists[1]);
+
+	for(int step = 0; step < 10; step++) {
+		std::vector<int> sameLists(3, 0);
+		pool.run(3, [&](int t) {
+			sameLists[t] = lists[t] == &ts::threadList<float>();
+		});
+		ASSERT_EQ(sameLists, std::vector<int>({1, 1, 1}));
+	}
+
+	// Extra shares are dropped, and new workers only join the next
+	// computations
+	std::atomic<int> nRuns(0);
+	pool.run(5, [&](int) { nRuns++; });
+	ASSERT_EQ(nRuns.load(), 3);
+
+	pool.reserve(4);
+	ASSERT_EQ(pool.size(), 4);
+	std::vector<int> ran(4, 0);
+	pool.run(4, [&](int t) { ran[t] = 1; });
+	ASSERT_EQ(ran, std::vector<int>({1, 1, 1, 1}));
+}
+
+
+
+TEST(ParallelTest, Grad) {
+	// Least squares fit of a * x + b, summed over samples. Data parallel
+	// gradients must match the serial ones, whatever the number of threads.
+
+	const int nSamples = 1000;
+
+	// More parameters than a reduction chunk, most of them unused
+	std::vector<double> parameters(3000, 0.0);
+	parameters[0] = 0.5;
+	parameters[2999] = -0.25;
+
+	auto f = [](int task, const std::vector<ts::Var<double>> &p) {
+		double x = task * 1e-3;
+		double y = 2.0 * x + 1.0;
+
+		ts::WengertList<double> * list = &ts::threadList<double>();
+		auto error = p[0] * ts::NewVar(x, list) + p[2999] - ts::NewVar(y, list);
+		return error * error;
+	};
+
+	double expectedLoss = 0.0;
+	double expectedA = 0.0;
+	double expectedB = 0.0;
+	for(int task = 0; task < nSamples; task++) {
+		double x = task * 1e-3;
+		double error = parameters[0] * x + parameters[2999] - (2.0 * x + 1.0);
+		expectedLoss += error * error;
+		expectedA += 2.0 * error * x;
+		expectedB += 2.0 * error;
+	}
+
+	for(int nThreads : {1, 2, 4}) {
+		double loss;
+		std::vector<double> gradient = ts::parallelGrad(f, parameters, nSamples, nThreads, &loss);
+
+		ASSERT_EQ(gradient.size(), parameters.size());
+		ASSERT_NEAR(loss, expectedLoss, 1e-9);
+		ASSERT_NEAR(gradient[0], expectedA, 1e-9);
+		ASSERT_NEAR(gradient[2999], expectedB, 1e-9);
+		ASSERT_EQ(gradient[1500], 0.0);
+	}
+
+	// Same with a pool given by the caller
+	ts::ThreadPool pool(3);
+	for(int step = 0; step < 2; step++) {
+		double loss;
+		std::vector<double> gradient = ts::parallelGrad(f, parameters, nSamples, 8, &loss, &pool);
+		ASSERT_NEAR(loss, expectedLoss, 1e-9);
+		ASSERT_NEAR(gradient[0], expectedA, 1e-9);
+	}
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** PARALLEL TEST SUITE ***" << std::endl;
+
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,179 @@
+/*
+* Test suite for compiled plans (traced Wengert lists replayed on new inputs)
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+
+#include "../include/tensorslow.h"
+
+
+
+TEST(PlanTest, Replay) {
+	// A compiled plan must give the same values and gradients as recording
+	// the computation again
+
+	auto f = [](ts::Var<double> x, ts::Var<double> y, ts::Var<double> c) {
+		return (x * y - c) / (x + y) + x / c;
+	};
+
+	ts::WengertList<double> wList;
+	wList.setTracing(true);
+
+	auto x = ts::NewVar(1.0, &wList);
+	auto y = ts::NewVar(2.0, &wList);
+	auto c = ts::NewVar(3.0, &wList);	// Constant
+	auto z = f(x, y, c);
+
+	auto w = x * y;
+	auto unused = x - y;
+
+	// Nodes recorded after the last output are dropped
+	ts::Plan<double> plan = wList.compile({x, y}, {z, w});
+	ASSERT_EQ(plan.size(), wList.size() - 1);
+	ASSERT_EQ(unused.getValue(), -1.0);
+	ASSERT_EQ(plan.getNInputs(), 2);
+	ASSERT_EQ(plan.getNOutputs(), 2);
+
+	for(int step = 0; step < 3; step++) {
+		double inputs[2] = {0.5 + step, -1.5 * step + 4.0};
+		double outputs[2];
+		double gradient[2];
+		plan.grad(inputs, outputs, gradient);
+
+		ts::WengertList<double> expectedList;
+		auto xe = ts::NewVar(inputs[0], &expectedList);
+		auto ye = ts::NewVar(inputs[1], &expectedList);
+		auto ce = ts::NewVar(3.0, &expectedList);
+		auto ze = f(xe, ye, ce);
+		auto expectedGrad = ze.grad();
+
+		ASSERT_EQ(outputs[0], ze.getValue());
+		ASSERT_EQ(outputs[1], inputs[0] * inputs[1]);
+		ASSERT_EQ(gradient[0], expectedGrad.getValue(xe));
+		ASSERT_EQ(gradient[1], expectedGrad.getValue(ye));
+
+		// Gradient of the second output
+		plan.grad(inputs, NULL, gradient, 1);
+		ASSERT_EQ(gradient[0], inputs[1]);
+		ASSERT_EQ(gradient[1], inputs[0]);
+	}
+}
+
+
+
+TEST(PlanTest, ElementaryFunctions) {
+	// Unary functions and powers are evaluated again on replay
+
+	auto f = [](ts::Var<double> x, ts::Var<double> y) {
+		return ts::tanh(x) * ts::exp(y) + ts::pow(x, y) - ts::log(ts::sqrt(y)) + ts::pow(ts::sin(x), 2.0);
+	};
+
+	ts::WengertList<double> wList;
+	wList.setTracing(true);
+
+	auto x = ts::NewVar(0.5, &wList);
+	auto y = ts::NewVar(1.5, &wList);
+	auto z = f(x, y);
+	ts::Plan<double> plan = wList.compile({x, y}, {z});
+	ASSERT_EQ(plan.size(), wList.size());
+
+	for(int step = 0; step < 3; step++) {
+		double inputs[2] = {0.25 + 0.5 * step, 2.0 - 0.25 * step};
+		double output;
+		double gradient[2];
+		plan.grad(inputs, &output, gradient);
+
+		ts::WengertList<double> expectedList;
+		auto xe = ts::NewVar(inputs[0], &expectedList);
+		auto ye = ts::NewVar(inputs[1], &expectedList);
+		auto ze = f(xe, ye);
+		auto expectedGrad = ze.grad();
+
+		ASSERT_EQ(output, ze.getValue());
+		ASSERT_EQ(gradient[0], expectedGrad.getValue(xe));
+		ASSERT_EQ(gradient[1], expectedGrad.getValue(ye));
+	}
+}
+
+
+
+TEST(PlanTest, Invalid) {
+	ts::WengertList<float> wList;
+
+	// Not traced
+	auto x = ts::NewVar(1.0f, &wList);
+	auto y = x * x;
+	ASSERT_EQ(wList.compile({x}, {y}).size(), 0);
+
+	// Tracing enabled after recording
+	wList.setTracing(true);
+	ASSERT_EQ(wList.compile({x}, {y}).size(), 0);
+
+	// Only input nodes can be plan inputs
+	wList.reset();
+	x = ts::NewVar(1.0f, &wList);
+	y = x * x;
+	ASSERT_EQ(wList.compile({y}, {y}).size(), 0);
+	ASSERT_EQ(wList.compile({x}, {y}).size(), 2);
+
+	// Fused expressions can't be replayed
+	auto z = ts::Var<float>(ts::lazy(x) * y + x);
+	ASSERT_EQ(wList.compile({x}, {z}).size(), 0);
+
+	// Vars from another list
+	ts::WengertList<float> otherList;
+	auto a = ts::NewVar(1.0f, &otherList);
+	ASSERT_EQ(wList.compile({a}, {y}).size(), 0);
+}
+
+
+
+TEST(PlanTest, Prune) {
+	// Pruned plans drop side computations, and still give the same results
+
+	ts::WengertList<double> wList;
+	wList.setTracing(true);
+
+	auto x = ts::NewVar(1.0, &wList);
+	auto unusedInput = ts::NewVar(4.0, &wList);
+	auto y = ts::NewVar(2.0, &wList);
+
+	// Metric recorded between the nodes of the output
+	auto a = ts::sin(x * y);
+	auto metric = ts::exp(a) + unusedInput * ts::NewVar(0.5, &wList);
+	auto z = a * x + ts::sqrt(y);
+
+	ts::Plan<double> plan = wList.compile({x, y, unusedInput}, {z});
+	ts::Plan<double> pruned = plan;
+	ASSERT_EQ(pruned.prune(), 4);
+	ASSERT_EQ(pruned.size(), plan.size() - 4);
+	ASSERT_EQ(pruned.prune(), 0);
+	ASSERT_EQ(metric.getValue(), std::exp(a.getValue()) + 2.0);
+
+	for(int step = 0; step < 3; step++) {
+		double inputs[3] = {0.5 + step, 1.5 - 0.25 * step, 3.0};
+		double output, prunedOutput;
+		double gradient[3], prunedGradient[3];
+
+		plan.grad(inputs, &output, gradient);
+		pruned.grad(inputs, &prunedOutput, prunedGradient);
+
+		ASSERT_EQ(prunedOutput, output);
+		for(int j = 0; j < 3; j++) {
+			ASSERT_EQ(prunedGradient[j], gradient[j]);
+		}
+		ASSERT_EQ(prunedGradient[2], 0.0);
+	}
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** PLAN TEST SUITE ***" << std::endl;
+
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,264 @@
+/*
+* Test suite for model files
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <fstream>
+#include <math.h>
+#include <thread>
+
+#include "../include/tensorslow.h"
+
+
+
+// Plan of f(x, y) = sin(x * y) + x / c, with a constant c = 3
+static ts::Plan<double> compilePlan() {
+	ts::WengertList<double> wList;
+	wList.setTracing(true);
+
+	auto x = ts::NewVar(1.0, &wList);
+	auto y = ts::NewVar(2.0, &wList);
+	auto c = ts::NewVar(3.0, &wList);
+	auto z = ts::sin(x * y) + x / c;
+
+	return wList.compile({x, y}, {z});
+}
+
+
+
+static std::vector<char> readFile(const std::string &path) {
+	std::ifstream file(path, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+
+
+static void writeFile(const std::string &path, const std::vector<char> &content) {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(content.data(), content.size());
+}
+
+
+
+TEST(SerializeTest, Tensors) {
+	// Tensors are read back in place, and stay valid once the model is closed
+
+	ts::Tensor<float> weights({3, 4});
+	for(int i = 0; i < weights.size(); i++) {
+		weights[i] = i * 0.25f - 1.0f;
+	}
+	ts::Tensor<float> bias({4}, 0.5f);
+	ts::Tensor<float> empty;
+
+	ts::io::Writer<float> writer;
+	ASSERT_TRUE(writer.add("layer0.weights", weights));
+	ASSERT_TRUE(writer.add("layer0.bias", bias));
+	ASSERT_TRUE(writer.add("empty", empty));
+	ASSERT_FALSE(writer.add("layer0.bias", weights));
+	ASSERT_FALSE(writer.add("", weights));
+	ASSERT_FALSE(writer.add(std::string(ts::io::maxNameLength + 1, 'a'), weights));
+
+	std::string path = testing::TempDir() + "/tensorslow-tensors.tsm";
+	ASSERT_TRUE(writer.write(path));
+	ASSERT_EQ(readFile(path).size() % 64, 0u);
+	ASSERT_EQ(ts::io::getScalarType(path), ts::io::ScalarType::Float);
+
+	ts::Tensor<float> loaded;
+	{
+		ts::io::Model<float> model;
+		ASSERT_TRUE(model.open(path));
+		ASSERT_TRUE(model.isMapped());
+		ASSERT_EQ(model.getNames(), std::vector<std::string>({"layer0.weights", "layer0.bias", "empty"}));
+
+		loaded = model.getTensor("layer0.weights");
+		ASSERT_EQ(model.getTensor("empty").size(), 0);
+		ASSERT_EQ(model.getTensor("missing").size(), 0);
+		ASSERT_EQ(model.getPlan("layer0.bias").size(), 0);
+
+		// Arrays are aligned in the file
+		ts::Tensor<float> loadedBias = model.getTensor("layer0.bias");
+		ASSERT_EQ(loadedBias.getShape(), std::vector<int>({4}));
+		ASSERT_EQ((uintptr_t) loadedBias.getData() % 64, 0u);
+	}
+
+	ASSERT_EQ(loaded.getShape(), weights.getShape());
+	for(int i = 0; i < weights.size(); i++) {
+		ASSERT_EQ(loaded[i], weights[i]);
+	}
+
+	// Modifications don't reach the file
+	loaded[0] = 42.0f;
+	ts::io::Model<float> model;
+	ASSERT_TRUE(model.open(path));
+	ASSERT_EQ(model.getTensor("layer0.weights")[0], weights[0]);
+
+	// Copies are independent
+	ts::Tensor<float> copy = model.getTensor("layer0.weights");
+	ts::Tensor<float> other = copy;
+	other[1] = 1.0f;
+	ASSERT_EQ(copy[1], weights[1]);
+
+	std::remove(path.c_str());
+}
+
+
+
+TEST(SerializeTest, Plans) {
+	// A loaded plan runs from the mapping, and gives the same results as the
+	// compiled one
+
+	ts::Plan<double> plan = compilePlan();
+	ts::Tensor<double> scale({2}, 2.0);
+
+	ts::io::Writer<double> writer;
+	ASSERT_TRUE(writer.add("f", plan));
+	ASSERT_TRUE(writer.add("scale", scale));
+
+	std::string path = testing::TempDir() + "/tensorslow-plan.tsm";
+	ASSERT_TRUE(writer.write(path));
+	ASSERT_EQ(ts::io::getScalarType(path), ts::io::ScalarType::Double);
+
+	ts::io::Model<double> model;
+	ASSERT_TRUE(model.open(path));
+	ts::Plan<double> loaded = model.getPlan("f");
+	ASSERT_EQ(loaded.size(), plan.size());
+	ASSERT_EQ(loaded.getNInputs(), 2);
+	ASSERT_EQ(loaded.getNOutputs(), 1);
+	ASSERT_EQ(model.getPlan("scale").size(), 0);
+
+	// Each thread can load its own plan : they only share their operations
+	std::vector<std::thread> threads;
+	std::vector<int> matching(4, 1);
+	for(int t = 0; t < 4; t++) {
+		threads.push_back(std::thread([&, t]() {
+			ts::Plan<double> threadPlan = model.getPlan("f");
+			ts::Plan<double> reference = plan;
+			for(int step = 0; step < 1000; step++) {
+				double inputs[2] = {0.1 * t, 0.001 * step};
+				double expected[1], output[1];
+				reference.forward(inputs, expected);
+				threadPlan.forward(inputs, output);
+				matching[t] = matching[t] && output[0] == expected[0];
+			}
+		}));
+	}
+	for(std::thread &thread : threads) {
+		thread.join();
+	}
+	for(int t = 0; t < 4; t++) {
+		ASSERT_TRUE(matching[t]);
+	}
+
+	// Copies of a loaded plan own their buffers, and can run independently
+	ts::Plan<double> copy = loaded;
+	model.close();
+
+	for(int step = 0; step < 3; step++) {
+		double inputs[2] = {0.5 + step, 1.0 - step};
+		double expected[1], expectedGradient[2];
+		double output[1], gradient[2];
+
+		plan.grad(inputs, expected, expectedGradient);
+		for(ts::Plan<double> * p : {&loaded, &copy}) {
+			p->grad(inputs, output, gradient);
+			ASSERT_EQ(output[0], expected[0]);
+			ASSERT_EQ(gradient[0], expectedGradient[0]);
+			ASSERT_EQ(gradient[1], expectedGradient[1]);
+		}
+	}
+
+	std::remove(path.c_str());
+}
+
+
+
+TEST(SerializeTest, InvalidFiles) {
+	// Files with another scalar type, version or inconsistent tables are
+	// rejected
+
+	ts::Tensor<float> tensor({2, 2}, 1.0f);
+	ts::io::Writer<float> writer;
+	writer.add("tensor", tensor);
+
+	std::string path = testing::TempDir() + "/tensorslow-invalid.tsm";
+	ASSERT_TRUE(writer.write(path));
+	std::vector<char> content = readFile(path);
+
+	ts::io::Model<double> wrongType;
+	ASSERT_FALSE(wrongType.open(path));
+	ASSERT_EQ(wrongType.getNames().size(), 0u);
+
+	ts::io::Model<float> model;
+	ASSERT_FALSE(model.open(path + ".missing"));
+	ASSERT_EQ(ts::io::getScalarType(path + ".missing"), ts::io::ScalarType::Unknown);
+
+	// Version
+	std::vector<char> corrupted = content;
+	corrupted[8]++;
+	writeFile(path, corrupted);
+	ASSERT_FALSE(model.open(path));
+	ASSERT_EQ(ts::io::getScalarType(path), ts::io::ScalarType::Unknown);
+
+	// Truncated file
+	corrupted = content;
+	corrupted.resize(content.size() - 64);
+	writeFile(path, corrupted);
+	ASSERT_FALSE(model.open(path));
+
+	// Shape that doesn't match the values (the shape of the only entry is the
+	// first array, right after the tables)
+	corrupted = content;
+	corrupted[192]++;
+	writeFile(path, corrupted);
+	ASSERT_FALSE(model.open(path));
+
+	writeFile(path, content);
+	ASSERT_TRUE(model.open(path));
+	ASSERT_EQ(model.getTensor("tensor")[3], 1.0f);
+
+	// Plans whose operands aren't nodes of the plan, or whose ops can't be
+	// replayed, are rejected when they are loaded (the sections of the only entry follow the header and the
+	// entry, the ops being the first one and the operands the second one)
+	ts::Plan<double> plan = compilePlan();
+	ts::io::Writer<double> planWriter;
+	planWriter.add("f", plan);
+	ASSERT_TRUE(planWriter.write(path));
+	content = readFile(path);
+
+	uint64_t opsOffset, operandsOffset;
+	std::memcpy(&opsOffset, content.data() + 128, sizeof(opsOffset));
+	std::memcpy(&operandsOffset, content.data() + 128 + 16, sizeof(operandsOffset));
+
+	ts::io::Model<double> planModel;
+	corrupted = content;
+	uint32_t operand = 1 << 20;
+	std::memcpy(corrupted.data() + operandsOffset + 4 * sizeof(uint32_t), &operand, sizeof(operand));
+	writeFile(path, corrupted);
+	ASSERT_TRUE(planModel.open(path));
+	ASSERT_EQ(planModel.getPlan("f").size(), 0);
+
+	corrupted = content;
+	corrupted[opsOffset + 3] = (char) ts::NodeOp::Fused;
+	writeFile(path, corrupted);
+	ASSERT_TRUE(planModel.open(path));
+	ASSERT_EQ(planModel.getPlan("f").size(), 0);
+
+	writeFile(path, content);
+	ASSERT_TRUE(planModel.open(path));
+	ASSERT_EQ(planModel.getPlan("f").size(), plan.size());
+
+	std::remove(path.c_str());
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** SERIALIZE TEST SUITE ***" << std::endl;
+
+	srand (time(NULL));
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,137 @@
+/*
+* Test suite for the autodiff instrumentation. Counters are compiled in this
+* file only (header-only mode), so it uses long double, which is not
+* instantiated in libtensorslow.so.
+*/
+
+#define TS_HEADER_ONLY
+#ifndef TS_INSTRUMENT
+#define TS_INSTRUMENT
+#endif
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+#include <thread>
+#include <vector>
+
+#include "../include/tensorslow.h"
+
+
+
+TEST(StatsTest, Counters) {
+	ts::WengertList<long double> wList;
+
+	auto x = ts::NewVar((long double) 2.0, &wList);
+	auto y = ts::NewVar((long double) 3.0, &wList);
+	auto z = x * y + ts::exp(x) - x * x;
+	auto w = ts::Var<long double>(ts::lazy(x) * y + z);
+
+	ts::TapeStats stats = wList.getStats();
+	ASSERT_TRUE(stats.enabled);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Input], 2);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Mul], 2);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Exp], 1);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Add], 1);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Sub], 1);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Fused], 1);
+	ASSERT_EQ(stats.nNodes, 8);
+	ASSERT_EQ(stats.bytes, (long) (wList.bytesPerNode() * 8 + 0.5));
+	ASSERT_EQ(stats.nSweeps, 0);
+
+	// Every kind of gradient is timed
+	z.grad();
+	w.sparseGrad();
+	wList.grad({z, w});
+
+	stats = wList.getStats();
+	ASSERT_EQ(stats.nSweeps, 3);
+	ASSERT_EQ(stats.sweptNodes, 7 + 8 + 8);
+	ASSERT_GT(stats.sweepSeconds, 0.0);
+	ASSERT_GT(stats.nodesPerSecond(), 0.0);
+	ASSERT_TRUE(stats.events.empty());
+
+	// Peak size survives reset(), counters are cleared by resetStats()
+	wList.reset();
+	x = ts::NewVar((long double) 1.0, &wList);
+	stats = wList.getStats();
+	ASSERT_EQ(stats.nNodes, 1);
+	ASSERT_EQ(stats.peakNodes, 8);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Input], 3);
+
+	wList.resetStats();
+	stats = wList.getStats();
+	ASSERT_EQ(stats.peakNodes, 1);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Input], 0);
+	ASSERT_EQ(stats.nSweeps, 0);
+}
+
+
+
+TEST(StatsTest, Export) {
+	ts::WengertList<long double> wList;
+	wList.setTraceEvents(true);
+
+	auto x = ts::NewVar((long double) 2.0, &wList);
+	auto y = x * x;
+	y.grad();
+	y.grad(2);
+
+	ts::TapeStats stats = wList.getStats();
+	ASSERT_EQ(stats.events.size(), 2u);
+	ASSERT_STREQ(stats.events[0].name, "grad");
+	ASSERT_STREQ(stats.events[1].name, "parallelGrad");
+	ASSERT_EQ(stats.events[1].nNodes, 2);
+	ASSERT_LE(stats.events[0].start, stats.events[1].start);
+
+	std::string json = stats.toJson();
+	ASSERT_EQ(json.front(), '{');
+	ASSERT_NE(json.find("\"enabled\": true"), std::string::npos);
+	ASSERT_NE(json.find("\"Mul\": 1"), std::string::npos);
+	ASSERT_NE(json.find("\"nSweeps\": 2"), std::string::npos);
+
+	std::string trace = stats.toChromeTrace();
+	ASSERT_EQ(trace.find("{\"traceEvents\": [{\"name\": \"grad\", \"ph\": \"X\""), 0u);
+	ASSERT_NE(trace.find("\"args\": {\"nodes\": 2}"), std::string::npos);
+}
+
+
+
+TEST(StatsTest, SharedList) {
+	// Nodes recorded by several threads are counted once the list is no
+	// longer shared, without the padding of the chunks
+	ts::WengertList<long double> wList;
+	auto x = ts::NewVar((long double) 0.5, &wList);
+
+	ASSERT_TRUE(wList.beginShared(4 * ts::internal::sharedChunkNodes));
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 3; t++) {
+		threads.push_back(std::thread([&]() {
+			ts::Var<long double> res = x;
+			for(int i = 0; i < 10; i++) {
+				res = ts::sin(res) * x;
+			}
+		}));
+	}
+	for(std::thread &thread : threads) {
+		thread.join();
+	}
+	wList.endShared();
+
+	ts::TapeStats stats = wList.getStats();
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Input], 1);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Sin], 30);
+	ASSERT_EQ(stats.nodesByOp[(int) ts::NodeOp::Mul], 30);
+	ASSERT_EQ(stats.nNodes, 1 + 3 * ts::internal::sharedChunkNodes);
+	ASSERT_EQ(stats.peakNodes, stats.nNodes);
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** STATS TEST SUITE ***" << std::endl;
+
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,236 @@
+/*
+* Test suite for the tensor autodiff engine
+*/
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+
+#include "../include/tensorslow.h"
+
+
+
+// Returns a tensor filled with random values in [min, min + range]
+ts::Tensor<float> randomTensor(std::vector<int> shape, float min, float range) {
+	ts::Tensor<float> res(shape);
+	for(int i = 0; i < res.size(); i++) {
+		res[i] = min + (float)rand()/(float)(RAND_MAX/range);
+	}
+	return res;
+}
+
+
+
+TEST(TensorTest, Elementwise) {
+	// Each elementwise operator records one node and returns the expected
+	// adjoints
+
+	ts::TensorList<float> list;
+
+	auto a = ts::NewTensorVar(randomTensor({2, 3}, 1.0f, 10.0f), &list);
+	auto b = ts::NewTensorVar(randomTensor({2, 3}, 1.0f, 10.0f), &list);
+
+	auto sumGrad = (a + b).grad();
+	auto diffGrad = (a - b).grad();
+	auto prodGrad = (a * b).grad();
+	auto quotGrad = (a / b).grad();
+
+	ASSERT_EQ(list.size(), 6);
+
+	for(int i = 0; i < 6; i++) {
+		float aVal = a.getValue()[i];
+		float bVal = b.getValue()[i];
+
+		ASSERT_EQ(sumGrad.getValue(a)[i], 1.0f);
+		ASSERT_EQ(sumGrad.getValue(b)[i], 1.0f);
+		ASSERT_EQ(diffGrad.getValue(a)[i], 1.0f);
+		ASSERT_EQ(diffGrad.getValue(b)[i], -1.0f);
+		ASSERT_EQ(prodGrad.getValue(a)[i], bVal);
+		ASSERT_EQ(prodGrad.getValue(b)[i], aVal);
+		ASSERT_FLOAT_EQ(quotGrad.getValue(a)[i], 1.0f / bVal);
+		ASSERT_FLOAT_EQ(quotGrad.getValue(b)[i], -aVal / (bVal * bVal));
+	}
+}
+
+
+
+TEST(TensorTest, Dot) {
+	// A 1024-wide dot product records a single node
+
+	ts::TensorList<double> list;
+
+	ts::Tensor<double> xVal({1024});
+	ts::Tensor<double> yVal({1024});
+	double expected = 0.0;
+	for(int i = 0; i < 1024; i++) {
+		xVal[i] = i;
+		yVal[i] = 1.0 / (i + 1);
+		expected += xVal[i] * yVal[i];
+	}
+
+	auto x = ts::NewTensorVar(xVal, &list);
+	auto y = ts::NewTensorVar(yVal, &list);
+	auto res = ts::dot(x, y);
+
+	ASSERT_EQ(list.size(), 3);
+	ASSERT_EQ(res.getShape(), std::vector<int>({1}));
+	ASSERT_NEAR(res.getValue()[0], expected, 1e-9);
+
+	auto grad = res.grad();
+	for(int i = 0; i < 1024; i++) {
+		ASSERT_EQ(grad.getValue(x)[i], yVal[i]);
+		ASSERT_EQ(grad.getValue(y)[i], xVal[i]);
+	}
+}
+
+
+
+TEST(TensorTest, Composition) {
+	// sum((a * x + b) / x) = sum(a + b / x)
+
+	ts::TensorList<double> list;
+
+	auto x = ts::NewTensorVar(ts::Tensor<double>({3}, {1.0, 2.0, 4.0}), &list);
+	auto a = ts::NewTensorVar(ts::Tensor<double>({3}, 3.0), &list);
+	auto b = ts::NewTensorVar(ts::Tensor<double>({3}, 2.0), &list);
+
+	auto res = ts::sum((a * x + b) / x);
+	auto grad = res.grad();
+
+	ASSERT_DOUBLE_EQ(res.getValue()[0], 9.0 + 2.0 + 1.0 + 0.5);
+
+	for(int i = 0; i < 3; i++) {
+		double xVal = x.getValue()[i];
+		ASSERT_DOUBLE_EQ(grad.getValue(x)[i], -2.0 / (xVal * xVal));
+		ASSERT_DOUBLE_EQ(grad.getValue(a)[i], 1.0);
+		ASSERT_DOUBLE_EQ(grad.getValue(b)[i], 1.0 / xVal);
+	}
+}
+
+
+
+TEST(TensorTest, MatMul) {
+	// sum(x * y) with x : 2 x 3 and y : 3 x 2 is a single matmul node, whose
+	// adjoints are dx = 1 * y^T and dy = x^T * 1
+
+	ts::TensorList<double> list;
+
+	auto x = ts::NewTensorVar(ts::Tensor<double>({2, 3}, {1, 2, 3, 4, 5, 6}), &list);
+	auto y = ts::NewTensorVar(ts::Tensor<double>({3, 2}, {7, 8, 9, 10, 11, 12}), &list);
+
+	auto prod = ts::matmul(x, y);
+	auto res = ts::sum(prod);
+	auto grad = res.grad();
+
+	ASSERT_EQ(list.size(), 4);
+	ASSERT_EQ(prod.getShape(), std::vector<int>({2, 2}));
+	ASSERT_EQ(prod.getValue()[0], 58.0);
+	ASSERT_EQ(prod.getValue()[1], 64.0);
+	ASSERT_EQ(prod.getValue()[2], 139.0);
+	ASSERT_EQ(prod.getValue()[3], 154.0);
+
+	for(int i = 0; i < 2; i++) {
+		for(int p = 0; p < 3; p++) {
+			double rowSum = y.getValue()[p * 2] + y.getValue()[p * 2 + 1];
+			double colSum = x.getValue()[p] + x.getValue()[3 + p];
+			ASSERT_EQ(grad.getValue(x)[i * 3 + p], rowSum);
+			ASSERT_EQ(grad.getValue(y)[p * 2 + i], colSum);
+		}
+	}
+
+	// Incompatible shapes
+	auto wrong = ts::matmul(x, x);
+	ASSERT_EQ(wrong.getValue().size(), 0);
+	ASSERT_EQ(list.size(), 4);
+}
+
+
+
+TEST(TensorTest, ElementaryFunctions) {
+	// sum(exp(x) + log(y) * tanh(x)), with both accurate and fast kernels
+
+	for(bool fastMath : {false, true}) {
+		ts::kernels::setFastMath(fastMath);
+		ts::TensorList<double> list;
+
+		auto x = ts::NewTensorVar(ts::Tensor<double>({2, 3}, {-2.0, -0.5, 0.0, 0.3, 1.0, 4.0}), &list);
+		auto y = ts::NewTensorVar(ts::Tensor<double>({2, 3}, {0.1, 0.5, 1.0, 2.0, 3.0, 10.0}), &list);
+
+		auto e = ts::exp(x);
+		auto res = ts::sum(e + ts::log(y) * ts::tanh(x));
+		auto grad = res.grad();
+		ASSERT_EQ(list.size(), 8);
+
+		for(int i = 0; i < 6; i++) {
+			double xi = x.getValue()[i];
+			double yi = y.getValue()[i];
+			double t = tanh(xi);
+
+			ASSERT_NEAR(e.getValue()[i], exp(xi), 1e-13);
+			ASSERT_NEAR(grad.getValue(x)[i], exp(xi) + log(yi) * (1.0 - t * t), 1e-13);
+			ASSERT_NEAR(grad.getValue(y)[i], t / yi, 1e-13);
+		}
+	}
+	ts::kernels::setFastMath(false);
+
+	// Unrecorded operand
+	ts::TensorVar<double> empty(ts::Tensor<double>(), NULL);
+	ASSERT_EQ(ts::exp(empty).getValue().size(), 0);
+}
+
+
+
+TEST(TensorTest, Unreached) {
+	// Nodes that the output doesn't depend on get a zero gradient
+
+	ts::TensorList<float> list;
+
+	auto a = ts::NewTensorVar(ts::Tensor<float>({4}, 1.0f), &list);
+	auto b = ts::NewTensorVar(ts::Tensor<float>({4}, 2.0f), &list);
+
+	auto res = ts::sum(a);
+	auto grad = res.grad();
+
+	ASSERT_EQ(grad.getValue(b).getShape(), std::vector<int>({4}));
+	for(int i = 0; i < 4; i++) {
+		ASSERT_EQ(grad.getValue(b)[i], 0.0f);
+	}
+}
+
+
+
+TEST(TensorTest, IncompatibleShapes) {
+	// Combining tensors of different shapes or lists doesn't record anything
+
+	ts::TensorList<float> list1;
+	ts::TensorList<float> list2;
+
+	auto a = ts::NewTensorVar(ts::Tensor<float>({2}, 1.0f), &list1);
+	auto b = ts::NewTensorVar(ts::Tensor<float>({3}, 1.0f), &list1);
+	auto c = ts::NewTensorVar(ts::Tensor<float>({2}, 1.0f), &list2);
+
+	auto d = a + b;
+	auto e = a * c;
+
+	ASSERT_EQ(d.getValue().size(), 0);
+	ASSERT_EQ(e.getValue().size(), 0);
+	ASSERT_EQ(list1.size(), 2);
+	ASSERT_EQ(list2.size(), 1);
+
+	// Their gradient is empty
+	auto grad = d.grad();
+	ASSERT_EQ(grad.getValue(a).size(), 0);
+	ASSERT_EQ(grad.getValue(d).size(), 0);
+}
+
+
+
+int main(int argc, char **argv) {
+	std::cout << "*** TENSOR TEST SUITE ***" << std::endl;
+
+	srand (time(NULL));
+
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}